@@ -93,6 +93,7 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 /* Includes:                                                                 */
 /*****************************************************************************/
 #include <stdint.h>
+#include <string.h>
 
 #include "vernamfs/aes128.h"
 
@@ -203,7 +204,7 @@ static uint8_t getSBoxValue(uint8_t num)
 
 
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states. 
-static void KeyExpansion(void)
+static void KeyExpansion(uint8_t* roundKey, const uint8_t* key)
 {
   uint32_t i, j, k;
   uint8_t tempa[4]; // Used for the column/row operations
@@ -211,10 +212,10 @@ static void KeyExpansion(void)
   // The first round key is the key itself.
   for(i = 0; i < Nk; ++i)
   {
-    RoundKey[(i * 4) + 0] = Key[(i * 4) + 0];
-    RoundKey[(i * 4) + 1] = Key[(i * 4) + 1];
-    RoundKey[(i * 4) + 2] = Key[(i * 4) + 2];
-    RoundKey[(i * 4) + 3] = Key[(i * 4) + 3];
+    roundKey[(i * 4) + 0] = key[(i * 4) + 0];
+    roundKey[(i * 4) + 1] = key[(i * 4) + 1];
+    roundKey[(i * 4) + 2] = key[(i * 4) + 2];
+    roundKey[(i * 4) + 3] = key[(i * 4) + 3];
   }
 
   // All other round keys are found from the previous round keys.
@@ -222,7 +223,7 @@ static void KeyExpansion(void)
   {
     for(j = 0; j < 4; ++j)
     {
-      tempa[j]=RoundKey[(i-1) * 4 + j];
+      tempa[j]=roundKey[(i-1) * 4 + j];
     }
     if (i % Nk == 0)
     {
@@ -261,10 +262,10 @@ static void KeyExpansion(void)
         tempa[3] = getSBoxValue(tempa[3]);
       }
     }
-    RoundKey[i * 4 + 0] = RoundKey[(i - Nk) * 4 + 0] ^ tempa[0];
-    RoundKey[i * 4 + 1] = RoundKey[(i - Nk) * 4 + 1] ^ tempa[1];
-    RoundKey[i * 4 + 2] = RoundKey[(i - Nk) * 4 + 2] ^ tempa[2];
-    RoundKey[i * 4 + 3] = RoundKey[(i - Nk) * 4 + 3] ^ tempa[3];
+    roundKey[i * 4 + 0] = roundKey[(i - Nk) * 4 + 0] ^ tempa[0];
+    roundKey[i * 4 + 1] = roundKey[(i - Nk) * 4 + 1] ^ tempa[1];
+    roundKey[i * 4 + 2] = roundKey[(i - Nk) * 4 + 2] ^ tempa[2];
+    roundKey[i * 4 + 3] = roundKey[(i - Nk) * 4 + 3] ^ tempa[3];
   }
 }
 
@@ -418,9 +419,13 @@ void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t* output)
   BlockCopy(output, input);
   state = (state_t*)output;
 
+  /*
+	Round key 0 is the key itself, so a differing key (e.g. a second
+	AES128CTR in the same process) is spotted cheaply, and re-expanded.
+  */
   Key = key;
-  if( !KeyExpanded ) {
-	KeyExpansion();
+  if( !KeyExpanded || memcmp(RoundKey, Key, KEYLEN) ) {
+	KeyExpansion(RoundKey, Key);
 	KeyExpanded = 1;
   }
 
@@ -428,5 +433,14 @@ void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t* output)
   Cipher();
 }
 
+/*
+  Reentrant key schedule only, for the CTR engine (see aesctr.c),
+  whose backends want the 176 bytes of round keys up front.
+*/
+void AES128_KeyExpansion(const uint8_t* key, uint8_t* roundKey)
+{
+  KeyExpansion(roundKey, key);
+}
+
 // eof
 
@@ -0,0 +1,456 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "vernamfs/aes128.h"
+#include "vernamfs/aesctr.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * AES-128 CTR keystream engine.  See aesctr.h.
+ *
+ * All backends implement just multi-block ECB encryption.  The CTR
+ * layer writes counter blocks into the caller's output buffer, a
+ * cache-sized batch at a time, and has the backend encrypt them in
+ * place.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERNAMFS_AES_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && \
+  (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define VERNAMFS_AES_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// Counter blocks written per backend call: 256 blocks, 4KB
+#define BATCHBLOCKS 256
+
+/*
+  The reference backend: the tiny-AES code in aes128.c, one block at a
+  time.  Not reentrant, it works on aes128.c's global state.
+*/
+static void ecbSoft( const AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+					 size_t count ) {
+  uint8_t block[AES128CTR_BLOCKSIZE];
+  size_t i;
+  for( i = 0; i < count; i++ ) {
+	memcpy( block, in + i * AES128CTR_BLOCKSIZE, AES128CTR_BLOCKSIZE );
+	AES128_ECB_encrypt( block, thiz->key, out + i * AES128CTR_BLOCKSIZE );
+  }
+}
+
+static int supportedAlways( void ) {
+  return 1;
+}
+
+/*
+  The table-driven software backend.  One 256-entry table of 32-bit
+  words folds SubBytes and MixColumns together: for S = sbox[x],
+  Te0[x] holds the column (2S, S, S, 3S), low byte first.  The other
+  three rows' contributions are the same column rotated, and the
+  sbox itself is byte 1.  So a round is 16 lookups, 12 rotates and
+  16 xors per block, all on 32-bit words, versus tiny-AES's per-byte
+  xtime/Multiply.  Round keys live on the stack, the table is const,
+  so this backend is reentrant and safe for generate's -j threads.
+*/
+static const uint32_t Te0[256] = {
+  0xa56363c6, 0x847c7cf8, 0x997777ee, 0x8d7b7bf6, 0x0df2f2ff, 0xbd6b6bd6,
+  0xb16f6fde, 0x54c5c591, 0x50303060, 0x03010102, 0xa96767ce, 0x7d2b2b56,
+  0x19fefee7, 0x62d7d7b5, 0xe6abab4d, 0x9a7676ec, 0x45caca8f, 0x9d82821f,
+  0x40c9c989, 0x877d7dfa, 0x15fafaef, 0xeb5959b2, 0xc947478e, 0x0bf0f0fb,
+  0xecadad41, 0x67d4d4b3, 0xfda2a25f, 0xeaafaf45, 0xbf9c9c23, 0xf7a4a453,
+  0x967272e4, 0x5bc0c09b, 0xc2b7b775, 0x1cfdfde1, 0xae93933d, 0x6a26264c,
+  0x5a36366c, 0x413f3f7e, 0x02f7f7f5, 0x4fcccc83, 0x5c343468, 0xf4a5a551,
+  0x34e5e5d1, 0x08f1f1f9, 0x937171e2, 0x73d8d8ab, 0x53313162, 0x3f15152a,
+  0x0c040408, 0x52c7c795, 0x65232346, 0x5ec3c39d, 0x28181830, 0xa1969637,
+  0x0f05050a, 0xb59a9a2f, 0x0907070e, 0x36121224, 0x9b80801b, 0x3de2e2df,
+  0x26ebebcd, 0x6927274e, 0xcdb2b27f, 0x9f7575ea, 0x1b090912, 0x9e83831d,
+  0x742c2c58, 0x2e1a1a34, 0x2d1b1b36, 0xb26e6edc, 0xee5a5ab4, 0xfba0a05b,
+  0xf65252a4, 0x4d3b3b76, 0x61d6d6b7, 0xceb3b37d, 0x7b292952, 0x3ee3e3dd,
+  0x712f2f5e, 0x97848413, 0xf55353a6, 0x68d1d1b9, 0x00000000, 0x2cededc1,
+  0x60202040, 0x1ffcfce3, 0xc8b1b179, 0xed5b5bb6, 0xbe6a6ad4, 0x46cbcb8d,
+  0xd9bebe67, 0x4b393972, 0xde4a4a94, 0xd44c4c98, 0xe85858b0, 0x4acfcf85,
+  0x6bd0d0bb, 0x2aefefc5, 0xe5aaaa4f, 0x16fbfbed, 0xc5434386, 0xd74d4d9a,
+  0x55333366, 0x94858511, 0xcf45458a, 0x10f9f9e9, 0x06020204, 0x817f7ffe,
+  0xf05050a0, 0x443c3c78, 0xba9f9f25, 0xe3a8a84b, 0xf35151a2, 0xfea3a35d,
+  0xc0404080, 0x8a8f8f05, 0xad92923f, 0xbc9d9d21, 0x48383870, 0x04f5f5f1,
+  0xdfbcbc63, 0xc1b6b677, 0x75dadaaf, 0x63212142, 0x30101020, 0x1affffe5,
+  0x0ef3f3fd, 0x6dd2d2bf, 0x4ccdcd81, 0x140c0c18, 0x35131326, 0x2fececc3,
+  0xe15f5fbe, 0xa2979735, 0xcc444488, 0x3917172e, 0x57c4c493, 0xf2a7a755,
+  0x827e7efc, 0x473d3d7a, 0xac6464c8, 0xe75d5dba, 0x2b191932, 0x957373e6,
+  0xa06060c0, 0x98818119, 0xd14f4f9e, 0x7fdcdca3, 0x66222244, 0x7e2a2a54,
+  0xab90903b, 0x8388880b, 0xca46468c, 0x29eeeec7, 0xd3b8b86b, 0x3c141428,
+  0x79dedea7, 0xe25e5ebc, 0x1d0b0b16, 0x76dbdbad, 0x3be0e0db, 0x56323264,
+  0x4e3a3a74, 0x1e0a0a14, 0xdb494992, 0x0a06060c, 0x6c242448, 0xe45c5cb8,
+  0x5dc2c29f, 0x6ed3d3bd, 0xefacac43, 0xa66262c4, 0xa8919139, 0xa4959531,
+  0x37e4e4d3, 0x8b7979f2, 0x32e7e7d5, 0x43c8c88b, 0x5937376e, 0xb76d6dda,
+  0x8c8d8d01, 0x64d5d5b1, 0xd24e4e9c, 0xe0a9a949, 0xb46c6cd8, 0xfa5656ac,
+  0x07f4f4f3, 0x25eaeacf, 0xaf6565ca, 0x8e7a7af4, 0xe9aeae47, 0x18080810,
+  0xd5baba6f, 0x887878f0, 0x6f25254a, 0x722e2e5c, 0x241c1c38, 0xf1a6a657,
+  0xc7b4b473, 0x51c6c697, 0x23e8e8cb, 0x7cdddda1, 0x9c7474e8, 0x211f1f3e,
+  0xdd4b4b96, 0xdcbdbd61, 0x868b8b0d, 0x858a8a0f, 0x907070e0, 0x423e3e7c,
+  0xc4b5b571, 0xaa6666cc, 0xd8484890, 0x05030306, 0x01f6f6f7, 0x120e0e1c,
+  0xa36161c2, 0x5f35356a, 0xf95757ae, 0xd0b9b969, 0x91868617, 0x58c1c199,
+  0x271d1d3a, 0xb99e9e27, 0x38e1e1d9, 0x13f8f8eb, 0xb398982b, 0x33111122,
+  0xbb6969d2, 0x70d9d9a9, 0x898e8e07, 0xa7949433, 0xb69b9b2d, 0x221e1e3c,
+  0x92878715, 0x20e9e9c9, 0x49cece87, 0xff5555aa, 0x78282850, 0x7adfdfa5,
+  0x8f8c8c03, 0xf8a1a159, 0x80898909, 0x170d0d1a, 0xdabfbf65, 0x31e6e6d7,
+  0xc6424284, 0xb86868d0, 0xc3414182, 0xb0999929, 0x772d2d5a, 0x110f0f1e,
+  0xcbb0b07b, 0xfc5454a8, 0xd6bbbb6d, 0x3a16162c
+};
+
+#define ROTL32(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define TE(c0,c1,c2,c3)								\
+  (Te0[(c0) & 0xff] ^								\
+   ROTL32( Te0[((c1) >> 8) & 0xff], 8 ) ^			\
+   ROTL32( Te0[((c2) >> 16) & 0xff], 16 ) ^			\
+   ROTL32( Te0[(c3) >> 24], 24 ))
+
+#define SBOX(x) ((Te0[x] >> 8) & 0xff)
+
+static uint32_t load32( const uint8_t* p ) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32( uint8_t* p, uint32_t v ) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void ecbTTable( const AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+					   size_t count ) {
+  uint32_t rk[44];
+  int i;
+  for( i = 0; i < 44; i++ )
+	rk[i] = load32( thiz->roundKeys + 4 * i );
+
+  size_t b;
+  for( b = 0; b < count; b++ ) {
+	const uint8_t* ip = in + b * AES128CTR_BLOCKSIZE;
+	uint8_t* op = out + b * AES128CTR_BLOCKSIZE;
+
+	// A column per word, row 0 in the low byte
+	uint32_t s0 = load32( ip ) ^ rk[0];
+	uint32_t s1 = load32( ip + 4 ) ^ rk[1];
+	uint32_t s2 = load32( ip + 8 ) ^ rk[2];
+	uint32_t s3 = load32( ip + 12 ) ^ rk[3];
+
+	// ShiftRows is just which column each row's byte is taken from
+	int r;
+	for( r = 1; r < 10; r++ ) {
+	  const uint32_t* k = rk + 4 * r;
+	  uint32_t t0 = TE( s0, s1, s2, s3 ) ^ k[0];
+	  uint32_t t1 = TE( s1, s2, s3, s0 ) ^ k[1];
+	  uint32_t t2 = TE( s2, s3, s0, s1 ) ^ k[2];
+	  uint32_t t3 = TE( s3, s0, s1, s2 ) ^ k[3];
+	  s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	// Last round, no MixColumns
+	uint32_t f[4];
+	uint32_t c[4] = { s0, s1, s2, s3 };
+	for( i = 0; i < 4; i++ ) {
+	  f[i] = SBOX( c[i] & 0xff ) |
+		(SBOX( (c[(i+1) & 3] >> 8) & 0xff ) << 8) |
+		(SBOX( (c[(i+2) & 3] >> 16) & 0xff ) << 16) |
+		((uint32_t)SBOX( c[(i+3) & 3] >> 24 ) << 24);
+	  store32( op + 4 * i, f[i] ^ rk[40 + i] );
+	}
+  }
+}
+
+#ifdef VERNAMFS_AES_X86
+
+#define AESNI_ROUND(r)						\
+  b0 = _mm_aesenc_si128( b0, rk[r] );		\
+  b1 = _mm_aesenc_si128( b1, rk[r] );		\
+  b2 = _mm_aesenc_si128( b2, rk[r] );		\
+  b3 = _mm_aesenc_si128( b3, rk[r] );		\
+  b4 = _mm_aesenc_si128( b4, rk[r] );		\
+  b5 = _mm_aesenc_si128( b5, rk[r] );		\
+  b6 = _mm_aesenc_si128( b6, rk[r] );		\
+  b7 = _mm_aesenc_si128( b7, rk[r] )
+
+/*
+  AES-NI, 8 blocks in flight, so the aesenc latency is hidden.  The
+  FIPS-197 round key byte order is exactly what aesenc wants.
+*/
+__attribute__((target("aes,sse2")))
+static void ecbAESNI( const AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+					  size_t count ) {
+  __m128i rk[11];
+  int r;
+  for( r = 0; r < 11; r++ )
+	rk[r] = _mm_loadu_si128( (const __m128i*)(thiz->roundKeys + 16 * r) );
+
+  const __m128i* src = (const __m128i*)in;
+  __m128i* dst = (__m128i*)out;
+
+  while( count >= 8 ) {
+	__m128i b0 = _mm_xor_si128( _mm_loadu_si128( src + 0 ), rk[0] );
+	__m128i b1 = _mm_xor_si128( _mm_loadu_si128( src + 1 ), rk[0] );
+	__m128i b2 = _mm_xor_si128( _mm_loadu_si128( src + 2 ), rk[0] );
+	__m128i b3 = _mm_xor_si128( _mm_loadu_si128( src + 3 ), rk[0] );
+	__m128i b4 = _mm_xor_si128( _mm_loadu_si128( src + 4 ), rk[0] );
+	__m128i b5 = _mm_xor_si128( _mm_loadu_si128( src + 5 ), rk[0] );
+	__m128i b6 = _mm_xor_si128( _mm_loadu_si128( src + 6 ), rk[0] );
+	__m128i b7 = _mm_xor_si128( _mm_loadu_si128( src + 7 ), rk[0] );
+	AESNI_ROUND(1);
+	AESNI_ROUND(2);
+	AESNI_ROUND(3);
+	AESNI_ROUND(4);
+	AESNI_ROUND(5);
+	AESNI_ROUND(6);
+	AESNI_ROUND(7);
+	AESNI_ROUND(8);
+	AESNI_ROUND(9);
+	_mm_storeu_si128( dst + 0, _mm_aesenclast_si128( b0, rk[10] ) );
+	_mm_storeu_si128( dst + 1, _mm_aesenclast_si128( b1, rk[10] ) );
+	_mm_storeu_si128( dst + 2, _mm_aesenclast_si128( b2, rk[10] ) );
+	_mm_storeu_si128( dst + 3, _mm_aesenclast_si128( b3, rk[10] ) );
+	_mm_storeu_si128( dst + 4, _mm_aesenclast_si128( b4, rk[10] ) );
+	_mm_storeu_si128( dst + 5, _mm_aesenclast_si128( b5, rk[10] ) );
+	_mm_storeu_si128( dst + 6, _mm_aesenclast_si128( b6, rk[10] ) );
+	_mm_storeu_si128( dst + 7, _mm_aesenclast_si128( b7, rk[10] ) );
+	src += 8;
+	dst += 8;
+	count -= 8;
+  }
+  while( count ) {
+	__m128i b = _mm_xor_si128( _mm_loadu_si128( src ), rk[0] );
+	for( r = 1; r < 10; r++ )
+	  b = _mm_aesenc_si128( b, rk[r] );
+	_mm_storeu_si128( dst, _mm_aesenclast_si128( b, rk[10] ) );
+	src++;
+	dst++;
+	count--;
+  }
+}
+
+#undef AESNI_ROUND
+
+static int supportedAESNI( void ) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports( "aes" ) && __builtin_cpu_supports( "sse2" );
+}
+
+#endif // VERNAMFS_AES_X86
+
+#ifdef VERNAMFS_AES_ARMV8
+
+/*
+  vaeseq is AddRoundKey+SubBytes+ShiftRows, vaesmcq is MixColumns.
+  So the rounds are offset by one compared to AES-NI, and the final
+  round key is a plain XOR.
+*/
+#define ARMV8_ROUND(r)									\
+  b0 = vaesmcq_u8( vaeseq_u8( b0, rk[r] ) );			\
+  b1 = vaesmcq_u8( vaeseq_u8( b1, rk[r] ) );			\
+  b2 = vaesmcq_u8( vaeseq_u8( b2, rk[r] ) );			\
+  b3 = vaesmcq_u8( vaeseq_u8( b3, rk[r] ) );			\
+  b4 = vaesmcq_u8( vaeseq_u8( b4, rk[r] ) );			\
+  b5 = vaesmcq_u8( vaeseq_u8( b5, rk[r] ) );			\
+  b6 = vaesmcq_u8( vaeseq_u8( b6, rk[r] ) );			\
+  b7 = vaesmcq_u8( vaeseq_u8( b7, rk[r] ) )
+
+#define ARMV8_LAST(i,b)											\
+  vst1q_u8( out + 16 * (i), veorq_u8( vaeseq_u8( b, rk[9] ), rk[10] ) )
+
+static void ecbARMv8( const AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+					  size_t count ) {
+  uint8x16_t rk[11];
+  int r;
+  for( r = 0; r < 11; r++ )
+	rk[r] = vld1q_u8( thiz->roundKeys + 16 * r );
+
+  while( count >= 8 ) {
+	uint8x16_t b0 = vld1q_u8( in + 0 );
+	uint8x16_t b1 = vld1q_u8( in + 16 );
+	uint8x16_t b2 = vld1q_u8( in + 32 );
+	uint8x16_t b3 = vld1q_u8( in + 48 );
+	uint8x16_t b4 = vld1q_u8( in + 64 );
+	uint8x16_t b5 = vld1q_u8( in + 80 );
+	uint8x16_t b6 = vld1q_u8( in + 96 );
+	uint8x16_t b7 = vld1q_u8( in + 112 );
+	for( r = 0; r < 9; r++ ) {
+	  ARMV8_ROUND(r);
+	}
+	ARMV8_LAST(0,b0);
+	ARMV8_LAST(1,b1);
+	ARMV8_LAST(2,b2);
+	ARMV8_LAST(3,b3);
+	ARMV8_LAST(4,b4);
+	ARMV8_LAST(5,b5);
+	ARMV8_LAST(6,b6);
+	ARMV8_LAST(7,b7);
+	in += 128;
+	out += 128;
+	count -= 8;
+  }
+  while( count ) {
+	uint8x16_t b = vld1q_u8( in );
+	for( r = 0; r < 9; r++ )
+	  b = vaesmcq_u8( vaeseq_u8( b, rk[r] ) );
+	vst1q_u8( out, veorq_u8( vaeseq_u8( b, rk[9] ), rk[10] ) );
+	in += 16;
+	out += 16;
+	count--;
+  }
+}
+
+#undef ARMV8_ROUND
+#undef ARMV8_LAST
+
+static int supportedARMv8( void ) {
+  return (getauxval( AT_HWCAP ) & HWCAP_AES) != 0;
+}
+
+#endif // VERNAMFS_AES_ARMV8
+
+typedef struct {
+  const char* name;
+  void (*ecb)( const AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+			   size_t count );
+  int (*supported)( void );
+} AESBackend;
+
+/*
+  In order of preference, best first.  Soft (tiny-AES, which keeps its
+  state in globals) is never chosen automatically, ttable always works.
+*/
+static const AESBackend backends[] = {
+#ifdef VERNAMFS_AES_X86
+  { "aesni", ecbAESNI, supportedAESNI },
+#endif
+#ifdef VERNAMFS_AES_ARMV8
+  { "armv8", ecbARMv8, supportedARMv8 },
+#endif
+  { "ttable", ecbTTable, supportedAlways },
+  { "soft",  ecbSoft,  supportedAlways },
+  { NULL, NULL, NULL }
+};
+
+void AES128CTRInit( AES128CTR* thiz, const uint8_t key[16] ) {
+  memcpy( thiz->key, key, sizeof( thiz->key ) );
+  AES128_KeyExpansion( key, thiz->roundKeys );
+
+  const AESBackend* b;
+  for( b = backends; b->name; b++ ) {
+	if( b->supported() ) {
+	  thiz->ecb = b->ecb;
+	  thiz->backend = b->name;
+	  return;
+	}
+  }
+}
+
+int AES128CTRSelect( AES128CTR* thiz, const char* backend ) {
+  const AESBackend* b;
+  for( b = backends; b->name; b++ ) {
+	if( strcmp( b->name, backend ) == 0 ) {
+	  if( !b->supported() )
+		return -1;
+	  thiz->ecb = b->ecb;
+	  thiz->backend = b->name;
+	  return 0;
+	}
+  }
+  return -1;
+}
+
+void AES128CTRBlocks( const AES128CTR* thiz, uint64_t counter,
+					  uint8_t* out, size_t count ) {
+  while( count ) {
+	size_t batch = count > BATCHBLOCKS ? BATCHBLOCKS : count;
+	size_t i;
+	for( i = 0; i < batch; i++ ) {
+	  uint64_t c = counter + i;
+	  uint8_t* block = out + i * AES128CTR_BLOCKSIZE;
+	  memcpy( block, &c, sizeof( c ) );
+	  memset( block + sizeof( c ), 0, AES128CTR_BLOCKSIZE - sizeof( c ) );
+	}
+	thiz->ecb( thiz, out, out, batch );
+	out += batch * AES128CTR_BLOCKSIZE;
+	counter += batch;
+	count -= batch;
+  }
+}
+
+void AES128CTRStream( const AES128CTR* thiz, uint64_t offset,
+					  uint8_t* out, size_t len ) {
+  uint8_t block[AES128CTR_BLOCKSIZE];
+  uint64_t counter = offset / AES128CTR_BLOCKSIZE;
+  size_t skip = offset % AES128CTR_BLOCKSIZE;
+
+  // Partial leading block
+  if( skip && len ) {
+	size_t n = AES128CTR_BLOCKSIZE - skip;
+	if( n > len )
+	  n = len;
+	AES128CTRBlocks( thiz, counter, block, 1 );
+	memcpy( out, block + skip, n );
+	out += n;
+	len -= n;
+	counter++;
+  }
+
+  size_t whole = len / AES128CTR_BLOCKSIZE;
+  AES128CTRBlocks( thiz, counter, out, whole );
+  out += whole * AES128CTR_BLOCKSIZE;
+  len -= whole * AES128CTR_BLOCKSIZE;
+  counter += whole;
+
+  // Partial trailing block
+  if( len ) {
+	AES128CTRBlocks( thiz, counter, block, 1 );
+	memcpy( out, block, len );
+  }
+}
+
+void AES128CTREncryptBlocks( const AES128CTR* thiz, const uint8_t* in,
+							 uint8_t* out, size_t count ) {
+  thiz->ecb( thiz, in, out, count );
+}
+
+// eof
@@ -0,0 +1,436 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "vernamfs/chacha20.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * ChaCha20 keystream engine.  See chacha20.h.
+ *
+ * The SIMD backends are 'vertical': vector register i holds state
+ * word i of 4 (or 8) consecutive blocks, so the quarter rounds are
+ * plain lane-wise adds, xors and rotates.  A 4x4 transpose at the end
+ * puts each block's words back together.  Any blocks left over after
+ * the last full group go through the scalar code.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERNAMFS_CHACHA_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VERNAMFS_CHACHA_NEON 1
+#include <arm_neon.h>
+#endif
+
+// "expand 32-byte k"
+static const uint32_t sigma[4] = 
+  { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static uint32_t load32( const uint8_t* p ) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32( uint8_t* p, uint32_t v ) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+#define ROTL32(v,n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a,b,c,d)								\
+  a += b; d ^= a; d = ROTL32( d, 16 );			\
+  c += d; b ^= c; b = ROTL32( b, 12 );			\
+  a += b; d ^= a; d = ROTL32( d, 8 );			\
+  c += d; b ^= c; b = ROTL32( b, 7 )
+
+static void initState( const ChaCha20* thiz, uint64_t counter, 
+					   uint32_t s[16] ) {
+  memcpy( s, sigma, sizeof( sigma ) );
+  memcpy( s + 4, thiz->key, sizeof( thiz->key ) );
+  s[12] = (uint32_t)counter;
+  s[13] = (uint32_t)(counter >> 32);
+  s[14] = 0;
+  s[15] = 0;
+}
+
+static void blocksScalar( const ChaCha20* thiz, uint64_t counter,
+						  uint8_t* out, size_t count ) {
+  size_t b;
+  for( b = 0; b < count; b++ ) {
+	uint32_t s[16], x[16];
+	initState( thiz, counter + b, s );
+	memcpy( x, s, sizeof( s ) );
+	int i;
+	for( i = 0; i < 10; i++ ) {
+	  QR( x[0], x[4], x[8],  x[12] );
+	  QR( x[1], x[5], x[9],  x[13] );
+	  QR( x[2], x[6], x[10], x[14] );
+	  QR( x[3], x[7], x[11], x[15] );
+	  QR( x[0], x[5], x[10], x[15] );
+	  QR( x[1], x[6], x[11], x[12] );
+	  QR( x[2], x[7], x[8],  x[13] );
+	  QR( x[3], x[4], x[9],  x[14] );
+	}
+	for( i = 0; i < 16; i++ )
+	  store32( out + b * CHACHA20_BLOCKSIZE + 4 * i, x[i] + s[i] );
+  }
+}
+
+static int supportedAlways( void ) {
+  return 1;
+}
+
+// Per-lane low and high counter words, for lanes blocks from counter
+static void laneCounters( uint64_t counter, int lanes, 
+						  uint32_t* lo, uint32_t* hi ) {
+  int i;
+  for( i = 0; i < lanes; i++ ) {
+	lo[i] = (uint32_t)(counter + i);
+	hi[i] = (uint32_t)((counter + i) >> 32);
+  }
+}
+
+/*
+  The double round, on 16 vectors x[0..15], given lane-wise ADD, XOR
+  and ROTn macros.
+*/
+#define VQR(a,b,c,d)										\
+  x[a] = ADD( x[a], x[b] ); x[d] = XOR( x[d], x[a] ); x[d] = ROT16( x[d] ); \
+  x[c] = ADD( x[c], x[d] ); x[b] = XOR( x[b], x[c] ); x[b] = ROT12( x[b] ); \
+  x[a] = ADD( x[a], x[b] ); x[d] = XOR( x[d], x[a] ); x[d] = ROT8( x[d] ); \
+  x[c] = ADD( x[c], x[d] ); x[b] = XOR( x[b], x[c] ); x[b] = ROT7( x[b] )
+
+#define VDOUBLEROUND								\
+  VQR( 0, 4, 8,  12 );								\
+  VQR( 1, 5, 9,  13 );								\
+  VQR( 2, 6, 10, 14 );								\
+  VQR( 3, 7, 11, 15 );								\
+  VQR( 0, 5, 10, 15 );								\
+  VQR( 1, 6, 11, 12 );								\
+  VQR( 2, 7, 8,  13 );								\
+  VQR( 3, 4, 9,  14 )
+
+#ifdef VERNAMFS_CHACHA_X86
+
+#define ADD(a,b) _mm_add_epi32( a, b )
+#define XOR(a,b) _mm_xor_si128( a, b )
+#define ROTV(v,n) _mm_or_si128( _mm_slli_epi32( v, n ),		\
+								_mm_srli_epi32( v, 32 - (n) ) )
+#define ROT16(v) ROTV( v, 16 )
+#define ROT12(v) ROTV( v, 12 )
+#define ROT8(v)  ROTV( v, 8 )
+#define ROT7(v)  ROTV( v, 7 )
+
+__attribute__((target("sse2")))
+static void blocksSSE2( const ChaCha20* thiz, uint64_t counter,
+						uint8_t* out, size_t count ) {
+  uint32_t s[16];
+  initState( thiz, counter, s );
+  while( count >= 4 ) {
+	__m128i x[16], o[16];
+	uint32_t lo[4], hi[4];
+	laneCounters( counter, 4, lo, hi );
+	int i;
+	for( i = 0; i < 16; i++ )
+	  o[i] = _mm_set1_epi32( s[i] );
+	o[12] = _mm_loadu_si128( (const __m128i*)lo );
+	o[13] = _mm_loadu_si128( (const __m128i*)hi );
+	for( i = 0; i < 16; i++ )
+	  x[i] = o[i];
+	for( i = 0; i < 10; i++ ) {
+	  VDOUBLEROUND;
+	}
+	for( i = 0; i < 16; i++ )
+	  x[i] = ADD( x[i], o[i] );
+
+	// Words 4g..4g+3 of lanes 0-3, transposed to one vector per block
+	int g;
+	for( g = 0; g < 4; g++ ) {
+	  __m128i t0 = _mm_unpacklo_epi32( x[4*g], x[4*g+1] );
+	  __m128i t1 = _mm_unpacklo_epi32( x[4*g+2], x[4*g+3] );
+	  __m128i t2 = _mm_unpackhi_epi32( x[4*g], x[4*g+1] );
+	  __m128i t3 = _mm_unpackhi_epi32( x[4*g+2], x[4*g+3] );
+	  uint8_t* p = out + 16 * g;
+	  _mm_storeu_si128( (__m128i*)p, _mm_unpacklo_epi64( t0, t1 ) );
+	  _mm_storeu_si128( (__m128i*)(p + 64), _mm_unpackhi_epi64( t0, t1 ) );
+	  _mm_storeu_si128( (__m128i*)(p + 128), _mm_unpacklo_epi64( t2, t3 ) );
+	  _mm_storeu_si128( (__m128i*)(p + 192), _mm_unpackhi_epi64( t2, t3 ) );
+	}
+	out += 4 * CHACHA20_BLOCKSIZE;
+	counter += 4;
+	count -= 4;
+  }
+  blocksScalar( thiz, counter, out, count );
+}
+
+#undef ADD
+#undef XOR
+#undef ROTV
+#undef ROT16
+#undef ROT12
+#undef ROT8
+#undef ROT7
+
+/*
+  AVX2, 8 lanes.  The unpacks work within each 128-bit half, so the
+  low halves end up holding blocks 0-3, the high halves blocks 4-7.
+  The 16 and 8 bit rotates are byte shuffles.
+*/
+#define ADD(a,b) _mm256_add_epi32( a, b )
+#define XOR(a,b) _mm256_xor_si256( a, b )
+#define ROTV(v,n) _mm256_or_si256( _mm256_slli_epi32( v, n ),	\
+								   _mm256_srli_epi32( v, 32 - (n) ) )
+#define ROT16(v) _mm256_shuffle_epi8( v, rot16 )
+#define ROT12(v) ROTV( v, 12 )
+#define ROT8(v)  _mm256_shuffle_epi8( v, rot8 )
+#define ROT7(v)  ROTV( v, 7 )
+
+__attribute__((target("avx2")))
+static void blocksAVX2( const ChaCha20* thiz, uint64_t counter,
+						uint8_t* out, size_t count ) {
+  const __m256i rot16 = 
+	_mm256_setr_epi8( 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+					  2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 );
+  const __m256i rot8 = 
+	_mm256_setr_epi8( 3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+					  3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14 );
+  uint32_t s[16];
+  initState( thiz, counter, s );
+  while( count >= 8 ) {
+	__m256i x[16], o[16];
+	uint32_t lo[8], hi[8];
+	laneCounters( counter, 8, lo, hi );
+	int i;
+	for( i = 0; i < 16; i++ )
+	  o[i] = _mm256_set1_epi32( s[i] );
+	o[12] = _mm256_loadu_si256( (const __m256i*)lo );
+	o[13] = _mm256_loadu_si256( (const __m256i*)hi );
+	for( i = 0; i < 16; i++ )
+	  x[i] = o[i];
+	for( i = 0; i < 10; i++ ) {
+	  VDOUBLEROUND;
+	}
+	for( i = 0; i < 16; i++ )
+	  x[i] = ADD( x[i], o[i] );
+
+	int g;
+	for( g = 0; g < 4; g++ ) {
+	  __m256i t0 = _mm256_unpacklo_epi32( x[4*g], x[4*g+1] );
+	  __m256i t1 = _mm256_unpacklo_epi32( x[4*g+2], x[4*g+3] );
+	  __m256i t2 = _mm256_unpackhi_epi32( x[4*g], x[4*g+1] );
+	  __m256i t3 = _mm256_unpackhi_epi32( x[4*g+2], x[4*g+3] );
+	  __m256i r[4];
+	  r[0] = _mm256_unpacklo_epi64( t0, t1 );
+	  r[1] = _mm256_unpackhi_epi64( t0, t1 );
+	  r[2] = _mm256_unpacklo_epi64( t2, t3 );
+	  r[3] = _mm256_unpackhi_epi64( t2, t3 );
+	  int b;
+	  for( b = 0; b < 4; b++ ) {
+		uint8_t* p = out + b * CHACHA20_BLOCKSIZE + 16 * g;
+		_mm_storeu_si128( (__m128i*)p, _mm256_castsi256_si128( r[b] ) );
+		_mm_storeu_si128( (__m128i*)(p + 4 * CHACHA20_BLOCKSIZE),
+						  _mm256_extracti128_si256( r[b], 1 ) );
+	  }
+	}
+	out += 8 * CHACHA20_BLOCKSIZE;
+	counter += 8;
+	count -= 8;
+  }
+  blocksSSE2( thiz, counter, out, count );
+}
+
+#undef ADD
+#undef XOR
+#undef ROTV
+#undef ROT16
+#undef ROT12
+#undef ROT8
+#undef ROT7
+
+static int supportedSSE2( void ) {
+  return __builtin_cpu_supports( "sse2" );
+}
+
+static int supportedAVX2( void ) {
+  return __builtin_cpu_supports( "avx2" );
+}
+
+#endif // VERNAMFS_CHACHA_X86
+
+#ifdef VERNAMFS_CHACHA_NEON
+
+#define ADD(a,b) vaddq_u32( a, b )
+#define XOR(a,b) veorq_u32( a, b )
+#define ROTV(v,n) vsriq_n_u32( vshlq_n_u32( v, n ), v, 32 - (n) )
+#define ROT16(v) vreinterpretq_u32_u16( vrev32q_u16( vreinterpretq_u16_u32( v ) ) )
+#define ROT12(v) ROTV( v, 12 )
+#define ROT8(v)  ROTV( v, 8 )
+#define ROT7(v)  ROTV( v, 7 )
+
+static void blocksNEON( const ChaCha20* thiz, uint64_t counter,
+						uint8_t* out, size_t count ) {
+  uint32_t s[16];
+  initState( thiz, counter, s );
+  while( count >= 4 ) {
+	uint32x4_t x[16], o[16];
+	uint32_t lo[4], hi[4];
+	laneCounters( counter, 4, lo, hi );
+	int i;
+	for( i = 0; i < 16; i++ )
+	  o[i] = vdupq_n_u32( s[i] );
+	o[12] = vld1q_u32( lo );
+	o[13] = vld1q_u32( hi );
+	for( i = 0; i < 16; i++ )
+	  x[i] = o[i];
+	for( i = 0; i < 10; i++ ) {
+	  VDOUBLEROUND;
+	}
+	for( i = 0; i < 16; i++ )
+	  x[i] = ADD( x[i], o[i] );
+
+	int g;
+	for( g = 0; g < 4; g++ ) {
+	  uint32x4x2_t ab = vtrnq_u32( x[4*g], x[4*g+1] );
+	  uint32x4x2_t cd = vtrnq_u32( x[4*g+2], x[4*g+3] );
+	  uint8_t* p = out + 16 * g;
+	  vst1q_u8( p, vreinterpretq_u8_u32( 
+		vcombine_u32( vget_low_u32( ab.val[0] ), vget_low_u32( cd.val[0] ) ) ) );
+	  vst1q_u8( p + 64, vreinterpretq_u8_u32( 
+		vcombine_u32( vget_low_u32( ab.val[1] ), vget_low_u32( cd.val[1] ) ) ) );
+	  vst1q_u8( p + 128, vreinterpretq_u8_u32( 
+		vcombine_u32( vget_high_u32( ab.val[0] ), vget_high_u32( cd.val[0] ) ) ) );
+	  vst1q_u8( p + 192, vreinterpretq_u8_u32( 
+		vcombine_u32( vget_high_u32( ab.val[1] ), vget_high_u32( cd.val[1] ) ) ) );
+	}
+	out += 4 * CHACHA20_BLOCKSIZE;
+	counter += 4;
+	count -= 4;
+  }
+  blocksScalar( thiz, counter, out, count );
+}
+
+#endif // VERNAMFS_CHACHA_NEON
+
+typedef struct {
+  const char* name;
+  void (*blocks)( const ChaCha20* thiz, uint64_t counter,
+				  uint8_t* out, size_t count );
+  int (*supported)( void );
+} ChaChaBackend;
+
+// In order of preference, best first.  Scalar always last.
+static const ChaChaBackend backends[] = {
+#ifdef VERNAMFS_CHACHA_X86
+  { "avx2",   blocksAVX2,   supportedAVX2 },
+  { "sse2",   blocksSSE2,   supportedSSE2 },
+#endif
+#ifdef VERNAMFS_CHACHA_NEON
+  { "neon",   blocksNEON,   supportedAlways },
+#endif
+  { "scalar", blocksScalar, supportedAlways },
+  { NULL, NULL, NULL }
+};
+
+void ChaCha20Init( ChaCha20* thiz, const uint8_t key[CHACHA20_KEYSIZE] ) {
+  int i;
+  for( i = 0; i < 8; i++ )
+	thiz->key[i] = load32( key + 4 * i );
+
+  const ChaChaBackend* b;
+  for( b = backends; b->name; b++ ) {
+	if( b->supported() ) {
+	  thiz->blocks = b->blocks;
+	  thiz->backend = b->name;
+	  return;
+	}
+  }
+}
+
+int ChaCha20Select( ChaCha20* thiz, const char* backend ) {
+  const ChaChaBackend* b;
+  for( b = backends; b->name; b++ ) {
+	if( strcmp( b->name, backend ) == 0 ) {
+	  if( !b->supported() )
+		return -1;
+	  thiz->blocks = b->blocks;
+	  thiz->backend = b->name;
+	  return 0;
+	}
+  }
+  return -1;
+}
+
+void ChaCha20Blocks( const ChaCha20* thiz, uint64_t counter,
+					 uint8_t* out, size_t count ) {
+  thiz->blocks( thiz, counter, out, count );
+}
+
+void ChaCha20Stream( const ChaCha20* thiz, uint64_t offset,
+					 uint8_t* out, size_t len ) {
+  uint8_t block[CHACHA20_BLOCKSIZE];
+  uint64_t counter = offset / CHACHA20_BLOCKSIZE;
+  size_t skip = offset % CHACHA20_BLOCKSIZE;
+
+  // Partial leading block
+  if( skip && len ) {
+	size_t n = CHACHA20_BLOCKSIZE - skip;
+	if( n > len )
+	  n = len;
+	thiz->blocks( thiz, counter, block, 1 );
+	memcpy( out, block + skip, n );
+	out += n;
+	len -= n;
+	counter++;
+  }
+
+  size_t whole = len / CHACHA20_BLOCKSIZE;
+  thiz->blocks( thiz, counter, out, whole );
+  out += whole * CHACHA20_BLOCKSIZE;
+  len -= whole * CHACHA20_BLOCKSIZE;
+  counter += whole;
+
+  // Partial trailing block
+  if( len ) {
+	thiz->blocks( thiz, counter, block, 1 );
+	memcpy( out, block, len );
+  }
+}
+
+// eof
@@ -0,0 +1,80 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "vernamfs/device.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Pad length for regular files and block devices alike.
+ */
+
+int VFSDeviceSize( const char* file, uint64_t* length ) {
+
+  struct stat st;
+  if( stat( file, &st ) )
+	return -1;
+
+  if( S_ISREG( st.st_mode ) ) {
+	*length = st.st_size;
+	return 0;
+  }
+
+#ifdef BLKGETSIZE64
+  if( S_ISBLK( st.st_mode ) ) {
+	int fd = open( file, O_RDONLY );
+	if( fd < 0 )
+	  return -1;
+	uint64_t size = 0;
+	int sc = ioctl( fd, BLKGETSIZE64, &size );
+	close( fd );
+	if( sc == -1 )
+	  return -1;
+	*length = size;
+	return 0;
+  }
+#endif
+
+  return -1;
+}
+
+// eof
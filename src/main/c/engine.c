@@ -0,0 +1,455 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "vernamfs/engine.h"
+#include "vernamfs/vernamfs.h"
+#include "vernamfs/xor.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * The mmap, pwrite and direct pad engines.  See engine.h.
+ */
+
+// Bytes read, xor'ed and written back at a time by pwrite and direct
+#define CHUNK (1 << 16)
+
+/*
+  Direct's partial blocks, at either end of a write, may be shared
+  with a neighbouring write, so each read-xor-write of one is done
+  under one of these, chosen by block number.
+*/
+#define BLOCKLOCKS 64
+
+typedef struct {
+  int type;
+  const char* name;
+} EngineInfo;
+
+static const EngineInfo infos[] = {
+  { VERNAMFS_ENGINE_MMAP,   "mmap" },
+  { VERNAMFS_ENGINE_PWRITE, "pwrite" },
+  { VERNAMFS_ENGINE_DIRECT, "direct" },
+  { 0, NULL }
+};
+
+/*
+  One mapped window of the pad, at offset, bytes long (the last may be
+  short), how many are xor'ing or syncing through it, and when last
+  pinned, by the engine's clock.  With no users, it may be unmapped
+  for another, least recently used first.
+*/
+struct VFSWindow {
+  uint64_t offset;
+  char* addr;
+  size_t bytes;
+  int users;
+  uint64_t used;
+};
+
+/*
+  fd is buffered, used by mmap and pwrite, and by direct only for a
+  short last block of the pad, directFd being opened O_DIRECT.  mmap's
+  windows are under lock.  Each pinning holds just one window at a
+  time, so a pinner finding all in use can wait for one.
+*/
+struct VFSEngine {
+  int type;
+  int fd;
+  int directFd;
+  uint64_t length;
+
+  uint64_t size;
+  uint64_t clock;
+  pthread_mutex_t lock;
+  pthread_cond_t unpinned;
+  int count;
+  struct VFSWindow* window;
+
+  pthread_mutex_t blockLocks[BLOCKLOCKS];
+};
+
+static const EngineInfo* locate( int type ) {
+  const EngineInfo* i;
+  for( i = infos; i->name; i++ )
+	if( i->type == type )
+	  return i;
+  return NULL;
+}
+
+int VFSEngineType( const char* name ) {
+  const EngineInfo* i;
+  for( i = infos; i->name; i++ )
+	if( strcmp( i->name, name ) == 0 )
+	  return i->type;
+  return -1;
+}
+
+const char* VFSEngineName( int type ) {
+  const EngineInfo* i = locate( type );
+  return i ? i->name : "unknown";
+}
+
+static void failed( const char* what, uint64_t offset ) {
+  fprintf( stderr, "Pad %s at %"PRIu64" failed: %s\n", what, offset, 
+		   strerror( errno ) );
+  abort();
+}
+
+static void fullRead( int fd, void* buf, size_t count, uint64_t offset ) {
+  char* bp = buf;
+  while( count > 0 ) {
+	ssize_t n = pread( fd, bp, count, offset );
+	if( n < 0 && errno == EINTR )
+	  continue;
+	if( n <= 0 )
+	  failed( "read", offset );
+	bp += n;
+	offset += n;
+	count -= n;
+  }
+}
+
+static void fullWrite( int fd, const void* buf, size_t count, 
+					   uint64_t offset ) {
+  const char* bp = buf;
+  while( count > 0 ) {
+	ssize_t n = pwrite( fd, bp, count, offset );
+	if( n < 0 && errno == EINTR )
+	  continue;
+	if( n <= 0 )
+	  failed( "write", offset );
+	bp += n;
+	offset += n;
+	count -= n;
+  }
+}
+
+/********************** mmap **********************/
+
+// The window holding pad offset, mapped if need be
+static struct VFSWindow* windowPin( VFSEngine* thiz, uint64_t offset ) {
+  uint64_t start = offset & ~(thiz->size - 1);
+  pthread_mutex_lock( &thiz->lock );
+  struct VFSWindow* w;
+  while( 1 ) {
+	struct VFSWindow* idle = NULL;
+	int i;
+	for( i = 0; i < thiz->count; i++ ) {
+	  w = thiz->window + i;
+	  if( w->addr && w->offset == start )
+		break;
+	  if( w->users == 0 && 
+		  (!idle || (idle->addr && (!w->addr || w->used < idle->used))) )
+		idle = w;
+	}
+	if( i < thiz->count )
+	  break;
+	if( idle ) {
+	  w = idle;
+	  if( w->addr )
+		munmap( w->addr, w->bytes );
+	  w->offset = start;
+	  w->bytes = thiz->length - start < thiz->size ? 
+		thiz->length - start : thiz->size;
+	  w->addr = mmap( NULL, w->bytes, PROT_READ|PROT_WRITE, MAP_SHARED, 
+					  thiz->fd, start );
+	  if( w->addr == MAP_FAILED )
+		failed( "mmap", start );
+	  break;
+	}
+	pthread_cond_wait( &thiz->unpinned, &thiz->lock );
+  }
+  w->users++;
+  w->used = ++thiz->clock;
+  pthread_mutex_unlock( &thiz->lock );
+  return w;
+}
+
+static void windowUnpin( VFSEngine* thiz, struct VFSWindow* w ) {
+  pthread_mutex_lock( &thiz->lock );
+  if( --w->users == 0 )
+	pthread_cond_signal( &thiz->unpinned );
+  pthread_mutex_unlock( &thiz->lock );
+}
+
+static void mmapCopy( VFSEngine* thiz, uint64_t offset, void* buf, 
+					  const void* src, size_t count ) {
+  uint8_t* bp = buf;
+  const uint8_t* sp = src;
+  while( count > 0 ) {
+	struct VFSWindow* w = windowPin( thiz, offset );
+	uint64_t in = offset - w->offset;
+	size_t n = w->bytes - in < count ? w->bytes - in : count;
+	if( sp ) {
+	  VFSXor( w->addr + in, sp, n );
+	  sp += n;
+	} else {
+	  memcpy( bp, w->addr + in, n );
+	  bp += n;
+	}
+	windowUnpin( thiz, w );
+	offset += n;
+	count -= n;
+  }
+}
+
+/*
+  Mapping a window only to msync it costs no reads, and an msync
+  MS_SYNC syncs the file's pages, not just those dirtied through that
+  mapping, so windows unmapped since the writes are synced too.
+*/
+static void mmapSync( VFSEngine* thiz, uint64_t from, uint64_t to ) {
+  uint64_t page = sysconf( _SC_PAGE_SIZE );
+  from &= ~(page - 1);
+  while( from < to ) {
+	struct VFSWindow* w = windowPin( thiz, from );
+	uint64_t end = w->offset + w->bytes < to ? w->offset + w->bytes : to;
+	msync( w->addr + (from - w->offset), end - from, MS_SYNC );
+	windowUnpin( thiz, w );
+	from = end;
+  }
+}
+
+/********************** pwrite **********************/
+
+static void pwriteXor( int fd, uint64_t offset, const void* buf, 
+					   size_t count ) {
+  uint8_t chunk[CHUNK];
+  const uint8_t* bp = buf;
+  while( count > 0 ) {
+	size_t n = count < CHUNK ? count : CHUNK;
+	fullRead( fd, chunk, n, offset );
+	VFSXor( chunk, bp, n );
+	fullWrite( fd, chunk, n, offset );
+	bp += n;
+	offset += n;
+	count -= n;
+  }
+}
+
+/********************** direct **********************/
+
+/*
+  A write is split into pieces: a partial block at either end, each
+  read, xor'ed and written whole under its block's lock, and runs of
+  whole blocks between, no other write's, so done unlocked.  A short
+  last block of the pad cannot be read or written direct, so goes via
+  fd.
+*/
+static void directCopy( VFSEngine* thiz, uint64_t offset, void* buf,
+						const void* src, size_t count ) {
+  uint8_t chunk[CHUNK] __attribute__((aligned( VERNAMFS_DIRECTALIGN )));
+  uint8_t* bp = buf;
+  const uint8_t* sp = src;
+  while( count > 0 ) {
+	uint64_t start = offset & ~(uint64_t)(VERNAMFS_DIRECTALIGN - 1);
+	size_t in = offset - start;
+	size_t n;
+	pthread_mutex_t* lock = NULL;
+	if( in || count < VERNAMFS_DIRECTALIGN ) {
+	  n = VERNAMFS_DIRECTALIGN - in < count ? 
+		VERNAMFS_DIRECTALIGN - in : count;
+	  lock = thiz->blockLocks + (start / VERNAMFS_DIRECTALIGN) % BLOCKLOCKS;
+	} else {
+	  n = count < CHUNK ? count & ~(size_t)(VERNAMFS_DIRECTALIGN - 1) : 
+		CHUNK;
+	}
+	size_t span = (in + n + VERNAMFS_DIRECTALIGN - 1) & 
+	  ~(size_t)(VERNAMFS_DIRECTALIGN - 1);
+
+	if( start + span > thiz->length ) {
+	  if( sp )
+		pwriteXor( thiz->fd, offset, sp, n );
+	  else
+		fullRead( thiz->fd, bp, n, offset );
+	} else if( sp ) {
+	  if( lock )
+		pthread_mutex_lock( lock );
+	  fullRead( thiz->directFd, chunk, span, start );
+	  VFSXor( chunk + in, sp, n );
+	  fullWrite( thiz->directFd, chunk, span, start );
+	  if( lock )
+		pthread_mutex_unlock( lock );
+	} else {
+	  fullRead( thiz->directFd, chunk, span, start );
+	  memcpy( bp, chunk + in, n );
+	}
+	if( sp )
+	  sp += n;
+	else
+	  bp += n;
+	offset += n;
+	count -= n;
+  }
+}
+
+/********************** Dispatch **********************/
+
+VFSEngine* VFSEngineOpen( int type, const char* path, uint64_t length,
+						  uint64_t windowBytes, int windows ) {
+
+  if( !locate( type ) )
+	return NULL;
+  if( type == VERNAMFS_ENGINE_MMAP ) {
+	if( windowBytes == 0 )
+	  windowBytes = VERNAMFS_WINDOWSIZE;
+	if( windowBytes & (windowBytes - 1) || 
+		windowBytes < (uint64_t)sysconf( _SC_PAGE_SIZE ) ||
+		windowBytes > VERNAMFS_MAXWINDOWSIZE || windows < 1 )
+	  return NULL;
+  }
+
+  VFSEngine* thiz = calloc( 1, sizeof( VFSEngine ) );
+  if( !thiz )
+	return NULL;
+  thiz->type = type;
+  thiz->length = length;
+  thiz->directFd = -1;
+  pthread_mutex_init( &thiz->lock, NULL );
+  pthread_cond_init( &thiz->unpinned, NULL );
+  int i;
+  for( i = 0; i < BLOCKLOCKS; i++ )
+	pthread_mutex_init( thiz->blockLocks + i, NULL );
+
+  thiz->fd = open( path, O_RDWR );
+  if( thiz->fd < 0 ) {
+	VFSEngineClose( thiz );
+	return NULL;
+  }
+  if( type == VERNAMFS_ENGINE_DIRECT ) {
+	thiz->directFd = open( path, O_RDWR | O_DIRECT );
+	if( thiz->directFd < 0 ) {
+	  VFSEngineClose( thiz );
+	  return NULL;
+	}
+  }
+  if( type == VERNAMFS_ENGINE_MMAP ) {
+	thiz->size = windowBytes;
+	thiz->count = windows;
+	thiz->window = calloc( windows, sizeof( struct VFSWindow ) );
+	if( !thiz->window ) {
+	  VFSEngineClose( thiz );
+	  return NULL;
+	}
+  }
+  return thiz;
+}
+
+int VFSEngineTypeOf( VFSEngine* thiz ) {
+  return thiz->type;
+}
+
+uint64_t VFSEngineSize( VFSEngine* thiz ) {
+  return thiz->length;
+}
+
+void VFSEngineRead( VFSEngine* thiz, uint64_t offset, void* buf, 
+					size_t count ) {
+  switch( thiz->type ) {
+  case VERNAMFS_ENGINE_MMAP:
+	mmapCopy( thiz, offset, buf, NULL, count );
+	break;
+  case VERNAMFS_ENGINE_PWRITE:
+	fullRead( thiz->fd, buf, count, offset );
+	break;
+  case VERNAMFS_ENGINE_DIRECT:
+	directCopy( thiz, offset, buf, NULL, count );
+	break;
+  }
+}
+
+void VFSEngineXor( VFSEngine* thiz, uint64_t offset, const void* buf, 
+				   size_t count ) {
+  switch( thiz->type ) {
+  case VERNAMFS_ENGINE_MMAP:
+	mmapCopy( thiz, offset, NULL, buf, count );
+	break;
+  case VERNAMFS_ENGINE_PWRITE:
+	pwriteXor( thiz->fd, offset, buf, count );
+	break;
+  case VERNAMFS_ENGINE_DIRECT:
+	directCopy( thiz, offset, NULL, buf, count );
+	break;
+  }
+}
+
+/*
+  pwrite and direct sync the whole file, there being no portable
+  ranged sync.  Direct writes are on the device already, but maybe
+  only in its cache, which this flushes.
+*/
+void VFSEngineSync( VFSEngine* thiz, uint64_t from, uint64_t to ) {
+  if( from >= to )
+	return;
+  if( thiz->type == VERNAMFS_ENGINE_MMAP )
+	mmapSync( thiz, from, to );
+  else
+	fdatasync( thiz->fd );
+}
+
+void VFSEngineAdvise( VFSEngine* thiz, uint64_t from, uint64_t to ) {
+  if( thiz->type != VERNAMFS_ENGINE_DIRECT && from < to )
+	posix_fadvise( thiz->fd, from, to - from, POSIX_FADV_WILLNEED );
+}
+
+void VFSEngineClose( VFSEngine* thiz ) {
+  int i;
+  for( i = 0; i < thiz->count; i++ )
+	if( thiz->window[i].addr )
+	  munmap( thiz->window[i].addr, thiz->window[i].bytes );
+  free( thiz->window );
+  if( thiz->fd >= 0 )
+	close( thiz->fd );
+  if( thiz->directFd >= 0 )
+	close( thiz->directFd );
+  pthread_mutex_destroy( &thiz->lock );
+  pthread_cond_destroy( &thiz->unpinned );
+  for( i = 0; i < BLOCKLOCKS; i++ )
+	pthread_mutex_destroy( thiz->blockLocks + i );
+  free( thiz );
+}
+
+// eof
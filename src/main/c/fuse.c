@@ -38,17 +38,21 @@
 
 #include <fuse.h>
 
+#include "vernamfs/engine.h"
 #include "vernamfs/vernamfs.h"
 
 /**
  * @author Stuart Maclean
  *
  * Fuse callbacks required for vernamfs. Uses a single VFS struct,
- * named Global, for the actual back-end implementation.
+ * named Global, for the actual back-end implementation.  Each open
+ * file is a VFSFile, held in fi->fh, so many files may be open and
+ * written at once, from the multi-threaded fuse loop.  With a sharded
+ * VFS, each writing process is pinned to one shard, by its pid.  With
+ * a pipeline, releases return once queued, each shard's worker
+ * writing files out behind them.
  */
 
-static int inUse = 0;
-
 static int vernamfs_getattr(const char *path, struct stat *stbuf ) {
   if( 1 )
 	printf( "%s: %s\n", __FUNCTION__, path );
@@ -134,19 +138,21 @@ static int vernamfs_open( const char* path, struct fuse_file_info* fi ) {
   if( (fi->flags & O_APPEND) == O_APPEND )
 	return -ENOTSUP;
 
-  if( inUse )
-	return -EBUSY;
-  inUse = 1;
-
-  fi->fh = (uint64_t)&Global;
-
-  int sc = VFSAddEntry( &Global, path );
-
-  // LOOK: make reporting a debug option...
-  if( 0 ) 
-	VFSReport( &Global, 1 );
-
-  return sc;
+  /*
+	Our writer's own shard first.  Only if that is full, try the
+	others in turn.
+  */
+  int first = fuse_get_context()->pid % GlobalShardCount;
+  VFSFile* f;
+  int sc = -ENOSPC;
+  int i;
+  for( i = 0; i < GlobalShardCount && sc == -ENOSPC; i++ )
+	sc = VFSFileOpen( GlobalShards + (first + i) % GlobalShardCount, 
+					  path, &f );
+  if( sc )
+	return sc;
+  fi->fh = (uint64_t)(uintptr_t)f;
+  return 0;
 }
 
 static int vernamfs_truncate(const char *path, off_t size) {
@@ -177,12 +183,8 @@ static int vernamfs_write(const char *path, const char *buf, size_t size,
   if( fi->fh == 0 )
 	return 0;
 
-  size_t sc = VFSWrite( &Global, buf, size );
-  
-  if( 0 )
-	VFSReport( &Global, 1 );
-
-  return sc == -1 ? -ENOSPC : sc;
+  VFSFile* f = (VFSFile*)(uintptr_t)fi->fh;
+  return VFSFileWrite( f, buf, size, offset );
 }
 
 static int vernamfs_release(const char *path, struct fuse_file_info *fi) {
@@ -192,15 +194,35 @@ static int vernamfs_release(const char *path, struct fuse_file_info *fi) {
   if( fi->fh == 0 )
 	return 0;
 
-  VFSRelease( &Global );
-  VFSStore( &Global );
+  VFSFile* f = (VFSFile*)(uintptr_t)fi->fh;
+  fi->fh = 0;
+  int sc = VFSFileRelease( f );
 
   if( 0 )
 	VFSReport( &Global, 1 );
 
-  inUse = 0;
+  return sc;
+}
 
-  return 0;
+/*
+  Any pipeline workers (see mount -q), and group commit timers (see
+  mount -y), start here, not in mount.c, since
+  fuse has by now forked into the background, which threads do not
+  survive.
+*/
+static void* vernamfs_init( void ) {
+
+  if( 1 )
+	printf( "%s\n", __FUNCTION__ );
+
+  int i;
+  for( i = 0; i < GlobalShardCount; i++ ) {
+	if( VFSStartPipeline( GlobalShards + i ) )
+	  fprintf( stderr, "Pipeline not started, releases synchronous\n" );
+	if( VFSStartGroupCommit( GlobalShards + i ) )
+	  fprintf( stderr, "Group commit timer not started\n" );
+  }
+  return NULL;
 }
 
 static void vernamfs_destroy(void* env ) {
@@ -208,7 +230,17 @@ static void vernamfs_destroy(void* env ) {
   if( 1 )
 	printf( "%s\n", __FUNCTION__ );
 
-  VFSStore( &Global );
+  int i;
+  for( i = 0; i < GlobalShardCount; i++ ) {
+	VFSStopPipeline( GlobalShards + i );
+	VFSStopGroupCommit( GlobalShards + i );
+	VFSStore( GlobalShards + i );
+	if( GlobalShardCount > 1 )
+	  printf( "\nShard %d\n", i );
+	VFSReportStats( GlobalShards + i );
+  }
+  if( Global.engine )
+	VFSEngineClose( Global.engine );
 }
 
 struct fuse_operations vernamfs_ops = {
@@ -221,6 +253,7 @@ struct fuse_operations vernamfs_ops = {
   .unlink = vernamfs_unlink,
   .write = vernamfs_write,
   .release = vernamfs_release,
+  .init = vernamfs_init,
   .destroy = vernamfs_destroy
 };
 
@@ -31,12 +31,24 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "vernamfs/cmds.h"
-#include "vernamfs/aes128.h"
+#include "vernamfs/keystream.h"
+#include "vernamfs/device.h"
+#include "vernamfs/vernamfs.h"
 
 /**
  * @author Stuart Maclean
@@ -63,8 +75,10 @@
  *
  * Currently we support only the AES-128 variant of aes, since that is
  * the only code we snarfed off the net to add to VernamFS.  This has
- * a 128-bit key.  If/when we locate a nice, clean, small AES-256
- * implementation (256-bit key), we'll add.
+ * a 128-bit key.  For a 256-bit key, use ChaCha20 instead (-c
+ * chacha20, or just supply a 32-byte key), see chacha20.c.  It is
+ * also the faster choice on cpus without AES instructions.  It too
+ * is driven by a block counter, so all the below applies equally.
  *
  * We use aes in 'counter mode', aka CTR mode.  We simply increment
  * the counter from 0, and keep counting until the desired length of
@@ -96,16 +110,132 @@
  *		30		480 
  *		32		2040
  *
- * Since we are using CTR mode, in theory we could parallelize the
- * generation, given each job a subsequence of the counter space.  In
- * practice, the aes code as is seems quick enough to be run
- * sequentially.
+ * Those numbers were for the original tiny-AES code, one block per
+ * encrypt call.  The keystream now comes from the CTR engine in
+ * aesctr.c, which uses AES-NI or the ARMv8 Crypto Extensions when
+ * the cpu has them, 8 blocks at a time, else a T-table software AES
+ * some 9x quicker than tiny-AES.  The output is byte-for-byte what it
+ * was.
+ *
+ * Output is produced a whole buffer (-b, default 1MB) at a time, and
+ * written with one write call, short writes retried.  When stdout is
+ * a pipe, the buffers are instead vmsplice'd into it, saving the
+ * copy.  With -v, a progress and throughput line goes to stderr.
+ *
+ * Since we are using CTR mode, we can parallelize the generation,
+ * giving each job a subsequence of the counter space.  With -j N, N
+ * worker threads claim successive buffer-sized chunks of the counter
+ * space.
+ * If stdout is a file or device, each worker writes its own chunks
+ * with pwrite, at the right offset.  If stdout is a pipe, chunks are
+ * handed to a small ring of slots and the main thread writes them out
+ * in order.  Either way the output is identical to the -j 1 run.
+ *
+ * Provisioning: with -o, the pad goes straight to the named file or
+ * block device (an SD card, say), opened O_DIRECT where the kernel
+ * allows it, so gigabytes of keystream do not wash through the page
+ * cache.  A regular file is preallocated up front.  The size may then
+ * be any byte count (-s), and for a device defaults to the whole
+ * device.  With -n, the VernamFS header that 'init' would write is
+ * laid over the start of the pad in the same pass, so
+ *
+ * $ vernamfs generate -j 4 -n 1024 -o /dev/mmcblk0 < KEY
+ *
+ * replaces the dd, generate, init sequence.  The vault copy is then
+ * just the same command, without -n, to a regular file.
  */
+
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+#define VERNAMFS_GENERATE_SPLICE 1
+#endif
+
+// Default output buffer, also the -j unit of work
+#define GENERATEBUFFERSIZEDEFAULT (1 << 20)
+
+typedef struct {
+  uint64_t total;
+  uint64_t done;
+  struct timeval start;
+  struct timeval last;
+  int verbose;
+} GenerateProgress;
+
+typedef struct {
+  int fd;
+  // Same file, never O_DIRECT, for a tail shorter than the alignment
+  int tailFd;
+  // O_DIRECT transfers must be multiples of this, 1 if not direct
+  size_t align;
+} GenerateOutput;
+
+typedef struct {
+  int fd;
+  uint8_t* buffer;
+  size_t bufferSize;
+  size_t segment;
+  size_t pos;
+  int splice;
+} GenerateStream;
+
+static void progressInit( GenerateProgress* thiz, uint64_t total, 
+						  int verbose );
+static void progressReport( GenerateProgress* thiz, int final );
+
+static int outputOpen( GenerateOutput* thiz, char* file, uint64_t length );
+static int outputClose( GenerateOutput* thiz );
+
+static int generateSerial( VFSKeystream* ks, uint64_t length, 
+						   GenerateOptions* options,
+						   GenerateProgress* progress );
+static int generateParallel( VFSKeystream* ks, uint64_t length,
+							 GenerateOutput* output,
+							 GenerateOptions* options,
+							 GenerateProgress* progress );
+
+static uint64_t parseSize( char* s );
+
 static int hexDecode( uint8_t* encoded, int len, uint8_t* result );
 
+static CommandOption a = 
+  { .id = "a", 
+	.text = "With -n, alignment of each file's content, in bytes, as for init." };
+
+static CommandOption b = 
+  { .id = "b", 
+	.text = "Output buffer size, in bytes, or with K/M/G suffix.  Defaults to 1M.\n    Rounded up to a page multiple." };
+
+static CommandOption c = 
+  { .id = "c", 
+	.text = "Keystream, aes128 or chacha20.  Defaults to that implied by the key\n    length, aes128 for -z.  Recorded in the header, with -n." };
+
+static CommandOption j = 
+  { .id = "j", 
+	.text = "Number of generator threads.  Defaults to 1.  0 means one per\n    online cpu." };
+
+static CommandOption l = 
+  { .id = "l", 
+	.text = "With -n, maximum length of file name, as for init." };
+
+static CommandOption n = 
+  { .id = "n", 
+	.text = "Maximum file count.  Write the VernamFS header, as init would, over\n    the start of the pad." };
+
+static CommandOption o = 
+  { .id = "o", 
+	.text = "Write the pad to this file or block device, using O_DIRECT where\n    possible, rather than to standard output." };
+
+static CommandOption s = 
+  { .id = "s", 
+	.text = "Pad size, in bytes, or with K/M/G suffix.  Any size, not just 2^N.\n    With -o and a block device, defaults to the whole device." };
+
 static CommandOption z = { .id = "z", .text = "Key is 16 zero bytes." };
 
-static CommandOption* options[] = { &z, NULL };
+static CommandOption v = 
+  { .id = "v", 
+	.text = "Verbose. Print progress and throughput to stderr." };
+
+static CommandOption* options[] = { &a, &b, &c, &j, &l, &n, &o, &s, &v, &z, 
+									NULL };
 
 static char example1[] = 
   "$ echo \"The cat sat on the mat\" | md5sum | cut -b 1-32 > KEY";
@@ -119,15 +249,26 @@ static char example4[] = "$ echo 12345678901234567890123456789012 | vernamfs gen
 
 static char example5[] = "$ vernamfs generate -z 24 > 16MB.pad";
 
+static char example6[] = "$ vernamfs generate -j 8 36 < KEY > /dev/sdCard";
+
+static char example7[] = "$ vernamfs generate -v -b 8M 30 < KEY | ssh host 'cat > 1GB.pad'";
+
+static char example8[] = "$ vernamfs generate -j 4 -n 1024 -o /dev/mmcblk0 < KEY";
+
+static char example9[] = "$ vernamfs generate -s 1500M -o vault.pad < KEY";
+
+static char example10[] = "$ vernamfs generate -z -c chacha20 -j 4 30 > 1GB.pad";
+
 static char* examples[] = { example1, example2, example3, example4, 
-							example5, NULL };
+							example5, example6, example7, example8,
+							example9, example10, NULL };
 
 static CommandHelp help = {
-  .summary = "Generate a pseudo one-time pad, using AES128 block cipher",
+  .summary = "Generate a pseudo one-time pad, using AES128 or ChaCha20",
 
-  .synopsis = "[<options>] log2PadSize",
+  .synopsis = "[<options>] [log2PadSize]",
 
-  .description = "Generate a pseudo one-time pad, using the AES128 block cipher, in CTR mode.\n  This is likely faster than reading /dev/[u]random.  It can be regenerated at\n  will, so no vault copy need be stored. It is of course not random.\n\n  log2PadSize is the base 2 log of the desired pad size. For a 1MB pad, use 20,\n  for 1GB, use 30, etc.  Minimum is 12.\n\n  The 16-byte AES key is expected, hex-encoded, on standard input, unless the \n  -z option is used.\n\n  Pad content is written to standard output, so redirect to a suitable file.",
+  .description = "Generate a pseudo one-time pad, using the AES128 block cipher, in CTR mode.\n  This is likely faster than reading /dev/[u]random.  It can be regenerated at\n  will, so no vault copy need be stored. It is of course not random.\n\n  log2PadSize is the base 2 log of the desired pad size. For a 1MB pad, use 20,\n  for 1GB, use 30, etc.  Minimum is 12.  Alternatively, -s gives\n  the size in bytes.\n\n  The 16-byte AES key is expected, hex-encoded, on standard input, unless the \n  -z option is used.  A 32-byte key selects ChaCha20 instead.\n\n  Pad content is written to standard output, so redirect to a suitable file,\n  or given -o, direct to a file or device.  With -n, the result is a ready to\n  mount VernamFS, no separate init needed.",
 
   .options = options,
 
@@ -142,115 +283,823 @@ Command generateCmd = {
 };
 
 /**
- * The aes key expected in hex-encoded form on STDIN.  If a trailing
- * newline character (\n) is found, it is removed.  If the -z option
+ * The aes (or chacha20) key expected in hex-encoded form on STDIN.
+ * Reading stops at a newline character (\n).  If the -z option
  * is given, no user key is required, and a zeroed key (N bits all
  * zero) is used, useful in testing.
  *
- * The log2 of the desired OTP length expected as sole mandatory
- * command argument.  So 20 produces a 1MB stream, 30 produces a 1GB
- * stream, etc.
+ * The log2 of the desired OTP length expected as sole command
+ * argument.  So 20 produces a 1MB stream, 30 produces a 1GB stream,
+ * etc.  It may be omitted if -s is given instead, or -o names a
+ * block device, whose size is then used.
  */
 
 int generateArgs( int argc, char* argv[] ) {
 
   int log2OTPSize = 0;
+  uint64_t length = 0;
+  int maxFiles = 0;
+  int maxNameLength = VERNAMFS_NAMELENGTHDEFAULT;
+  uint64_t alignment = 0;
 
   uint8_t userKey[32] = { 0 };
   uint8_t zeroKey[32] = { 0 };
 
   int keyLen = 0;
   uint8_t* key = NULL;
+  char* cipher = NULL;
+
+  GenerateOptions options = { .threads = 1, 
+							  .bufferSize = GENERATEBUFFERSIZEDEFAULT,
+							  .verbose = 0,
+							  .output = NULL,
+							  .header = NULL,
+							  .headerSize = 0 };
 
   int c;
-  while( (c = getopt( argc, argv, "z") ) != -1 ) {
+  while( (c = getopt( argc, argv, "a:b:c:j:l:n:o:s:vz") ) != -1 ) {
 	switch( c ) {
+	case 'a':
+	  alignment = atol( optarg );
+	  break;
+	case 'b':
+	  options.bufferSize = parseSize( optarg );
+	  break;
+	case 'c':
+	  cipher = optarg;
+	  break;
+	case 'j':
+	  options.threads = atoi( optarg );
+	  break;
+	case 'l':
+	  maxNameLength = atoi( optarg );
+	  break;
+	case 'n':
+	  maxFiles = atoi( optarg );
+	  if( maxFiles < 1 ) {
+		fprintf( stderr, "%s: Max file count %d too small.\n", 
+				 argv[0], maxFiles );
+		return -1;
+	  }
+	  break;
+	case 'o':
+	  options.output = optarg;
+	  break;
+	case 's':
+	  length = parseSize( optarg );
+	  if( length == 0 ) {
+		fprintf( stderr, "%s: Bad pad size.\n", argv[0] );
+		return -1;
+	  }
+	  break;
+	case 'v':
+	  options.verbose = 1;
+	  break;
 	case 'z':
 	  key = zeroKey;
-	  keyLen = 16;
 	  break;
 	default:
 	  break;
 	}
   }
 
-  if( optind+1 > argc ) {
+  if( optind < argc ) {
+	log2OTPSize = atoi( argv[optind] );
+	if( log2OTPSize < 12 || log2OTPSize > 40 ) {
+	  fprintf( stderr, "%s: Size out-of-bounds: 12 <= log2PadSize <= 40\n", 
+			   argv[0] );
+	  return -1;
+	}
+	length = (uint64_t)1 << log2OTPSize;
+  }
+
+  // No size given: a device to fill, or nothing to go on
+  if( length == 0 && options.output ) {
+	uint64_t deviceLength;
+	struct stat st;
+	if( stat( options.output, &st ) == 0 && S_ISBLK( st.st_mode ) &&
+		VFSDeviceSize( options.output, &deviceLength ) == 0 )
+	  length = deviceLength;
+  }
+  if( length == 0 ) {
 	commandHelp( &generateCmd );
 	return -1;
   }
+  if( length < (1 << 12) ) {
+	fprintf( stderr, "%s: Pad size %"PRIu64" too small, minimum 4K.\n", 
+			 argv[0], length );
+	return -1;
+  }
 
-  log2OTPSize = atoi( argv[optind] );
-  if( log2OTPSize < 12 || log2OTPSize > 40 ) {
-	fprintf( stderr, "%s: Size out-of-bounds: 12 <= log2PadSize <= 40\n", 
-			 argv[0] );
+  if( options.threads == 0 )
+	options.threads = sysconf( _SC_NPROCESSORS_ONLN );
+  if( options.threads < 1 ) {
+	fprintf( stderr, "%s: Thread count %d too small.\n", argv[0], 
+			 options.threads );
 	return -1;
   }
-  
+
+  if( options.bufferSize == 0 ) {
+	fprintf( stderr, "%s: Bad buffer size.\n", argv[0] );
+	return -1;
+  }
+  long pageSize = sysconf( _SC_PAGE_SIZE );
+  options.bufferSize = (options.bufferSize + pageSize - 1) & ~(pageSize - 1);
+
+  VFS vfs;
+  if( maxFiles ) {
+	if( alignment > pageSize || (alignment & (alignment - 1)) ) {
+	  fprintf( stderr, "%s: Alignment %"PRIu64" not a power of 2 from 1 "
+			   "to %ld.\n", argv[0], alignment, pageSize );
+	  return -1;
+	}
+	if( VFSInit( &vfs, length, maxFiles, maxNameLength, alignment ) ) {
+	  fprintf( stderr, "%s: Pad too small for %d files.\n", 
+			   argv[0], maxFiles );
+	  return -1;
+	}
+  }
+
   if( !key ) {
-	uint8_t keyHex[128];
-	int nin = read( STDIN_FILENO, keyHex, 32 );
-	if( nin < 32 ) {
+	// Up to the first newline, or EOF
+	uint8_t keyHex[130];
+	int nin = 0;
+	while( nin < sizeof( keyHex ) ) {
+	  ssize_t n = read( STDIN_FILENO, keyHex + nin, sizeof( keyHex ) - nin );
+	  if( n <= 0 )
+		break;
+	  nin += n;
+	  if( memchr( keyHex, '\n', nin ) )
+		break;
+	}
+
+	// Crude but effective way to strip whitespace!
+	int digits = 0;
+	while( digits < nin && isxdigit( keyHex[digits] ) )
+	  digits++;
+	if( digits != 32 && digits != 64 ) {
 	  fprintf( stderr, 
-			   "%s: Hexed key (length %d) too short. Need 32 hex digits.\n", 
-			   argv[0], nin );
+			   "%s: Hexed key length %d. Need 32 or 64 hex digits.\n", 
+			   argv[0], digits );
 	  return -1;
 	}
 	
-	// Crude but effective way to strip whitespace!
-	if( keyHex[nin-1] == '\n' )
-	  nin--;
-	
-	keyLen = hexDecode( (uint8_t*)keyHex, nin, userKey );
+	keyLen = hexDecode( (uint8_t*)keyHex, digits, userKey );
 	key = userKey;
   }
 
-  switch( keyLen ) {
+  /*
+	The keystream: as named by -c, else as implied by the key length,
+	16 bytes for AES-128, 32 for ChaCha20.  The -z key fits either.
+  */
+  int padType;
+  if( cipher )
+	padType = VFSKeystreamType( cipher );
+  else if( key == zeroKey )
+	padType = VERNAMFS_PADTYPE_AES128CTR;
+  else
+	padType = VFSKeystreamTypeForKeySize( keyLen );
+  if( padType < 0 ) {
+	fprintf( stderr, "%s: Unknown keystream: %s\n", argv[0], cipher );
+	return -1;
+  }
+  if( key == zeroKey )
+	keyLen = VFSKeystreamKeySize( padType );
+  if( keyLen != VFSKeystreamKeySize( padType ) ) {
+	fprintf( stderr, "%s: key length %d not supported by %s\n", argv[0], 
+			 keyLen, VFSKeystreamName( padType ) );
+	return -1;
+  }
 
-  case 16:
-	generate128( (char*)key, log2OTPSize );
-	break;
+  // The header records the keystream, for the vault side
+  char* header = NULL;
+  if( maxFiles ) {
+	VFSSetPadType( &vfs, padType );
+	options.headerSize = VFSHeaderExtent( &vfs );
+	header = calloc( 1, options.headerSize );
+	if( !header ) {
+	  fprintf( stderr, "%s: Cannot allocate header\n", argv[0] );
+	  return -1;
+	}
+	vfs.backing = header;
+	VFSStore( &vfs );
+	options.header = header;
+  }
 
-  case 32:
-	// LOOK: find an aes256 implementation
-	fprintf( stderr, 
-			 "%s: AES256 not (yet) supported, use 16-byte key.\n", 
-			 argv[0] );
-	break;
+  int sc = generateKeystream( padType, key, length, &options );
+  free( header );
+  return sc;
+}
 
-  default:
-	fprintf( stderr, "%s: key length %d not supported\n", argv[0], keyLen );
+int generateKeystream( int padType, const uint8_t* key, uint64_t length,
+					   GenerateOptions* options ) {
+
+  VFSKeystream ks;
+  if( VFSKeystreamInit( &ks, padType, key ) )
 	return -1;
+
+  GenerateOutput output;
+  if( outputOpen( &output, options->output, length ) )
+	return -1;
+
+  GenerateProgress progress;
+  progressInit( &progress, length, options->verbose );
+
+  // Named outputs are always seekable, so take the pwrite path
+  int sc;
+  if( options->threads > 1 || options->output )
+	sc = generateParallel( &ks, length, &output, options, &progress );
+  else
+	sc = generateSerial( &ks, length, options, &progress );
+
+  progressReport( &progress, 1 );
+
+  if( outputClose( &output ) )
+	sc = -1;
+  return sc;
+}
+
+/********************** Private Impl: Progress Reporting *****************/
+
+static double secondsSince( struct timeval* t ) {
+  struct timeval now;
+  gettimeofday( &now, NULL );
+  return (now.tv_sec - t->tv_sec) + (now.tv_usec - t->tv_usec) / 1e6;
+}
+
+static void progressInit( GenerateProgress* thiz, uint64_t total, 
+						  int verbose ) {
+  thiz->total = total;
+  thiz->done = 0;
+  thiz->verbose = verbose;
+  gettimeofday( &thiz->start, NULL );
+  thiz->last = thiz->start;
+}
+
+// May be called by any worker thread
+static void progressAdd( GenerateProgress* thiz, uint64_t bytes ) {
+  __atomic_add_fetch( &thiz->done, bytes, __ATOMIC_RELAXED );
+}
+
+// Only ever called by the main thread.  Prints at most once a second.
+static void progressReport( GenerateProgress* thiz, int final ) {
+  if( !thiz->verbose )
+	return;
+  if( !final && secondsSince( &thiz->last ) < 1.0 )
+	return;
+  gettimeofday( &thiz->last, NULL );
+
+  uint64_t done = __atomic_load_n( &thiz->done, __ATOMIC_RELAXED );
+  double secs = secondsSince( &thiz->start );
+  double mbs = secs > 0 ? (done / 1048576.0) / secs : 0;
+  fprintf( stderr, "\rgenerate: %"PRIu64"/%"PRIu64" MB (%d%%), %.1f MB/s%s",
+		   done >> 20, thiz->total >> 20,
+		   thiz->total ? (int)(100 * done / thiz->total) : 100, mbs,
+		   final ? "\n" : "" );
+}
+
+/********************** Private Impl: Buffered Output ********************/
+
+static int writeFully( int fd, const uint8_t* buf, size_t len ) {
+  while( len ) {
+	ssize_t nout = write( fd, buf, len );
+	if( nout < 0 ) {
+	  if( errno == EINTR )
+		continue;
+	  return -1;
+	}
+	buf += nout;
+	len -= nout;
+  }
+  return 0;
+}
+
+static int pwriteFully( int fd, const uint8_t* buf, size_t len, off_t offset ) {
+  while( len ) {
+	ssize_t nout = pwrite( fd, buf, len, offset );
+	if( nout < 0 ) {
+	  if( errno == EINTR )
+		continue;
+	  return -1;
+	}
+	buf += nout;
+	len -= nout;
+	offset += nout;
+  }
+  return 0;
+}
+
+/*
+  vmsplice hands the pages themselves to the pipe, no copy.  The catch
+  is that we must not refill a page until the reader has consumed it.
+  We know it has once at least a whole pipe's worth of data has been
+  spliced after it.  So a splicing stream fills a ring of segments,
+  each half the pipe size, with enough segments that the ring minus
+  one segment covers the pipe.
+
+  @return 0 on success, 1 if vmsplice is not usable here (caller
+  should write instead), -1 on a real write error.
+*/
+static int vmspliceFully( int fd, const uint8_t* buf, size_t len ) {
+#ifdef VERNAMFS_GENERATE_SPLICE
+  int first = 1;
+  while( len ) {
+	struct iovec iov = { .iov_base = (void*)buf, .iov_len = len };
+	ssize_t nout = vmsplice( fd, &iov, 1, 0 );
+	if( nout < 0 ) {
+	  if( errno == EINTR )
+		continue;
+	  if( first && (errno == EINVAL || errno == ENOSYS || errno == EBADF) )
+		return 1;
+	  return -1;
+	}
+	first = 0;
+	buf += nout;
+	len -= nout;
   }
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+static int streamOpen( GenerateStream* thiz, int fd, size_t bufferSize ) {
+
+  thiz->fd = fd;
+  thiz->splice = 0;
+  thiz->pos = 0;
+  thiz->segment = bufferSize;
+  thiz->bufferSize = bufferSize;
+
+#ifdef VERNAMFS_GENERATE_SPLICE
+  struct stat st;
+  if( fstat( fd, &st ) == 0 && S_ISFIFO( st.st_mode ) ) {
+	// Ask for a pipe as big as our buffer, take whatever we get
+	fcntl( fd, F_SETPIPE_SZ, (int)bufferSize );
+	int pipeSize = fcntl( fd, F_GETPIPE_SZ );
+	long pageSize = sysconf( _SC_PAGE_SIZE );
+	if( pipeSize >= 2 * pageSize ) {
+	  size_t segment = (pipeSize / 2) & ~(pageSize - 1);
+	  size_t segments = bufferSize / segment;
+	  if( segments * segment < pipeSize + segment )
+		segments = (pipeSize + segment + segment - 1) / segment;
+	  thiz->splice = 1;
+	  thiz->segment = segment;
+	  thiz->bufferSize = segments * segment;
+	}
+  }
+#endif
 
+  void* buffer;
+  if( posix_memalign( &buffer, sysconf( _SC_PAGE_SIZE ), thiz->bufferSize ) )
+	return -1;
+  thiz->buffer = (uint8_t*)buffer;
   return 0;
 }
 
-int generate128( char key[], int log2OTPSize ) {
+// Where the next output goes, and how much room there is
+static uint8_t* streamNext( GenerateStream* thiz, size_t* capacity ) {
+  *capacity = thiz->segment;
+  return thiz->buffer + thiz->pos;
+}
+
+// Emit len bytes, as filled in at the last streamNext
+static int streamPut( GenerateStream* thiz, size_t len ) {
+  uint8_t* data = thiz->buffer + thiz->pos;
+  if( thiz->splice ) {
+	int sc = vmspliceFully( thiz->fd, data, len );
+	if( sc < 0 )
+	  return -1;
+	if( sc == 0 ) {
+	  thiz->pos += thiz->segment;
+	  if( thiz->pos + thiz->segment > thiz->bufferSize )
+		thiz->pos = 0;
+	  return 0;
+	}
+	// Not a pipe vmsplice can feed after all, so plain writes from now on
+	thiz->splice = 0;
+	thiz->pos = 0;
+  }
+  return writeFully( thiz->fd, data, len );
+}
+
+static void streamClose( GenerateStream* thiz ) {
+  free( thiz->buffer );
+}
+
+/********************** Private Impl: Named Output ***********************/
+
+/*
+  O_DIRECT wants buffer, offset and length all aligned, to the device's
+  logical block size.  Our buffers and chunk offsets are page aligned,
+  and a page is a multiple of any block size we will meet, so only the
+  pad's final, partial page needs care.  That goes via tailFd.
+*/
+static int outputOpen( GenerateOutput* thiz, char* file, uint64_t length ) {
 
-  uint8_t input[16] = { 0 };
+  thiz->fd = thiz->tailFd = STDOUT_FILENO;
+  thiz->align = 1;
+  if( !file )
+	return 0;
 
-  uint8_t output[16];
+  struct stat st;
+  int isDevice = stat( file, &st ) == 0 && S_ISBLK( st.st_mode );
+  if( isDevice ) {
+	uint64_t deviceLength;
+	if( VFSDeviceSize( file, &deviceLength ) == 0 && length > deviceLength ) {
+	  fprintf( stderr, "%s: Pad size %"PRIu64" exceeds device size %"PRIu64"\n",
+			   file, length, deviceLength );
+	  return -1;
+	}
+  }
 
-  uint64_t sz = (uint64_t)(1LL << log2OTPSize);
+  int flags = O_WRONLY | O_CREAT;
+#ifdef O_DIRECT
+  thiz->fd = open( file, flags | O_DIRECT, 0644 );
+  if( thiz->fd >= 0 )
+	thiz->align = sysconf( _SC_PAGE_SIZE );
+  else if( errno != EINVAL )
+	goto failed;
+#endif
+  // No O_DIRECT here, or the filesystem (e.g. tmpfs) refused it
+  if( thiz->align == 1 ) {
+	thiz->fd = open( file, flags, 0644 );
+	if( thiz->fd < 0 )
+	  goto failed;
+  }
 
-  // AES outputs 16 bytes at a time...
-  uint64_t iterations = sz >> 4;
+  thiz->tailFd = thiz->fd;
+  if( thiz->align > 1 ) {
+	thiz->tailFd = open( file, O_WRONLY );
+	if( thiz->tailFd < 0 ) {
+	  close( thiz->fd );
+	  goto failed;
+	}
+  }
+
+  if( !isDevice ) {
+	// Exact length, and the blocks reserved now rather than piecemeal
+	if( ftruncate( thiz->fd, length ) ) {
+	  perror( "generate.ftruncate" );
+	  outputClose( thiz );
+	  return -1;
+	}
+#ifdef __linux__
+	fallocate( thiz->fd, 0, 0, length );
+#endif
+  }
+  return 0;
+
+ failed:
+  perror( file );
+  return -1;
+}
+
+static int outputClose( GenerateOutput* thiz ) {
+  if( thiz->fd == STDOUT_FILENO )
+	return 0;
+  int sc = 0;
+  if( fdatasync( thiz->fd ) || 
+	  (thiz->tailFd != thiz->fd && fdatasync( thiz->tailFd )) ) {
+	perror( "generate.fdatasync" );
+	sc = -1;
+  }
+  if( thiz->tailFd != thiz->fd )
+	close( thiz->tailFd );
+  close( thiz->fd );
+  return sc;
+}
+
+static int outputPwrite( GenerateOutput* thiz, const uint8_t* buf,
+						 size_t len, off_t offset ) {
+  size_t aligned = len - len % thiz->align;
+  if( aligned && pwriteFully( thiz->fd, buf, aligned, offset ) )
+	return -1;
+  if( aligned < len && pwriteFully( thiz->tailFd, buf + aligned, len - aligned,
+									offset + aligned ) )
+	return -1;
+  return 0;
+}
+
+// Keystream for blocks [first,first+count), with any header laid over
+static void fillBlocks( VFSKeystream* ks, uint64_t first, uint8_t* buf,
+						uint64_t count, GenerateOptions* options ) {
+  VFSKeystreamBlocks( ks, first, buf, count );
+  if( first == 0 && options->header ) {
+	size_t len = count * ks->blockSize;
+	if( len > options->headerSize )
+	  len = options->headerSize;
+	memcpy( buf, options->header, len );
+  }
+}
+
+static int generateSerial( VFSKeystream* ks, uint64_t length, 
+						   GenerateOptions* options,
+						   GenerateProgress* progress ) {
+  GenerateStream stream;
+  if( streamOpen( &stream, STDOUT_FILENO, options->bufferSize ) ) {
+	fprintf( stderr, "generate: Cannot allocate output buffer\n" );
+	return -1;
+  }
 
   /* 
-	 The mode of operation here is 'counter mode' aka CTR.
-	 We just set the input to a counter, starting at 0.
+	 The mode of operation here is 'counter mode' aka CTR.  The
+	 counter starts at 0.  The engine fills a whole output buffer per
+	 call, which is then written (or spliced) in one go.  A length
+	 that is not a whole number of blocks just drops the surplus of
+	 the final block.
   */
-  uint64_t i;
-  for( i = 0; i < iterations; i++ ) {
-	uint64_t* ip = (uint64_t*)input;
-	*ip = i;
-	AES128_ECB_encrypt( input, (uint8_t*)key, output );
-	write( STDOUT_FILENO, output, 16 );
+  size_t blockSize = ks->blockSize;
+  uint64_t blocks = (length + blockSize - 1) / blockSize;
+  int sc = 0;
+  uint64_t i = 0;
+  while( i < blocks ) {
+	size_t capacity;
+	uint8_t* buf = streamNext( &stream, &capacity );
+	uint64_t count = blocks - i;
+	if( count > capacity / blockSize )
+	  count = capacity / blockSize;
+	fillBlocks( ks, i, buf, count, options );
+	uint64_t len = count * blockSize;
+	if( len > length - i * blockSize )
+	  len = length - i * blockSize;
+	if( streamPut( &stream, len ) ) {
+	  perror( "generate.write" );
+	  sc = -1;
+	  break;
+	}
+	i += count;
+	progressAdd( progress, len );
+	progressReport( progress, 0 );
   }
 
-  return 0;
+  streamClose( &stream );
+  return sc;
 }
 
+/********************** Private Impl: Parallel Generation ****************/
+
+typedef struct {
+  uint8_t* data;
+  uint64_t chunk;	// which chunk this slot may hold next
+  int full;
+} GenerateSlot;
+
+typedef struct {
+  VFSKeystream* ks;
+  GenerateOptions* options;
+  uint64_t length;
+  uint64_t blocks;
+  uint64_t chunkBlocks;
+  uint64_t chunks;
+  uint64_t nextChunk;	// claimed by workers via atomic fetch-add
+  GenerateOutput* output;
+  int fd;
+  off_t base;			// output file offset of counter 0, if seekable
+  int seekable;
+  int failed;
+  GenerateProgress* progress;
+
+  // Ordered reassembly, when the output is a pipe
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  GenerateSlot* slots;
+  int slotCount;
+} GenerateJob;
+
+static uint64_t chunkBlockCount( GenerateJob* job, uint64_t chunk ) {
+  uint64_t first = chunk * job->chunkBlocks;
+  uint64_t count = job->blocks - first;
+  return count > job->chunkBlocks ? job->chunkBlocks : count;
+}
+
+// Bytes of output in a chunk, only the last can be short
+static uint64_t chunkLength( GenerateJob* job, uint64_t chunk ) {
+  uint64_t first = chunk * job->chunkBlocks * job->ks->blockSize;
+  uint64_t len = job->length - first;
+  uint64_t max = job->chunkBlocks * job->ks->blockSize;
+  return len > max ? max : len;
+}
+
+static uint8_t* chunkAlloc( GenerateJob* job ) {
+  void* p;
+  if( posix_memalign( &p, sysconf( _SC_PAGE_SIZE ),
+					  job->chunkBlocks * job->ks->blockSize ) )
+	return NULL;
+  return (uint8_t*)p;
+}
+
+static void* generateWorker( void* arg ) {
+  GenerateJob* job = (GenerateJob*)arg;
+
+  uint8_t* own = NULL;
+  if( job->seekable ) {
+	own = chunkAlloc( job );
+	if( !own ) {
+	  __atomic_store_n( &job->failed, 1, __ATOMIC_SEQ_CST );
+	  return NULL;
+	}
+  }
+
+  while( !__atomic_load_n( &job->failed, __ATOMIC_SEQ_CST ) ) {
+	uint64_t k = __atomic_fetch_add( &job->nextChunk, 1, __ATOMIC_SEQ_CST );
+	if( k >= job->chunks )
+	  break;
+	uint64_t first = k * job->chunkBlocks;
+	uint64_t count = chunkBlockCount( job, k );
+
+	if( job->seekable ) {
+	  uint64_t len = chunkLength( job, k );
+	  fillBlocks( job->ks, first, own, count, job->options );
+	  if( outputPwrite( job->output, own, len,
+						job->base + first * job->ks->blockSize ) ) {
+		perror( "generate.pwrite" );
+		__atomic_store_n( &job->failed, 1, __ATOMIC_SEQ_CST );
+	  }
+	  progressAdd( job->progress, len );
+	  continue;
+	}
+
+	// Wait for the writer to drain the slot's previous chunk
+	GenerateSlot* slot = job->slots + (k % job->slotCount);
+	pthread_mutex_lock( &job->lock );
+	while( !job->failed && (slot->full || slot->chunk != k) )
+	  pthread_cond_wait( &job->cond, &job->lock );
+	pthread_mutex_unlock( &job->lock );
+	if( job->failed )
+	  break;
+
+	fillBlocks( job->ks, first, slot->data, count, job->options );
+
+	pthread_mutex_lock( &job->lock );
+	slot->full = 1;
+	pthread_cond_broadcast( &job->cond );
+	pthread_mutex_unlock( &job->lock );
+  }
+
+  free( own );
+  return NULL;
+}
+
+// The main thread's part in the pipe case: write out chunks in order
+static void generateWriter( GenerateJob* job ) {
+  uint64_t k;
+  for( k = 0; k < job->chunks; k++ ) {
+	GenerateSlot* slot = job->slots + (k % job->slotCount);
+	pthread_mutex_lock( &job->lock );
+	while( !job->failed && !(slot->full && slot->chunk == k) )
+	  pthread_cond_wait( &job->cond, &job->lock );
+	int failed = job->failed;
+	pthread_mutex_unlock( &job->lock );
+	if( failed )
+	  return;
+
+	uint64_t len = chunkLength( job, k );
+	if( writeFully( job->fd, slot->data, len ) ) {
+	  perror( "generate.write" );
+	  pthread_mutex_lock( &job->lock );
+	  job->failed = 1;
+	  pthread_cond_broadcast( &job->cond );
+	  pthread_mutex_unlock( &job->lock );
+	  return;
+	}
+	progressAdd( job->progress, len );
+	progressReport( job->progress, 0 );
+
+	pthread_mutex_lock( &job->lock );
+	slot->full = 0;
+	slot->chunk += job->slotCount;
+	pthread_cond_broadcast( &job->cond );
+	pthread_mutex_unlock( &job->lock );
+  }
+}
+
+static int generateParallel( VFSKeystream* ks, uint64_t length,
+							 GenerateOutput* output,
+							 GenerateOptions* options,
+							 GenerateProgress* progress ) {
+
+  int threads = options->threads;
+
+  GenerateJob job;
+  job.ks = ks;
+  job.options = options;
+  job.length = length;
+  job.blocks = (length + ks->blockSize - 1) / ks->blockSize;
+  job.chunkBlocks = options->bufferSize / ks->blockSize;
+  job.chunks = (job.blocks + job.chunkBlocks - 1) / job.chunkBlocks;
+  job.nextChunk = 0;
+  job.output = output;
+  job.fd = output->fd;
+  job.failed = 0;
+  job.progress = progress;
+  job.slots = NULL;
+  job.slotCount = 0;
+  pthread_mutex_init( &job.lock, NULL );
+  pthread_cond_init( &job.cond, NULL );
+
+  /*
+	Positional writes need a file or device we can seek on.  Anything
+	else (pipe, socket, tty) gets the ordered reassembly, as does an
+	O_APPEND file (e.g. >> redirection), on which pwrite ignores its
+	offset and appends, so chunks would land in completion order.
+  */
+  struct stat st;
+  job.base = lseek( job.fd, 0, SEEK_CUR );
+  int flags = fcntl( job.fd, F_GETFL );
+  job.seekable = job.base >= 0 && fstat( job.fd, &st ) == 0 &&
+	(S_ISREG( st.st_mode ) || S_ISBLK( st.st_mode )) &&
+	flags >= 0 && !(flags & O_APPEND);
+
+  int sc = 0;
+  int i;
+  if( !job.seekable ) {
+	// Two slots per worker, so workers rarely wait on the writer
+	job.slotCount = 2 * threads;
+	job.slots = calloc( job.slotCount, sizeof( GenerateSlot ) );
+	if( !job.slots )
+	  return -1;
+	for( i = 0; i < job.slotCount; i++ ) {
+	  job.slots[i].chunk = i;
+	  job.slots[i].data = chunkAlloc( &job );
+	  if( !job.slots[i].data )
+		sc = -1;
+	}
+  }
+
+  pthread_t* tids = calloc( threads, sizeof( pthread_t ) );
+  int started = 0;
+  if( tids && !sc ) {
+	for( started = 0; started < threads; started++ ) {
+	  if( pthread_create( tids + started, NULL, generateWorker, &job ) )
+		break;
+	}
+  }
+  if( started == 0 ) {
+	fprintf( stderr, "generate: Cannot start worker threads\n" );
+	job.failed = 1;
+  }
+
+  if( started ) {
+	if( !job.seekable ) {
+	  generateWriter( &job );
+	} else if( progress->verbose ) {
+	  while( !__atomic_load_n( &job.failed, __ATOMIC_SEQ_CST ) &&
+			 __atomic_load_n( &progress->done, __ATOMIC_RELAXED ) <
+			 progress->total ) {
+		usleep( 250000 );
+		progressReport( progress, 0 );
+	  }
+	}
+  }
+
+  for( i = 0; i < started; i++ )
+	pthread_join( tids[i], NULL );
+  free( tids );
+
+  // Leave stdout positioned as a sequential write would have
+  if( job.seekable && !job.failed )
+	lseek( job.fd, job.base + job.length, SEEK_SET );
+
+  if( job.slots ) {
+	for( i = 0; i < job.slotCount; i++ )
+	  free( job.slots[i].data );
+	free( job.slots );
+  }
+  pthread_cond_destroy( &job.cond );
+  pthread_mutex_destroy( &job.lock );
+
+  return job.failed ? -1 : 0;
+}
+
+/*
+  Sizes may be given in bytes, or with a K, M or G suffix (powers of 2).
+  @return 0 on a malformed size.
+*/
+static uint64_t parseSize( char* s ) {
+  char* end;
+  uint64_t result = strtoull( s, &end, 0 );
+  switch( *end ) {
+  case 'k':
+  case 'K':
+	result <<= 10;
+	end++;
+	break;
+  case 'm':
+  case 'M':
+	result <<= 20;
+	end++;
+	break;
+  case 'g':
+  case 'G':
+	result <<= 30;
+	end++;
+	break;
+  default:
+	break;
+  }
+  return *end ? 0 : result;
+}
 
 static int hexDecode( uint8_t* encoded, int len, uint8_t* result ) {
 
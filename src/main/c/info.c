@@ -33,10 +33,12 @@
  */
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
 #include "vernamfs/vernamfs.h"
 
 static CommandOption e = 
@@ -94,31 +96,36 @@ int infoArgs( int argc, char* argv[] ) {
 
 int info( char* file, int expert ) {
 
-  struct stat st;
-  int sc = stat( file, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", file );
+  uint64_t length;
+  if( VFSDeviceSize( file, &length ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
 	return -1;
   }
 
-  if( st.st_size < sizeof( VFSHeader ) ) {
+  if( length < sizeof( VFSHeader ) ) {
 	fprintf( stderr, "%s: Too small to contain header\n", file );
 	return -1;
   }
   
-  VFS vfs;
-  // NOT using mmapped-based VFSLoad, so set backing accordingly
-  vfs.backing = 0;
-
-  VFSHeader* h = &vfs.header;
+  /*
+	NOT using an mmap, just read the header, plus room for any shard
+	headers and cursor slots, and load from that.
+  */
+  char buf[VERNAMFS_SLOTSOFFSET + 
+		   (VERNAMFS_MAXSHARDS + 1) * 2 * sizeof( VFSCursorSlot )];
+  memset( buf, 0, sizeof( buf ) );
   int fd = open( file, O_RDONLY );
-  int nin = read( fd, h, sizeof( VFSHeader ) );
-  if( nin != sizeof( VFSHeader ) ){
+  int nin = read( fd, buf, sizeof( buf ) );
+  if( nin < (int)sizeof( VFSHeader ) ){
 	perror( "infoFile.read" );
 	close( fd );
 	return -1;
   }
 
+  VFS vfs;
+  VFSLoad( &vfs, buf );
+  VFSHeader* h = &vfs.header;
+
   if( h->magic != VERNAMFS_MAGIC ) {
 	fprintf( stderr, "%s: Invalid magic number\n", file );
   } else {
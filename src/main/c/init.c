@@ -38,6 +38,8 @@
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
+#include "vernamfs/keystream.h"
 #include "vernamfs/vernamfs.h"
 
 /**
@@ -71,11 +73,27 @@ static CommandOption l =
   { .id = "l", 
 	.text = "Maximum length of file name.  Defaults to 64-17=47. Minimum is 32-17=15.\n    Maximum is 128-17=111." };
 
+static CommandOption a = 
+  { .id = "a", 
+	.text = "Alignment of each file's content, in bytes: a power of 2, from 1 up to\n    the page size (the default).  Small values let many small files share\n    a page of pad." };
+
+static CommandOption c = 
+  { .id = "c", 
+	.text = "Record the keystream the pad was generated with, aes128 or chacha20.\n    Lets recover regenerate the vault pad from just the key." };
+
+static CommandOption sOpt = 
+  { .id = "s", 
+	.text = "Split the VernamFS into this many shards, each with its own table and\n    data area, so that concurrent writers never contend.  Maximum 32." };
+
+static CommandOption x = 
+  { .id = "x", 
+	.text = "Write files as chains of extents, so that open files stream straight to\n    the pad, with no more than one extent (64KB) each held in memory." };
+
 static CommandOption e = 
   { .id = "e", 
 	.text = "Expert mode.  Prints out entire VFS header." };
 
-static CommandOption* options[] = { &e, &f, &l, NULL };
+static CommandOption* options[] = { &a, &c, &e, &f, &l, &sOpt, &x, NULL };
 
 static char example1[] = 
   "$ dd if=/dev/urandom bs=1M count=1024 of=OTP.1GB";
@@ -84,7 +102,14 @@ static char example2[] = "$ vernamfs init OTP.1GB 128";
 
 static char example3[] = "$ vernamfs init -f -l 128 OTP.1GB 1024";
 
-static char* examples[] = { example1, example2, example3, NULL };
+static char example4[] = "$ vernamfs init -s 4 OTP.1GB 1024";
+
+static char example5[] = "$ vernamfs init -x OTP.1GB 1024";
+
+static char example6[] = "$ vernamfs init -a 64 OTP.1GB 100000";
+
+static char* examples[] = { example1, example2, example3, example4, 
+							example5, example6, NULL };
 
 static CommandHelp help = {
   .summary = "Initialise a one-time pad file with a VernamFS header",
@@ -107,10 +132,31 @@ int initArgs( int argc, char* argv[] ) {
   int maxFileNameLength = VERNAMFS_NAMELENGTHDEFAULT;
   char* file = NULL;
   int maxFiles = 0;
+  int padType = VERNAMFS_PADTYPE_UNKNOWN;
+  int shards = 1;
+  int chained = 0;
+  uint64_t alignment = 0;
+  long pageSize = sysconf( _SC_PAGE_SIZE );
 
   int c;
-  while( (c = getopt( argc, argv, "efl:") ) != -1 ) {
+  while( (c = getopt( argc, argv, "a:c:efl:s:x") ) != -1 ) {
 	switch( c ) {
+	case 'a':
+	  alignment = atol( optarg );
+	  if( alignment < 1 || alignment > pageSize || 
+		  (alignment & (alignment - 1)) ) {
+		fprintf( stderr, "%s: Alignment %s not a power of 2 from 1 to %ld.\n",
+				 argv[0], optarg, pageSize );
+		return -1;
+	  }
+	  break;
+	case 'c':
+	  padType = VFSKeystreamType( optarg );
+	  if( padType < 0 ) {
+		fprintf( stderr, "%s: Unknown keystream: %s\n", argv[0], optarg );
+		return -1;
+	  }
+	  break;
 	case 'e':
 	  expert = 1;
 	  break;
@@ -120,6 +166,17 @@ int initArgs( int argc, char* argv[] ) {
 	case 'l':
 	  maxFileNameLength = atoi( optarg );
 	  break;
+	case 's':
+	  shards = atoi( optarg );
+	  if( shards < 1 || shards > VERNAMFS_MAXSHARDS ) {
+		fprintf( stderr, "%s: Shard count %d out of range.\n", argv[0], 
+				 shards );
+		return -1;
+	  }
+	  break;
+	case 'x':
+	  chained = 1;
+	  break;
 	default:
 	  break;
 	}
@@ -137,25 +194,31 @@ int initArgs( int argc, char* argv[] ) {
 	return -1;
   }
 
-  return init( file, maxFiles, maxFileNameLength, force, expert );
+  return init( file, maxFiles, maxFileNameLength, padType, alignment, 
+			   shards, chained, force, expert );
 }
 
-int init( char* file, int maxFiles, int maxFileNameLength,
-		  int force, int expert ) {
+int init( char* file, int maxFiles, int maxFileNameLength, int padType,
+		  uint64_t alignment, int shards, int chained, int force, 
+		  int expert ) {
 
-  struct stat st;
-  int sc = stat( file, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file.\n", file );
+  uint64_t length;
+  if( VFSDeviceSize( file, &length ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device.\n", file );
 	return -1;
   }
   
   VFS vfs;
-  sc = VFSInit( &vfs, st.st_size, maxFiles, maxFileNameLength );
+  int sc = shards > 1 ?
+	VFSInitSharded( &vfs, length, maxFiles, maxFileNameLength, alignment,
+					shards ) :
+	VFSInit( &vfs, length, maxFiles, maxFileNameLength, alignment );
   if( sc ) {
 	fprintf( stderr, "%s:  Device too small.\n", file );
 	return sc;
   }
+  VFSSetPadType( &vfs, padType );
+  VFSSetChained( &vfs, chained );
 
   int fd = open( file, O_RDWR );
   uint64_t b8 = 0;
@@ -171,9 +234,14 @@ int init( char* file, int maxFiles, int maxFileNameLength,
 	return -1;
   }
   
+  // Header and any shard headers, as VFSStore would lay them out
+  int len = VFSHeaderExtent( &vfs );
+  char* buf = calloc( 1, len );
+  vfs.backing = buf;
+  VFSStore( &vfs );
   lseek( fd, 0, SEEK_SET );
-  int len = sizeof( VFSHeader );
-  int nout = write( fd, &vfs.header, len );
+  int nout = write( fd, buf, len );
+  free( buf );
   if( nout != len ) {
 	perror( "init.write" );
 	close( fd );
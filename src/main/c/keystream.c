@@ -0,0 +1,122 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include "vernamfs/keystream.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Dispatch to the AES-128 CTR or ChaCha20 engine.  See keystream.h.
+ */
+
+typedef struct {
+  int type;
+  const char* name;
+  size_t keySize;
+} KeystreamInfo;
+
+static const KeystreamInfo infos[] = {
+  { VERNAMFS_PADTYPE_AES128CTR, "aes128",   16 },
+  { VERNAMFS_PADTYPE_CHACHA20,  "chacha20", CHACHA20_KEYSIZE },
+  { 0, NULL, 0 }
+};
+
+static const KeystreamInfo* locate( int type ) {
+  const KeystreamInfo* i;
+  for( i = infos; i->name; i++ )
+	if( i->type == type )
+	  return i;
+  return NULL;
+}
+
+int VFSKeystreamType( const char* name ) {
+  const KeystreamInfo* i;
+  for( i = infos; i->name; i++ )
+	if( strcmp( i->name, name ) == 0 )
+	  return i->type;
+  return -1;
+}
+
+const char* VFSKeystreamName( int type ) {
+  const KeystreamInfo* i = locate( type );
+  return i ? i->name : "unknown";
+}
+
+size_t VFSKeystreamKeySize( int type ) {
+  const KeystreamInfo* i = locate( type );
+  return i ? i->keySize : 0;
+}
+
+int VFSKeystreamTypeForKeySize( size_t keySize ) {
+  const KeystreamInfo* i;
+  for( i = infos; i->name; i++ )
+	if( i->keySize == keySize )
+	  return i->type;
+  return -1;
+}
+
+int VFSKeystreamInit( VFSKeystream* thiz, int type, const uint8_t* key ) {
+  thiz->type = type;
+  switch( type ) {
+  case VERNAMFS_PADTYPE_AES128CTR:
+	AES128CTRInit( &thiz->aes, key );
+	thiz->blockSize = AES128CTR_BLOCKSIZE;
+	return 0;
+  case VERNAMFS_PADTYPE_CHACHA20:
+	ChaCha20Init( &thiz->chacha, key );
+	thiz->blockSize = CHACHA20_BLOCKSIZE;
+	return 0;
+  default:
+	return -1;
+  }
+}
+
+void VFSKeystreamBlocks( const VFSKeystream* thiz, uint64_t counter,
+						 uint8_t* out, size_t count ) {
+  if( thiz->type == VERNAMFS_PADTYPE_CHACHA20 )
+	ChaCha20Blocks( &thiz->chacha, counter, out, count );
+  else
+	AES128CTRBlocks( &thiz->aes, counter, out, count );
+}
+
+void VFSKeystreamStream( const VFSKeystream* thiz, uint64_t offset,
+						 uint8_t* out, size_t len ) {
+  if( thiz->type == VERNAMFS_PADTYPE_CHACHA20 )
+	ChaCha20Stream( &thiz->chacha, offset, out, len );
+  else
+	AES128CTRStream( &thiz->aes, offset, out, len );
+}
+
+// eof
@@ -0,0 +1,325 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
+#include "vernamfs/engine.h"
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * The 'log' command: a record log (see VFSLog) fed from standard
+ * input, one record per line.  For producers writing many small
+ * records, e.g. telemetry, where a file per record, via the mount,
+ * would cost a table slot and a page of pad each.
+ *
+ * Records accumulate in one segment, committed to the table every -b
+ * bytes, or -t seconds after its first record, whichever comes first,
+ * and at end of input or on SIGINT/SIGTERM.  Within a segment, records
+ * reach the pad -c bytes at a time.  Each segment is an entry
+ * of the log's name, so vls lists them, and recover (or vcat) writes
+ * their records back out, one per line, to that one file.
+ *
+ * The log writes the pad directly, so must not run while that pad is
+ * mounted, nor alongside another log on it.  Both lock the pad
+ * (flock), so the second to start is refused.
+ *
+ * remote$ sensor | vernamfs log -t 60 OTP /sensor.log
+ */
+
+// Longer lines are split into several records
+#define LOGLINEMAX (1 << 16)
+
+static CommandOption b = 
+  { .id = "b", 
+	.text = "Commit a segment once it holds this many bytes of records.\n    Defaults to 64K." };
+
+static CommandOption t = 
+  { .id = "t", 
+	.text = "Commit a segment this many seconds after its first record.\n    Defaults to 10.  0 means on size (or end of input) only." };
+
+static CommandOption c = 
+  { .id = "c", 
+	.text = "Write-combining size: records reach the pad in aligned chunks of this\n    many bytes, e.g. the flash erase block size.  A power of 2, 4096 to\n    67108864.  Defaults to 65536." };
+
+static CommandOption* options[] = { &b, &t, &c, NULL };
+
+static char example1[] = 
+  "$ sensor | vernamfs log OTP /sensor.log";
+
+static char example2[] = 
+  "$ tail -F /var/log/messages | vernamfs log -t 60 -b 1000000 OTP /messages";
+
+static char example3[] = 
+  "vault$ vernamfs recover OTP.R OTP.V data; cat data/sensor.log";
+
+static char* examples[] = { example1, example2, example3, NULL };
+
+static CommandHelp help = {
+  .summary = "Append records, one per input line, to a log on the pad",
+  .synopsis = "[<options>] OTPFile logName",
+  .description = "Read lines from standard input, writing each as a record straight onto\n  the pad.  Records share one table entry per segment, committed by size or\n  time, so cost no table slot or padding each.  Not to be used on a mounted\n  pad.",
+  .options = options,
+  .examples = examples
+};
+
+Command logCmd = {
+  .name = "log",
+  .help = &help,
+  .invoke = logArgs
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onSignal( int sig ) {
+  stopping = 1;
+}
+
+int logArgs( int argc, char* argv[] ) {
+
+  uint64_t commitBytes = 1 << 16;
+  int commitSecs = 10;
+  uint64_t combineSize = 0;
+  VFS probe;
+
+  int c;
+  while( (c = getopt( argc, argv, "b:t:c:") ) != -1 ) {
+	switch( c ) {
+	case 'b':
+	  commitBytes = strtoull( optarg, NULL, 0 );
+	  if( commitBytes == 0 ) {
+		fprintf( stderr, "%s: Bad commit size: %s\n", argv[0], optarg );
+		return -1;
+	  }
+	  break;
+	case 't':
+	  commitSecs = atoi( optarg );
+	  break;
+	case 'c':
+	  combineSize = strtoull( optarg, NULL, 0 );
+	  if( combineSize == 0 || VFSSetCombineSize( &probe, combineSize ) ) {
+		fprintf( stderr, "%s: Bad combine size: %s\n", argv[0], optarg );
+		return -1;
+	  }
+	  break;
+	default:
+	  break;
+	}
+  }
+
+  if( optind+2 > argc ) {
+	commandHelp( &logCmd );
+	return -1;
+  }
+
+  return logRecords( argv[optind], argv[optind+1], commitBytes, commitSecs,
+					 combineSize );
+}
+
+static int appendRecord( VFSLog* log, const void* record, uint32_t length ) {
+  int sc = VFSLogAppend( log, record, length );
+  if( sc )
+	fprintf( stderr, "Log full: %s\n", strerror( -sc ) );
+  return sc;
+}
+
+int logRecords( char* file, char* name, uint64_t commitBytes, int commitSecs,
+				uint64_t combineSize ) {
+
+  uint64_t deviceLength;
+  if( VFSDeviceSize( file, &deviceLength ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
+	return -1;
+  }
+
+  /*
+	As for mount: only the header mapped here, the log written through
+	an engine's windows, so the pad may outgrow the address space.
+  */
+  size_t length = deviceLength < VERNAMFS_HEADERMAPSIZE ? 
+	deviceLength : VERNAMFS_HEADERMAPSIZE;
+
+  int fd = open( file, O_RDWR );
+  if( fd < 0 ) {
+	fprintf( stderr, "%s: Not read/writable\n", file );
+	return -1;
+  }
+
+  /*
+	Held while we run, for this fd stays open throughout.  A mount, or
+	another log, keeps its own cursors, and whichever stored its header
+	last would roll the other's back, so reusing pad.
+  */
+  if( flock( fd, LOCK_EX|LOCK_NB ) ) {
+	fprintf( stderr, "%s: In use, by a mount or log\n", file );
+	close( fd );
+	return -1;
+  }
+  
+  void* addr = mmap( NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+  if( addr == MAP_FAILED ) {
+	fprintf( stderr, "%s: MMap failed\n", file );
+	close( fd );
+	return -1;
+  }
+
+  VFS vfs;
+  VFSLoad( &vfs, addr );
+  if( vfs.header.magic != VERNAMFS_MAGIC ) {
+	fprintf( stderr, 
+			 "Magic number missing. Initialize with 'vernamfs init %s'.\n", 
+			 file );
+	munmap( addr, length );
+	close( fd );
+	return -1;
+  }
+
+  // One window for the log, one for the table
+  VFSEngine* engine = VFSEngineOpen( VERNAMFS_ENGINE_MMAP, file, 
+									 deviceLength, 0, 2 );
+  if( !engine ) {
+	fprintf( stderr, "%s: Cannot open for engine %s\n", file,
+			 VFSEngineName( VERNAMFS_ENGINE_MMAP ) );
+	munmap( addr, length );
+	close( fd );
+	return -1;
+  }
+  VFSSetEngine( &vfs, engine );
+  VFSSetCombineSize( &vfs, combineSize );
+
+  // On a sharded pad, one shard, chosen as fuse.c would
+  VFS shard;
+  VFSShard( &vfs, getpid() % VFSShardCount( &vfs ), &shard );
+
+  VFSLog* log;
+  int sc = VFSLogOpen( &shard, name, commitBytes, &log );
+  if( sc ) {
+	fprintf( stderr, "%s: %s\n", name, strerror( -sc ) );
+	VFSEngineClose( engine );
+	munmap( addr, length );
+	close( fd );
+	return -1;
+  }
+
+  // No SA_RESTART, so a signal wakes the poll below
+  struct sigaction sa;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = onSignal;
+  sigaction( SIGINT, &sa, NULL );
+  sigaction( SIGTERM, &sa, NULL );
+
+  char* line = malloc( LOGLINEMAX );
+  if( !line ) {
+	fprintf( stderr, "%s: Out of memory\n", name );
+	VFSLogClose( log );
+	VFSEngineClose( engine );
+	munmap( addr, length );
+	close( fd );
+	return -1;
+  }
+  size_t have = 0;
+  time_t deadline = 0;
+  sc = 0;
+  while( !stopping && sc == 0 ) {
+
+	// Wait for input, or until the pending segment is due
+	int timeout = -1;
+	if( commitSecs > 0 && log->length > 0 ) {
+	  time_t now = time( NULL );
+	  timeout = deadline > now ? (deadline - now) * 1000 : 0;
+	}
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	int n = poll( &pfd, 1, timeout );
+	if( n < 0 && errno != EINTR )
+	  break;
+	if( n == 0 ) {
+	  VFSLogCommit( log );
+	  continue;
+	}
+	if( n < 0 )
+	  continue;
+
+	ssize_t nin = read( STDIN_FILENO, line + have, LOGLINEMAX - have );
+	if( nin <= 0 )
+	  break;
+	uint64_t before = log->length;
+	uint64_t segment = log->start;
+	have += nin;
+
+	// Every complete line a record, less its newline
+	char* cp = line;
+	char* nl;
+	while( sc == 0 && (nl = memchr( cp, '\n', have - (cp - line) )) ) {
+	  sc = appendRecord( log, cp, nl - cp );
+	  cp = nl + 1;
+	}
+	have -= cp - line;
+	memmove( line, cp, have );
+	if( sc == 0 && have == LOGLINEMAX ) {
+	  sc = appendRecord( log, line, have );
+	  have = 0;
+	}
+
+	// A segment begun by these records is due commitSecs from now
+	if( log->length > 0 && (before == 0 || log->start != segment) )
+	  deadline = time( NULL ) + commitSecs;
+  }
+
+  // Any unterminated last line is a record too
+  if( sc == 0 && have > 0 )
+	appendRecord( log, line, have );
+  free( line );
+
+  VFSLogClose( log );
+  VFSEngineClose( engine );
+  munmap( addr, length );
+  close( fd );
+  return sc ? -1 : 0;
+}
+
+// eof
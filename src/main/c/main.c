@@ -86,9 +86,18 @@
  *
  * remote$ fusermount -u foo
  *
- * NB: Single-threaded FUSE operation is REQUIRED, and is set
- * internally.  Our VFS cannot work in a multi-threaded FUSE loop.
- * All access must be serialized.
+ * The FUSE loop is multi-threaded, so several files may be written
+ * at once: each open file is held in memory until closed, then given
+ * its own table entry and data extent.  A -s fuse option still forces
+ * single-threadedness if wanted.
+ *
+ * LOG
+ * ---
+ * log - Append records, one per line of stdin, to a record log on the
+ * OTP, for many small writes without a file (and table slot) each.
+ * An alternative to mount for telemetry, e.g.
+ *
+ * remote$ sensor | vernamfs log /path/to/my/otp /sensor.log
  *
  * INIT
  * ----
@@ -130,6 +139,10 @@
 
 VFS Global;
 
+VFS* GlobalShards = &Global;
+
+int GlobalShardCount = 1;
+
 int main( int argc, char* argv[] ) {
 
   cmds = (Command**)calloc( 32, sizeof( Command* ) );
@@ -144,6 +157,8 @@ int main( int argc, char* argv[] ) {
   cmds[N++] = &infoCmd;
 
   cmds[N++] = &mountCmd;
+
+  cmds[N++] = &logCmd;
   
   cmds[N++] = &rlsCmd;
 
@@ -37,18 +37,46 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <fuse.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
+#include "vernamfs/engine.h"
 #include "vernamfs/vernamfs.h"
 
+static CommandOption b = 
+  { .id = "b", 
+	.text = "Before OTPFile.  End any file reaching this many bytes, carrying on\n    in a new file, name.0001, name.0002, etc.  K/M/G suffixes allowed." };
+static CommandOption t = 
+  { .id = "t", 
+	.text = "Before OTPFile.  As -b, but ending files this many seconds old." };
+static CommandOption c = 
+  { .id = "c", 
+	.text = "Before OTPFile.  Write-combining size: chained files (init -x) reach\n    the pad in extents of this many bytes, e.g. the flash erase block size.\n    A power of 2, 4K to 64M, K/M suffixes allowed.  Defaults to 64K." };
 static CommandOption f = { .id = "f", .text = "Fuse mount in foreground." };
 static CommandOption d = { .id = "d", .text = "Fuse mount in debug mode." };
 
-static CommandOption* options[] = { &f, &d, NULL };
+static CommandOption p = 
+  { .id = "p", 
+	.text = "Before OTPFile.  Prefetch: have the pad read in this many bytes ahead\n    of where files are being written, so writes do not wait on the device.\n    K/M/G suffixes allowed." };
+static CommandOption q = 
+  { .id = "q", 
+	.text = "Before OTPFile.  Pipeline: a closing file is queued, up to this many\n    deep, to be written to the pad in the background, so close returns at\n    once.  A close finding the queue full waits.  Files are still written\n    in closing order." };
+static CommandOption y = 
+  { .id = "y", 
+	.text = "Before OTPFile.  Durability: lazy (the default), leaving the kernel to\n    write back; file, syncing each closed file's data, then table entry,\n    then header; or group[,N[,T]], syncing likewise every N closed files\n    (default 64) and every T msecs (default 100).  Costs reported at unmount.\n    file cannot be combined with -q." };
+static CommandOption w = 
+  { .id = "w", 
+	.text = "Before OTPFile.  Window size: map the pad this many bytes at a time, as\n    writes reach it, so that pads may exceed the address space, e.g. 64G\n    on 32-bit units.  A power of 2, a page to 1G, K/M/G suffixes allowed,\n    or 'all' to map the whole pad at once.  Defaults to 16M.  mmap only." };
+static CommandOption e = 
+  { .id = "e", 
+	.text = "Before OTPFile.  I/O engine: mmap (the default), mapping windows of the\n    pad, see -w; pwrite, buffered reads and writes; or direct, O_DIRECT\n    reads and writes of aligned blocks, bypassing the page cache.  Try\n    each on the medium at hand, e.g. mmap on tmpfs, direct on SD cards." };
+static CommandOption* options[] = { &b, &t, &c, &p, &q, &y, &w, &e, &f, &d, 
+									NULL };
 
 static char example1[] = 
   "$ dd if=/dev/urandom bs=1M count=1 of=OTP.1GB; mkdir mnt";
@@ -61,14 +89,25 @@ static char example4[] = "$ cp myFile mnt/; echo foobar > mnt/foo";
 
 static char example5[] = "$ fusermount -u mnt";
 
-static char* examples[] = { example1, example2, example3, 
-							example4, example5, NULL };
+static char example6[] = "$ vernamfs mount -b 64M -t 3600 OTP.1GB mnt";
+
+static char example7[] = "$ vernamfs mount -c 4M -p 16M -q 8 OTP.1GB mnt";
+
+static char example8[] = "$ vernamfs mount -y group,32,250 OTP.1GB mnt";
+
+static char example9[] = "$ vernamfs mount -w 4M /dev/mmcblk0p2 mnt";
+
+static char example10[] = "$ vernamfs mount -e direct /dev/mmcblk0p2 mnt";
+
+static char* examples[] = { example1, example2, example3, example4, 
+							example5, example6, example7, example8, 
+							example9, example10, NULL };
 
 
 static CommandHelp help = {
   .summary = "Mount a VernamFS device/file",
-  .synopsis = "OTPFile mountPoint [<fuseOptions>]",
-  .description = "Mount a mountPoint, with a one-time pad file as the underlying storage.\n  The mount uses FUSE, in single-threaded mode. Any data written to the mount\n  point is encrypted via XOR'ing with the pad contents.  The filesystem is\n  write-only!",
+  .synopsis = "[<options>] OTPFile mountPoint [<fuseOptions>]",
+  .description = "Mount a mountPoint, with a one-time pad file as the underlying storage.\n  The mount uses FUSE, in multi-threaded mode, so several files may be open\n  for writing at once.  Each is held in memory until closed, when it is\n  allocated its place on the pad.  Any data written to the mount\n  point is encrypted via XOR'ing with the pad contents.  The filesystem is\n  write-only!  With -b or -t, long-running writers' files are ended and\n  continued transparently, so that each part is recoverable in-mission.",
   .options = options,
   .examples = examples
 };
@@ -79,32 +118,190 @@ Command mountCmd = {
   .invoke = mountArgs
 };
 
+/*
+  A byte count, with optional K, M or G suffix.  0 if malformed.
+*/
+static uint64_t parseBytes( char* s ) {
+  char* end;
+  uint64_t result = strtoull( s, &end, 10 );
+  switch( *end ) {
+  case 'K': case 'k':
+	result <<= 10;
+	end++;
+	break;
+  case 'M': case 'm':
+	result <<= 20;
+	end++;
+	break;
+  case 'G': case 'g':
+	result <<= 30;
+	end++;
+	break;
+  }
+  return *end ? 0 : result;
+}
+
+/*
+  lazy, file or group[,files[,msecs]], the group counts replacing
+  those given.  -1 if malformed.
+*/
+static int parseDurability( char* s, int* files, int* msecs ) {
+  if( strcmp( s, "lazy" ) == 0 )
+	return VERNAMFS_DURABILITY_LAZY;
+  if( strcmp( s, "file" ) == 0 )
+	return VERNAMFS_DURABILITY_FILE;
+  if( strncmp( s, "group", 5 ) )
+	return -1;
+  int n = 0;
+  if( s[5] == ',' )
+	n = sscanf( s + 6, "%d,%d", files, msecs );
+  else if( s[5] )
+	return -1;
+  if( n < 0 || *files < 0 || *msecs < 0 || (*files == 0 && *msecs == 0) )
+	return -1;
+  return VERNAMFS_DURABILITY_GROUP;
+}
+
 // argc, argv straight from main, NOT shifted, since fuse_main needs argv[0] ?
 int mountArgs( int argc, char* argv[] ) {
 
+  /*
+	Our own options come before the OTP file, so cannot be confused
+	with fuse's, which follow the mount point.  Not getopt, which would
+	go looking among fuse's too.
+  */
+  uint64_t rotateBytes = 0;
+  int rotateSecs = 0;
+  uint64_t combineSize = 0;
+  uint64_t prefetchBytes = 0;
+  int pipelineDepth = 0;
+  int durability = VERNAMFS_DURABILITY_LAZY;
+  int groupFiles = 64, groupMsecs = 100;
+  uint64_t windowBytes = VERNAMFS_WINDOWSIZE;
+  int engineType = VERNAMFS_ENGINE_MMAP;
+  int ours = 0;
+  while( 2 + ours + 1 < argc ) {
+	char* opt = argv[2 + ours];
+	if( strcmp( opt, "-b" ) == 0 ) {
+	  rotateBytes = parseBytes( argv[2 + ours + 1] );
+	  if( rotateBytes == 0 ) {
+		fprintf( stderr, "Bad rotation size: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-t" ) == 0 ) {
+	  rotateSecs = atoi( argv[2 + ours + 1] );
+	  if( rotateSecs <= 0 ) {
+		fprintf( stderr, "Bad rotation time: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-c" ) == 0 ) {
+	  combineSize = parseBytes( argv[2 + ours + 1] );
+	  VFS probe;
+	  if( combineSize == 0 || VFSSetCombineSize( &probe, combineSize ) ) {
+		fprintf( stderr, "Bad combine size: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-p" ) == 0 ) {
+	  prefetchBytes = parseBytes( argv[2 + ours + 1] );
+	  if( prefetchBytes == 0 ) {
+		fprintf( stderr, "Bad prefetch size: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-q" ) == 0 ) {
+	  pipelineDepth = atoi( argv[2 + ours + 1] );
+	  if( pipelineDepth <= 0 ) {
+		fprintf( stderr, "Bad queue depth: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-y" ) == 0 ) {
+	  durability = parseDurability( argv[2 + ours + 1], 
+									&groupFiles, &groupMsecs );
+	  if( durability < 0 ) {
+		fprintf( stderr, "Bad durability: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-w" ) == 0 ) {
+	  char* arg = argv[2 + ours + 1];
+	  windowBytes = strcmp( arg, "all" ) ? parseBytes( arg ) : 0;
+	  if( strcmp( arg, "all" ) && 
+		  (windowBytes == 0 || windowBytes & (windowBytes - 1) ||
+		   windowBytes < (uint64_t)sysconf( _SC_PAGE_SIZE ) ||
+		   windowBytes > VERNAMFS_MAXWINDOWSIZE) ) {
+		fprintf( stderr, "Bad window size: %s\n", arg );
+		return -1;
+	  }
+	} else if( strcmp( opt, "-e" ) == 0 ) {
+	  engineType = VFSEngineType( argv[2 + ours + 1] );
+	  if( engineType < 0 ) {
+		fprintf( stderr, "Bad engine: %s\n", argv[2 + ours + 1] );
+		return -1;
+	  }
+	} else {
+	  break;
+	}
+	ours += 2;
+  }
+
+  /*
+	Pipelined, a close returns before its file is written, let alone
+	synced, which is just what -y file promises it will not.
+  */
+  if( durability == VERNAMFS_DURABILITY_FILE && pipelineDepth ) {
+	fprintf( stderr, "-y file: not with -q\n" );
+	return -1;
+  }
+
+  if( windowBytes == 0 && engineType != VERNAMFS_ENGINE_MMAP ) {
+	fprintf( stderr, "-w all: mmap engine only\n" );
+	return -1;
+  }
+
   /*
 	Must be 4+, since (1) progName, (2) 'mount', (3) our OTP file and 
 	(4) a fuse mount point. 5+ would be any fuseOptions
   */
-  if( argc < 4 ) {
+  if( argc - ours < 4 ) {
 	commandHelp( &mountCmd );
 	return -1;
   }
 
-  char* file = argv[2];
-  struct stat st;
-  int sc = stat( file, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", file );
+  char* file = argv[2 + ours];
+  uint64_t deviceLength;
+  if( VFSDeviceSize( file, &deviceLength ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
+	return -1;
+  }
+
+  /*
+	Through an engine (see VFSSetEngine), only the header is mapped
+	here, the rest reached as files are written, so the pad may
+	outgrow the address space.  Else the whole pad, as before engines.
+  */
+  uint64_t mapLength = deviceLength;
+  if( windowBytes && mapLength > VERNAMFS_HEADERMAPSIZE )
+	mapLength = VERNAMFS_HEADERMAPSIZE;
+  size_t length = mapLength;
+  if( length != mapLength ) {
+	fprintf( stderr, "%s: Too large to map whole, see -w\n", file );
 	return -1;
   }
-  size_t length = st.st_size;
 
   int fd = open( file, O_RDWR );
   if( fd < 0 ) {
 	fprintf( stderr, "%s: Not read/writable\n", file );
 	return -1;
   }
+
+  /*
+	Held for the life of the mount, for this fd stays open throughout.
+	A log, or another mount, keeps its own cursors, and whichever stored
+	its header last would roll the other's back, so reusing pad.
+  */
+  if( flock( fd, LOCK_EX|LOCK_NB ) ) {
+	fprintf( stderr, "%s: In use, by a mount or log\n", file );
+	close( fd );
+	return -1;
+  }
   
   void* addr = mmap( NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
   if( addr == MAP_FAILED ) {
@@ -114,6 +311,7 @@ int mountArgs( int argc, char* argv[] ) {
   }
   
   VFSLoad( &Global, addr );
+  int i;
 
   // If this backing file/device not VFS-initialized, bail
   if( Global.header.magic != VERNAMFS_MAGIC ) {
@@ -125,27 +323,62 @@ int mountArgs( int argc, char* argv[] ) {
 	return -1;
   }
 
+  // Two mmap windows per shard, one for each cursor, plus two spare
+  if( windowBytes ) {
+	VFSEngine* engine = VFSEngineOpen( engineType, file, deviceLength, 
+									   windowBytes, 
+									   2 * VFSShardCount( &Global ) + 2 );
+	if( !engine ) {
+	  fprintf( stderr, "%s: Cannot open for engine %s\n", file, 
+			   VFSEngineName( engineType ) );
+	  munmap( addr, length );
+	  close( fd );
+	  return -1;
+	}
+	VFSSetEngine( &Global, engine );
+  }
+
   VFSReport( &Global, 1 );
+  VFSSetRotation( &Global, rotateBytes, rotateSecs );
+  VFSSetCombineSize( &Global, combineSize );
+  VFSSetPrefetch( &Global, prefetchBytes );
+  VFSSetPipeline( &Global, pipelineDepth );
+  VFSSetDurability( &Global, durability, groupFiles, groupMsecs );
+
+  // Each shard a VFS of its own, see fuse.c for which writer gets which
+  GlobalShardCount = VFSShardCount( &Global );
+  if( GlobalShardCount > 1 ) {
+	GlobalShards = calloc( GlobalShardCount, sizeof( VFS ) );
+	if( !GlobalShards ) {
+	  fprintf( stderr, "%s: Out of memory\n", file );
+	  if( Global.engine )
+		VFSEngineClose( Global.engine );
+	  munmap( addr, length );
+	  close( fd );
+	  return -1;
+	}
+	for( i = 0; i < GlobalShardCount; i++ )
+	  VFSShard( &Global, i, GlobalShards + i );
+  }
 
   /*
 	Re-org the command line so that fuse_main doesn't see our 'mount'
-	subcommand literal nor our OPTFILE.  Given that we MUST run the
-	single-threaded fuse loop, overwrite our argv[1] with the '-s'
-	option that forces single-threadedness, then shift all other args
-	(including the NULL) down one place, which eliminates our OPTFILE
-	from the args list.
+	subcommand literal, our options nor our OPTFILE, by shifting all
+	other args (including the NULL) down.  The fuse loop is left
+	multi-threaded, since open files are independent VFSFiles (see
+	fuse.c), so several writers may be busy at once. A '-s' fuse option
+	still forces single-threadedness if wanted.
 
 	Note how we are preserving argv[0].  Note quite sure WHY we need
 	to do this, but if we don't, Fuse does NOT work and we get left
 	with un-unmountable broken mount points!  Fuse is using some
 	property of argv[0] for sure.
   */
-  argv[1] = "-s";
-  int i;
-  for( i = 2; i < argc; i++ )
-	argv[i] = argv[i+1];
+  int shift = 2 + ours;
+  for( i = 1; i <= argc-shift; i++ )
+	argv[i] = argv[i+shift];
 
-  return fuse_main( argc-1, argv, &vernamfs_ops );
+  return fuse_main( argc-shift, argv, &vernamfs_ops );
 }
 
 // eof
@@ -41,6 +41,7 @@
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
 #include "vernamfs/vernamfs.h"
 #include "vernamfs/remote.h"
 
@@ -121,13 +122,12 @@ int rcatArgs( int argc, char* argv[] ) {
 
 int rcat( char* file, uint64_t offset, uint64_t length ) {
 
-  struct stat st;
-  int sc = stat( file, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", file );
+  uint64_t deviceLength;
+  if( VFSDeviceSize( file, &deviceLength ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
 	return -1;
   }
-  size_t mappedLength = st.st_size;
+  size_t mappedLength = deviceLength;
 
   int fd = open( file, O_RDONLY );
   if( fd < 0 ) {
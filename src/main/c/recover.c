@@ -33,6 +33,7 @@
  */
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -40,17 +41,36 @@
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
 #include "vernamfs/vernamfs.h"
 
+static CommandOption c = 
+  { .id = "c", 
+	.text = "With -k or -z, the keystream the pad was generated with, aes128 or\n    chacha20.  Defaults to that implied by the key length, else that\n    recorded in the remote header." };
+
+static CommandOption k = 
+  { .id = "k", 
+	.text = "Key file, hex-encoded as for generate.  The vault pad is\n    regenerated from the key, so no OTPVAULT is given." };
+
+static CommandOption z = 
+  { .id = "z", 
+	.text = "As -k, but with the all-zeros key." };
+
+static CommandOption* options[] = { &c, &k, &z, NULL };
+
 static char example1[] = 
   "$ vernamfs recover 16MB.R 16MB.V outDir";
 
-static char* examples[] = { example1, NULL };
+static char example2[] = 
+  "$ vernamfs recover -k KEY 16MB.R outDir";
+
+static char* examples[] = { example1, example2, NULL };
 
 static CommandHelp help = {
   .summary = "Combine vault, remote pads to recover entire remote data",
-  .synopsis = "OTPREMOTE OTPVAULT outputDir",
-  .description = "Recover XORs the retrieved remote OTP with the locally held original\n  vault copy to reveal the plaintext remote data. Results are stored into\n  a specified local directory.",
+  .synopsis = "[<options>] OTPREMOTE OTPVAULT|-k KEY outputDir",
+  .description = "Recover XORs the retrieved remote OTP with the locally held original\n  vault copy to reveal the plaintext remote data. Results are stored into\n  a specified local directory.  For a generated OTP, the key may be given\n  instead of the vault copy, and only the pad ranges in use are regenerated.",
+  .options = options,
   .examples = examples
 };
 
@@ -60,129 +80,230 @@ Command recoverCmd = {
   .invoke = recoverArgs
 };
 
+// Just the header, to see how the remote pad was made
+static int remotePadType( char* otpRemote ) {
+  VFS vfs;
+  int fd = open( otpRemote, O_RDONLY );
+  if( fd < 0 )
+	return VERNAMFS_PADTYPE_UNKNOWN;
+  int nin = read( fd, &vfs.header, sizeof( VFSHeader ) );
+  close( fd );
+  if( nin != sizeof( VFSHeader ) || vfs.header.magic != VERNAMFS_MAGIC )
+	return VERNAMFS_PADTYPE_UNKNOWN;
+  return VFSPadType( &vfs );
+}
+
 int recoverArgs( int argc, char* argv[] ) {
 
-  if( argc < 4 ) {
+  char* cipher = NULL;
+  char* keyFile = NULL;
+  int zeroKey = 0;
+
+  int c;
+  while( (c = getopt( argc, argv, "c:k:z") ) != -1 ) {
+	switch( c ) {
+	case 'c':
+	  cipher = optarg;
+	  break;
+	case 'k':
+	  keyFile = optarg;
+	  break;
+	case 'z':
+	  zeroKey = 1;
+	  break;
+	default:
+	  break;
+	}
+  }
+
+  int keyed = keyFile || zeroKey;
+  if( optind + (keyed ? 2 : 3) > argc ) {
 	commandHelp( &recoverCmd );
 	return -1;
   }
 
-  char* otpRemote = argv[1];
-  char* otpVault = argv[2];
-  char* resultsDir = argv[3];
-  return recover( otpRemote, otpVault, resultsDir );
-}
+  char* otpRemote = argv[optind++];
 
-int recover( char* otpRemote, char* otpVault, char* outputDir ) {
+  /*
+	The remote header gives the table entry size, so no -l needed
+	here, and likely the keystream too.
+  */
+  int padType = VERNAMFS_PADTYPE_UNKNOWN;
+  if( keyed )
+	padType = remotePadType( otpRemote );
 
-  struct stat st;
-  int sc = stat( otpRemote, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", otpRemote );
+  VFSVault vault;
+  if( VFSVaultOpen( &vault, keyed ? NULL : argv[optind++], keyFile, zeroKey,
+					cipher, padType, VERNAMFS_NAMELENGTHDEFAULT ) )
 	return -1;
-  }
-  off_t remoteLength = st.st_size;
 
-  sc = stat( otpVault, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "Not a regular file: %s\n", otpVault );
-	return -1;
-  }
-  off_t vaultLength = st.st_size;
+  char* resultsDir = argv[optind];
+  int sc = recover( otpRemote, &vault, resultsDir );
+  VFSVaultClose( &vault );
+  return sc;
+}
 
-  int fdR = open( otpRemote, O_RDONLY );
-  if( fdR < 0 ) {
-	fprintf( stderr, "Cannot open: %s\n", otpRemote );
-	return -1;
-  }
-  
-  void* addrR = mmap( NULL, remoteLength, PROT_READ, MAP_PRIVATE, 
-					  fdR, 0 );
-  if( addrR == MAP_FAILED ) {
-	fprintf( stderr, "Cannot mmap: %s\n", otpRemote );
-	close( fdR );
-	return -1;
-  }
+/*
+  A chained file, extent by extent, so only one extent's content is
+  ever held in memory.  The chain must stay within the pad and move
+  forward, else the table entry (or the vault) is not what we think.
+*/
+static void recoverChain( char* addrR, uint64_t lengthR, VFSVault* vault,
+						  VFSTableEntryFixed* tef, char* path ) {
 
-  int fdV = open( otpVault, O_RDONLY );
-  if( fdV < 0 ) {
-	fprintf( stderr, "Cannot open: %s\n", otpVault );
-	munmap( addrR, remoteLength );
-	close( fdR );
-	return -1;
-  }
-  
-  void* addrV = mmap( NULL, vaultLength, PROT_READ, MAP_PRIVATE, 
-					  fdV, 0 );
-  if( addrV == MAP_FAILED ) {
-	fprintf( stderr, "Cannot mmap: %s\n", otpVault );
-	close( fdV );
-	munmap( addrR, remoteLength );
-	close( fdR );
-	return -1;
+  int fdOut = open( path, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH );
+  if( fdOut < 0 ) {
+	fprintf( stderr, "Cannot open: %s (%d)\n", path, errno );
+	return;
   }
 
-
-  sc = mkdir( outputDir, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH );
-  if( sc && errno != EEXIST ) {
-	fprintf( stderr, "Cannot mkdir: %s\n", outputDir );
-	munmap( addrV, vaultLength );
-	close( fdV );
-	munmap( addrR, remoteLength );
-	close( fdR );
-	return -1;
+  // Extent size is the writer's combine size, so grow to fit
+  char* contentActual = NULL;
+  uint64_t capacity = 0;
+  uint64_t remaining = tef->length & VERNAMFS_LENGTH_MASK;
+  uint64_t extent = tef->offset;
+  while( extent && remaining ) {
+	VFSExtentHeader eh;
+	if( extent + sizeof( eh ) > lengthR ||
+		VFSVaultXor( vault, extent, &eh, addrR + extent, sizeof( eh ) ) )
+	  break;
+	uint64_t content = extent + sizeof( eh );
+	if( eh.length > remaining || 
+		eh.length > VERNAMFS_MAXCOMBINESIZE - sizeof( eh ) ||
+		content + eh.length > lengthR ||
+		(eh.next && eh.next <= extent) )
+	  break;
+	if( eh.length > capacity ) {
+	  char* grown = (char*)realloc( contentActual, eh.length );
+	  if( !grown )
+		break;
+	  contentActual = grown;
+	  capacity = eh.length;
+	}
+	if( VFSVaultXor( vault, content, contentActual, addrR + content, 
+					 eh.length ) )
+	  break;
+	ssize_t nout = write( fdOut, contentActual, eh.length );
+	if( nout != eh.length ) {
+	  fprintf( stderr, "Write failure: %s (%d)\n", path, errno );
+	  break;
+	}
+	remaining -= eh.length;
+	extent = eh.next;
   }
+  if( remaining )
+	fprintf( stderr, "Broken extent chain: %s (0x%"PRIx64")\n", path, 
+			 extent );
+  free( contentActual );
+  close( fdOut );
+}
 
-  VFS remoteVFS;
-  VFSLoad( &remoteVFS, addrR );
-  VFSHeader* hR = &remoteVFS.header;
+static void recoverTable( VFS* remoteVFS, VFSVault* vault, char* outputDir ) {
+
+  char* addrR = remoteVFS->backing;
+  VFSHeader* hR = &remoteVFS->header;
 
   uint64_t tableLength = hR->tablePtr - hR->tableOffset;
   uint32_t tableEntrySize = hR->tableEntrySize;
   uint32_t tableEntryCount = tableLength / tableEntrySize;
 
   char* tableR = (char*)(addrR + hR->tableOffset);
-  char* tableV = (char*)(addrV + hR->tableOffset);
   char* teActual = (char*)malloc( tableEntrySize );
   int i;
   for( i = 0; i < tableEntryCount; i++ ) {
 	char* teRemote = tableR + i * tableEntrySize;
-	char* teVault =  tableV + i * tableEntrySize;
-	int j;
-	for( j = 0; j < tableEntrySize; j++ )
-	  teActual[j] = teRemote[j] ^ teVault[j];
+	if( VFSVaultXor( vault, hR->tableOffset + i * tableEntrySize,
+					 teActual, teRemote, tableEntrySize ) )
+	  break;
 	VFSTableEntryFixed* tef = (VFSTableEntryFixed*)teActual;
 	char* name = teActual + sizeof( VFSTableEntryFixed );
 	
 	if( 0 ) {
 	  // printf( "%s %lx %lx\n", name, tef->offset, tef->length );
 	}
-	char* contentActual = (char*)malloc( tef->length );
-	char* contentR = (char*)(addrR + tef->offset );
-	char* contentV = (char*)(addrV + tef->offset );
-	uint64_t c;
-	for( c = 0; c < tef->length; c++ ) {
-	  contentActual[c] = contentR[c] ^ contentV[c];
-	}
 	char path[256];
 	// Offset name by 1 char, since the stored value leads with '/'
 	sprintf( path, "%s/%s", outputDir, name+1 );
-	int fdOut = open( path, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH );
+
+	if( tef->length & VERNAMFS_LENGTH_CHAINED ) {
+	  recoverChain( addrR, hR->length, vault, tef, path );
+	  continue;
+	}
+
+	uint64_t length = tef->length & VERNAMFS_LENGTH_MASK;
+	char* contentActual = (char*)malloc( length );
+	char* contentR = (char*)(addrR + tef->offset );
+	if( VFSVaultXor( vault, tef->offset, contentActual, contentR, 
+					 length ) ) {
+	  free( contentActual );
+	  continue;
+	}
+
+	// A log's segments all append to the one file, a record per line
+	int records = (tef->length & VERNAMFS_LENGTH_RECORDS) != 0;
+	int fdOut = open( path, O_WRONLY|O_CREAT|(records ? O_APPEND : 0), 
+					  S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH );
 	if( fdOut < 0 ) {
 	  fprintf( stderr, "Cannot open: %s (%d)\n", path, errno );
+	} else if( records ) {
+	  if( VFSLogSplit( contentActual, length, fdOut ) < 0 )
+		fprintf( stderr, "Broken log segment: %s (0x%"PRIx64")\n", path,
+				 tef->offset );
+	  close( fdOut );
 	} else {
-	  ssize_t nout = write( fdOut, contentActual, tef->length );
-	  if( nout != tef->length ) {
+	  ssize_t nout = write( fdOut, contentActual, length );
+	  if( nout != length ) {
 		fprintf( stderr, "Write failure: %s (%d)\n", path, errno );
 	  }
 	  close( fdOut );
 	}
 	free( contentActual );
-	free( teActual );
+  }
+  free( teActual );
+}
+
+int recover( char* otpRemote, VFSVault* vault, char* outputDir ) {
+
+  uint64_t deviceLength;
+  if( VFSDeviceSize( otpRemote, &deviceLength ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", otpRemote );
+	return -1;
+  }
+  off_t remoteLength = deviceLength;
+
+  int fdR = open( otpRemote, O_RDONLY );
+  if( fdR < 0 ) {
+	fprintf( stderr, "Cannot open: %s\n", otpRemote );
+	return -1;
+  }
+  
+  void* addrR = mmap( NULL, remoteLength, PROT_READ, MAP_PRIVATE, 
+					  fdR, 0 );
+  if( addrR == MAP_FAILED ) {
+	fprintf( stderr, "Cannot mmap: %s\n", otpRemote );
+	close( fdR );
+	return -1;
+  }
+
+  int sc = mkdir( outputDir, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH );
+  if( sc && errno != EEXIST ) {
+	fprintf( stderr, "Cannot mkdir: %s\n", outputDir );
+	munmap( addrR, remoteLength );
+	close( fdR );
+	return -1;
+  }
+
+  VFS remoteVFS;
+  VFSLoad( &remoteVFS, addrR );
+
+  // Every table, just the one unless the remote VFS is sharded
+  int i;
+  for( i = 0; i < VFSShardCount( &remoteVFS ); i++ ) {
+	VFS shard;
+	VFSShard( &remoteVFS, i, &shard );
+	recoverTable( &shard, vault, outputDir );
   }
 
-  munmap( addrV, vaultLength );
-  close( fdV );
   munmap( addrR, remoteLength );
   close( fdR );
   
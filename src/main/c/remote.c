@@ -47,6 +47,9 @@ VFSRemoteResult* VFSRemoteResultRead( int fd ) {
   
   uint64_t offset;
   int nin = read( fd, &offset, sizeof( uint64_t ) );
+  // A clean end of input, e.g. after the last of several results
+  if( nin == 0 )
+	return NULL;
   if( nin != sizeof( uint64_t ) ) {
 	fprintf( stderr, "Cannot read remoteResult offset\n" );
 	return NULL;
@@ -62,8 +65,15 @@ VFSRemoteResult* VFSRemoteResultRead( int fd ) {
   char* data = malloc( length );
   if( !data )
 	return NULL;
-  nin = read( fd, data, length );
-  if( nin != length ) {
+  // Loop, since from a pipe, reads may be short
+  uint64_t total = 0;
+  while( total < length ) {
+	ssize_t n = read( fd, data + total, length - total );
+	if( n <= 0 )
+	  break;
+	total += n;
+  }
+  if( total != length ) {
 	fprintf( stderr, "Cannot read remoteResult data\n" );
 	free( data );
 	return NULL;
@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
+#include "vernamfs/device.h"
 #include "vernamfs/vernamfs.h"
 #include "vernamfs/remote.h"
 
@@ -103,13 +104,12 @@ int rlsArgs( int argc, char* argv[] ) {
 
 int rls( char* file ) {
 
-  struct stat st;
-  int sc = stat( file, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", file );
+  uint64_t deviceLength;
+  if( VFSDeviceSize( file, &deviceLength ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
 	return -1;
   }
-  size_t length = st.st_size;
+  size_t length = deviceLength;
 
   int fd = open( file, O_RDONLY );
   if( fd < 0 ) {
@@ -129,8 +129,6 @@ int rls( char* file ) {
   
   // LOOK: check magic number, are we actually loading a VFS file?
 
-  VFSHeader* h = &vfs.header;
-
   /*
 	We write a 'Remote Result', which is a triple.  Values for an 'ls'
 	listing are
@@ -140,17 +138,26 @@ int rls( char* file ) {
 	2: table length in bytes
 
 	3: table entries, as N VFSTableEntry structs
+
+	A sharded VFS has a table per shard, so gives one result per shard,
+	back to back.
   */
+  int i;
+  for( i = 0; i < VFSShardCount( &vfs ); i++ ) {
+	VFS shard;
+	VFSShard( &vfs, i, &shard );
+	VFSHeader* h = &shard.header;
 
-  VFSRemoteResult vrr;
-  vrr.offset = h->tableOffset;
-  vrr.length = h->tablePtr - h->tableOffset;
-  vrr.data   = addr + h->tableOffset;
+	VFSRemoteResult vrr;
+	vrr.offset = h->tableOffset;
+	vrr.length = h->tablePtr - h->tableOffset;
+	vrr.data   = addr + h->tableOffset;
 
-  // Set this for completeness, we are NOT calling RemoteResultFree anyway
-  vrr.dataOnHeap = 0;
+	// Set this for completeness, we are NOT calling RemoteResultFree anyway
+	vrr.dataOnHeap = 0;
 
-  VFSRemoteResultWrite( &vrr, STDOUT_FILENO );
+	VFSRemoteResultWrite( &vrr, STDOUT_FILENO );
+  }
 
   munmap( addr, length );
   close( fd );
@@ -0,0 +1,216 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "vernamfs/device.h"
+#include "vernamfs/vault.h"
+#include "vernamfs/vernamfs.h"
+#include "vernamfs/xor.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Vault access, by mapped vault copy or by AES key.  See vault.h.
+ */
+
+// Keystream is produced, and XOR'ed, this much at a time
+#define SCRATCHSIZE (1 << 16)
+
+int VFSVaultOpenFile( VFSVault* thiz, const char* file ) {
+
+  memset( thiz, 0, sizeof( VFSVault ) );
+
+  if( VFSDeviceSize( file, &thiz->length ) ) {
+	fprintf( stderr, "%s: Not a regular file or block device\n", file );
+	return -1;
+  }
+
+  thiz->fd = open( file, O_RDONLY );
+  if( thiz->fd < 0 ) {
+	fprintf( stderr, "Cannot open vaultFile: %s\n", file );
+	return -1;
+  }
+
+  thiz->addr = mmap( NULL, thiz->length, PROT_READ, MAP_PRIVATE, 
+					 thiz->fd, 0 );
+  if( thiz->addr == MAP_FAILED ) {
+	fprintf( stderr, "Cannot mmap vaultFile: %s\n", file );
+	close( thiz->fd );
+	thiz->addr = NULL;
+	return -1;
+  }
+
+  /*
+	Assumed that the vault header's tableEntrySize matches that of the
+	remote data
+  */
+  VFS vaultVFS;
+  VFSLoad( &vaultVFS, thiz->addr );
+  thiz->tableEntrySize = vaultVFS.header.tableEntrySize;
+  return 0;
+}
+
+int VFSVaultOpenKey( VFSVault* thiz, int padType, const uint8_t* key,
+					 int maxNameLength ) {
+
+  memset( thiz, 0, sizeof( VFSVault ) );
+  thiz->fd = -1;
+
+  int tableEntrySize = VFSTableEntrySize( maxNameLength );
+  if( tableEntrySize < 0 ) {
+	fprintf( stderr, "Bad maximum name length: %d\n", maxNameLength );
+	return -1;
+  }
+  thiz->tableEntrySize = tableEntrySize;
+
+  if( VFSKeystreamInit( &thiz->keystream, padType, key ) ) {
+	fprintf( stderr, "Pad type %s cannot be regenerated from a key\n",
+			 VFSKeystreamName( padType ) );
+	return -1;
+  }
+
+  thiz->scratch = malloc( SCRATCHSIZE );
+  if( !thiz->scratch )
+	return -1;
+  return 0;
+}
+
+int VFSVaultKeyRead( const char* keyFile, uint8_t key[32] ) {
+
+  FILE* fp = fopen( keyFile, "r" );
+  if( !fp ) {
+	fprintf( stderr, "Cannot open keyFile: %s\n", keyFile );
+	return -1;
+  }
+  char hex[128] = { 0 };
+  char* line = fgets( hex, sizeof( hex ), fp );
+  fclose( fp );
+
+  // Same format as 'generate' reads from stdin: 32 or 64 hex digits
+  int digits = 0;
+  while( line && digits < 64 && isxdigit( (unsigned char)hex[digits] ) )
+	digits++;
+  if( digits != 32 && digits != 64 ) {
+	fprintf( stderr, "%s: Hexed key length %d. Need 32 or 64 hex digits.\n",
+			 keyFile, digits );
+	return -1;
+  }
+  int i;
+  for( i = 0; i < digits / 2; i++ ) {
+	unsigned int b;
+	sscanf( hex + 2 * i, "%2x", &b );
+	key[i] = (uint8_t)b;
+  }
+  return digits / 2;
+}
+
+int VFSVaultOpen( VFSVault* thiz, const char* vaultFile, 
+				  const char* keyFile, int zeroKey, const char* cipher,
+				  int padType, int maxNameLength ) {
+
+  if( !keyFile && !zeroKey )
+	return VFSVaultOpenFile( thiz, vaultFile );
+
+  uint8_t key[32] = { 0 };
+  int keySize = 0;
+  if( keyFile ) {
+	keySize = VFSVaultKeyRead( keyFile, key );
+	if( keySize < 0 )
+	  return -1;
+	padType = VFSKeystreamTypeForKeySize( keySize );
+  }
+  if( cipher ) {
+	padType = VFSKeystreamType( cipher );
+	if( padType < 0 ) {
+	  fprintf( stderr, "Unknown keystream: %s\n", cipher );
+	  return -1;
+	}
+  }
+  if( padType == VERNAMFS_PADTYPE_UNKNOWN )
+	padType = VERNAMFS_PADTYPE_AES128CTR;
+  if( keyFile && keySize != VFSKeystreamKeySize( padType ) ) {
+	fprintf( stderr, "%s: %d-byte key, but %s needs %d\n", keyFile, 
+			 keySize, VFSKeystreamName( padType ),
+			 (int)VFSKeystreamKeySize( padType ) );
+	return -1;
+  }
+  return VFSVaultOpenKey( thiz, padType, key, maxNameLength );
+}
+
+void VFSVaultClose( VFSVault* thiz ) {
+  if( thiz->addr ) {
+	munmap( thiz->addr, thiz->length );
+	close( thiz->fd );
+	thiz->addr = NULL;
+  }
+  free( thiz->scratch );
+  thiz->scratch = NULL;
+}
+
+int VFSVaultXor( VFSVault* thiz, uint64_t offset, void* dest,
+				 const void* src, size_t count ) {
+
+  if( thiz->addr ) {
+	if( offset + count > thiz->length ) {
+	  fprintf( stderr, 
+			   "Vault length (%"PRIx64") too short, need %"PRIx64"\n",
+			   thiz->length, offset + count );
+	  return -1;
+	}
+	VFSXorCombine( dest, src, thiz->addr + offset, count );
+	return 0;
+  }
+
+  uint8_t* d = (uint8_t*)dest;
+  const uint8_t* s = (const uint8_t*)src;
+  while( count ) {
+	size_t n = count > SCRATCHSIZE ? SCRATCHSIZE : count;
+	VFSKeystreamStream( &thiz->keystream, offset, thiz->scratch, n );
+	VFSXorCombine( d, s, thiz->scratch, n );
+	offset += n;
+	d += n;
+	s += n;
+	count -= n;
+  }
+  return 0;
+}
+
+// eof
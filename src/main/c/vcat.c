@@ -33,12 +33,12 @@
  */
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "vernamfs/cmds.h"
@@ -53,32 +53,59 @@
  * input 
  *
  * 1: the output of some previous rcat command,
- * 2: the local vault copy of the OTP.
+ * 2: the local vault copy of the OTP, or for a generated OTP, its key.
  * 
  * A remote ls listing (rls) file is optional, and if supplied, will enable
- * naming of the new content.
+ * naming of the new content.  It is needed too for a file written as
+ * a chain of extents (init -x): the rcat result must then span all
+ * the file's extents, from its listed offset on, and just the chain
+ * is recovered.  A log segment (see log.c) is written out a record
+ * per line.
  *
  * Example usage:
  *
  * vault$ vernamfs vcat OTPVAULT rcat.result rls.result?
  *
+ * vault$ vernamfs vcat -k KEY rcat.result rls.result?
+ *
  * @see rcat.c
  * @see remote.c
  */
 
+static CommandOption c = 
+  { .id = "c", 
+	.text = "With -k or -z, the keystream the pad was generated with, aes128 or\n    chacha20.  Defaults to that implied by the key length." };
+
+static CommandOption k = 
+  { .id = "k", 
+	.text = "Key file, hex-encoded as for generate.  The vault pad is\n    regenerated from the key, so no OTPVault is given." };
+
+static CommandOption l = 
+  { .id = "l", 
+	.text = "With -k or -z, the maximum file name length the remote was\n    initialised with.  Defaults to 64-17=47." };
+
+static CommandOption z = 
+  { .id = "z", 
+	.text = "As -k, but with the all-zeros key." };
+
+static CommandOption* options[] = { &c, &k, &l, &z, NULL };
+
 static char example1[] = 
   "remote$ vernamfs rcat OTP.remote 0x1234 0x5678 > remote.cat";
 static char example2[] = 
   "vault$  vernamfs vcat OTP.vault remote.cat";
 static char example3[] = 
   "vault$  vernamfs vcat OTP.vault remote.cat remote.ls";
+static char example4[] = 
+  "vault$  vernamfs vcat -k KEY remote.cat remote.ls";
 
-static char* examples[] = { example1, example2, example3, NULL };
+static char* examples[] = { example1, example2, example3, example4, NULL };
 
 static CommandHelp help = {
   .summary = "Recover encrypted file content",
-  .synopsis = "OTPVault rcatResult rlsResult?",
-  .description = "Recover remote file content, by combining remote cat result and local vault\n  copy of the OTP. If remote ls result supplied, recovered content is\n  written to named file, else written to stdout.",
+  .synopsis = "[<options>] OTPVault|-k KEY rcatResult rlsResult?",
+  .description = "Recover remote file content, by combining remote cat result and local vault\n  copy of the OTP. If remote ls result supplied, recovered content is\n  written to named file, else written to stdout.  For a generated OTP, the\n  key may be given instead of the vault copy.",
+  .options = options,
   .examples = examples
 };
 
@@ -90,27 +117,54 @@ Command vcatCmd = {
 
 int vcatArgs( int argc, char* argv[] ) {
 
-  if( argc < 3 ) {
+  char* cipher = NULL;
+  char* keyFile = NULL;
+  int zeroKey = 0;
+  int maxNameLength = VERNAMFS_NAMELENGTHDEFAULT;
+
+  int c;
+  while( (c = getopt( argc, argv, "c:k:l:z") ) != -1 ) {
+	switch( c ) {
+	case 'c':
+	  cipher = optarg;
+	  break;
+	case 'k':
+	  keyFile = optarg;
+	  break;
+	case 'l':
+	  maxNameLength = atoi( optarg );
+	  break;
+	case 'z':
+	  zeroKey = 1;
+	  break;
+	default:
+	  break;
+	}
+  }
+
+  int keyed = keyFile || zeroKey;
+  if( optind + (keyed ? 1 : 2) > argc ) {
 	commandHelp( &vcatCmd );
 	return -1;
   }
 
-  char* vaultFile = argv[1];
-  char* rcatResultFile = argv[2];
-  char* rlsResultFile = argc > 3 ? argv[3] : NULL;
+  VFSVault vault;
+  if( VFSVaultOpen( &vault, keyed ? NULL : argv[optind++], keyFile, zeroKey,
+					cipher, VERNAMFS_PADTYPE_UNKNOWN, maxNameLength ) )
+	return -1;
+
+  char* rcatResultFile = argv[optind];
+  char* rlsResultFile = optind+1 < argc ? argv[optind+1] : NULL;
 
-  return vcat( vaultFile, rcatResultFile, rlsResultFile );
+  int sc = vcat( &vault, rcatResultFile, rlsResultFile );
+  VFSVaultClose( &vault );
+  return sc;
 }
 
-int vcat( char* vaultFile, char* rcatResultFile, char* rlsResultFile ) {
+static int vcatChain( VFSRemoteResult* rrcat, VFSTableEntryFixed* tef, 
+					  int fd, char* fileName );
 
-  struct stat st;
-  int sc = stat( vaultFile, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", vaultFile );
-	return -1;
-  }
-  size_t vaultLength = st.st_size;
+int vcat( VFSVault* vault, char* rcatResultFile, char* rlsResultFile ) {
 
   int fdRcat = open( rcatResultFile, O_RDONLY );
   if( fdRcat < 0 ) {
@@ -121,96 +175,60 @@ int vcat( char* vaultFile, char* rcatResultFile, char* rlsResultFile ) {
   VFSRemoteResult* rrcat = VFSRemoteResultRead( fdRcat );
   close( fdRcat );
 
-  if( rrcat->offset + rrcat->length > vaultLength ) {
-	fprintf( stderr, "Vault length (%"PRIx64") too short, need %"PRIx64"\n",
-			 (uint64_t)vaultLength, rrcat->offset + rrcat->length );
-	VFSRemoteResultFree( rrcat );
-	free( rrcat );
-	return -1;
-  }
-
-  int fdVault = open( vaultFile, O_RDONLY );
-  if( fdVault < 0 ) {
-	perror( "open" );
-	VFSRemoteResultFree( rrcat );
-	free( rrcat );
-	return -1;
-  }
-  
-  void* addr = mmap( NULL, vaultLength, PROT_READ, MAP_PRIVATE, fdVault, 0 );
-  if( addr == MAP_FAILED ) {
-	perror( "mmap" );
-	close( fdVault );
-	VFSRemoteResultFree( rrcat );
-	free( rrcat );
-	return -1;
-  }
-
   /*
 	LOOK: if content length too long, a completely in-memory recovery
-	will not be feasible...
+	will not be feasible...  The content is decoded in place, in the
+	rcat result's own buffer.
   */
-  char* content = malloc( rrcat->length );
-  if( !content ) {
-	munmap( addr, vaultLength );
-	close( fdVault );
+  char* content = rrcat->data;
+  if( VFSVaultXor( vault, rrcat->offset, content, content, rrcat->length ) ) {
 	VFSRemoteResultFree( rrcat );
 	free( rrcat );
 	return -1;
   }
 
-  char* rData = rrcat->data;
-  char* vData = addr + rrcat->offset;
-
-  // LOOK: do most of this a word at a time...
-  int i;
-  for( i = 0; i < rrcat->length; i++ )
-	content[i] = rData[i] ^ vData[i];
-
   /*
 	Consult any supplied rlsResult, transform to plain-text listing
 	(as per vls) and can then look up correct file name based on
 	matching offsets.  If fails, just write the vcat result to STDOUT.
   */
   char fileName[VERNAMFS_MAXNAMELENGTH+1] = {0};
+  VFSTableEntryFixed found = { 0 };
   VFSRemoteResult* rrls = NULL;
   if( rlsResultFile ) {
 	int fdRls = open( rlsResultFile, O_RDONLY );
 	if( fdRls < 0 ) {
 	  fprintf( stderr, "Cannot open rlsResult: %s\n", rlsResultFile );
 	} else {
-	  rrls = VFSRemoteResultRead( fdRls );
-	  close( fdRls );
-	  VFS vaultVFS;
-	  VFSLoad( &vaultVFS, addr );
-
-	  // LOOK: Can/should check vaultVFS.header.tableOffset == rrls->offset
-
-	  int tableEntrySize = vaultVFS.header.tableEntrySize;
-	  int tableEntryCount = rrls->length / tableEntrySize;
+	  // One result per table, several if the remote VFS is sharded
+	  int tableEntrySize = vault->tableEntrySize;
 	  char* teActual = (char*)malloc( tableEntrySize );
-	  char* rls = rrls->data;
-	  char* vls = (char*)(addr + rrls->offset);
-	  for( i = 0; i < tableEntryCount; i++ ) {
-		char* teRemote = (char*)(rls + i * tableEntrySize);
-		char* teVault  = (char*)(vls + i * tableEntrySize);
-		int j;
-		for( j = 0; j < tableEntrySize; j++ )
-		  teActual[j] = teRemote[j] ^ teVault[j];
+	  while( !fileName[0] && (rrls = VFSRemoteResultRead( fdRls )) ) {
+		int tableEntryCount = rrls->length / tableEntrySize;
+		char* rls = rrls->data;
+		int i;
+		for( i = 0; i < tableEntryCount; i++ ) {
+		  char* teRemote = (char*)(rls + i * tableEntrySize);
+		  if( VFSVaultXor( vault, rrls->offset + i * tableEntrySize,
+						   teActual, teRemote, tableEntrySize ) )
+			break;
 		
-		VFSTableEntryFixed* tef = (VFSTableEntryFixed*)teActual;
-		if( rrcat->offset == tef->offset ) {
-		  char* cp = (char*)tef + sizeof( VFSTableEntryFixed );
-		  //		printf( "Found %d: %s\n", i, cp );
-		  if( *cp == '/' )
-			cp++;
-		  strcpy( fileName, cp );
-		  break;
+		  VFSTableEntryFixed* tef = (VFSTableEntryFixed*)teActual;
+		  if( rrcat->offset == tef->offset ) {
+			char* cp = (char*)tef + sizeof( VFSTableEntryFixed );
+			//		printf( "Found %d: %s\n", i, cp );
+			if( *cp == '/' )
+			  cp++;
+			strcpy( fileName, cp );
+			found = *tef;
+			break;
+		  }
 		}
+		VFSRemoteResultFree( rrls );
+		free( rrls );
 	  }
 	  free( teActual );
-	  VFSRemoteResultFree( rrls );
-	  free( rrls );
+	  close( fdRls );
 	}
   }
   
@@ -221,24 +239,73 @@ int vcat( char* vaultFile, char* rcatResultFile, char* rlsResultFile ) {
 	files. That is not a problem remotely, but is here at the vault.
 	We choose to always APPEND data to any existing local file.
   */
+  int sc = 0;
   if( strlen( fileName ) ) {
 	int fd = open( fileName, 
 				   O_WRONLY | O_CREAT | O_APPEND,
 				   S_IRUSR | S_IRGRP | S_IROTH );
-	int nout = write( fd, content, rrcat->length );
-	if( nout != rrcat->length ) {
-	  fprintf( stderr, "Failed to write %s: %d = %d (%d)\n",
-			   fileName, (int)rrcat->length, nout, errno );
+	uint64_t length = found.length & VERNAMFS_LENGTH_MASK;
+	if( found.length & VERNAMFS_LENGTH_CHAINED ) {
+	  sc = vcatChain( rrcat, &found, fd, fileName );
+	} else if( found.length & VERNAMFS_LENGTH_RECORDS ) {
+	  // A log segment, a record per line
+	  if( length > rrcat->length || VFSLogSplit( content, length, fd ) < 0 ) {
+		fprintf( stderr, "%s: broken log segment\n", fileName );
+		sc = -1;
+	  }
+	} else {
+	  int nout = write( fd, content, rrcat->length );
+	  if( nout != rrcat->length ) {
+		fprintf( stderr, "Failed to write %s: %d = %d (%d)\n",
+				 fileName, (int)rrcat->length, nout, errno );
+	  }
 	}
 	close( fd );
   } else {
 	write( STDOUT_FILENO, content, rrcat->length );
   }
 
-  munmap( addr, vaultLength );
-  close( fdVault );
   VFSRemoteResultFree( rrcat );
   free( rrcat );
+  return sc;
+}
+
+/*
+  Follow the chain of extents through the (decoded) rcat result,
+  writing out each extent's content.  Any extent not covered means
+  the rcat range was too short.
+*/
+static int vcatChain( VFSRemoteResult* rrcat, VFSTableEntryFixed* tef, 
+					  int fd, char* fileName ) {
+
+  uint64_t start = rrcat->offset;
+  uint64_t end = rrcat->offset + rrcat->length;
+  uint64_t remaining = tef->length & VERNAMFS_LENGTH_MASK;
+  uint64_t extent = tef->offset;
+  while( extent && remaining ) {
+	VFSExtentHeader eh;
+	if( extent < start || extent + sizeof( eh ) > end )
+	  break;
+	memcpy( &eh, (char*)rrcat->data + (extent - start), sizeof( eh ) );
+	uint64_t content = extent + sizeof( eh );
+	if( eh.length > remaining || content + eh.length > end ||
+		(eh.next && eh.next <= extent) )
+	  break;
+	int nout = write( fd, (char*)rrcat->data + (content - start), 
+					  eh.length );
+	if( nout != eh.length ) {
+	  fprintf( stderr, "Failed to write %s: %d = %d (%d)\n",
+			   fileName, (int)eh.length, nout, errno );
+	  return -1;
+	}
+	remaining -= eh.length;
+	extent = eh.next;
+  }
+  if( remaining ) {
+	fprintf( stderr, "%s: extent at 0x%"PRIx64" not in rcat result\n", 
+			 fileName, extent );
+	return -1;
+  }
   return 0;
 }
 
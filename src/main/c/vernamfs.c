@@ -34,59 +34,428 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+
+#include "vernamfs/engine.h"
+#include "vernamfs/keystream.h"
 #include "vernamfs/vernamfs.h"
 #include "vernamfs/version.h"
+#include "vernamfs/xor.h"
 
 /**
  * @author Stuart Maclean
  *
  * The vernamfs 'back end'.  Called by fuse routines. Could also in
  * theory be called directly by programs linking to Vernamfs as a
- * library, if FUSE were not available.  Advantage of FUSE is that it
- * provides the serialization we require to ensure no byte of the OTP
- * is ever written to twice.
+ * library, if FUSE were not available.
+ *
+ * No byte of the OTP may ever be written twice.  The VFSFile api
+ * ensures that for concurrent writers by claiming each file's table
+ * entry and data extent, with atomic fetch-adds on cursors in the
+ * VFS, only once the file is complete.  The claimed regions are then
+ * the writer's alone, so the XOR work proceeds in parallel.  On a
+ * chained VFS, each extent of a file is claimed likewise, as it
+ * fills.  The older VFSAddEntry/VFSWrite/VFSRelease api, and the
+ * VFSLog record logs, write straight to the pad and rely on their
+ * caller to serialize.
  */
 
 static uint64_t alignUp( uint64_t val, uint64_t boundary );
 
-// Accumulating count of the active file write.  Reset on release
-static uint64_t totalLength = 0;
+static void VFSPadXor( VFS* thiz, uint64_t offset, 
+					   const void* buf, size_t count );
+
+static void VFSCursorsInit( VFS* thiz );
+static void prefetch( VFS* thiz, uint64_t from, uint64_t to );
+static void storeLock( VFS* thiz );
+static void storeUnlock( VFS* thiz );
 
-static int VFSHeaderInit( VFSHeader* thiz, size_t length, 
-						  int maxFiles, int maxNameLength );
+static int VFSHeaderInit( VFSHeader* thiz, uint64_t length, 
+						  int maxFiles, int maxNameLength, 
+						  uint64_t alignment );
 static void VFSHeaderLoad( VFSHeader* hTarget, void* addr );
 static void VFSHeaderStore( VFSHeader* hSource, void* addr );
 static void VFSHeaderReport( VFSHeader* h, int expert );
+static uint64_t slotNewest( void* backing, int unit, VFSCursorSlot* result );
+static void slotWrite( void* backing, int unit, uint64_t sequence,
+					   uint64_t tablePtr, uint64_t dataPtr );
 
-int VFSInit( VFS* thiz, size_t length, int maxFiles, int maxNameLength ) {
+int VFSInit( VFS* thiz, uint64_t length, int maxFiles, int maxNameLength,
+			 uint64_t alignment ) {
   VFSHeader* h = &thiz->header;
-  return VFSHeaderInit( h, length, maxFiles, maxNameLength );
+  int sc = VFSHeaderInit( h, length, maxFiles, maxNameLength, alignment );
+  thiz->shardCount = 0;
+  thiz->shard = -1;
+  thiz->rotateBytes = 0;
+  thiz->rotateSecs = 0;
+  thiz->combineSize = 0;
+  thiz->prefetchBytes = 0;
+  thiz->pipelineDepth = 0;
+  thiz->pipeline = NULL;
+  thiz->durability = VERNAMFS_DURABILITY_LAZY;
+  thiz->groupFiles = thiz->groupMsecs = 0;
+  thiz->groupTimer = NULL;
+  thiz->engine = NULL;
+  thiz->slotSequence = 0;
+  VFSCursorsInit( thiz );
+  return sc;
+}
+
+/*
+  Lay out the shards as equal page-aligned regions after the header
+  page, each a table then a data area, as for an unsharded VFS.  Any
+  remainder goes to the last shard.
+*/
+int VFSInitSharded( VFS* thiz, uint64_t length, int maxFiles, 
+					int maxNameLength, uint64_t alignment, int shards ) {
+
+  if( shards < 2 || shards > VERNAMFS_MAXSHARDS )
+	return -1;
+  if( maxFiles < shards )
+	maxFiles = shards;
+  int filesPerShard = (maxFiles + shards - 1) / shards;
+  if( VFSInit( thiz, length, filesPerShard * shards, maxNameLength, 
+			   alignment ) )
+	return -1;
+
+  VFSHeader* h = &thiz->header;
+  uint64_t page = sysconf( _SC_PAGE_SIZE );
+  uint64_t start = alignUp( VERNAMFS_SHARDSOFFSET + 
+							shards * sizeof( VFSShardHeader ), page );
+  uint64_t regionLength = (length - start) / shards / page * page;
+  uint64_t tableExtent = alignUp( (uint64_t)filesPerShard * h->tableEntrySize,
+								  page );
+  uint64_t minDataArea = (uint64_t)filesPerShard * h->padding;
+  if( tableExtent + minDataArea > regionLength )
+	return -1;
+
+  int i;
+  for( i = 0; i < shards; i++ ) {
+	VFSShardHeader* sh = thiz->shards + i;
+	uint64_t offset = start + i * regionLength;
+	sh->tableOffset = offset;
+	sh->tablePtr = offset;
+	sh->maxFiles = filesPerShard;
+	sh->dataOffset = offset + tableExtent;
+	sh->dataPtr = sh->dataOffset;
+	sh->length = i < shards - 1 ? offset + regionLength : length;
+	sh->unused = 0;
+  }
+  thiz->shardCount = shards;
+
+  // The whole-VFS table and data pointers describe an empty table
+  h->type = FILESYSTEMTYPE_SHARDEDFAT;
+  h->tableOffset = h->tablePtr = thiz->shards[0].tableOffset;
+  h->dataOffset = h->dataPtr = thiz->shards[0].dataOffset;
+  return 0;
 }
 
 void VFSLoad( VFS* thiz, void* addr ) {
   VFSHeader* h = &thiz->header;
   VFSHeaderLoad( h, addr );
   thiz->backing = addr;
+  thiz->shardCount = 0;
+  thiz->shard = -1;
+  thiz->rotateBytes = 0;
+  thiz->rotateSecs = 0;
+  thiz->combineSize = 0;
+  thiz->prefetchBytes = 0;
+  thiz->pipelineDepth = 0;
+  thiz->pipeline = NULL;
+  thiz->durability = VERNAMFS_DURABILITY_LAZY;
+  thiz->groupFiles = thiz->groupMsecs = 0;
+  thiz->groupTimer = NULL;
+  thiz->engine = NULL;
+  if( h->type == FILESYSTEMTYPE_SHARDEDFAT ) {
+	uint32_t count = *(uint32_t*)((char*)addr + VERNAMFS_SHARDCOUNTOFFSET);
+	if( count > VERNAMFS_MAXSHARDS )
+	  count = VERNAMFS_MAXSHARDS;
+	memcpy( thiz->shards, (char*)addr + VERNAMFS_SHARDSOFFSET,
+			count * sizeof( VFSShardHeader ) );
+	thiz->shardCount = count;
+  }
+
+  // The newest committed pointers, where slots are kept and valid
+  thiz->slotSequence = 0;
+  if( h->flags & VERNAMFS_FLAGS_SLOTS ) {
+	VFSCursorSlot slot;
+	thiz->slotSequence = slotNewest( addr, 0, &slot );
+	if( thiz->slotSequence ) {
+	  h->tablePtr = slot.tablePtr;
+	  h->dataPtr = slot.dataPtr;
+	}
+	int i;
+	for( i = 0; i < thiz->shardCount; i++ ) {
+	  if( slotNewest( addr, i + 1, &slot ) ) {
+		thiz->shards[i].tablePtr = slot.tablePtr;
+		thiz->shards[i].dataPtr = slot.dataPtr;
+	  }
+	}
+  }
+  VFSCursorsInit( thiz );
 }
 
+/*
+  A shard view stores only its own pointers, into its slot among the
+  shard headers, so views of different shards never touch the same
+  bytes.
+*/
 void VFSStore( VFS* thiz ) {
   VFSHeader* h = &thiz->header;
+  int slots = (h->flags & VERNAMFS_FLAGS_SLOTS) != 0;
+  if( thiz->shard >= 0 ) {
+	if( slots )
+	  slotWrite( thiz->backing, thiz->shard + 1, ++thiz->slotSequence,
+				 h->tablePtr, h->dataPtr );
+	VFSShardHeader* sh = (VFSShardHeader*)
+	  ((char*)thiz->backing + VERNAMFS_SHARDSOFFSET) + thiz->shard;
+	sh->tablePtr = h->tablePtr;
+	sh->dataPtr = h->dataPtr;
+	return;
+  }
+
+  /*
+	The first store, e.g. by init, clears every slot, since the page
+	may hold anything, then commits each shard's first pointers too.
+  */
+  if( slots && thiz->slotSequence == 0 ) {
+	memset( (char*)thiz->backing + VERNAMFS_SLOTSOFFSET, 0, 
+			(thiz->shardCount + 1) * 2 * sizeof( VFSCursorSlot ) );
+	int i;
+	for( i = 0; i < thiz->shardCount; i++ )
+	  slotWrite( thiz->backing, i + 1, 1, thiz->shards[i].tablePtr, 
+				 thiz->shards[i].dataPtr );
+  }
+  if( slots )
+	slotWrite( thiz->backing, 0, ++thiz->slotSequence, 
+			   h->tablePtr, h->dataPtr );
   VFSHeaderStore( h, thiz->backing );
+  if( thiz->shardCount ) {
+	*(uint32_t*)((char*)thiz->backing + VERNAMFS_SHARDCOUNTOFFSET) = 
+	  thiz->shardCount;
+	*(uint32_t*)((char*)thiz->backing + VERNAMFS_SHARDCOUNTOFFSET + 
+				 sizeof( uint32_t )) = 0;
+	memcpy( (char*)thiz->backing + VERNAMFS_SHARDSOFFSET, thiz->shards,
+			thiz->shardCount * sizeof( VFSShardHeader ) );
+  }
+}
+
+size_t VFSHeaderExtent( VFS* thiz ) {
+  if( thiz->header.flags & VERNAMFS_FLAGS_SLOTS )
+	return VERNAMFS_SLOTSOFFSET + 
+	  (thiz->shardCount + 1) * 2 * sizeof( VFSCursorSlot );
+  if( thiz->shardCount )
+	return VERNAMFS_SHARDSOFFSET + 
+	  thiz->shardCount * sizeof( VFSShardHeader );
+  return sizeof( VFSHeader );
+}
+
+int VFSShardCount( VFS* thiz ) {
+  return thiz->shardCount ? thiz->shardCount : 1;
+}
+
+void VFSShard( VFS* thiz, int i, VFS* result ) {
+  *result = *thiz;
+  if( thiz->shardCount == 0 )
+	return;
+  VFSShardHeader* sh = thiz->shards + i;
+  VFSHeader* h = &result->header;
+  h->tableOffset = sh->tableOffset;
+  h->tablePtr = sh->tablePtr;
+  h->maxFiles = sh->maxFiles;
+  h->dataOffset = sh->dataOffset;
+  h->dataPtr = sh->dataPtr;
+  h->length = sh->length;
+  result->shardCount = 0;
+  result->shard = i;
+  result->slotSequence = 0;
+  if( (h->flags & VERNAMFS_FLAGS_SLOTS) && thiz->backing ) {
+	VFSCursorSlot slot;
+	result->slotSequence = slotNewest( thiz->backing, i + 1, &slot );
+  }
+  VFSCursorsInit( result );
+  prefetch( result, h->tablePtr, h->tablePtr );
+  prefetch( result, h->dataPtr, h->dataPtr );
+}
+
+int VFSPadType( VFS* thiz ) {
+  return thiz->header.flags & VERNAMFS_FLAGS_PADTYPE;
+}
+
+void VFSSetPadType( VFS* thiz, int padType ) {
+  VFSHeader* h = &thiz->header;
+  h->flags = (h->flags & ~VERNAMFS_FLAGS_PADTYPE) | 
+	(padType & VERNAMFS_FLAGS_PADTYPE);
+}
+
+void VFSSetRotation( VFS* thiz, uint64_t bytes, int secs ) {
+  thiz->rotateBytes = bytes;
+  thiz->rotateSecs = secs;
+}
+
+int VFSSetCombineSize( VFS* thiz, uint64_t bytes ) {
+  if( bytes && (bytes & (bytes - 1) ||
+				bytes < VERNAMFS_MINCOMBINESIZE ||
+				bytes > VERNAMFS_MAXCOMBINESIZE) )
+	return -1;
+  thiz->combineSize = bytes;
+  return 0;
+}
+
+uint64_t VFSCombineSize( VFS* thiz ) {
+  return thiz->combineSize ? thiz->combineSize : VERNAMFS_EXTENTSIZE;
+}
+
+void VFSSetPrefetch( VFS* thiz, uint64_t bytes ) {
+  VFSHeader* h = &thiz->header;
+  thiz->prefetchBytes = bytes;
+  prefetch( thiz, h->tablePtr, h->tablePtr );
+  prefetch( thiz, h->dataPtr, h->dataPtr );
+}
+
+void VFSSetEngine( VFS* thiz, struct VFSEngine* engine ) {
+  thiz->engine = engine;
+}
+
+int VFSChained( VFS* thiz ) {
+  return thiz->header.flags & VERNAMFS_FLAGS_CHAINED;
+}
+
+void VFSSetChained( VFS* thiz, int chained ) {
+  VFSHeader* h = &thiz->header;
+  if( chained )
+	h->flags |= VERNAMFS_FLAGS_CHAINED;
+  else
+	h->flags &= ~VERNAMFS_FLAGS_CHAINED;
 }
 
 // Debug...
 void VFSReport( VFS* thiz, int expert ) {
   VFSHeader* h = &thiz->header;
-  VFSHeaderReport( h, expert );
+  if( thiz->shardCount == 0 ) {
+	VFSHeaderReport( h, expert );
+	if( expert && (h->flags & VERNAMFS_FLAGS_SLOTS) )
+	  printf( "SlotSequence  : %"PRIu64"\n", thiz->slotSequence );
+	return;
+  }
+
+  /*
+	Sharded: report totals over all shards as if one table and data
+	area, then each shard.
+  */
+  VFSHeader total = *h;
+  uint64_t tableUsed = 0, dataUsed = 0, dataSpace = 0;
+  int i;
+  for( i = 0; i < thiz->shardCount; i++ ) {
+	VFSShardHeader* sh = thiz->shards + i;
+	tableUsed += sh->tablePtr - sh->tableOffset;
+	dataUsed += sh->dataPtr - sh->dataOffset;
+	dataSpace += sh->length - sh->dataOffset;
+  }
+  total.tablePtr = total.tableOffset + tableUsed;
+  total.dataOffset = total.length - dataSpace;
+  total.dataPtr = total.dataOffset + dataUsed;
+  VFSHeaderReport( &total, expert );
+
+  printf( "\n" );
+  printf( "Shards                                  : %d\n", 
+		  thiz->shardCount );
+  for( i = 0; i < thiz->shardCount; i++ ) {
+	VFSShardHeader* sh = thiz->shards + i;
+	if( expert ) {
+	  printf( "Shard %2d      : Table 0x%"PRIx64"-0x%"PRIx64
+			  " Data 0x%"PRIx64"-0x%"PRIx64"-0x%"PRIx64"\n", i,
+			  sh->tableOffset, sh->tablePtr, sh->dataOffset, sh->dataPtr,
+			  sh->length );
+	} else {
+	  printf( "Shard %2d: %"PRIu64" of %u files, %"PRIu64" of %"PRIu64
+			  " content bytes used\n", i,
+			  (sh->tablePtr - sh->tableOffset) / h->tableEntrySize,
+			  sh->maxFiles, sh->dataPtr - sh->dataOffset,
+			  sh->length - sh->dataOffset );
+	}
+  }
+}
+
+/*
+  About to write pad bytes from..to, so ask for them, and the window
+  beyond, to be read in, unless that much is already asked for.  Only
+  what no earlier call asked for is asked for now, so concurrent
+  writers (their claims consecutive) share one readahead stream per
+  area.  A lost race just leaves the asking to the winner.
+*/
+static void prefetch( VFS* thiz, uint64_t from, uint64_t to ) {
+
+  uint64_t window = thiz->prefetchBytes;
+  if( window == 0 || !thiz->backing )
+	return;
+
+  VFSHeader* h = &thiz->header;
+  uint64_t* mark;
+  uint64_t limit;
+  if( from < h->dataOffset ) {
+	mark = &thiz->tablePrefetched;
+	limit = h->tableOffset + (uint64_t)h->maxFiles * h->tableEntrySize;
+  } else {
+	mark = &thiz->dataPrefetched;
+	limit = h->length;
+  }
+
+  uint64_t have = __atomic_load_n( mark, __ATOMIC_RELAXED );
+  uint64_t want = to + window;
+  if( want > limit )
+	want = limit;
+  if( to + window / 2 <= have || want <= have )
+	return;
+  if( from < have )
+	from = have;
+  if( !__atomic_compare_exchange_n( mark, &have, want, 0, 
+									__ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+	return;
+
+  if( thiz->engine ) {
+	VFSEngineAdvise( thiz->engine, from, want );
+	return;
+  }
+  uintptr_t page = sysconf( _SC_PAGE_SIZE );
+  uintptr_t start = ((uintptr_t)thiz->backing + from) & ~(page - 1);
+  uintptr_t end = (uintptr_t)thiz->backing + want;
+  madvise( (void*)start, end - start, MADV_WILLNEED );
+}
 
-  //  printf( "Backing: %"PRIx64"\n", (uint64_t)thiz->backing );
+/*
+  The single route by which table and data areas are written: XOR
+  count bytes of buf into the pad at offset.  With prefetch on, a
+  window at a time, each asking for the next.  Through the engine, if
+  any.
+*/
+static void VFSPadXor( VFS* thiz, uint64_t offset, 
+					   const void* buf, size_t count ) {
+  uint64_t window = thiz->prefetchBytes;
+  const uint8_t* bp = buf;
+  while( count > 0 ) {
+	size_t n = window && count > window ? window : count;
+	prefetch( thiz, offset, offset + n );
+	if( thiz->engine )
+	  VFSEngineXor( thiz->engine, offset, bp, n );
+	else
+	  VFSXor( (char*)thiz->backing + offset, bp, n );
+	offset += n;
+	bp += n;
+	count -= n;
+  }
 }
 
-// When fuse sees an 'open'...
 int VFSAddEntry( VFS* thiz, const char* path ) {
 
   VFSHeader* h = &thiz->header;
@@ -105,27 +474,22 @@ int VFSAddEntry( VFS* thiz, const char* path ) {
 	return -ENAMETOOLONG;
 
   // Fill in the data offset in the table entry...
-  VFSTableEntryFixed* te = 
-	(VFSTableEntryFixed*)( thiz->backing + h->tablePtr );
-  te->offset ^= h->dataPtr;
+  VFSPadXor( thiz, h->tablePtr + offsetof( VFSTableEntryFixed, offset ),
+			 &h->dataPtr, sizeof( uint64_t ) );
 
   // Fill in the name in the table entry...
-  char* tableEntryName = 
-	(char*)( thiz->backing + h->tablePtr + sizeof( VFSTableEntryFixed ) );
-  int i;
-  for( i = 0; i < requiredSpace; i++ )
-	tableEntryName[i] ^= path[i];
+  VFSPadXor( thiz, h->tablePtr + sizeof( VFSTableEntryFixed ), 
+			 path, requiredSpace );
 
   /*
 	Note how the table entry length field is NOT filled in until the
 	data length finally known, which is at close/release time.  At that
 	time we also bump the tablePtr to start a new table entry.
   */
-
+  thiz->fileStart = h->dataPtr;
   return 0;
 }
 
-// When fuse sees a 'write'...
 size_t VFSWrite( VFS* thiz, const void* buf, size_t count ) {
 
   VFSHeader* h = &thiz->header;
@@ -137,57 +501,952 @@ size_t VFSWrite( VFS* thiz, const void* buf, size_t count ) {
 
   size_t actual = space > count ? count : space;
  
-  char* dest = (char*)(thiz->backing + h->dataPtr);
-  char* src = (char*)buf;
-  int i;
-  /*
-	Write out to backing, XOR'ing as we go. This renders the data
-	unreadable (LOOK: Is this costing us a byte-by-byte write to
-	backing store??)
-  */
+  // Write out to backing, XOR'ing as we go. This renders the data unreadable
+  VFSPadXor( thiz, h->dataPtr, buf, actual );
 
-  // Thought a word-at-a-time copy would be faster, it isn't!
-  if( 0 ) {
-	int words = actual / sizeof( size_t );
-	int bytes = actual - words * sizeof( size_t );
-
-	size_t* destS = (size_t*)dest;
-	size_t* srcS = (size_t*)src;
-	for( i = 0; i < words; i++ )
-	  destS[i] ^= srcS[i];
-	dest += words * sizeof( size_t );
-	src += words * sizeof( size_t );
-	for( i = 0; i < bytes; i++ )
-	  dest[i] ^= src[i];
-	
-  } else {
-	for( i = 0; i < actual; i++ )
-	  dest[i] ^= src[i];
-  }
-	
-  // Update the data ptr and total length of the file being written...
   h->dataPtr += actual;
-  totalLength += actual;
   return actual;
 }
 
-// When fuse sees a 'release'...
 void VFSRelease( VFS* thiz ) {
   VFSHeader* h = &thiz->header;
-  VFSTableEntryFixed* te = 
-	(VFSTableEntryFixed*)( thiz->backing + h->tablePtr );
 
   // Complete the table entry, with xor'ed length, hence unreadable
-  te->length ^= totalLength;
+  uint64_t length = h->dataPtr - thiz->fileStart;
+  VFSPadXor( thiz, h->tablePtr + offsetof( VFSTableEntryFixed, length ),
+			 &length, sizeof( uint64_t ) );
 
-  // Reset file total length and bump table and data ptrs
-  totalLength = 0;
+  // Bump table and data ptrs
   h->tablePtr += h->tableEntrySize;
   h->dataPtr = alignUp( h->dataPtr, h->padding );
 }
 
+/********************** VFSFile: concurrent writers **********************/
+
+/*
+  All cursors start from the header's pointers, so those files already
+  written, and their data, are as good as reserved, claimed, published.
+*/
+static void VFSCursorsInit( VFS* thiz ) {
+  VFSHeader* h = &thiz->header;
+  thiz->tableReserved = thiz->tableClaim = thiz->tablePublished = h->tablePtr;
+  thiz->dataReserved = thiz->dataClaim = h->dataPtr;
+  thiz->tablePrefetched = thiz->dataPrefetched = 0;
+  thiz->storeBusy = 0;
+  thiz->groupPending = 0;
+  thiz->groupLow = UINT64_MAX;
+  thiz->storedTable = thiz->syncedTable = h->tablePtr;
+  thiz->syncBusy = 0;
+  memset( &thiz->stats, 0, sizeof( VFSStats ) );
+}
+
+static void storeLock( VFS* thiz ) {
+  while( __atomic_test_and_set( &thiz->storeBusy, __ATOMIC_ACQUIRE ) )
+	sched_yield();
+}
+
+static void storeUnlock( VFS* thiz ) {
+  __atomic_clear( &thiz->storeBusy, __ATOMIC_RELEASE );
+}
+
+/*
+  Under storeLock, store the header as advanced by a flush or publish.
+  Under group durability, the tablePtr stored stays that of the last
+  group flush, but the dataPtr still goes out with every claim, so a
+  remount never hands out pad that may already be on the device.
+*/
+static void storeHeader( VFS* thiz ) {
+  VFSHeader* h = &thiz->header;
+  uint64_t tablePtr = h->tablePtr;
+  if( thiz->durability == VERNAMFS_DURABILITY_GROUP )
+	h->tablePtr = thiz->storedTable;
+  VFSStore( thiz );
+  h->tablePtr = tablePtr;
+  thiz->stats.stores++;
+}
+
+static uint64_t nanos( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sync pad bytes from..to to the device, whole pages, waiting
+static void padSync( VFS* thiz, uint64_t from, uint64_t to ) {
+  if( from >= to )
+	return;
+  if( thiz->engine && to > VERNAMFS_HEADERMAPSIZE ) {
+	VFSEngineSync( thiz->engine, from, to );
+	return;
+  }
+  uintptr_t page = sysconf( _SC_PAGE_SIZE );
+  uintptr_t start = ((uintptr_t)thiz->backing + from) & ~(page - 1);
+  uintptr_t end = (uintptr_t)thiz->backing + to;
+  msync( (void*)start, end - start, MS_SYNC );
+}
+
+// Sync the header, or for a shard view, its shard's pointers
+static void headerSync( VFS* thiz ) {
+  uint64_t end = thiz->shard >= 0 ? 
+	VERNAMFS_SHARDSOFFSET + (thiz->shard + 1) * sizeof( VFSShardHeader ) :
+	VFSHeaderExtent( thiz );
+  padSync( thiz, 0, end );
+}
+
+static void countFlush( VFS* thiz, int files, uint64_t took ) {
+  VFSStats* st = &thiz->stats;
+  __atomic_fetch_add( &st->flushes, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &st->flushFiles, files, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &st->flushNanos, took, __ATOMIC_RELAXED );
+  uint64_t max = __atomic_load_n( &st->maxFlushNanos, __ATOMIC_RELAXED );
+  while( took > max &&
+		 !__atomic_compare_exchange_n( &st->maxFlushNanos, &max, took, 1,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+	;
+}
+
+/*
+  One ordered flush of all releases published since the last: their
+  data, then the table up to the last of them, then a header whose
+  tablePtr covers just those.  The pointers are snapshotted first,
+  since publishing carries on meanwhile.  The dataPtr stored is the
+  latest, never behind what claims since have stored.  Should another
+  flush be under way, leaves the pending releases to the next.
+*/
+static void VFSGroupFlush( VFS* thiz ) {
+
+  if( __atomic_test_and_set( &thiz->syncBusy, __ATOMIC_ACQUIRE ) )
+	return;
+
+  VFSHeader* h = &thiz->header;
+  storeLock( thiz );
+  int files = thiz->groupPending;
+  uint64_t low = thiz->groupLow;
+  uint64_t tablePtr = h->tablePtr;
+  uint64_t dataPtr = h->dataPtr;
+  thiz->groupPending = 0;
+  thiz->groupLow = UINT64_MAX;
+  storeUnlock( thiz );
+
+  if( files > 0 ) {
+	uint64_t t0 = nanos();
+	padSync( thiz, low, dataPtr );
+	padSync( thiz, thiz->syncedTable, tablePtr );
+
+	storeLock( thiz );
+	thiz->storedTable = tablePtr;
+	storeHeader( thiz );
+	storeUnlock( thiz );
+
+	headerSync( thiz );
+	thiz->syncedTable = tablePtr;
+	countFlush( thiz, files, nanos() - t0 );
+  }
+  __atomic_clear( &thiz->syncBusy, __ATOMIC_RELEASE );
+}
+
+/*
+  Add amount to *counter, unless that would take it past limit.
+  @return 0 if added, -1 if not.
+*/
+static int reserve( uint64_t* counter, uint64_t amount, uint64_t limit ) {
+  uint64_t current = __atomic_load_n( counter, __ATOMIC_RELAXED );
+  do {
+	if( current + amount > limit )
+	  return -1;
+  } while( !__atomic_compare_exchange_n( counter, &current, current + amount,
+										 1, __ATOMIC_RELAXED, 
+										 __ATOMIC_RELAXED ) );
+  return 0;
+}
+
+int VFSFileOpen( VFS* thiz, const char* path, VFSFile** result ) {
+
+  VFSHeader* h = &thiz->header;
+
+  /*
+	The 1 is due to us needing to add a NULL to the stored name.  A
+	rotating file's parts need room for a .NNNN suffix too.
+  */
+  int requiredSpace = strlen( path ) + 1;
+  if( thiz->rotateBytes || thiz->rotateSecs )
+	requiredSpace += 5;
+  int maxNameLength =  h->tableEntrySize - sizeof( VFSTableEntryFixed );
+  if( requiredSpace > maxNameLength )
+	return -ENAMETOOLONG;
+
+  // Reserve a table slot, claimed for real at release
+  uint64_t tableEnd = h->tableOffset + 
+	(uint64_t)h->maxFiles * h->tableEntrySize;
+  if( reserve( &thiz->tableReserved, h->tableEntrySize, tableEnd ) )
+	return -ENOSPC;
+
+  VFSFile* f = calloc( 1, sizeof( VFSFile ) );
+  if( f )
+	f->name = strdup( path );
+  if( !f || !f->name ) {
+	free( f );
+	__atomic_fetch_sub( &thiz->tableReserved, h->tableEntrySize, 
+						__ATOMIC_RELAXED );
+	return -ENOMEM;
+  }
+  f->vfs = thiz;
+  f->partStarted = time( NULL );
+
+  // Chained, the most we ever stage is one extent's content
+  if( VFSChained( thiz ) ) {
+	f->capacity = VFSCombineSize( thiz ) - sizeof( VFSExtentHeader );
+	f->data = malloc( f->capacity );
+	if( !f->data ) {
+	  free( f->name );
+	  free( f );
+	  __atomic_fetch_sub( &thiz->tableReserved, h->tableEntrySize, 
+						  __ATOMIC_RELAXED );
+	  return -ENOMEM;
+	}
+  }
+  *result = f;
+  return 0;
+}
+
+/*
+  Claim a chained file's reservation for its next extent.  A full
+  extent, combine-size bytes, starts on a combine-size boundary, so
+  that it reaches the pad in one erase block, say, not straddling two.
+  The gap skipped is reserved first, unless the pad is too full, when
+  the extent just goes where the cursor is.  Gaps are multiples of
+  the padding, so the cursor stays padding-aligned.
+*/
+static uint64_t claimExtent( VFSFile* thiz ) {
+  VFS* vfs = thiz->vfs;
+  uint64_t size = sizeof( VFSExtentHeader ) + thiz->capacity;
+  if( thiz->reserved != size )
+	return __atomic_fetch_add( &vfs->dataClaim, thiz->reserved,
+							   __ATOMIC_RELAXED );
+  uint64_t claim = __atomic_load_n( &vfs->dataClaim, __ATOMIC_RELAXED );
+  while( 1 ) {
+	uint64_t start = alignUp( claim, size );
+	uint64_t gap = start - claim;
+	if( gap && reserve( &vfs->dataReserved, gap, vfs->header.length ) )
+	  return __atomic_fetch_add( &vfs->dataClaim, size, __ATOMIC_RELAXED );
+	if( __atomic_compare_exchange_n( &vfs->dataClaim, &claim, start + size,
+									 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+	  return start;
+	if( gap )
+	  __atomic_fetch_sub( &vfs->dataReserved, gap, __ATOMIC_RELAXED );
+  }
+}
+
+/*
+  Claim our reservation as the file's next extent and write out the
+  staged content there.  The previous extent's header, now that its
+  next is known, is written too.  Then store a header covering the
+  new extent, so that, whatever happens to this file, no later mount
+  hands out that pad space again.
+*/
+static void VFSFileFlush( VFSFile* thiz ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+  uint64_t count = thiz->length - thiz->flushed;
+
+  uint64_t extent = claimExtent( thiz );
+  VFSPadXor( vfs, extent + sizeof( VFSExtentHeader ), thiz->data, count );
+  if( thiz->lastExtent ) {
+	VFSExtentHeader eh = { .next = extent, 
+						   .length = thiz->lastExtentLength };
+	VFSPadXor( vfs, thiz->lastExtent, &eh, sizeof( eh ) );
+  } else {
+	thiz->firstExtent = extent;
+  }
+  uint64_t previous = thiz->lastExtent;
+  thiz->lastExtent = extent;
+  thiz->lastExtentLength = count;
+  thiz->flushed = thiz->length;
+  thiz->reserved = 0;
+
+  // Per-file durability: the extent, and the header before it, first
+  uint64_t t0 = 0;
+  if( vfs->durability == VERNAMFS_DURABILITY_FILE ) {
+	t0 = nanos();
+	if( previous )
+	  padSync( vfs, previous, previous + sizeof( VFSExtentHeader ) );
+	padSync( vfs, extent, extent + sizeof( VFSExtentHeader ) + count );
+  }
+
+  storeLock( vfs );
+  h->dataPtr = __atomic_load_n( &vfs->dataClaim, __ATOMIC_RELAXED );
+  storeHeader( vfs );
+  storeUnlock( vfs );
+
+  if( vfs->durability == VERNAMFS_DURABILITY_FILE ) {
+	headerSync( vfs );
+	countFlush( vfs, 0, nanos() - t0 );
+  }
+}
+
+/*
+  Append count bytes of buf, or of zeros if buf NULL, to a chained
+  file, reserving pad space as the staged extent grows, and flushing
+  it whenever full.
+*/
+static int VFSFileAppend( VFSFile* thiz, const void* buf, size_t count ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+  const uint8_t* bp = buf;
+
+  while( count > 0 ) {
+	uint64_t staged = thiz->length - thiz->flushed;
+	uint64_t n = thiz->capacity - staged;
+	if( n > count )
+	  n = count;
+
+	uint64_t reserved = alignUp( sizeof( VFSExtentHeader ) + staged + n, 
+								 h->padding );
+	if( reserved > thiz->reserved ) {
+	  if( reserve( &vfs->dataReserved, reserved - thiz->reserved, 
+				   h->length ) )
+		return -ENOSPC;
+	  thiz->reserved = reserved;
+	}
+
+	if( bp ) {
+	  memcpy( thiz->data + staged, bp, n );
+	  bp += n;
+	} else {
+	  memset( thiz->data + staged, 0, n );
+	}
+	thiz->length += n;
+	count -= n;
+	if( thiz->length - thiz->flushed == thiz->capacity )
+	  VFSFileFlush( thiz );
+  }
+  return 0;
+}
+
+/*
+  Writes land in the staged extent.  Any earlier content is already
+  on the pad, so cannot be written again.
+*/
+static int VFSFileWriteChained( VFSFile* thiz, const void* buf, 
+								size_t count, uint64_t offset ) {
+
+  if( offset < thiz->flushed )
+	return -EINVAL;
+
+  const uint8_t* bp = buf;
+  size_t remaining = count;
+  if( offset < thiz->length ) {
+	uint64_t n = thiz->length - offset;
+	if( n > remaining )
+	  n = remaining;
+	memcpy( thiz->data + (offset - thiz->flushed), bp, n );
+	bp += n;
+	remaining -= n;
+	offset += n;
+  }
+
+  // Any hole left by a seek past the end reads back as zeros
+  int sc = 0;
+  if( offset > thiz->length )
+	sc = VFSFileAppend( thiz, NULL, offset - thiz->length );
+  if( sc == 0 )
+	sc = VFSFileAppend( thiz, bp, remaining );
+  return sc ? sc : count;
+}
+
+static void VFSFileCommit( VFSFile* thiz );
+
+/*
+  Is the current part of a rotating file (see VFSSetRotation) due to
+  be ended?
+*/
+static int rotationDue( VFSFile* thiz ) {
+  VFS* vfs = thiz->vfs;
+  if( vfs->rotateBytes && thiz->length >= vfs->rotateBytes )
+	return 1;
+  if( vfs->rotateSecs && thiz->length > 0 &&
+	  time( NULL ) - thiz->partStarted >= vfs->rotateSecs )
+	return 1;
+  return 0;
+}
+
+/*
+  End the current part: commit it, under its own table entry, as if
+  released, and start the next, in a fresh table slot.  If no slot is
+  left, or no suffix, the current part just carries on growing.
+*/
+static void VFSFileRotate( VFSFile* thiz ) {
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+  if( thiz->part >= VERNAMFS_MAXPART )
+	return;
+  uint64_t tableEnd = h->tableOffset + 
+	(uint64_t)h->maxFiles * h->tableEntrySize;
+  if( reserve( &vfs->tableReserved, h->tableEntrySize, tableEnd ) )
+	return;
+  VFSFileCommit( thiz );
+  thiz->base += thiz->length;
+  thiz->length = 0;
+  thiz->flushed = 0;
+  thiz->firstExtent = thiz->lastExtent = 0;
+  thiz->lastExtentLength = 0;
+  thiz->part++;
+  thiz->partStarted = time( NULL );
+}
+
+int VFSFileWrite( VFSFile* thiz, const void* buf, size_t count, 
+				  uint64_t offset ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+
+  /*
+	Rotate only on writes past all content so far, i.e. appends, the
+	usual pattern for a long-running writer.  Offsets are then
+	relative to the current part.
+  */
+  if( offset >= thiz->base + thiz->length && rotationDue( thiz ) )
+	VFSFileRotate( thiz );
+  if( offset < thiz->base )
+	return -EINVAL;
+  offset -= thiz->base;
+  uint64_t end = offset + count;
+
+  if( VFSChained( vfs ) )
+	return VFSFileWriteChained( thiz, buf, count, offset );
+
+  /*
+	Reserve pad space for any growth, so that the extent claimed at
+	release is sure to fit.  Reservations are padding-aligned, as are
+	the extents themselves.
+  */
+  if( end > thiz->length ) {
+	uint64_t reserved = alignUp( end, h->padding );
+	if( reserved > thiz->reserved ) {
+	  if( reserve( &vfs->dataReserved, reserved - thiz->reserved, 
+				   h->length ) )
+		return -ENOSPC;
+	  thiz->reserved = reserved;
+	}
+  }
+
+  if( end > thiz->capacity ) {
+	uint64_t capacity = thiz->capacity ? 2 * thiz->capacity : 4096;
+	while( capacity < end )
+	  capacity *= 2;
+	uint8_t* data = realloc( thiz->data, capacity );
+	if( !data )
+	  return -ENOMEM;
+	thiz->data = data;
+	thiz->capacity = capacity;
+  }
+
+  // Any hole left by a seek past the end reads back as zeros
+  if( offset > thiz->length )
+	memset( thiz->data + thiz->length, 0, offset - thiz->length );
+  memcpy( thiz->data + offset, buf, count );
+  if( end > thiz->length )
+	thiz->length = end;
+  return count;
+}
+
+static void pipelinePut( struct VFSPipeline* thiz, VFSFile* f );
+
+/*
+  The work of a release, whether done by the releasing caller or by a
+  pipeline's worker.
+*/
+static void VFSFileFinish( VFSFile* thiz ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+
+  // A rotated file's last part, if empty, needs no entry, nor its slot
+  if( thiz->part > 0 && thiz->length == 0 )
+	__atomic_fetch_sub( &vfs->tableReserved, h->tableEntrySize, 
+						__ATOMIC_RELAXED );
+  else
+	VFSFileCommit( thiz );
+
+  free( thiz->data );
+  free( thiz->name );
+  free( thiz );
+}
+
+int VFSFileRelease( VFSFile* thiz ) {
+  if( thiz->vfs->pipeline )
+	pipelinePut( thiz->vfs->pipeline, thiz );
+  else
+	VFSFileFinish( thiz );
+  return 0;
+}
+
+/*
+  Write out the file (or current part of a rotating file) and its
+  table entry, then publish.  Part 0 has the file's own name, later
+  parts have .0001, .0002, etc appended.
+*/
+static void VFSFileCommit( VFSFile* thiz ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+
+  /*
+	Our table entry and data extent, ours alone once claimed.  Both
+	fit, given the reservations made at open and write.  The extent is
+	exactly our reservation, so the data cursor stays padding-aligned.
+  */
+  uint64_t tablePtr = __atomic_fetch_add( &vfs->tableClaim, 
+										  h->tableEntrySize, 
+										  __ATOMIC_RELAXED );
+  VFSTableEntryFixed tef;
+  if( VFSChained( vfs ) ) {
+	// The last extent, then its header, the end of the chain
+	if( thiz->length > thiz->flushed )
+	  VFSFileFlush( thiz );
+	if( thiz->lastExtent ) {
+	  VFSExtentHeader eh = { .next = 0, .length = thiz->lastExtentLength };
+	  VFSPadXor( vfs, thiz->lastExtent, &eh, sizeof( eh ) );
+	}
+	tef.offset = thiz->firstExtent;
+	tef.length = thiz->length | VERNAMFS_LENGTH_CHAINED;
+  } else {
+	uint64_t dataPtr = __atomic_fetch_add( &vfs->dataClaim, thiz->reserved,
+										   __ATOMIC_RELAXED );
+	VFSPadXor( vfs, dataPtr, thiz->data, thiz->length );
+	tef.offset = dataPtr;
+	tef.length = thiz->length;
+	thiz->reserved = 0;
+  }
+
+  char name[VERNAMFS_MAXTABLEENTRYSIZE];
+  if( thiz->part )
+	snprintf( name, sizeof( name ), "%s.%04d", thiz->name, thiz->part );
+  else
+	strcpy( name, thiz->name );
+  VFSPadXor( vfs, tablePtr, &tef, sizeof( tef ) );
+  VFSPadXor( vfs, tablePtr + sizeof( VFSTableEntryFixed ), 
+			 name, strlen( name ) + 1 );
+
+  // Per-file durability: the data, then the table entry, before publishing
+  uint64_t t0 = 0;
+  if( vfs->durability == VERNAMFS_DURABILITY_FILE ) {
+	t0 = nanos();
+	if( VFSChained( vfs ) ) {
+	  if( thiz->lastExtent )
+		padSync( vfs, thiz->lastExtent, thiz->lastExtent + 
+				 sizeof( VFSExtentHeader ) + thiz->lastExtentLength );
+	} else {
+	  padSync( vfs, tef.offset, tef.offset + thiz->length );
+	}
+	padSync( vfs, tablePtr, tablePtr + h->tableEntrySize );
+  }
+
+  /*
+	Publish: wait for every earlier table entry to be published, then
+	store a header covering ours.  So the stored tablePtr never spans
+	an incomplete entry.  The stored dataPtr covers all extents
+	claimed so far, complete or not, so none is ever handed out again.
+	Only the publishing step is serialized, and only briefly.
+  */
+  while( __atomic_load_n( &vfs->tablePublished, __ATOMIC_ACQUIRE ) != 
+		 tablePtr )
+	sched_yield();
+  storeLock( vfs );
+  h->tablePtr = tablePtr + h->tableEntrySize;
+  h->dataPtr = __atomic_load_n( &vfs->dataClaim, __ATOMIC_RELAXED );
+  storeHeader( vfs );
+  int pending = 0;
+  if( vfs->durability == VERNAMFS_DURABILITY_GROUP ) {
+	if( thiz->length && tef.offset < vfs->groupLow )
+	  vfs->groupLow = tef.offset;
+	pending = ++vfs->groupPending;
+  }
+  storeUnlock( vfs );
+  __atomic_store_n( &vfs->tablePublished, tablePtr + h->tableEntrySize, 
+					__ATOMIC_RELEASE );
+
+  __atomic_fetch_add( &vfs->stats.files, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &vfs->stats.bytes, thiz->length, __ATOMIC_RELAXED );
+  if( vfs->durability == VERNAMFS_DURABILITY_FILE ) {
+	headerSync( vfs );
+	countFlush( vfs, 1, nanos() - t0 );
+  } else if( vfs->groupFiles && pending >= vfs->groupFiles ) {
+	VFSGroupFlush( vfs );
+  }
+}
+
+/********************** VFSPipeline: background release **********************/
+
+/*
+  A bounded queue of released files, many releasers in, one worker
+  out.  Releasers take a free slot (waiting if none), then the next
+  position, by atomic increment, so no lock is held.  The worker takes
+  positions in order, so files are written out in release order.
+  Slots are NULL when empty, a releaser between taking a position and
+  filling it being awaited by the worker.
+*/
+struct VFSPipeline {
+  int depth;
+  VFSFile** slots;
+  uint64_t head, tail;
+  sem_t free, queued;
+  pthread_t worker;
+};
+
+static void semWait( sem_t* s ) {
+  while( sem_wait( s ) && errno == EINTR )
+	;
+}
+
+static void pipelinePut( struct VFSPipeline* thiz, VFSFile* f ) {
+  semWait( &thiz->free );
+  uint64_t i = __atomic_fetch_add( &thiz->tail, 1, __ATOMIC_RELAXED );
+  __atomic_store_n( thiz->slots + i % thiz->depth, f, __ATOMIC_RELEASE );
+  sem_post( &thiz->queued );
+}
+
+/*
+  Runs until woken with nothing queued, which only VFSStopPipeline
+  does, once no more releases can come.
+*/
+static void* pipelineWorker( void* arg ) {
+  struct VFSPipeline* thiz = arg;
+  while( 1 ) {
+	semWait( &thiz->queued );
+	if( thiz->head == __atomic_load_n( &thiz->tail, __ATOMIC_RELAXED ) )
+	  break;
+	VFSFile** slot = thiz->slots + thiz->head % thiz->depth;
+	VFSFile* f;
+	while( !(f = __atomic_load_n( slot, __ATOMIC_ACQUIRE )) )
+	  sched_yield();
+	*slot = NULL;
+	thiz->head++;
+	sem_post( &thiz->free );
+	VFSFileFinish( f );
+  }
+  return NULL;
+}
+
+void VFSSetPipeline( VFS* thiz, int depth ) {
+  thiz->pipelineDepth = depth;
+}
+
+int VFSStartPipeline( VFS* thiz ) {
+
+  if( thiz->pipelineDepth <= 0 || thiz->pipeline )
+	return 0;
+
+  struct VFSPipeline* p = calloc( 1, sizeof( struct VFSPipeline ) );
+  if( !p )
+	return -1;
+  p->depth = thiz->pipelineDepth;
+  p->slots = calloc( p->depth, sizeof( VFSFile* ) );
+  if( !p->slots ) {
+	free( p );
+	return -1;
+  }
+  sem_init( &p->free, 0, p->depth );
+  sem_init( &p->queued, 0, 0 );
+  if( pthread_create( &p->worker, NULL, pipelineWorker, p ) ) {
+	sem_destroy( &p->free );
+	sem_destroy( &p->queued );
+	free( p->slots );
+	free( p );
+	return -1;
+  }
+  thiz->pipeline = p;
+  return 0;
+}
+
+void VFSStopPipeline( VFS* thiz ) {
+
+  struct VFSPipeline* p = thiz->pipeline;
+  if( !p )
+	return;
+
+  sem_post( &p->queued );
+  pthread_join( p->worker, NULL );
+  thiz->pipeline = NULL;
+  sem_destroy( &p->free );
+  sem_destroy( &p->queued );
+  free( p->slots );
+  free( p );
+}
+
+/********************** Durability **********************/
+
+/*
+  Wakes every msecs to flush any pending releases, until stopped.
+*/
+struct VFSGroupTimer {
+  VFS* vfs;
+  sem_t stop;
+  pthread_t thread;
+};
+
+static void* groupTimer( void* arg ) {
+  struct VFSGroupTimer* thiz = arg;
+  int msecs = thiz->vfs->groupMsecs;
+  while( 1 ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	ts.tv_sec += msecs / 1000;
+	ts.tv_nsec += (msecs % 1000) * 1000000L;
+	if( ts.tv_nsec >= 1000000000L ) {
+	  ts.tv_sec++;
+	  ts.tv_nsec -= 1000000000L;
+	}
+	if( sem_timedwait( &thiz->stop, &ts ) == 0 )
+	  break;
+	if( errno == ETIMEDOUT )
+	  VFSGroupFlush( thiz->vfs );
+  }
+  return NULL;
+}
+
+void VFSSetDurability( VFS* thiz, int mode, int files, int msecs ) {
+  thiz->durability = mode;
+  thiz->groupFiles = files;
+  thiz->groupMsecs = msecs;
+}
+
+int VFSStartGroupCommit( VFS* thiz ) {
+
+  if( thiz->durability != VERNAMFS_DURABILITY_GROUP || 
+	  thiz->groupMsecs <= 0 || thiz->groupTimer )
+	return 0;
+
+  struct VFSGroupTimer* t = calloc( 1, sizeof( struct VFSGroupTimer ) );
+  if( !t )
+	return -1;
+  t->vfs = thiz;
+  sem_init( &t->stop, 0, 0 );
+  if( pthread_create( &t->thread, NULL, groupTimer, t ) ) {
+	sem_destroy( &t->stop );
+	free( t );
+	return -1;
+  }
+  thiz->groupTimer = t;
+  return 0;
+}
+
+void VFSStopGroupCommit( VFS* thiz ) {
+
+  struct VFSGroupTimer* t = thiz->groupTimer;
+  if( t ) {
+	sem_post( &t->stop );
+	pthread_join( t->thread, NULL );
+	thiz->groupTimer = NULL;
+	sem_destroy( &t->stop );
+	free( t );
+  }
+  if( thiz->durability == VERNAMFS_DURABILITY_GROUP )
+	VFSGroupFlush( thiz );
+}
+
+void VFSReportStats( VFS* thiz ) {
+  VFSStats* st = &thiz->stats;
+  static const char* modes[] = { "lazy", "file", "group" };
+  printf( "Durability                              : %s\n",
+		  modes[thiz->durability] );
+  printf( "Files written                           : %"PRIu64"\n", 
+		  st->files );
+  printf( "Content bytes written                   : %"PRIu64"\n", 
+		  st->bytes );
+  printf( "Header stores                           : %"PRIu64"\n", 
+		  st->stores );
+  printf( "Flushes (files)                         : %"PRIu64
+		  " (%"PRIu64")\n", st->flushes, st->flushFiles );
+  if( st->flushes ) {
+	printf( "Flush time total/mean/max (usecs)       : %"PRIu64
+			"/%"PRIu64"/%"PRIu64"\n", st->flushNanos / 1000, 
+			st->flushNanos / st->flushes / 1000, st->maxFlushNanos / 1000 );
+  }
+}
+
+/********************** VFSLog: record logs **********************/
+
+int VFSLogOpen( VFS* thiz, const char* path, uint64_t commitBytes, 
+				VFSLog** result ) {
+
+  VFSHeader* h = &thiz->header;
+
+  if( h->tablePtr == h->tableOffset + h->maxFiles * h->tableEntrySize )
+	return -ENOSPC;
+
+  // The 1 is due to us needing to add a NULL to the stored name.
+  int requiredSpace = strlen( path ) + 1;
+  int maxNameLength =  h->tableEntrySize - sizeof( VFSTableEntryFixed );
+  if( requiredSpace > maxNameLength )
+	return -ENAMETOOLONG;
+
+  VFSLog* l = calloc( 1, sizeof( VFSLog ) );
+  if( l ) {
+	l->name = strdup( path );
+	l->buffer = malloc( VFSCombineSize( thiz ) );
+  }
+  if( !l || !l->name || !l->buffer ) {
+	if( l ) {
+	  free( l->name );
+	  free( l->buffer );
+	}
+	free( l );
+	return -ENOMEM;
+  }
+  l->vfs = thiz;
+  l->commitBytes = commitBytes;
+  l->start = l->stored = h->dataPtr;
+  *result = l;
+  return 0;
+}
+
+/*
+  Write the buffered bytes onto the pad, in one go, first storing a
+  dataPtr covering them.
+*/
+static void VFSLogFlush( VFSLog* thiz ) {
+
+  if( thiz->buffered == 0 )
+	return;
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+  uint64_t end = thiz->start + thiz->length;
+
+  if( end > thiz->stored ) {
+	thiz->stored = end;
+	h->dataPtr = end;
+	VFSStore( vfs );
+  }
+  VFSPadXor( vfs, end - thiz->buffered, thiz->buffer, thiz->buffered );
+  thiz->buffered = 0;
+}
+
+/*
+  Add count bytes to the segment, via the buffer, flushing it whenever
+  the segment reaches a multiple of the combine size.
+*/
+static void VFSLogPut( VFSLog* thiz, const void* buf, uint64_t count ) {
+
+  uint64_t size = VFSCombineSize( thiz->vfs );
+  const uint8_t* bp = buf;
+
+  while( count > 0 ) {
+	uint64_t end = thiz->start + thiz->length;
+	uint64_t room = size - end % size;
+	uint64_t n = room < count ? room : count;
+	memcpy( thiz->buffer + thiz->buffered, bp, n );
+	thiz->buffered += n;
+	thiz->length += n;
+	bp += n;
+	count -= n;
+	if( n == room )
+	  VFSLogFlush( thiz );
+  }
+}
+
+int VFSLogAppend( VFSLog* thiz, const void* record, uint32_t length ) {
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+
+  // A new segment will need its table entry
+  if( thiz->length == 0 && 
+	  h->tablePtr == h->tableOffset + h->maxFiles * h->tableEntrySize )
+	return -ENOSPC;
+
+  uint64_t end = thiz->start + thiz->length + sizeof( length ) + length;
+  if( end > h->length )
+	return -ENOSPC;
+
+  VFSLogPut( thiz, &length, sizeof( length ) );
+  VFSLogPut( thiz, record, length );
+
+  if( thiz->length >= thiz->commitBytes )
+	VFSLogCommit( thiz );
+  return 0;
+}
+
+void VFSLogCommit( VFSLog* thiz ) {
+
+  if( thiz->length == 0 )
+	return;
+
+  VFS* vfs = thiz->vfs;
+  VFSHeader* h = &vfs->header;
+
+  VFSLogFlush( thiz );
+
+  VFSTableEntryFixed tef = { .offset = thiz->start,
+							 .length = thiz->length | VERNAMFS_LENGTH_RECORDS };
+  VFSPadXor( vfs, h->tablePtr, &tef, sizeof( tef ) );
+  VFSPadXor( vfs, h->tablePtr + sizeof( VFSTableEntryFixed ), 
+			 thiz->name, strlen( thiz->name ) + 1 );
+
+  thiz->start = alignUp( thiz->start + thiz->length, h->padding );
+  if( thiz->start > h->length )
+	thiz->start = h->length;
+  thiz->length = 0;
+  thiz->stored = thiz->start;
+
+  h->tablePtr += h->tableEntrySize;
+  h->dataPtr = thiz->start;
+  VFSStore( vfs );
+}
+
+void VFSLogClose( VFSLog* thiz ) {
+  VFSLogCommit( thiz );
+  free( thiz->buffer );
+  free( thiz->name );
+  free( thiz );
+}
+
+int VFSLogSplit( const void* segment, uint64_t length, int fd ) {
+  const uint8_t* bp = segment;
+  uint64_t offset = 0;
+  int records = 0;
+  while( offset < length ) {
+	uint32_t recordLength;
+	if( offset + sizeof( recordLength ) > length )
+	  return -1;
+	memcpy( &recordLength, bp + offset, sizeof( recordLength ) );
+	offset += sizeof( recordLength );
+	if( offset + recordLength > length )
+	  return -1;
+	if( write( fd, bp + offset, recordLength ) != recordLength ||
+		write( fd, "\n", 1 ) != 1 )
+	  return -1;
+	offset += recordLength;
+	records++;
+  }
+  return records;
+}
+
 /********************** Private Impl: Header Read/Write ******************/
 
+/*
+  Given user's suggested maxNameLength, we minimise our VFSTableEntry
+  size such that it can hold the required fixed parts (currently
+  offset and length) and a name of length at least the maxNameLength,
+  and we pad size of VFSTableEntry up to next 2^N.  We know the loop
+  test will succeed, since we checked maxNameLength too big first.
+*/
+int VFSTableEntrySize( int maxNameLength ) {
+  if( maxNameLength < 1 || maxNameLength > VERNAMFS_MAXNAMELENGTH )
+	return -1;
+  int i;
+  for( i = VERNAMFS_MINTABLEENTRYSIZE; i <= VERNAMFS_MAXTABLEENTRYSIZE; i<<=1) {
+	// The 1 is needed for the NULL terminating the name
+	uint64_t spaceForName = i - sizeof( VFSTableEntryFixed ) - 1;
+	if( maxNameLength <= spaceForName )
+	  return i;
+  }
+  return -1;
+}
+
 /**
  * @param length - Desired length of the entire VFS, in bytes.  The
  * length comprises the header, the FAT and the data area.
@@ -198,41 +1457,29 @@ void VFSRelease( VFS* thiz ) {
  * @param maxNameLength - How long file names can be in the VFS.
  * Affects FAT entry size and thus FAT size.  Typical values are 32,
  * 64.  FAT entry size is rounded up for next pow2.
+ *
+ * @param alignment - File content alignment, 0 for page.  The minimum
+ * data area is one alignment unit per file.
  */
-static int VFSHeaderInit( VFSHeader* thiz, size_t length, 
-						  int maxFiles, int maxNameLength ) {
+static int VFSHeaderInit( VFSHeader* thiz, uint64_t length, 
+						  int maxFiles, int maxNameLength, 
+						  uint64_t alignment ) {
   
   if( maxFiles < 1 )
 	return -1;
-  if( maxNameLength < 1 || maxNameLength > VERNAMFS_MAXNAMELENGTH )
+  int tableEntrySize = VFSTableEntrySize( maxNameLength );
+  if( tableEntrySize < 0 )
 	return -1;
 
-  // LOOK: Would this be better off as sectorSize == 512 bytes??
-  uint64_t padding = sysconf( _SC_PAGE_SIZE );
+  uint64_t page = sysconf( _SC_PAGE_SIZE );
+  uint64_t padding = alignment ? alignment : page;
+  if( padding > page || (padding & (padding - 1)) )
+	return -1;
 
-  // The VFSHeader comes first, the table next, at padded offset
-  uint64_t tableOffset = alignUp( sizeof( VFSHeader ), padding );
+  // The VFSHeader comes first, the table next, at page-aligned offset
+  uint64_t tableOffset = alignUp( sizeof( VFSHeader ), page );
 
-  /* 
-	 Given user's suggested maxNameLength, we minimise our
-	 VFSTableEntry size such that it can hold the required fixed parts
-	 (currently offset and length) and a name of length at least the
-	 maxNameLength, and we pad size of VFSTableEntry up to next 2^N.
-	 We know the loop test will succeed, since we checked
-	 maxNameLength too big above.
-  */
-  uint32_t tableEntrySize;
-  int i;
-  for( i = VERNAMFS_MINTABLEENTRYSIZE; i <= VERNAMFS_MAXTABLEENTRYSIZE; i<<=1) {
-	// The 1 is needed for the NULL terminating the name
-	uint64_t spaceForName = i - sizeof( VFSTableEntryFixed ) - 1;
-	if( maxNameLength <= spaceForName ) {
-	  tableEntrySize = i;
-	  break;
-	}
-  }
-
-  uint64_t tableExtent = alignUp( maxFiles * tableEntrySize, padding );
+  uint64_t tableExtent = alignUp( maxFiles * tableEntrySize, page );
 
   uint64_t minDataArea = maxFiles * padding;
 
@@ -253,7 +1500,7 @@ static int VFSHeaderInit( VFSHeader* thiz, size_t length,
   thiz->type = FILESYSTEMTYPE_ENCRYPTEDFAT;
   thiz->version = (MAJOR_VERSION << 16) | (MINOR_VERSION << 8) |
 	PATCH_VERSION;
-  thiz->flags = 0;
+  thiz->flags = VERNAMFS_FLAGS_SLOTS;
   thiz->length = length;
   thiz->padding = padding;
 
@@ -297,6 +1544,13 @@ static void VFSHeaderReport( VFSHeader* h, int expert ) {
 			h->length );
 	printf( "Maximum file name length                : %d\n",
 			h->tableEntrySize - (int)sizeof( VFSTableEntryFixed ) - 1);
+	printf( "File content alignment (bytes)          : %"PRIu64"\n",
+			h->padding );
+	printf( "Pad keystream                           : %s\n",
+			VFSKeystreamName( h->flags & VERNAMFS_FLAGS_PADTYPE ) );
+	printf( "File content layout                     : %s\n",
+			h->flags & VERNAMFS_FLAGS_CHAINED ? "chained extents" : 
+			"contiguous" );
 	printf( "\n" );
 	printf( "Number of files the filesystem can hold : %d\n",
 			h->maxFiles );
@@ -316,6 +1570,56 @@ static void VFSHeaderLoad( VFSHeader* hTarget, void* addr ) {
   *hTarget = *hSource;
 }
 
+/*
+  FNV-1a over all but the checksum itself.  Never 0 for an all-zeros
+  slot, so a cleared slot is never valid.
+*/
+static uint32_t slotChecksum( const VFSCursorSlot* slot ) {
+  const uint8_t* bp = (const uint8_t*)slot;
+  uint32_t result = 2166136261u;
+  size_t i;
+  for( i = 0; i < offsetof( VFSCursorSlot, checksum ); i++ ) {
+	result ^= bp[i];
+	result *= 16777619u;
+  }
+  return result;
+}
+
+static VFSCursorSlot* slotAt( void* backing, int unit, int which ) {
+  return (VFSCursorSlot*)((char*)backing + VERNAMFS_SLOTSOFFSET) + 
+	2 * unit + which;
+}
+
+/*
+  Unit 0 is the VFS itself, unit i+1 its shard i.  The slot written
+  is the one not holding the previous sequence.
+*/
+static void slotWrite( void* backing, int unit, uint64_t sequence,
+					   uint64_t tablePtr, uint64_t dataPtr ) {
+  VFSCursorSlot slot = { .sequence = sequence, .tablePtr = tablePtr,
+						 .dataPtr = dataPtr, .unused = 0 };
+  slot.checksum = slotChecksum( &slot );
+  *slotAt( backing, unit, sequence & 1 ) = slot;
+}
+
+/*
+  @return the sequence of the newer valid slot of the unit, with
+  *result set to it, or 0 if neither is valid.
+*/
+static uint64_t slotNewest( void* backing, int unit, VFSCursorSlot* result ) {
+  uint64_t sequence = 0;
+  int which;
+  for( which = 0; which < 2; which++ ) {
+	VFSCursorSlot slot = *slotAt( backing, unit, which );
+	if( slot.sequence > sequence && 
+		slot.checksum == slotChecksum( &slot ) ) {
+	  sequence = slot.sequence;
+	  *result = slot;
+	}
+  }
+  return sequence;
+}
+
 static void VFSHeaderStore( VFSHeader* hSource, void* addr ) {
   VFSHeader* hTarget = (VFSHeader*)addr;
   // Note that the header store is NOT an XOR operation, it cannot be...
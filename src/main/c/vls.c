@@ -37,9 +37,6 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <sys/mman.h>
-#include <sys/stat.h>
-
 #include "vernamfs/cmds.h"
 #include "vernamfs/vernamfs.h"
 #include "vernamfs/remote.h"
@@ -51,6 +48,8 @@
  * course unintelligible since it is still XOR'ed with the OTP.
  *
  * The 'vaultFile' is the local, pristine copy of the original OTP.
+ * For a pad made by 'generate', the AES key (-k) serves instead, and
+ * just the table's bytes of the pad are regenerated.
  *
  * We can recover the logical remote table contents, and thus see a
  * listing of remote operations, by XOR'ing the actual remote table
@@ -75,11 +74,27 @@
  * @see rls.c
  */
 
+static CommandOption c = 
+  { .id = "c", 
+	.text = "With -k or -z, the keystream the pad was generated with, aes128 or\n    chacha20.  Defaults to that implied by the key length." };
+
+static CommandOption k = 
+  { .id = "k", 
+	.text = "Key file, hex-encoded as for generate.  The vault pad is\n    regenerated from the key, so no OTPVAULT is given." };
+
+static CommandOption l = 
+  { .id = "l", 
+	.text = "With -k or -z, the maximum file name length the remote was\n    initialised with.  Defaults to 64-17=47." };
+
 static CommandOption r = 
   { .id = "r", 
 	.text = "Print raw file table content. Default is readable listing." };
 
-static CommandOption* options[] = { &r, NULL };
+static CommandOption z = 
+  { .id = "z", 
+	.text = "As -k, but with the all-zeros key." };
+
+static CommandOption* options[] = { &c, &k, &l, &r, &z, NULL };
 
 static char example1[] = 
   "$ vernamfs vls OTP.vault rlsResult";
@@ -93,12 +108,16 @@ static char example3[] =
 static char example4[] = 
   "$ vernamfs rls OTP.remote | vernamfs vls OTP.vault";
 
-static char* examples[] = { example1, example2, example3, example4, NULL };
+static char example5[] = 
+  "$ vernamfs vls -k KEY rlsResult";
+
+static char* examples[] = { example1, example2, example3, example4, 
+							example5, NULL };
 
 static CommandHelp help = {
   .summary ="Recover encrypted file listing",
-  .synopsis = "[<options>] OTPVAULT rlsResultFile|STDIN",
-  .description = "Recover remote file listing, showing name and size of each allocated file.\n  Does this by combining remote ls result and local vault copy of the OTP.\n  Remote ls result supplied as a file, or on stdin.",
+  .synopsis = "[<options>] OTPVAULT|-k KEY rlsResultFile|STDIN",
+  .description = "Recover remote file listing, showing name and size of each allocated file.\n  Does this by combining remote ls result and local vault copy of the OTP.\n  Remote ls result supplied as a file, or on stdin.  For a generated OTP,\n  the key may be given instead of the vault copy.",
   .options = options,
   .examples = examples,
 };
@@ -112,50 +131,63 @@ Command vlsCmd = {
 int vlsArgs( int argc, char* argv[] ) {
 
   int raw = 0;
-  char* vaultFile = NULL;
+  char* cipher = NULL;
+  char* keyFile = NULL;
+  int zeroKey = 0;
+  int maxNameLength = VERNAMFS_NAMELENGTHDEFAULT;
   char* rlsResult = NULL;
   
   int c;
-  while( (c = getopt( argc, argv, "r") ) != -1 ) {
+  while( (c = getopt( argc, argv, "c:k:l:rz") ) != -1 ) {
 	switch( c ) {
+	case 'c':
+	  cipher = optarg;
+	  break;
+	case 'k':
+	  keyFile = optarg;
+	  break;
+	case 'l':
+	  maxNameLength = atoi( optarg );
+	  break;
 	case 'r':
 	  raw = 1;
 	  break;
+	case 'z':
+	  zeroKey = 1;
+	  break;
 	default:
 	  break;
 	}
   }
 
-  if( optind < argc ) {
-	vaultFile = argv[optind];
-  } else {
+  int keyed = keyFile || zeroKey;
+  if( !keyed && optind >= argc ) {
 	commandHelp( &vlsCmd );
 	return -1;
   }
 
-  if( optind+1 < argc ) 
-	rlsResult = argv[optind+1];
+  VFSVault vault;
+  if( VFSVaultOpen( &vault, keyed ? NULL : argv[optind++], keyFile, zeroKey,
+					cipher, VERNAMFS_PADTYPE_UNKNOWN, maxNameLength ) )
+	return -1;
 
-  // printf( "raw %d, vaultFile %s, rlsResult %p\n", raw, vaultFile,rlsResult );
+  if( optind < argc ) 
+	rlsResult = argv[optind];
 
-  return vls( vaultFile, raw, rlsResult );
+  int sc = vls( &vault, raw, rlsResult );
+  VFSVaultClose( &vault );
+  return sc;
 }
 
+static int vlsTable( VFSVault* vault, int raw, VFSRemoteResult* rrls );
+
 /*
   The 'remote ls' is expected as a file, or on STDIN.  It would have
   been obtained via an 'rls' command, and shipped to the 'vault'
-  location.  
+  location.  Only the vault bytes under the remote table are needed.
 */
 
-int vls( char* vaultFile, int raw, char* rlsResult ) {
-
-  struct stat st;
-  int sc = stat( vaultFile, &st );
-  if( sc || !S_ISREG( st.st_mode ) ) {
-	fprintf( stderr, "%s: Not a regular file\n", vaultFile );
-	return -1;
-  }
-  off_t vaultLength = st.st_size;
+int vls( VFSVault* vault, int raw, char* rlsResult ) {
 
   int fdRls = STDIN_FILENO;
   if( rlsResult ) {
@@ -166,68 +198,45 @@ int vls( char* vaultFile, int raw, char* rlsResult ) {
 	}
   }
   
-  VFSRemoteResult* rrls = VFSRemoteResultRead( fdRls );
-  if( rlsResult )
-	close( fdRls );
-
-  if( rrls->offset + rrls->length > vaultLength ) {
-	fprintf( stderr, "Vault length (%"PRIx64") too short, need %"PRIx64"\n",
-			 vaultLength, rrls->offset + rrls->length );
+  /*
+	One remote result per table: just the one, unless the remote VFS
+	is sharded.
+  */
+  int results = 0;
+  int sc = 0;
+  VFSRemoteResult* rrls;
+  while( sc == 0 && (rrls = VFSRemoteResultRead( fdRls )) ) {
+	results++;
+	sc = vlsTable( vault, raw, rrls );
 	VFSRemoteResultFree( rrls );
 	free( rrls );
-	return -1;
   }
-
-  // printf( "Off %x, len %x\n", rlsOffset, rlsLength );
+  if( rlsResult )
+	close( fdRls );
 
   // Possible that the remote FS be currently empty
-  if( rrls->length == 0 ) {
-	VFSRemoteResultFree( rrls );
-	free( rrls );
-	return -1;
-  }
-  
-  int fd = open( vaultFile, O_RDONLY );
-  if( fd < 0 ) {
-	fprintf( stderr, "Cannot open vaultFile: %s\n", vaultFile );
-	return -1;
-  }
-  
-  // Was trying length, offset related to rls info, not working...
-  int mappedLength = vaultLength;
-  int mappedOffset = 0;
-
-  void* addr = mmap( NULL, mappedLength, PROT_READ, MAP_PRIVATE, 
-					 fd, mappedOffset );
-  if( addr == MAP_FAILED ) {
-	fprintf( stderr, "Cannot mmap vaultFile: %s\n", vaultFile );
-	close( fd );
-	VFSRemoteResultFree( rrls );
-	free( rrls );
+  if( results == 0 )
 	return -1;
-  }
+  return sc;
+}
+
+static int vlsTable( VFSVault* vault, int raw, VFSRemoteResult* rrls ) {
 
-  VFS vaultVFS;
-  VFSLoad( &vaultVFS, addr );
+  // printf( "Off %x, len %x\n", rlsOffset, rlsLength );
 
-  // LOOK: Can/should check vaultVFS.header.tableOffset == vrr->offset
+  if( rrls->length == 0 )
+	return 0;
 
-  /*
-	Assumed that the vault header's tableEntrySize matches that of the
-	remote data
-  */
-  int tableEntrySize = vaultVFS.header.tableEntrySize;
+  // The whole table in one go, decoded in place
+  char* table = rrls->data;
+  if( VFSVaultXor( vault, rrls->offset, table, table, rrls->length ) )
+	return -1;
+
+  int tableEntrySize = vault->tableEntrySize;
   int tableEntryCount = rrls->length / tableEntrySize;
-  char* teActual = (char*)malloc( tableEntrySize );
-  char* rls = rrls->data;
-  char* vls = (char*)(addr + rrls->offset);
   int i;
   for( i = 0; i < tableEntryCount; i++ ) {
-	char* teRemote = rls + i * tableEntrySize;
-	char* teVault =  vls + i * tableEntrySize;
-	int j;
-	for( j = 0; j < tableEntrySize; j++ )
-	  teActual[j] = teRemote[j] ^ teVault[j];
+	char* teActual = table + i * tableEntrySize;
 	VFSTableEntryFixed* tef = (VFSTableEntryFixed*)teActual;
 	char* name = teActual + sizeof( VFSTableEntryFixed );
 
@@ -238,18 +247,17 @@ int vls( char* vaultFile, int raw, char* rlsResult ) {
 	if( raw ) {
 	  write( STDOUT_FILENO, teActual, tableEntrySize ); 
 	} else {
-	  printf( "%s 0x%"PRIx64" 0x%"PRIx64"\n", 
-			  name, tef->offset, tef->length );
+	  /*
+		A chained file's offset is that of its first extent only.  A
+		log segment's records are not in the table, so cannot be
+		listed here, see vcat, recover.
+	  */
+	  printf( "%s 0x%"PRIx64" 0x%"PRIx64"%s\n", 
+			  name, tef->offset, tef->length & VERNAMFS_LENGTH_MASK,
+			  tef->length & VERNAMFS_LENGTH_CHAINED ? " chained" : 
+			  tef->length & VERNAMFS_LENGTH_RECORDS ? " records" : "" );
 	}
   }
-  free( teActual );
-
-  VFSRemoteResultFree( rrls );
-  free( rrls );
-
-  munmap( addr, mappedLength );
-  close( fd );
-
   return 0;
 }
 
@@ -0,0 +1,326 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "vernamfs/xor.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * XOR kernels, with the best one chosen at program startup.  See
+ * xor.h.
+ *
+ * Each kernel computes dest = a ^ b over count bytes.  The in-place
+ * VFSXor is just the case dest == a.  Kernels first bring dest up to
+ * their vector alignment with the word-at-a-time code, then run an
+ * unrolled vector loop (unaligned loads, aligned stores), then
+ * finish any tail with the word-at-a-time code again.
+ *
+ * On x86 the vector kernels are compiled via gcc's target attribute,
+ * so a plain build (no -mavx2 etc) still contains all of them, and
+ * the cpu is interrogated at runtime.  On ARM, the NEON kernel is
+ * present only if the compiler targets NEON (e.g -mfpu=neon on
+ * armv7, always on aarch64).
+ */
+
+typedef void (*XorKernel)( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+						   size_t count );
+
+typedef struct {
+  const char* name;
+  XorKernel kernel;
+  int (*supported)( void );
+} XorKernelInfo;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERNAMFS_XOR_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VERNAMFS_XOR_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+  Word-at-a-time, with byte-wise head and tail.  The memcpys compile
+  down to plain (possibly unaligned) loads and stores, but keep us
+  clear of strict-aliasing trouble.
+*/
+static void xorScalar( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+					   size_t count ) {
+  while( count && ((uintptr_t)dest & (sizeof( uint64_t ) - 1)) ) {
+	*dest++ = *a++ ^ *b++;
+	count--;
+  }
+  while( count >= sizeof( uint64_t ) ) {
+	uint64_t wa, wb;
+	memcpy( &wa, a, sizeof( wa ) );
+	memcpy( &wb, b, sizeof( wb ) );
+	wa ^= wb;
+	memcpy( dest, &wa, sizeof( wa ) );
+	dest += sizeof( uint64_t );
+	a += sizeof( uint64_t );
+	b += sizeof( uint64_t );
+	count -= sizeof( uint64_t );
+  }
+  while( count ) {
+	*dest++ = *a++ ^ *b++;
+	count--;
+  }
+}
+
+static int supportedAlways( void ) {
+  return 1;
+}
+
+/*
+  How many leading bytes to handle before dest is aligned on the
+  vector width, bounded by count.
+*/
+static size_t headLength( const uint8_t* dest, size_t width, size_t count ) {
+  size_t mis = (uintptr_t)dest & (width - 1);
+  size_t head = mis ? width - mis : 0;
+  return head > count ? count : head;
+}
+
+#ifdef VERNAMFS_XOR_X86
+
+__attribute__((target("sse2")))
+static void xorSSE2( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+					 size_t count ) {
+  size_t head = headLength( dest, 16, count );
+  xorScalar( dest, a, b, head );
+  dest += head; a += head; b += head; count -= head;
+
+  while( count >= 64 ) {
+	__m128i a0 = _mm_loadu_si128( (const __m128i*)(a + 0) );
+	__m128i a1 = _mm_loadu_si128( (const __m128i*)(a + 16) );
+	__m128i a2 = _mm_loadu_si128( (const __m128i*)(a + 32) );
+	__m128i a3 = _mm_loadu_si128( (const __m128i*)(a + 48) );
+	__m128i b0 = _mm_loadu_si128( (const __m128i*)(b + 0) );
+	__m128i b1 = _mm_loadu_si128( (const __m128i*)(b + 16) );
+	__m128i b2 = _mm_loadu_si128( (const __m128i*)(b + 32) );
+	__m128i b3 = _mm_loadu_si128( (const __m128i*)(b + 48) );
+	_mm_store_si128( (__m128i*)(dest + 0), _mm_xor_si128( a0, b0 ) );
+	_mm_store_si128( (__m128i*)(dest + 16), _mm_xor_si128( a1, b1 ) );
+	_mm_store_si128( (__m128i*)(dest + 32), _mm_xor_si128( a2, b2 ) );
+	_mm_store_si128( (__m128i*)(dest + 48), _mm_xor_si128( a3, b3 ) );
+	dest += 64; a += 64; b += 64; count -= 64;
+  }
+  while( count >= 16 ) {
+	__m128i va = _mm_loadu_si128( (const __m128i*)a );
+	__m128i vb = _mm_loadu_si128( (const __m128i*)b );
+	_mm_store_si128( (__m128i*)dest, _mm_xor_si128( va, vb ) );
+	dest += 16; a += 16; b += 16; count -= 16;
+  }
+  xorScalar( dest, a, b, count );
+}
+
+__attribute__((target("avx2")))
+static void xorAVX2( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+					 size_t count ) {
+  size_t head = headLength( dest, 32, count );
+  xorScalar( dest, a, b, head );
+  dest += head; a += head; b += head; count -= head;
+
+  while( count >= 128 ) {
+	__m256i a0 = _mm256_loadu_si256( (const __m256i*)(a + 0) );
+	__m256i a1 = _mm256_loadu_si256( (const __m256i*)(a + 32) );
+	__m256i a2 = _mm256_loadu_si256( (const __m256i*)(a + 64) );
+	__m256i a3 = _mm256_loadu_si256( (const __m256i*)(a + 96) );
+	__m256i b0 = _mm256_loadu_si256( (const __m256i*)(b + 0) );
+	__m256i b1 = _mm256_loadu_si256( (const __m256i*)(b + 32) );
+	__m256i b2 = _mm256_loadu_si256( (const __m256i*)(b + 64) );
+	__m256i b3 = _mm256_loadu_si256( (const __m256i*)(b + 96) );
+	_mm256_store_si256( (__m256i*)(dest + 0), _mm256_xor_si256( a0, b0 ) );
+	_mm256_store_si256( (__m256i*)(dest + 32), _mm256_xor_si256( a1, b1 ) );
+	_mm256_store_si256( (__m256i*)(dest + 64), _mm256_xor_si256( a2, b2 ) );
+	_mm256_store_si256( (__m256i*)(dest + 96), _mm256_xor_si256( a3, b3 ) );
+	dest += 128; a += 128; b += 128; count -= 128;
+  }
+  while( count >= 32 ) {
+	__m256i va = _mm256_loadu_si256( (const __m256i*)a );
+	__m256i vb = _mm256_loadu_si256( (const __m256i*)b );
+	_mm256_store_si256( (__m256i*)dest, _mm256_xor_si256( va, vb ) );
+	dest += 32; a += 32; b += 32; count -= 32;
+  }
+  xorScalar( dest, a, b, count );
+}
+
+__attribute__((target("avx512f")))
+static void xorAVX512( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+					   size_t count ) {
+  size_t head = headLength( dest, 64, count );
+  xorScalar( dest, a, b, head );
+  dest += head; a += head; b += head; count -= head;
+
+  while( count >= 256 ) {
+	__m512i a0 = _mm512_loadu_si512( (const void*)(a + 0) );
+	__m512i a1 = _mm512_loadu_si512( (const void*)(a + 64) );
+	__m512i a2 = _mm512_loadu_si512( (const void*)(a + 128) );
+	__m512i a3 = _mm512_loadu_si512( (const void*)(a + 192) );
+	__m512i b0 = _mm512_loadu_si512( (const void*)(b + 0) );
+	__m512i b1 = _mm512_loadu_si512( (const void*)(b + 64) );
+	__m512i b2 = _mm512_loadu_si512( (const void*)(b + 128) );
+	__m512i b3 = _mm512_loadu_si512( (const void*)(b + 192) );
+	_mm512_store_si512( (void*)(dest + 0), _mm512_xor_si512( a0, b0 ) );
+	_mm512_store_si512( (void*)(dest + 64), _mm512_xor_si512( a1, b1 ) );
+	_mm512_store_si512( (void*)(dest + 128), _mm512_xor_si512( a2, b2 ) );
+	_mm512_store_si512( (void*)(dest + 192), _mm512_xor_si512( a3, b3 ) );
+	dest += 256; a += 256; b += 256; count -= 256;
+  }
+  while( count >= 64 ) {
+	__m512i va = _mm512_loadu_si512( (const void*)a );
+	__m512i vb = _mm512_loadu_si512( (const void*)b );
+	_mm512_store_si512( (void*)dest, _mm512_xor_si512( va, vb ) );
+	dest += 64; a += 64; b += 64; count -= 64;
+  }
+  xorScalar( dest, a, b, count );
+}
+
+static int supportedSSE2( void ) {
+  return __builtin_cpu_supports( "sse2" );
+}
+
+static int supportedAVX2( void ) {
+  return __builtin_cpu_supports( "avx2" );
+}
+
+static int supportedAVX512( void ) {
+  return __builtin_cpu_supports( "avx512f" );
+}
+
+#endif // VERNAMFS_XOR_X86
+
+#ifdef VERNAMFS_XOR_NEON
+
+static void xorNEON( uint8_t* dest, const uint8_t* a, const uint8_t* b,
+					 size_t count ) {
+  size_t head = headLength( dest, 16, count );
+  xorScalar( dest, a, b, head );
+  dest += head; a += head; b += head; count -= head;
+
+  while( count >= 64 ) {
+	uint8x16_t a0 = vld1q_u8( a + 0 );
+	uint8x16_t a1 = vld1q_u8( a + 16 );
+	uint8x16_t a2 = vld1q_u8( a + 32 );
+	uint8x16_t a3 = vld1q_u8( a + 48 );
+	uint8x16_t b0 = vld1q_u8( b + 0 );
+	uint8x16_t b1 = vld1q_u8( b + 16 );
+	uint8x16_t b2 = vld1q_u8( b + 32 );
+	uint8x16_t b3 = vld1q_u8( b + 48 );
+	vst1q_u8( dest + 0, veorq_u8( a0, b0 ) );
+	vst1q_u8( dest + 16, veorq_u8( a1, b1 ) );
+	vst1q_u8( dest + 32, veorq_u8( a2, b2 ) );
+	vst1q_u8( dest + 48, veorq_u8( a3, b3 ) );
+	dest += 64; a += 64; b += 64; count -= 64;
+  }
+  while( count >= 16 ) {
+	vst1q_u8( dest, veorq_u8( vld1q_u8( a ), vld1q_u8( b ) ) );
+	dest += 16; a += 16; b += 16; count -= 16;
+  }
+  xorScalar( dest, a, b, count );
+}
+
+#endif // VERNAMFS_XOR_NEON
+
+// In order of preference, best first.  Scalar always last.
+static const XorKernelInfo kernels[] = {
+#ifdef VERNAMFS_XOR_X86
+  { "avx512", xorAVX512, supportedAVX512 },
+  { "avx2",   xorAVX2,   supportedAVX2 },
+  { "sse2",   xorSSE2,   supportedSSE2 },
+#endif
+#ifdef VERNAMFS_XOR_NEON
+  { "neon",   xorNEON,   supportedAlways },
+#endif
+  { "scalar", xorScalar, supportedAlways },
+  { NULL, NULL, NULL }
+};
+
+static const XorKernelInfo* active = NULL;
+
+__attribute__((constructor))
+static void xorInit( void ) {
+#ifdef VERNAMFS_XOR_X86
+  __builtin_cpu_init();
+#endif
+  const XorKernelInfo* k;
+  for( k = kernels; k->name; k++ ) {
+	if( k->supported() ) {
+	  active = k;
+	  return;
+	}
+  }
+}
+
+void VFSXor( void* dest, const void* src, size_t count ) {
+  if( !active )
+	xorInit();
+  active->kernel( (uint8_t*)dest, (const uint8_t*)dest,
+				  (const uint8_t*)src, count );
+}
+
+void VFSXorCombine( void* dest, const void* a, const void* b, size_t count ) {
+  if( !active )
+	xorInit();
+  active->kernel( (uint8_t*)dest, (const uint8_t*)a, (const uint8_t*)b,
+				  count );
+}
+
+const char* VFSXorKernelName( void ) {
+  if( !active )
+	xorInit();
+  return active->name;
+}
+
+int VFSXorSelect( const char* name ) {
+#ifdef VERNAMFS_XOR_X86
+  __builtin_cpu_init();
+#endif
+  const XorKernelInfo* k;
+  for( k = kernels; k->name; k++ ) {
+	if( strcmp( k->name, name ) == 0 ) {
+	  if( !k->supported() )
+		return -1;
+	  active = k;
+	  return 0;
+	}
+  }
+  return -1;
+}
+
+// eof
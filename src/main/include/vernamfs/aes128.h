@@ -38,4 +38,7 @@
 
 void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output);
 
+// Expand a 16-byte key into the 11 round keys, 176 bytes.
+void AES128_KeyExpansion(const uint8_t* key, uint8_t* roundKey);
+
 #endif //_AES_H_
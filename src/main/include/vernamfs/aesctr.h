@@ -0,0 +1,110 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_AESCTR_H
+#define _VERNAMFS_AESCTR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @author Stuart Maclean
+ *
+ * AES-128 in counter (CTR) mode, as used to produce pseudo one-time
+ * pads (see generate.c).  The counter block for block number N is N
+ * as a uint64_t in host byte order (little-endian on all our x86 and
+ * ARM targets) in bytes 0-7, bytes 8-15 all zero.  The keystream is thus identical to that produced by the original
+ * one-block-at-a-time generate loop, so existing pads and keys stay
+ * valid.
+ *
+ * Since each block depends only on its counter, any block of the
+ * keystream can be computed directly, and in any order.
+ *
+ * Backends, best first: AES-NI on x86, the ARMv8 Crypto Extensions
+ * on aarch64 (when compiled for them), then a portable T-table
+ * software AES.  The hardware backends keep 8 blocks in flight at
+ * once.  The original tiny-AES code remains available, by name only,
+ * as a reference.
+ */
+
+#define AES128CTR_BLOCKSIZE 16
+
+typedef struct AES128CTR {
+  uint8_t key[16];
+  uint8_t roundKeys[176];
+
+  // Encrypt count 16-byte blocks, in may equal out
+  void (*ecb)( const struct AES128CTR* thiz, const uint8_t* in, uint8_t* out,
+			   size_t count );
+
+  const char* backend;
+} AES128CTR;
+
+/**
+ * Expand the key and pick the best available backend.
+ */
+void AES128CTRInit( AES128CTR* thiz, const uint8_t key[16] );
+
+/**
+ * Force a backend by name ("aesni", "armv8", "ttable",
+ * "soft").
+ *
+ * @return 0 on success, -1 if unknown or unsupported by this cpu.
+ */
+int AES128CTRSelect( AES128CTR* thiz, const char* backend );
+
+/**
+ * Produce count blocks of keystream, for counters counter,
+ * counter+1, ... counter+count-1, into out (16 * count bytes).
+ */
+void AES128CTRBlocks( const AES128CTR* thiz, uint64_t counter,
+					  uint8_t* out, size_t count );
+
+/**
+ * Produce len bytes of keystream starting at byte offset offset,
+ * i.e. bytes offset..offset+len-1 of the pad 'generate' would write.
+ * Neither offset nor len need be block multiples.
+ */
+void AES128CTRStream( const AES128CTR* thiz, uint64_t offset,
+					  uint8_t* out, size_t len );
+
+/**
+ * ECB-encrypt count independent 16-byte blocks, using whichever
+ * backend is selected.  Exposed for testing against NIST vectors.
+ */
+void AES128CTREncryptBlocks( const AES128CTR* thiz, const uint8_t* in,
+							 uint8_t* out, size_t count );
+
+#endif
+
+// eof
@@ -0,0 +1,99 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_CHACHA20_H
+#define _VERNAMFS_CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @author Stuart Maclean
+ *
+ * ChaCha20 keystream, the second pad generator alongside AES-128 CTR
+ * (see aesctr.h).  A 256-bit key, and on cpus without AES hardware,
+ * several times faster than any software AES.
+ *
+ * We use Bernstein's original layout: a 64-bit block counter in state
+ * words 12-13, and a 64-bit nonce in words 14-15, always zero (each
+ * pad has its own key).  For counters below 2^32 the keystream is thus
+ * that of RFC 7539 with an all-zero nonce.  Like CTR mode, any block
+ * can be computed directly from its counter.
+ *
+ * Backends, best first: AVX2 (8 blocks at once), SSE2 (4), NEON (4),
+ * then portable scalar code.
+ */
+
+#define CHACHA20_BLOCKSIZE 64
+
+#define CHACHA20_KEYSIZE 32
+
+typedef struct ChaCha20 {
+  uint32_t key[8];
+
+  // Produce count blocks of keystream, for counters counter onwards
+  void (*blocks)( const struct ChaCha20* thiz, uint64_t counter,
+				  uint8_t* out, size_t count );
+
+  const char* backend;
+} ChaCha20;
+
+/**
+ * Load the key and pick the best available backend.
+ */
+void ChaCha20Init( ChaCha20* thiz, const uint8_t key[CHACHA20_KEYSIZE] );
+
+/**
+ * Force a backend by name ("avx2", "sse2", "neon", "scalar").
+ *
+ * @return 0 on success, -1 if unknown or unsupported by this cpu.
+ */
+int ChaCha20Select( ChaCha20* thiz, const char* backend );
+
+/**
+ * Produce count blocks of keystream, for counters counter,
+ * counter+1, ... counter+count-1, into out (64 * count bytes).
+ */
+void ChaCha20Blocks( const ChaCha20* thiz, uint64_t counter,
+					 uint8_t* out, size_t count );
+
+/**
+ * Produce len bytes of keystream starting at byte offset offset.
+ * Neither offset nor len need be block multiples.
+ */
+void ChaCha20Stream( const ChaCha20* thiz, uint64_t offset,
+					 uint8_t* out, size_t len );
+
+#endif
+
+// eof
@@ -35,6 +35,9 @@
 #define _VERNAMFS_CMDS_H
 
 #include <inttypes.h>
+#include <stddef.h>
+
+#include "vernamfs/vault.h"
 
 extern char* ProgramName;
 
@@ -70,6 +73,7 @@ extern Command vlsCmd;
 extern Command rcatCmd;
 extern Command vcatCmd;
 extern Command recoverCmd;
+extern Command logCmd;
 
 Command* commandLocate( char* name );
 
@@ -81,8 +85,8 @@ int helpArgs( int argc, char* argv[] );
 
 int initArgs( int argc, char* argv[] );
 
-int init( char* file, int maxFiles, int maxFileNameLength,
-	  int force, int expert );
+int init( char* file, int maxFiles, int maxFileNameLength, int padType,
+	  uint64_t alignment, int shards, int chained, int force, int expert );
 
 int infoArgs( int argc, char* argv[] );
 
@@ -90,6 +94,11 @@ int info( char* file, int expert );
 
 int mountArgs( int argc, char* argv[] );
 
+int logArgs( int argc, char* argv[] );
+
+int logRecords( char* file, char* name, uint64_t commitBytes, 
+				int commitSecs, uint64_t combineSize );
+
 int rlsArgs( int argc, char* argv[] );
 
 int rls( char* file );
@@ -97,12 +106,14 @@ int rls( char* file );
 int vlsArgs( int argc, char* argv[] );
 
 /*
+ * @param vault - the vault copy of the OTP, or its AES key
+ *
  * @param raw - if TRUE, print the actual table as raw, suitable for formatting
  * by e.g. xxd.  If FALSE, print the table in human-readable form.
  *
  * @param rlsResultOptional - file with rls content, or NULL for stdin
  */
-int vls( char* file, int raw, char* rlsResultOptional );
+int vls( VFSVault* vault, int raw, char* rlsResultOptional );
 
 int rcatArgs( int argc, char* argv[] );
 
@@ -110,16 +121,35 @@ int rcat( char* file, uint64_t offset, uint64_t length );
 
 int vcatArgs( int argc, char* argv[] );
 
-int vcat( char* file, char* rcatResult, char* rlsResultOptional );
+int vcat( VFSVault* vault, char* rcatResult, char* rlsResultOptional );
 
 int generateArgs( int argc, char* argv[] );
 
-// Using aes/ctr mode with a 128-bit key to generate OTP
-int generate128( char key[], int log2OTPSize );
+typedef struct {
+  // With threads > 1, the counter space is split across that many threads
+  int threads;
+  // Bytes produced per write, and per thread work unit. A page multiple.
+  size_t bufferSize;
+  // Progress and throughput to stderr
+  int verbose;
+  // File or block device to write the pad to, NULL means stdout
+  char* output;
+  // If non-NULL, replaces the first headerSize bytes of the pad
+  const void* header;
+  size_t headerSize;
+} GenerateOptions;
+
+/*
+  Generate an OTP of length bytes from a keystream, aes/ctr with a
+  128-bit key or chacha20 with a 256-bit key.  padType is a
+  VERNAMFS_PADTYPE_ value, see vernamfs.h.
+*/
+int generateKeystream( int padType, const uint8_t* key, uint64_t length,
+					   GenerateOptions* options );
 
 // LOOK: what is a good/better name for the entire VFS recovery operation??
 int recoverArgs( int argc, char* argv[] );
 
-int recover( char* remoteOTP, char* vaultOTP, char* outputDir );
+int recover( char* remoteOTP, VFSVault* vault, char* outputDir );
 
 #endif
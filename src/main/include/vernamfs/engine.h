@@ -0,0 +1,126 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_ENGINE_H
+#define _VERNAMFS_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @author Stuart Maclean
+ *
+ * How a mounted VFS reaches its pad's table and data areas (the
+ * header is always mapped, see VFSSetEngine): through mmap windows,
+ * through buffered pread/pwrite, or through O_DIRECT pread/pwrite of
+ * aligned bounce buffers, bypassing the page cache.  Which does best
+ * depends on the medium, e.g. mmap on tmpfs, pwrite on ext4 files,
+ * direct on raw SD cards.  All are safe for concurrent callers
+ * writing disjoint ranges.  An engine unable to read or write the pad
+ * mid-mount gives up (abort), since carrying on would lose content.
+ */
+
+#define VERNAMFS_ENGINE_MMAP (0)
+#define VERNAMFS_ENGINE_PWRITE (1)
+#define VERNAMFS_ENGINE_DIRECT (2)
+
+/*
+  O_DIRECT transfers are of whole blocks of this size, so aligned, as
+  is the table area (page-aligned) and so never shares a block with
+  the header.
+*/
+#define VERNAMFS_DIRECTALIGN (4096)
+
+typedef struct VFSEngine VFSEngine;
+
+/**
+ * @return the engine type named "mmap", "pwrite" or "direct", or -1.
+ */
+int VFSEngineType( const char* name );
+
+/**
+ * @return the name of an engine type, "unknown" if none.
+ */
+const char* VFSEngineName( int type );
+
+/**
+ * Open the pad file/device, length bytes, for an engine of type.  For
+ * mmap, windowBytes is the window size (see VERNAMFS_WINDOWSIZE) and
+ * windows how many may be mapped at once, e.g. one per cursor plus
+ * spare, the least recently used idle one being remapped as needed.
+ *
+ * @return the engine, or NULL if the pad will not open for it (e.g.
+ * O_DIRECT on tmpfs), windowBytes is not a power of 2 from the page
+ * size up to VERNAMFS_MAXWINDOWSIZE, or no memory.
+ */
+VFSEngine* VFSEngineOpen( int type, const char* path, uint64_t length,
+						  uint64_t windowBytes, int windows );
+
+int VFSEngineTypeOf( VFSEngine* thiz );
+
+// The pad's length, as opened
+uint64_t VFSEngineSize( VFSEngine* thiz );
+
+/**
+ * Read count pad bytes at offset into buf.
+ */
+void VFSEngineRead( VFSEngine* thiz, uint64_t offset, void* buf, 
+					size_t count );
+
+/**
+ * XOR count bytes of buf into the pad at offset, i.e. read, xor and
+ * write back.
+ */
+void VFSEngineXor( VFSEngine* thiz, uint64_t offset, const void* buf, 
+				   size_t count );
+
+/**
+ * Have pad bytes from..to, as written so far, reach the device,
+ * waiting until they have.
+ */
+void VFSEngineSync( VFSEngine* thiz, uint64_t from, uint64_t to );
+
+/**
+ * Pad bytes from..to will soon be read, so start reading them in, if
+ * the engine reads through a cache.
+ */
+void VFSEngineAdvise( VFSEngine* thiz, uint64_t from, uint64_t to );
+
+/**
+ * Unmap and close all, once no more calls can come.
+ */
+void VFSEngineClose( VFSEngine* thiz );
+
+#endif
+
+// eof
@@ -0,0 +1,100 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_KEYSTREAM_H
+#define _VERNAMFS_KEYSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vernamfs/aesctr.h"
+#include "vernamfs/chacha20.h"
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * A seekable keystream, of whichever type generated a pad: AES-128
+ * in CTR mode (aesctr.h) or ChaCha20 (chacha20.h).  Types are the
+ * VERNAMFS_PADTYPE_ values recorded in the VFS header flags.  Both
+ * are produced in fixed-size blocks, 16 and 64 bytes respectively,
+ * each a function of the key and its block number alone.
+ */
+
+typedef struct {
+  int type;
+  size_t blockSize;
+  AES128CTR aes;
+  ChaCha20 chacha;
+} VFSKeystream;
+
+/**
+ * @return the pad type named "aes128" or "chacha20", or -1.
+ */
+int VFSKeystreamType( const char* name );
+
+/**
+ * @return the name of a pad type, "unknown" if not a keystream.
+ */
+const char* VFSKeystreamName( int type );
+
+/**
+ * @return key length in bytes for the pad type, 0 if not a keystream.
+ */
+size_t VFSKeystreamKeySize( int type );
+
+/**
+ * @return the pad type whose keys are keySize bytes long, or -1.
+ */
+int VFSKeystreamTypeForKeySize( size_t keySize );
+
+/**
+ * @return 0 on success, -1 if type is not a keystream.
+ */
+int VFSKeystreamInit( VFSKeystream* thiz, int type, const uint8_t* key );
+
+/**
+ * count whole blocks of keystream, from block number counter.
+ */
+void VFSKeystreamBlocks( const VFSKeystream* thiz, uint64_t counter,
+						 uint8_t* out, size_t count );
+
+/**
+ * len bytes of keystream, i.e. of the generated pad, from byte offset.
+ */
+void VFSKeystreamStream( const VFSKeystream* thiz, uint64_t offset,
+						 uint8_t* out, size_t len );
+
+#endif
+
+// eof
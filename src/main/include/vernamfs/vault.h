@@ -0,0 +1,118 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_VAULT_H
+#define _VERNAMFS_VAULT_H
+
+#include <stdint.h>
+
+#include "vernamfs/keystream.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * The vault side's view of the original pad.  Either a vault copy
+ * (file or device), mapped as before, or, for pads produced by
+ * 'generate', just the key.  A keyed vault computes only those
+ * pad bytes it is asked for, straight from the keystream, so
+ * vls, vcat and recover never need a (possibly multi-TB) vault image.
+ *
+ * A keyed vault has no header to consult, so the table entry size
+ * comes from the maximum name length the remote was initialised with
+ * (init -l, or generate -l).
+ */
+
+typedef struct {
+  // Vault copy, mapped
+  int fd;
+  void* addr;
+  uint64_t length;
+
+  // Keyed, addr NULL
+  VFSKeystream keystream;
+  uint8_t* scratch;
+
+  uint32_t tableEntrySize;
+} VFSVault;
+
+/**
+ * Open a vault copy of the pad.
+ *
+ * @return 0 on success, -1 on failure, errors reported to stderr.
+ */
+int VFSVaultOpenFile( VFSVault* thiz, const char* file );
+
+/**
+ * A vault regenerated on demand from the key, for a pad of the given
+ * type (a VERNAMFS_PADTYPE_ value).
+ *
+ * @return 0 on success, -1 if maxNameLength out of range.
+ */
+int VFSVaultOpenKey( VFSVault* thiz, int padType, const uint8_t* key,
+					 int maxNameLength );
+
+/**
+ * Read a hex-encoded key, as 'generate' takes, from keyFile.  16
+ * bytes (32 hex digits) for AES-128, 32 bytes for ChaCha20.
+ *
+ * @return key length in bytes, or -1 on failure, errors reported to
+ * stderr.
+ */
+int VFSVaultKeyRead( const char* keyFile, uint8_t key[32] );
+
+/**
+ * The vault options common to vls, vcat and recover: -k keyFile, or
+ * -z for the all-zeros key, with -c naming the keystream.  Without
+ * -c, a key file's length decides, else padType (if known) applies.
+ * No key file and no -z means vaultFile, a vault copy.
+ *
+ * @return 0 on success, -1 on failure, errors reported to stderr.
+ */
+int VFSVaultOpen( VFSVault* thiz, const char* vaultFile, 
+				  const char* keyFile, int zeroKey, const char* cipher,
+				  int padType, int maxNameLength );
+
+void VFSVaultClose( VFSVault* thiz );
+
+/**
+ * dest[i] = src[i] ^ pad[offset+i], for i in 0..count-1.  dest may
+ * equal src.
+ *
+ * @return 0 on success, -1 if the range lies beyond a vault copy.
+ */
+int VFSVaultXor( VFSVault* thiz, uint64_t offset, void* dest,
+				 const void* src, size_t count );
+
+#endif
+
+// eof
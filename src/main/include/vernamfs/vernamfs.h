@@ -35,6 +35,7 @@
 #define _VERNAMFS_TYPES_H
 
 #include <stdint.h>
+#include <time.h>
 
 
 /**
@@ -139,6 +140,47 @@
 */
 #define FILESYSTEMTYPE_ENCRYPTEDFAT (1)
 
+/*
+  The 'sharded FAT' variant: after the header, the pad is split into K
+  regions (shards), each an encrypted FAT of its own, with its own
+  table, data area and pointers.  The per-shard pointers live in a
+  VFSShardHeader array stored, in the clear, right after the
+  VFSHeader, preceded by a 32-bit shard count (and 32 bits unused).
+  The VFSHeader's own table and data pointers are unused, left
+  describing an empty table.  Writers pinned to different shards need
+  no coordination at all, and shards can be sized to sit on separate
+  devices (e.g. a striped pad).
+*/
+#define FILESYSTEMTYPE_SHARDEDFAT (2)
+
+// Bounded so that header and shard headers fit in the first page
+#define VERNAMFS_MAXSHARDS (32)
+
+/*
+  The low 4 bits of the header flags record which keystream, if any,
+  the pad was generated with, so the vault side knows how to
+  regenerate it from the key.  See keystream.h.  Unknown (0) for pads
+  from any other source, e.g. /dev/urandom.
+*/
+#define VERNAMFS_FLAGS_PADTYPE (0xf)
+
+#define VERNAMFS_PADTYPE_UNKNOWN (0)
+#define VERNAMFS_PADTYPE_AES128CTR (1)
+#define VERNAMFS_PADTYPE_CHACHA20 (2)
+
+/*
+  Files are written as chains of extents, so that open files stream
+  their content to the pad as it arrives, rather than staging it all
+  until release.  See VFSExtentHeader.
+*/
+#define VERNAMFS_FLAGS_CHAINED (0x10)
+
+/*
+  The table and data pointers are committed to alternating cursor
+  slots, see VFSCursorSlot, not just to the header.  Set by init.
+*/
+#define VERNAMFS_FLAGS_SLOTS (0x20)
+
 
 // For structs serialised to disk, ensure zero padding...
 #pragma pack(1)
@@ -166,8 +208,10 @@ typedef struct {
 
   /*
     Padding ensures that file content begins on a memory page or hard
-    disk sector boundary. Currently we are using memory page, likely
-    4096.
+    disk sector boundary.  Defaults to memory page, likely 4096, but
+    may be as small as 1 (init -a), so that small files do not each
+    burn a page of pad.  The table and data areas themselves are
+    always page-aligned.
   */
   uint64_t padding;
 
@@ -236,6 +280,46 @@ typedef struct {
   uint64_t length;
 } VFSTableEntryFixed;
   
+/*
+  Set in a table entry's length when the offset locates the first of
+  a chain of extents, rather than the file's one contiguous extent.
+  So entries describe themselves, and the vault tools need no header.
+*/
+#define VERNAMFS_LENGTH_CHAINED ((uint64_t)1 << 63)
+
+/*
+  Set in a table entry's length when the content is a segment of a
+  record log: records back to back, each a 32-bit length then that
+  many bytes.  See VFSLog.
+*/
+#define VERNAMFS_LENGTH_RECORDS ((uint64_t)1 << 62)
+
+#define VERNAMFS_LENGTH_MASK (VERNAMFS_LENGTH_RECORDS - 1)
+
+/*
+  Each extent of a chained file starts with this header, followed by
+  length content bytes.  Next is the offset of the next extent, 0 for
+  the last.  It is xor'ed onto the pad, as is the content, but only
+  once the next extent is claimed (or the file released), so every
+  header is still written just once.  Extents of one file lie at
+  increasing offsets.
+*/
+typedef struct {
+  uint64_t next;
+  uint64_t length;
+} VFSExtentHeader;
+
+/*
+  Default write-combining size (see VFSSetCombineSize), so the most a
+  chained file holds in memory: one extent's worth, header included.
+  A multiple of any likely padding.
+*/
+#define VERNAMFS_EXTENTSIZE (1 << 16)
+
+// Bounds on VFSSetCombineSize, from a page up to a large erase block
+#define VERNAMFS_MINCOMBINESIZE (1 << 12)
+#define VERNAMFS_MAXCOMBINESIZE (1 << 26)
+
 /*
   Minimum tableEntrySize is 32, since a 16 byte one could hold 
   ONLY offset,length and thus would have no room for a name.
@@ -244,6 +328,13 @@ typedef struct {
 
 #define VERNAMFS_MAXTABLEENTRYSIZE (128)
 
+/*
+  The last part number of a rotating file (see VFSSetRotation), so
+  that the .NNNN suffix, which VFSFileOpen makes room for, stays 4
+  digits wide.
+*/
+#define VERNAMFS_MAXPART (9999)
+
 /*
   Given max table entry size, have this much room for the file name,
   given that we have to add a null-terminator to the stored string.
@@ -257,54 +348,527 @@ typedef struct {
 */
 #define VERNAMFS_NAMELENGTHDEFAULT (64 - sizeof( VFSTableEntryFixed ) -1)
 
+/*
+  One shard of a sharded VFS, see FILESYSTEMTYPE_SHARDEDFAT above.
+  Fields as for the VFSHeader, all offsets absolute into the pad.
+  Length is the offset of the shard's end, so that a shard viewed as a
+  VFS (see VFSShard) needs no other adjustment.
+*/
+typedef struct {
+  uint64_t tableOffset;
+  uint64_t tablePtr;
+  uint64_t dataOffset;
+  uint64_t dataPtr;
+  uint64_t length;
+  uint32_t maxFiles;
+  uint32_t unused;
+} VFSShardHeader;
+
+#define VERNAMFS_SHARDCOUNTOFFSET (sizeof( VFSHeader ))
+#define VERNAMFS_SHARDSOFFSET (sizeof( VFSHeader ) + 2 * sizeof( uint32_t ))
+
+/*
+  One committed pair of table and data pointers.  Each VFS, and each
+  shard, has two slots, written alternately, each commit with the
+  next sequence number and a checksum over the rest.  So a commit is a
+  single small write that leaves the previous one intact, and a write
+  torn by power loss fails its checksum, the loader then taking the
+  other slot.  Loaders take the valid slot of highest sequence, over
+  the header's own pointers, which are still kept current for older
+  readers.
+*/
+typedef struct {
+  uint64_t sequence;
+  uint64_t tablePtr;
+  uint64_t dataPtr;
+  uint32_t checksum;
+  uint32_t unused;
+} VFSCursorSlot;
+
+/*
+  The slot pairs follow the largest possible set of shard headers, the
+  VFS's own pair first, then each shard's, all within the first page.
+*/
+#define VERNAMFS_SLOTSOFFSET \
+  ((VERNAMFS_SHARDSOFFSET + VERNAMFS_MAXSHARDS * sizeof( VFSShardHeader ) \
+	+ 63) & ~(size_t)63)
+
+#pragma pack()
+
+/*
+  How much of the pad, from 0, a mount through an engine (see
+  VFSSetEngine) maps for the header: VFSHeaderExtent of any VFS.
+*/
+#define VERNAMFS_HEADERMAPSIZE \
+  (VERNAMFS_SLOTSOFFSET + \
+   (VERNAMFS_MAXSHARDS + 1) * 2 * sizeof( VFSCursorSlot ))
+
+// Default mmap engine window size, see engine.h, and the most allowed
+#define VERNAMFS_WINDOWSIZE (1 << 24)
+#define VERNAMFS_MAXWINDOWSIZE (1 << 30)
+
+/*
+  How VFSFile releases reach the device, see VFSSetDurability.  Lazy:
+  whenever the kernel writes back the mapping.  File: each release
+  syncs its data, then its table entry, then the header, in that
+  order.  Group: releases are synced likewise, but many at once.
+*/
+#define VERNAMFS_DURABILITY_LAZY  0
+#define VERNAMFS_DURABILITY_FILE  1
+#define VERNAMFS_DURABILITY_GROUP 2
+
+/*
+  Counts kept as a VFS is written, see VFSReportStats.  A flush is one
+  ordered sync, of one file or of a group.
+*/
+typedef struct {
+  uint64_t files;
+  uint64_t bytes;
+  uint64_t stores;
+  uint64_t flushes;
+  uint64_t flushFiles;
+  uint64_t flushNanos;
+  uint64_t maxFlushNanos;
+} VFSStats;
+
 /*
   Combine the VFSHeader together with its memory-mapped backing store,
-  since often need both together.  
+  since often need both together.  Not serialised, so not packed.
 */
 typedef struct {
   VFSHeader header;
   void* backing;
+
+  // Data offset of the file being written via VFSAddEntry/VFSWrite
+  uint64_t fileStart;
+
+  /*
+	Cursors for concurrent VFSFile handles, all moved by atomic ops
+	only, no lock.  Reserved counts table slots/data bytes promised to
+	open handles plus those already claimed.  Claim is where the next
+	table entry/data extent goes.  Published is the tablePtr last
+	stored to the header: table entries are published strictly in
+	order, once complete.  All are byte offsets, as in the header.
+  */
+  uint64_t tableReserved, dataReserved;
+  uint64_t tableClaim, dataClaim;
+  uint64_t tablePublished;
+
+  /*
+	Held, briefly, by whoever is storing the header.  Both file
+	releases and chained files' extent flushes store it.
+  */
+  char storeBusy;
+
+  /*
+	For a sharded VFS, its shards.  For a view of one shard (see
+	VFSShard), which one, else -1.
+  */
+  uint32_t shardCount;
+  VFSShardHeader shards[VERNAMFS_MAXSHARDS];
+  int shard;
+
+  // VFSFile rotation, see VFSSetRotation.  0 for none.
+  uint64_t rotateBytes;
+  int rotateSecs;
+
+  // Write-combining size, see VFSSetCombineSize.  0 for the default.
+  uint64_t combineSize;
+
+  /*
+	Readahead, see VFSSetPrefetch.  The window, 0 for none, and how far
+	into the table and data areas the pad has been asked for so far.
+  */
+  uint64_t prefetchBytes;
+  uint64_t tablePrefetched, dataPrefetched;
+
+  /*
+	Background release, see VFSSetPipeline.  The queue depth, 0 for
+	none, and, once started, the queue and its worker.
+  */
+  int pipelineDepth;
+  struct VFSPipeline* pipeline;
+
+  /*
+	Durability, see VFSSetDurability.  Group only: the releases
+	published since the last group flush, the lowest data offset they
+	use, the tablePtr that flush stored, how far the table is synced,
+	and the timer, once started.  All bar syncedTable only touched
+	under storeBusy.
+  */
+  int durability;
+  int groupFiles, groupMsecs;
+  int groupPending;
+  uint64_t groupLow;
+  uint64_t storedTable;
+  uint64_t syncedTable;
+  char syncBusy;
+  struct VFSGroupTimer* groupTimer;
+
+  /*
+	The engine reaching the table and data areas, see VFSSetEngine,
+	else NULL, backing then mapping the whole pad.  Shared by all
+	views of the VFS.
+  */
+  struct VFSEngine* engine;
+
+  VFSStats stats;
+
+  // Sequence of the last cursor slot committed, 0 if none yet
+  uint64_t slotSequence;
 } VFS;
 
+/*
+  One open file, as written by one of possibly many concurrent
+  writers (e.g. fuse handles).  Content is staged in memory, and only
+  at release are a table entry and a contiguous data extent claimed
+  and the content written to the pad.  So concurrent writers never
+  interleave in the data area, and no pad byte is written twice.
+
+  On a chained VFS (VERNAMFS_FLAGS_CHAINED), only the content not yet
+  flushed is staged, at most one extent's worth, the combine size.
+  Each full extent is claimed and written as soon as complete, so
+  concurrent files' extents do interleave in the data area.
+*/
+typedef struct {
+  VFS* vfs;
+  char* name;
+  uint8_t* data;
+  uint64_t length;
+  uint64_t capacity;
+
+  // Pad data bytes reserved for us, unflushed length rounded up to padding
+  uint64_t reserved;
+
+  /*
+	Chained only: content bytes already on the pad, and the first and
+	latest extents written.  The latest extent's header is pending,
+	awaiting the next extent's offset.
+  */
+  uint64_t flushed;
+  uint64_t firstExtent, lastExtent;
+  uint64_t lastExtentLength;
+
+  /*
+	Rotating only: the current part, 0 the first, and where it starts
+	in the file as written.  Length etc are then the part's alone.
+  */
+  int part;
+  uint64_t base;
+  time_t partStarted;
+} VFSFile;
+
+/*
+  A record log: a long-lived stream of small records, each placed on
+  the pad straight after the last, into one growing extent, the
+  segment.  Only when commitBytes of records have accumulated (or on
+  VFSLogCommit) is a single table entry written, covering the whole
+  segment.  So records cost no table slot, padding or header store of
+  their own.  Like the single writer api, a log must have its VFS to
+  itself.
+
+  Records are combined in memory and xor'ed onto the pad a chunk at a
+  time, each chunk ending on a multiple of the combine size, so the
+  pad sees few, large, aligned writes however small the records.
+*/
+typedef struct {
+  VFS* vfs;
+  char* name;
+  uint64_t commitBytes;
+
+  // The current segment, and its record bytes so far
+  uint64_t start;
+  uint64_t length;
+
+  // The segment's last buffered bytes, not yet on the pad
+  uint8_t* buffer;
+  uint64_t buffered;
+
+  /*
+	The dataPtr last stored, never behind the records on the pad, so
+	that a crash never leaves written records beyond it.
+  */
+  uint64_t stored;
+} VFSLog;
+
 /**
+ * @param alignment - Boundary each file's content starts on, a power
+ * of 2 no larger than the page size, or 0 for the page size.
+ *
  * @return 0 if initialization worked, or -1 otherwise.  -1 condition
  * likely due to insufficient space to hold the VFS, given the supplied
- * length
+ * length, else a bad alignment.
+ */
+int VFSInit( VFS* thiz, uint64_t length, int maxFiles, int maxNameLength,
+			 uint64_t alignment );
+
+/**
+ * As VFSInit, but of type FILESYSTEMTYPE_SHARDEDFAT, with maxFiles
+ * and the data area split evenly over shards regions.
+ *
+ * @return 0 if initialization worked, or -1 if too little space or
+ * shards out of range (2 to VERNAMFS_MAXSHARDS).
+ */
+int VFSInitSharded( VFS* thiz, uint64_t length, int maxFiles, 
+					int maxNameLength, uint64_t alignment, int shards );
+
+/**
+ * Bytes at the start of the backing holding header (and any shard
+ * headers and cursor slots) in the clear, as written by VFSStore.
+ */
+size_t VFSHeaderExtent( VFS* thiz );
+
+/**
+ * @return number of shards, 1 for an unsharded VFS.
+ */
+int VFSShardCount( VFS* thiz );
+
+/**
+ * Make result a VFS of its own for shard i of thiz, over the same
+ * backing.  VFSFile, VFSStore etc work on it as for any VFS, storing
+ * only that shard's pointers.  For an unsharded VFS, shard 0 is the
+ * whole VFS.
+ */
+void VFSShard( VFS* thiz, int i, VFS* result );
+
+/**
+ * The table entry size init would choose for the given maximum file
+ * name length, as needed by the vault tools when no vault header is
+ * to hand (keyed vaults, see vault.h).
+ *
+ * @return entry size in bytes, or -1 if maxNameLength out of range.
  */
-int VFSInit( VFS* thiz, size_t length, int maxFiles, int maxNameLength );
+int VFSTableEntrySize( int maxNameLength );
 
 void VFSLoad( VFS* thiz, void* addr );
 
+/**
+ * Which keystream generated the pad, a VERNAMFS_PADTYPE_ value.
+ */
+int VFSPadType( VFS* thiz );
+
+void VFSSetPadType( VFS* thiz, int padType );
+
 // Debug, print out info..
 void VFSReport( VFS*, int expert );
 
 /**
- * Called at each fuse_release and also at fuse_destroy
+ * Called at each fuse_release and also at fuse_destroy.  Writes the
+ * header, and any shard headers, to the backing.  For a shard view,
+ * writes just that shard's pointers.  Given VERNAMFS_FLAGS_SLOTS, the
+ * pointers are committed to the next cursor slot first, and the first
+ * store lays out all the slots.
  */
 void VFSStore( VFS* thiz );
 
 /**
- * Called on fuse_open
+ * Have VFSFile writes end a file once it reaches bytes, or secs after
+ * it was started, and carry on into a new file, named as the first
+ * but with suffix .0001, .0002, etc.  The writer sees one file, the
+ * table as many, each complete, so a long-running writer's content
+ * is recoverable (e.g. by rcat) as it goes.  Rotation happens on the
+ * next append once due.  Part VERNAMFS_MAXPART is never ended, just
+ * grows.  0 for either means no limit of that kind.
+ */
+void VFSSetRotation( VFS* thiz, uint64_t bytes, int secs );
+
+/**
+ * Write-combining: have chained files' extents (see VFSFile), and
+ * record logs' chunks (see VFSLog), be this many bytes, e.g. the
+ * backing flash's erase block size, so that each reaches the pad in
+ * one large write.  Holds for files and logs opened after.
+ *
+ * @return 0, or -1 if bytes not a power of 2 in the range
+ * VERNAMFS_MINCOMBINESIZE to VERNAMFS_MAXCOMBINESIZE.  0 restores the
+ * default, VERNAMFS_EXTENTSIZE.
+ */
+int VFSSetCombineSize( VFS* thiz, uint64_t bytes );
+
+uint64_t VFSCombineSize( VFS* thiz );
+
+/**
+ * Keep the pad this many bytes ahead of each write, in both table and
+ * data areas, being read in (madvise MADV_WILLNEED) before it is
+ * needed, so that xor'ing onto a freshly mapped device does not stall
+ * on page faults.  Large writes are xor'ed a window at a time, each
+ * with the next being read in.  Starts at once from the current
+ * pointers.  0 for none, the default.
+ */
+void VFSSetPrefetch( VFS* thiz, uint64_t bytes );
+
+/**
+ * Have the table and data areas reached through engine (see
+ * engine.h), e.g. windows of the pad mapped as writes reach them,
+ * rather than through backing, which then need only map the header,
+ * i.e. the first VERNAMFS_HEADERMAPSIZE bytes.  So address space and
+ * page tables used need not grow with the pad, which may then exceed
+ * a 32-bit address space.  Views made by VFSShard after share the
+ * engine.  Readahead (see VFSSetPrefetch) and syncs (see
+ * VFSSetDurability) go through it too.  The caller closes it, once
+ * done with the VFS.
+ */
+void VFSSetEngine( VFS* thiz, struct VFSEngine* engine );
+
+/**
+ * Have VFSFileRelease just queue the file, up to depth files deep,
+ * for a worker thread to write out, in release order, so that the
+ * releasing caller (e.g. a fuse thread) need not wait on the xor and
+ * header store.  A release finding the queue full waits for room.
+ * Takes effect at VFSStartPipeline, so that the worker is started
+ * after any fork, e.g. by fuse going into the background.  Releases
+ * then return before their files are written, so before any sync that
+ * file durability (see VFSSetDurability) makes.
+ */
+void VFSSetPipeline( VFS* thiz, int depth );
+
+/**
+ * @return 0 if the worker started, or there is none to start, else -1,
+ * when releases stay synchronous.
+ */
+int VFSStartPipeline( VFS* thiz );
+
+/**
+ * Wait for all queued releases to be written out, then stop the
+ * worker.  Releases are synchronous again after.
+ */
+void VFSStopPipeline( VFS* thiz );
+
+/**
+ * How VFSFile releases are made durable, one of the
+ * VERNAMFS_DURABILITY_ modes.  For group, a flush happens once files
+ * releases are pending, and, given VFSStartGroupCommit, once msecs have
+ * passed with any pending.  Until flushed, a group's releases are not
+ * in the stored tablePtr, though the stored dataPtr still covers every
+ * claim as made, so no pad is handed out twice.  0 for either means no
+ * limit of that kind.
+ */
+void VFSSetDurability( VFS* thiz, int mode, int files, int msecs );
+
+/**
+ * Group durability only: start the timer thread flushing pending
+ * releases every msecs.  Like VFSStartPipeline, to be called after any
+ * fork.
+ *
+ * @return 0 if started, or there is none to start, else -1.
+ */
+int VFSStartGroupCommit( VFS* thiz );
+
+/**
+ * Stop any timer thread, then flush any pending releases.
+ */
+void VFSStopGroupCommit( VFS* thiz );
+
+/**
+ * Print the VFS's counts (see VFSStats) to stdout: files and bytes
+ * written, header stores, and the number and cost of flushes.
+ */
+void VFSReportStats( VFS* thiz );
+
+/**
+ * @return non-zero if files are written as chains of extents.
+ */
+int VFSChained( VFS* thiz );
+
+void VFSSetChained( VFS* thiz, int chained );
+
+/**
+ * Single writer api: add, write, release one file at a time, straight
+ * onto the pad.  Must not be mixed with concurrent VFSFile handles.
+ * Files are always contiguous, even on a chained VFS.
  * 
- * @return 0 on success, or -1 if no space left to add a new entry.
+ * @return 0 on success, or -ENOSPC if no space left to add a new
+ * entry, -ENAMETOOLONG if name too long for a table entry.
  */
 int VFSAddEntry( VFS* thiz, const char* name );
 
 /**
- * Called on fuse_write
+ * @return count of bytes written, or -1 if the pad is full.
  */
 size_t VFSWrite( VFS* thiz, const void* buf, size_t count );
 
+void VFSRelease( VFS* thiz );
+
 /**
- * Called on fuse_release
+ * Called on fuse_open.  Reserves a table slot, so that the file is
+ * sure to have one at release.  Safe to call concurrently, as are
+ * VFSFileWrite and VFSFileRelease.  Table and data claims are
+ * lock-free.  Storing the header, at an extent flush or a release, is
+ * serialized by a brief spin-lock, and a release waits for every
+ * earlier table entry to be published before storing its own.
+ *
+ * @return 0 on success, with *result set, or -ENOSPC if all table
+ * slots taken or reserved, -ENAMETOOLONG, or -ENOMEM.
  */
-void VFSRelease( VFS* thiz );
+int VFSFileOpen( VFS* thiz, const char* name, VFSFile** result );
+
+/**
+ * Called on fuse_write.  Stages count bytes at offset in the file,
+ * reserving pad space to match.  On a chained VFS, writes out each
+ * extent as it fills.  Rotates the file if due.
+ *
+ * @return count on success, or -ENOSPC if the pad has insufficient
+ * unreserved space, -ENOMEM, or, chained or rotating only, -EINVAL if
+ * offset lies in content already written out.
+ */
+int VFSFileWrite( VFSFile* thiz, const void* buf, size_t count, 
+				  uint64_t offset );
+
+/**
+ * Called on fuse_release.  Claims the table entry and data extent,
+ * writes both to the pad, then, once all earlier claims are complete
+ * too, stores the header.  Frees the handle.  With a pipeline
+ * started, all that is done later, by its worker.
+ */
+int VFSFileRelease( VFSFile* thiz );
+
+
+/**
+ * Start a log, named as for a file.  Its segments, once committed,
+ * are all entries of that name.
+ *
+ * @return 0 on success, with *result set, or -ENOSPC if no table
+ * slot left, -ENAMETOOLONG, -ENOMEM.
+ */
+int VFSLogOpen( VFS* thiz, const char* name, uint64_t commitBytes, 
+				VFSLog** result );
+
+/**
+ * Append one record, committing the segment if it has reached
+ * commitBytes.  The record may yet be buffered, see VFSLog.
+ *
+ * @return 0 on success, or -ENOSPC if the pad, or the table (for a
+ * new segment), is full.
+ */
+int VFSLogAppend( VFSLog* thiz, const void* record, uint32_t length );
 
+/**
+ * Write out any buffered records, then the table entry for the
+ * segment so far, if any records, and start a new segment.
+ */
+void VFSLogCommit( VFSLog* thiz );
+
+/**
+ * Commit, then free the log.
+ */
+void VFSLogClose( VFSLog* thiz );
+
+/**
+ * Write out the records of a (decoded) log segment to fd, each
+ * followed by a newline.
+ *
+ * @return count of records, or -1 if the segment's framing is broken.
+ */
+int VFSLogSplit( const void* segment, uint64_t length, int fd );
 
 extern struct fuse_operations vernamfs_ops;
 
 extern VFS Global;
 
-#pragma pack()
+/*
+  The shards of Global as mounted, or just Global itself if unsharded.
+  See mount.c.
+*/
+extern VFS* GlobalShards;
+extern int GlobalShardCount;
 
 #endif
@@ -0,0 +1,82 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _VERNAMFS_XOR_H
+#define _VERNAMFS_XOR_H
+
+#include <stddef.h>
+
+/**
+ * @author Stuart Maclean
+ *
+ * The XOR 'engine'.  Every place where we combine a one-time pad with
+ * some other byte sequence (the VFS write path, vls, vcat, recover)
+ * comes through here.  There are SSE2, AVX2 and AVX-512 kernels on
+ * x86 and a NEON kernel on ARM, plus a portable word-at-a-time
+ * kernel.  The best kernel the running CPU supports is selected on
+ * first use.
+ *
+ * Buffers need not be aligned, nor need lengths be multiples of any
+ * vector width.  Unaligned heads and tails are handled internally.
+ */
+
+/**
+ * dest[i] ^= src[i], for i in 0..count-1.  Used on the remote side
+ * to XOR plain text into the pad.
+ */
+void VFSXor( void* dest, const void* src, size_t count );
+
+/**
+ * dest[i] = a[i] ^ b[i], for i in 0..count-1.  Used on the vault
+ * side to combine remote and vault pad contents.  dest may alias a
+ * or b exactly, but must not otherwise overlap them.
+ */
+void VFSXorCombine( void* dest, const void* a, const void* b, size_t count );
+
+/**
+ * @return name of the kernel currently in use, e.g. "avx2"
+ */
+const char* VFSXorKernelName( void );
+
+/**
+ * Force a particular kernel, by name, for testing and benchmarking.
+ * Names are "scalar", "sse2", "avx2", "avx512" and "neon".
+ *
+ * @return 0 on success, -1 if the named kernel is unknown or not
+ * supported by this CPU.
+ */
+int VFSXorSelect( const char* name );
+
+#endif
+
+// eof
@@ -0,0 +1,141 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vernamfs/aes128.h"
+#include "vernamfs/aesctr.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Check every AES backend the cpu supports against the NIST SP
+ * 800-38A ECB-AES128 vectors (as quoted in aes128.c), and check the
+ * CTR keystream against the original tiny-AES one-block-at-a-time
+ * generate loop.
+ */
+
+static const uint8_t nistKey[16] = {
+  0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+  0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+static const uint8_t nistPlain[64] = {
+  0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+  0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+  0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+  0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+  0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+  0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+  0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+
+static const uint8_t nistCipher[64] = {
+  0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60,
+  0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97,
+  0xf5, 0xd3, 0xd5, 0x85, 0x03, 0xb9, 0x69, 0x9d,
+  0xe7, 0x85, 0x89, 0x5a, 0x96, 0xfd, 0xba, 0xaf,
+  0x43, 0xb1, 0xcd, 0x7f, 0x59, 0x8e, 0xce, 0x23,
+  0x88, 0x1b, 0x00, 0xe3, 0xed, 0x03, 0x06, 0x88,
+  0x7b, 0x0c, 0x78, 0x5e, 0x27, 0xe8, 0xad, 0x3f,
+  0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5d, 0xd4 };
+
+#define CTRBLOCKS 1000
+
+static void testBackend( const char* name ) {
+
+  AES128CTR ctr;
+  AES128CTRInit( &ctr, nistKey );
+  if( AES128CTRSelect( &ctr, name ) ) {
+	printf( "%s: not supported, skipped\n", name );
+	return;
+  }
+  printf( "%s\n", name );
+
+  // The four NIST blocks, then 9 blocks so the 8-wide paths are hit
+  uint8_t out[64];
+  AES128CTREncryptBlocks( &ctr, nistPlain, out, 4 );
+  assert( memcmp( out, nistCipher, 64 ) == 0 );
+
+  uint8_t in9[9*16], out9[9*16];
+  int i;
+  for( i = 0; i < 9; i++ )
+	memcpy( in9 + 16 * i, nistPlain + 16 * (i % 4), 16 );
+  AES128CTREncryptBlocks( &ctr, in9, out9, 9 );
+  for( i = 0; i < 9; i++ )
+	assert( memcmp( out9 + 16 * i, nistCipher + 16 * (i % 4), 16 ) == 0 );
+
+  // CTR keystream matches the original generate loop
+  static uint8_t ks[CTRBLOCKS*16];
+  AES128CTRBlocks( &ctr, 0, ks, CTRBLOCKS );
+  for( i = 0; i < CTRBLOCKS; i++ ) {
+	uint8_t input[16] = { 0 };
+	uint8_t expected[16];
+	uint64_t* ip = (uint64_t*)input;
+	*ip = i;
+	AES128_ECB_encrypt( input, nistKey, expected );
+	assert( memcmp( ks + 16 * i, expected, 16 ) == 0 );
+  }
+
+  // Random access: a keystream run from the middle matches
+  uint8_t mid[37*16];
+  AES128CTRBlocks( &ctr, 501, mid, 37 );
+  assert( memcmp( mid, ks + 501 * 16, sizeof( mid ) ) == 0 );
+
+  // Byte-granular access, at every alignment of offset and length
+  uint8_t bytes[100];
+  int off, len;
+  for( off = 0; off < 40; off++ ) {
+	for( len = 0; len <= sizeof( bytes ); len += 7 ) {
+	  AES128CTRStream( &ctr, 1000 + off, bytes, len );
+	  assert( memcmp( bytes, ks + 1000 + off, len ) == 0 );
+	}
+  }
+}
+
+int main( int argc, char* argv[] ) {
+
+  testBackend( "soft" );
+
+  testBackend( "ttable" );
+
+  testBackend( "aesni" );
+
+  testBackend( "armv8" );
+
+  return 0;
+}
+
+// eof
@@ -0,0 +1,154 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vernamfs/chacha20.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Check every ChaCha20 backend the cpu supports against RFC 7539
+ * (Appendix A.1, test vectors 1 and 2: zero key, zero nonce, block
+ * counters 0 and 1), across the 32-bit counter carry, and against
+ * the scalar backend for runs that are not a whole number of vector
+ * groups.
+ */
+
+static const uint8_t rfcKeystream[128] = {
+  0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+  0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+  0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a,
+  0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+  0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d,
+  0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+  0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c,
+  0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86,
+  0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a,
+  0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+  0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69,
+  0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+  0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43,
+  0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+  0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45,
+  0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f };
+
+// Key 00 01 .. 1f, block counters 0xffffffff and 0x100000000
+static const uint8_t carryKeystream[128] = {
+  0x1c, 0xe0, 0xde, 0xb8, 0x92, 0x5f, 0xcc, 0xea,
+  0x2d, 0x55, 0x87, 0xe8, 0x50, 0x05, 0x45, 0x59,
+  0xed, 0xcb, 0xbe, 0xb1, 0xa6, 0xc8, 0xe1, 0xc0,
+  0x2c, 0x1e, 0x89, 0xab, 0xba, 0x08, 0xb0, 0x1c,
+  0xad, 0x60, 0x48, 0xfe, 0x5a, 0xb5, 0x24, 0x2e,
+  0xd6, 0xbe, 0xfb, 0xef, 0x6b, 0x40, 0x40, 0xfc,
+  0xb6, 0x66, 0xa5, 0xf3, 0x85, 0x8d, 0x94, 0x2a,
+  0x91, 0x2c, 0x4e, 0x88, 0x00, 0x30, 0x1a, 0x42,
+  0xd8, 0x38, 0xfb, 0x09, 0x53, 0x6e, 0x2e, 0x3a,
+  0x10, 0xe8, 0xf2, 0x3f, 0x48, 0x62, 0x73, 0xa6,
+  0x9f, 0x42, 0xd8, 0xe6, 0x40, 0xd7, 0x81, 0xed,
+  0xe3, 0x84, 0x79, 0x3c, 0x34, 0xc3, 0x25, 0x64,
+  0xfc, 0x43, 0x61, 0xe5, 0xd5, 0xc5, 0xb6, 0x20,
+  0x58, 0x3b, 0x05, 0x28, 0x19, 0x2f, 0x4c, 0x61,
+  0x09, 0xf2, 0x3a, 0x0e, 0x14, 0x39, 0x8e, 0xe6,
+  0x53, 0x7c, 0xdc, 0xf2, 0xcd, 0x61, 0x0e, 0xa2 };
+
+#define RUNBLOCKS 37
+
+static void testBackend( const char* name ) {
+
+  uint8_t zeroKey[CHACHA20_KEYSIZE] = { 0 };
+  uint8_t seqKey[CHACHA20_KEYSIZE];
+  int i;
+  for( i = 0; i < CHACHA20_KEYSIZE; i++ )
+	seqKey[i] = i;
+
+  ChaCha20 cc;
+  ChaCha20Init( &cc, zeroKey );
+  if( ChaCha20Select( &cc, name ) ) {
+	printf( "%s: not supported, skipped\n", name );
+	return;
+  }
+  printf( "%s\n", name );
+
+  uint8_t out[2*CHACHA20_BLOCKSIZE];
+  ChaCha20Blocks( &cc, 0, out, 2 );
+  assert( memcmp( out, rfcKeystream, sizeof( out ) ) == 0 );
+
+  ChaCha20Init( &cc, seqKey );
+  ChaCha20Select( &cc, name );
+  ChaCha20Blocks( &cc, 0xffffffffULL, out, 2 );
+  assert( memcmp( out, carryKeystream, sizeof( out ) ) == 0 );
+
+  // Odd-length runs, straddling the carry, match the scalar code
+  ChaCha20 ref;
+  ChaCha20Init( &ref, seqKey );
+  ChaCha20Select( &ref, "scalar" );
+  static uint8_t expected[RUNBLOCKS*CHACHA20_BLOCKSIZE];
+  static uint8_t actual[RUNBLOCKS*CHACHA20_BLOCKSIZE];
+  uint64_t first = 0x100000000ULL - 13;
+  ChaCha20Blocks( &ref, first, expected, RUNBLOCKS );
+  int n;
+  for( n = 0; n <= RUNBLOCKS; n++ ) {
+	memset( actual, 0, sizeof( actual ) );
+	ChaCha20Blocks( &cc, first, actual, n );
+	assert( memcmp( actual, expected, n * CHACHA20_BLOCKSIZE ) == 0 );
+  }
+
+  // Byte-granular access
+  uint8_t bytes[200];
+  int off, len;
+  for( off = 0; off < 70; off++ ) {
+	for( len = 0; len <= sizeof( bytes ); len += 13 ) {
+	  ChaCha20Stream( &cc, first * CHACHA20_BLOCKSIZE + off, bytes, len );
+	  assert( memcmp( bytes, expected + off, len ) == 0 );
+	}
+  }
+}
+
+int main( int argc, char* argv[] ) {
+
+  testBackend( "scalar" );
+
+  testBackend( "sse2" );
+
+  testBackend( "avx2" );
+
+  testBackend( "neon" );
+
+  return 0;
+}
+
+// eof
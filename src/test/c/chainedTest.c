@@ -0,0 +1,295 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Chained VFSFile writers on an all-zeros pad, so that table, extent
+ * headers and content all read back in the clear.  Writers interleave
+ * their files' writes, so their extents interleave in the data area.
+ * Every chain must lead, in order, through its file's content, no two
+ * extents may overlap, and the stored header must cover each extent
+ * as soon as it is written, not just at release.  Full extents must
+ * start on combine-size boundaries.  A larger combine size must give
+ * larger extents.
+ */
+
+#define WRITERS 4
+#define FILESPERWRITER 6
+#define PADSIZE (32 << 20)
+
+static VFS vfs;
+
+static uint64_t alignUp( uint64_t val, uint64_t boundary ) {
+  return (val + boundary - 1) & ~(boundary - 1);
+}
+
+static uint8_t content( int writer, int file, uint64_t offset ) {
+  return (uint8_t)(writer * 31 + file * 7 + offset / 3);
+}
+
+static uint64_t fileSize( int writer, int file ) {
+  // Some empty, some under one extent, some several extents
+  return (uint64_t)(writer * 977 + file * 40961) % 300000;
+}
+
+/*
+  Each writer has all its files open at once, writing a chunk to each
+  in turn, so no file is ever written start to end in one go.
+*/
+static void* writer( void* arg ) {
+  int sc;
+  int w = (int)(intptr_t)arg;
+  VFSFile* files[FILESPERWRITER];
+  uint64_t offsets[FILESPERWRITER] = { 0 };
+  uint8_t buf[9000];
+  int i;
+  for( i = 0; i < FILESPERWRITER; i++ ) {
+	char name[32];
+	sprintf( name, "/w%d.%d", w, i );
+	sc = VFSFileOpen( &vfs, name, files + i );
+	assert( sc == 0 );
+  }
+  int open = FILESPERWRITER;
+  while( open ) {
+	for( i = 0; i < FILESPERWRITER; i++ ) {
+	  if( !files[i] )
+		continue;
+	  uint64_t size = fileSize( w, i );
+	  uint64_t n = size - offsets[i];
+	  uint64_t chunk = 1000 + (w * 13 + i * 1777 + offsets[i]) % 8000;
+	  if( n > chunk )
+		n = chunk;
+	  uint64_t j;
+	  for( j = 0; j < n; j++ )
+		buf[j] = content( w, i, offsets[i] + j );
+	  if( n ) {
+		sc = VFSFileWrite( files[i], buf, n, offsets[i] );
+		assert( sc == n );
+	  }
+	  offsets[i] += n;
+	  assert( files[i]->capacity <= VERNAMFS_EXTENTSIZE );
+	  if( offsets[i] == size ) {
+		sc = VFSFileRelease( files[i] );
+		assert( sc == 0 );
+		files[i] = NULL;
+		open--;
+	  }
+	}
+  }
+  return NULL;
+}
+
+typedef struct {
+  uint64_t offset, length;
+} Extent;
+
+static int compareExtents( const void* a, const void* b ) {
+  const Extent* ea = a;
+  const Extent* eb = b;
+  return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  uint8_t* pad = calloc( 1, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, WRITERS * FILESPERWRITER + 2, 30, 0 );
+  assert( sc == 0 );
+  VFSSetChained( &vfs, 1 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  assert( VFSChained( &vfs ) );
+  VFSHeader* h = &vfs.header;
+
+  // Stored dataPtr covers an extent as soon as it is written out
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/early", &f );
+  assert( sc == 0 );
+  uint64_t payload = VERNAMFS_EXTENTSIZE - sizeof( VFSExtentHeader );
+  uint8_t big[VERNAMFS_EXTENTSIZE];
+  memset( big, 0x5a, sizeof( big ) );
+  sc = VFSFileWrite( f, big, payload, 0 );
+  assert( sc == payload );
+  VFSHeader* stored = (VFSHeader*)pad;
+  assert( stored->tablePtr == h->tableOffset );
+  uint64_t first = alignUp( h->dataOffset, VERNAMFS_EXTENTSIZE );
+  assert( stored->dataPtr == first + VERNAMFS_EXTENTSIZE );
+
+  // Flushed content cannot be rewritten, staged content can
+  sc = VFSFileWrite( f, big, 10, payload - 1 );
+  assert( sc == -EINVAL );
+  sc = VFSFileWrite( f, big, 10, payload + 5 );
+  assert( sc == 10 );
+  sc = VFSFileWrite( f, "ab", 2, payload + 6 );
+  assert( sc == 2 );
+
+  // A hole reads back as zeros
+  sc = VFSFileWrite( f, "z", 1, payload + 20 );
+  assert( sc == 1 );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+
+  VFSTableEntryFixed* tef = (VFSTableEntryFixed*)(pad + h->tableOffset);
+  assert( tef->length == ((payload + 21) | VERNAMFS_LENGTH_CHAINED) );
+  assert( tef->offset == first );
+  VFSExtentHeader* eh = (VFSExtentHeader*)(pad + tef->offset);
+  assert( eh->length == payload );
+  assert( eh->next == tef->offset + VERNAMFS_EXTENTSIZE );
+  eh = (VFSExtentHeader*)(pad + eh->next);
+  uint8_t* tail = (uint8_t*)(eh + 1);
+  assert( eh->next == 0 && eh->length == 21 );
+  assert( tail[0] == 0 && tail[4] == 0 );
+  assert( tail[5] == 0x5a && tail[6] == 'a' && tail[7] == 'b' );
+  assert( tail[15] == 0 && tail[19] == 0 && tail[20] == 'z' );
+
+  pthread_t tids[WRITERS];
+  int i;
+  for( i = 0; i < WRITERS; i++ )
+	pthread_create( tids + i, NULL, writer, (void*)(intptr_t)i );
+  for( i = 0; i < WRITERS; i++ )
+	pthread_join( tids[i], NULL );
+
+  // Walk every chain, collecting extents, checking content
+  int files = 1 + WRITERS * FILESPERWRITER;
+  assert( stored->tablePtr == h->tableOffset + files * h->tableEntrySize );
+  int maxExtents = files * (300000 / payload + 2);
+  Extent* extents = calloc( maxExtents, sizeof( Extent ) );
+  int count = 0;
+  for( i = 0; i < files; i++ ) {
+	uint8_t* te = pad + h->tableOffset + i * h->tableEntrySize;
+	tef = (VFSTableEntryFixed*)te;
+	assert( tef->length & VERNAMFS_LENGTH_CHAINED );
+	int w, n;
+	if( sscanf( (char*)te + sizeof( VFSTableEntryFixed ), 
+				"/w%d.%d", &w, &n ) != 2 ) {
+	  extents[count].offset = tef->offset;
+	  extents[count++].length = VERNAMFS_EXTENTSIZE;
+	  extents[count].offset = tef->offset + VERNAMFS_EXTENTSIZE;
+	  extents[count++].length = sizeof( VFSExtentHeader ) + 21;
+	  continue;
+	}
+	uint64_t size = fileSize( w, n );
+	assert( (tef->length & VERNAMFS_LENGTH_MASK) == size );
+	uint64_t offset = 0;
+	uint64_t extent = tef->offset;
+	while( extent ) {
+	  eh = (VFSExtentHeader*)(pad + extent);
+	  assert( extent >= h->dataOffset );
+	  assert( extent + sizeof( *eh ) + eh->length <= stored->dataPtr );
+	  assert( eh->next == 0 || eh->next > extent );
+	  if( eh->length == payload )
+		assert( extent % VERNAMFS_EXTENTSIZE == 0 );
+	  uint8_t* data = (uint8_t*)(eh + 1);
+	  uint64_t j;
+	  for( j = 0; j < eh->length; j++ )
+		assert( data[j] == content( w, n, offset + j ) );
+	  offset += eh->length;
+	  assert( count < maxExtents );
+	  extents[count].offset = extent;
+	  extents[count++].length = sizeof( *eh ) + eh->length;
+	  extent = eh->next;
+	}
+	assert( offset == size );
+	if( size == 0 )
+	  assert( tef->offset == 0 );
+  }
+
+  qsort( extents, count, sizeof( Extent ), compareExtents );
+  for( i = 1; i < count; i++ )
+	assert( extents[i-1].offset + extents[i-1].length <= extents[i].offset );
+
+  // Full pad: a write that cannot be reserved fails, cleanly
+  sc = VFSFileOpen( &vfs, "/full", &f );
+  assert( sc == 0 );
+  uint64_t space = h->length - vfs.dataReserved;
+  uint64_t offset = 0;
+  while( (sc = VFSFileWrite( f, big, 4096, offset )) > 0 )
+	offset += sc;
+  assert( sc == -ENOSPC );
+  assert( offset <= space );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  assert( stored->dataPtr <= h->length );
+
+  // Write-combining, 1M extents, on a fresh pad
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, 4, 30, 0 );
+  assert( sc == 0 );
+  VFSSetChained( &vfs, 1 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  sc = VFSSetCombineSize( &vfs, 1 << 20 );
+  assert( sc == 0 );
+  sc = VFSFileOpen( &vfs, "/wide", &f );
+  assert( sc == 0 );
+  payload = (1 << 20) - sizeof( VFSExtentHeader );
+  assert( f->capacity == payload );
+  for( offset = 0; offset + sizeof( big ) < 3 * payload; offset += sc ) {
+	sc = VFSFileWrite( f, big, sizeof( big ), offset );
+	assert( sc == sizeof( big ) );
+	if( offset + sc < payload )
+	  assert( stored->dataPtr == h->dataOffset );
+  }
+  first = alignUp( h->dataOffset, 1 << 20 );
+  assert( stored->dataPtr == first + 2 * (1 << 20) );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  tef = (VFSTableEntryFixed*)(pad + h->tableOffset);
+  assert( tef->offset == first );
+  eh = (VFSExtentHeader*)(pad + tef->offset);
+  assert( eh->length == payload && eh->next == tef->offset + (1 << 20) );
+  eh = (VFSExtentHeader*)(pad + eh->next);
+  assert( eh->length == payload && eh->next == tef->offset + 2 * (1 << 20) );
+  eh = (VFSExtentHeader*)(pad + eh->next);
+  assert( eh->next == 0 && eh->length == offset - 2 * payload );
+
+  free( extents );
+  free( pad );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
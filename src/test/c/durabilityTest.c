@@ -0,0 +1,223 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * VFSSetDurability on an all-zeros, file-backed (so msync'able) pad.
+ * Per-file, every release must be flushed, and stored, on its own.
+ * Group, the stored tablePtr must not move until a group is flushed,
+ * by count, by the timer, or at stop, and then cover exactly the
+ * group, even with concurrent writers still publishing, while the
+ * stored dataPtr covers every claim, chained extents included.  The
+ * stats must count it all.
+ */
+
+#define PADSIZE (8 << 20)
+#define MAXFILES 256
+#define WRITERS 4
+#define FILESPERWRITER 40
+
+static VFS vfs;
+
+static void writeFile( const char* name, int size ) {
+  int sc;
+  uint8_t buf[5000];
+  memset( buf, size & 0xff, size );
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, name, &f );
+  assert( sc == 0 );
+  sc = VFSFileWrite( f, buf, size, 0 );
+  assert( sc == size );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+}
+
+static void* writer( void* arg ) {
+  int w = (int)(intptr_t)arg;
+  int i;
+  for( i = 0; i < FILESPERWRITER; i++ ) {
+	char name[32];
+	sprintf( name, "/w%d.%d", w, i );
+	writeFile( name, 100 + w * 10 + i );
+  }
+  return NULL;
+}
+
+static void fresh( uint8_t* pad ) {
+  int sc;
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, MAXFILES, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+}
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  char path[] = "/tmp/durabilityTestXXXXXX";
+  int fd = mkstemp( path );
+  assert( fd >= 0 );
+  unlink( path );
+  sc = ftruncate( fd, PADSIZE );
+  assert( sc == 0 );
+  uint8_t* pad = mmap( NULL, PADSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, 
+					   fd, 0 );
+  assert( pad != MAP_FAILED );
+  VFSHeader* stored = (VFSHeader*)pad;
+  VFSHeader* h = &vfs.header;
+
+  // Lazy, the default: stored at every release, never flushed
+  fresh( pad );
+  assert( vfs.durability == VERNAMFS_DURABILITY_LAZY );
+  writeFile( "/a", 10 );
+  assert( stored->tablePtr == h->tableOffset + h->tableEntrySize );
+  assert( vfs.stats.files == 1 && vfs.stats.bytes == 10 );
+  assert( vfs.stats.stores == 1 && vfs.stats.flushes == 0 );
+
+  // Per-file: a flush per release
+  fresh( pad );
+  VFSSetDurability( &vfs, VERNAMFS_DURABILITY_FILE, 0, 0 );
+  int i;
+  for( i = 0; i < 5; i++ ) {
+	writeFile( "/f", 1000 );
+	assert( stored->tablePtr == h->tableOffset + (i+1) * h->tableEntrySize );
+  }
+  assert( vfs.stats.flushes == 5 && vfs.stats.flushFiles == 5 );
+  assert( vfs.stats.maxFlushNanos <= vfs.stats.flushNanos );
+
+  // Group of 4: nothing stored until the 4th release, then all 4
+  fresh( pad );
+  VFSSetDurability( &vfs, VERNAMFS_DURABILITY_GROUP, 4, 0 );
+  uint64_t tableStart = h->tableOffset;
+  for( i = 0; i < 3; i++ )
+	writeFile( "/g", 1000 );
+  assert( stored->tablePtr == tableStart );
+  assert( stored->dataPtr == h->dataPtr );
+  assert( vfs.stats.stores == 3 && vfs.stats.flushes == 0 );
+  writeFile( "/g", 1000 );
+  assert( stored->tablePtr == tableStart + 4 * h->tableEntrySize );
+  assert( stored->dataPtr == h->dataPtr );
+  assert( vfs.stats.flushes == 1 && vfs.stats.flushFiles == 4 );
+
+  // The rest at stop
+  writeFile( "/g", 1000 );
+  assert( stored->tablePtr == tableStart + 4 * h->tableEntrySize );
+  VFSStopGroupCommit( &vfs );
+  assert( stored->tablePtr == tableStart + 5 * h->tableEntrySize );
+  assert( vfs.stats.flushes == 2 && vfs.stats.flushFiles == 5 );
+
+  // By time alone
+  fresh( pad );
+  VFSSetDurability( &vfs, VERNAMFS_DURABILITY_GROUP, 0, 20 );
+  sc = VFSStartGroupCommit( &vfs );
+  assert( sc == 0 );
+  writeFile( "/t", 1000 );
+  for( i = 0; i < 100 && 
+		 __atomic_load_n( &vfs.stats.flushes, __ATOMIC_RELAXED ) == 0; i++ )
+	usleep( 10000 );
+  VFSStopGroupCommit( &vfs );
+  assert( vfs.groupTimer == NULL );
+  assert( stored->tablePtr == tableStart + h->tableEntrySize );
+  assert( vfs.stats.flushes == 1 );
+
+  // Group, chained: an extent's pad is stored as claimed, its file not
+  fresh( pad );
+  VFSSetChained( &vfs, 1 );
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFSSetDurability( &vfs, VERNAMFS_DURABILITY_GROUP, 4, 0 );
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/c", &f );
+  assert( sc == 0 );
+  static uint8_t extent[VERNAMFS_EXTENTSIZE];
+  sc = VFSFileWrite( f, extent, sizeof( extent ), 0 );
+  assert( sc == sizeof( extent ) );
+  assert( stored->tablePtr == tableStart );
+  assert( stored->dataPtr == h->dataPtr && h->dataPtr > h->dataOffset );
+  assert( vfs.stats.flushes == 0 );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  assert( stored->tablePtr == tableStart );
+  VFSStopGroupCommit( &vfs );
+  assert( stored->tablePtr == tableStart + h->tableEntrySize );
+
+  // Concurrent writers, count and timer both: the stored header only
+  // ever covers whole groups of complete files
+  fresh( pad );
+  VFSSetDurability( &vfs, VERNAMFS_DURABILITY_GROUP, 16, 5 );
+  sc = VFSStartGroupCommit( &vfs );
+  assert( sc == 0 );
+  pthread_t tids[WRITERS];
+  for( i = 0; i < WRITERS; i++ )
+	pthread_create( tids + i, NULL, writer, (void*)(intptr_t)i );
+  for( i = 0; i < WRITERS; i++ )
+	pthread_join( tids[i], NULL );
+  VFSStopGroupCommit( &vfs );
+  int files = WRITERS * FILESPERWRITER;
+  assert( stored->tablePtr == tableStart + files * h->tableEntrySize );
+  assert( vfs.stats.files == files && vfs.stats.flushFiles == files );
+  assert( vfs.stats.stores == files + vfs.stats.flushes );
+  for( i = 0; i < files; i++ ) {
+	uint8_t* te = pad + tableStart + i * h->tableEntrySize;
+	VFSTableEntryFixed* tef = (VFSTableEntryFixed*)te;
+	int w, n;
+	sc = sscanf( (char*)(tef + 1), "/w%d.%d", &w, &n );
+	assert( sc == 2 );
+	assert( tef->length == 100 + w * 10 + n );
+	assert( pad[tef->offset] == tef->length );
+	assert( tef->offset + tef->length <= stored->dataPtr );
+  }
+
+  munmap( pad, PADSIZE );
+  close( fd );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
@@ -0,0 +1,288 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "vernamfs/engine.h"
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Each engine (engine.h) on a file-backed pad.  First alone: xors at
+ * assorted offsets and lengths, unaligned, across blocks and windows,
+ * up to a short last block, and concurrent xors of neighbouring
+ * ranges sharing blocks, must match a model of the pad.  Then beneath
+ * an all-zeros VFS (VFSSetEngine), with only the header mapped as
+ * backing, as when mounted.  A file larger than a window, on a plain
+ * pad and on each shard of a sharded one, must land intact, as seen
+ * through a mapping of the whole pad, with no more mmap windows
+ * mapped at once than asked for, and syncs (file durability) must go
+ * through the engine too.
+ */
+
+#define PADSIZE (4 << 20)
+#define SHARDS 3
+#define NEIGHBOURS 6
+
+// Engine-alone pad, its last block short, and the neighbours' ranges
+#define SMALLSIZE ((1 << 20) + 100)
+#define RANGE 100
+#define RANGES 2000
+
+static VFSEngine* engine;
+static char path[] = "/tmp/engineTestXXXXXX";
+
+static void* neighbour( void* arg ) {
+  int w = (int)(intptr_t)arg;
+  uint8_t buf[RANGE];
+  int k;
+  for( k = w; k < RANGES; k += NEIGHBOURS ) {
+	memset( buf, k % 251 + 1, RANGE );
+	VFSEngineXor( engine, (uint64_t)k * RANGE, buf, RANGE );
+  }
+  return NULL;
+}
+
+static void alone( int type ) {
+
+  int sc;
+  int fd = open( path, O_RDWR );
+  assert( fd >= 0 );
+  sc = ftruncate( fd, 0 );
+  assert( sc == 0 );
+  sc = ftruncate( fd, SMALLSIZE );
+  assert( sc == 0 );
+  close( fd );
+  engine = VFSEngineOpen( type, path, SMALLSIZE, 4 * 4096, 2 );
+  assert( engine );
+  assert( VFSEngineTypeOf( engine ) == type );
+  assert( VFSEngineSize( engine ) == SMALLSIZE );
+
+  static uint8_t model[SMALLSIZE], buf[SMALLSIZE];
+  memset( model, 0, sizeof( model ) );
+  static const uint64_t spans[][2] = {
+	{ 0, 1 }, { 1, 4095 }, { 4095, 2 }, { 4096, 4096 }, { 5000, 70000 },
+	{ 8191, 16385 }, { 123, 3 * 65536 + 77 }, { SMALLSIZE - 5000, 5000 },
+	{ SMALLSIZE - 1, 1 }, { SMALLSIZE - 200, 150 }, { 0, SMALLSIZE }
+  };
+  int i;
+  for( i = 0; i < sizeof( spans ) / sizeof( spans[0] ); i++ ) {
+	uint64_t off = spans[i][0], len = spans[i][1];
+	uint64_t j;
+	for( j = 0; j < len; j++ ) {
+	  buf[j] = (uint8_t)(i * 37 + j);
+	  model[off + j] ^= buf[j];
+	}
+	VFSEngineXor( engine, off, buf, len );
+	memset( buf, 0, len );
+	VFSEngineRead( engine, off, buf, len );
+	assert( memcmp( buf, model + off, len ) == 0 );
+  }
+  VFSEngineSync( engine, 0, SMALLSIZE );
+  VFSEngineAdvise( engine, 0, SMALLSIZE );
+
+  // Neighbours, every block shared, none's xor lost to another's
+  pthread_t tids[NEIGHBOURS];
+  for( i = 0; i < NEIGHBOURS; i++ )
+	pthread_create( tids + i, NULL, neighbour, (void*)(intptr_t)i );
+  for( i = 0; i < NEIGHBOURS; i++ )
+	pthread_join( tids[i], NULL );
+  int k;
+  for( k = 0; k < RANGES; k++ ) {
+	int j;
+	for( j = 0; j < RANGE; j++ )
+	  model[k * RANGE + j] ^= k % 251 + 1;
+  }
+  VFSEngineRead( engine, 0, buf, SMALLSIZE );
+  assert( memcmp( buf, model, SMALLSIZE ) == 0 );
+  VFSEngineClose( engine );
+
+  // As the page cache, or device, has it
+  fd = open( path, O_RDONLY );
+  sc = pread( fd, buf, SMALLSIZE, 0 );
+  assert( sc == SMALLSIZE );
+  close( fd );
+  assert( memcmp( buf, model, SMALLSIZE ) == 0 );
+}
+
+// Mappings of the pad file, merged neighbours counting as one
+static int mappings( void ) {
+  FILE* fp = fopen( "/proc/self/maps", "r" );
+  assert( fp );
+  char line[512];
+  int n = 0;
+  while( fgets( line, sizeof( line ), fp ) )
+	if( strstr( line, path ) )
+	  n++;
+  fclose( fp );
+  return n;
+}
+
+static void run( int type, int shards, int durability ) {
+
+  int sc;
+  int fd = open( path, O_RDWR );
+  assert( fd >= 0 );
+  sc = ftruncate( fd, 0 );
+  assert( sc == 0 );
+  sc = ftruncate( fd, PADSIZE );
+  assert( sc == 0 );
+  uint8_t* pad = mmap( NULL, PADSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, 
+					   fd, 0 );
+  assert( pad != MAP_FAILED );
+
+  VFS vfs;
+  int files = 4 * SHARDS;
+  if( shards > 1 ) {
+	sc = VFSInitSharded( &vfs, PADSIZE, files, 30, 0, shards );
+	assert( sc == 0 );
+  }
+  else {
+	sc = VFSInit( &vfs, PADSIZE, files, 30, 0 );
+	assert( sc == 0 );
+  }
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  int before = mappings();
+
+  // As mount does: the header alone, the rest, for mmap, a page at a time
+  void* header = mmap( NULL, VERNAMFS_HEADERMAPSIZE, PROT_READ|PROT_WRITE, 
+					   MAP_SHARED, fd, 0 );
+  assert( header != MAP_FAILED );
+  VFSLoad( &vfs, header );
+  uint64_t page = sysconf( _SC_PAGE_SIZE );
+  int windows = 2 * VFSShardCount( &vfs ) + 2;
+  engine = VFSEngineOpen( type, path, PADSIZE, page, windows );
+  assert( engine );
+  VFSSetEngine( &vfs, engine );
+
+  VFS views[SHARDS];
+  int units = VFSShardCount( &vfs );
+  VFS* targets = units > 1 ? views : &vfs;
+  int i;
+  for( i = 0; i < units && units > 1; i++ )
+	VFSShard( &vfs, i, views + i );
+  for( i = 0; i < units; i++ )
+	VFSSetDurability( targets + i, durability, 0, 0 );
+
+  // Larger than a window, so xor'ed through several, on every shard
+  static uint8_t big[5 * 4096 + 123];
+  for( i = 0; i < units; i++ ) {
+	size_t j;
+	for( j = 0; j < sizeof( big ); j++ )
+	  big[j] = (uint8_t)(i * 7 + j / 11 + 1);
+	VFSFile* f;
+	sc = VFSFileOpen( targets + i, "/big", &f );
+	assert( sc == 0 );
+	sc = VFSFileWrite( f, big, sizeof( big ), 0 );
+	assert( sc == sizeof( big ) );
+	sc = VFSFileRelease( f );
+	assert( sc == 0 );
+	VFSTableEntryFixed* tef = 
+	  (VFSTableEntryFixed*)(pad + targets[i].header.tableOffset);
+	assert( tef->length == sizeof( big ) );
+	assert( memcmp( pad + tef->offset, big, sizeof( big ) ) == 0 );
+  }
+
+  // The header, and at most the windows asked for
+  assert( mappings() - before <= 1 + windows );
+
+  VFSEngineClose( engine );
+  assert( mappings() - before <= 1 );
+  munmap( header, VERNAMFS_HEADERMAPSIZE );
+  munmap( pad, PADSIZE );
+  close( fd );
+}
+
+int main( int argc, char* argv[] ) {
+
+  int fd = mkstemp( path );
+  assert( fd >= 0 );
+  close( fd );
+
+  // Names, and bad window sizes
+  assert( VFSEngineType( "mmap" ) == VERNAMFS_ENGINE_MMAP );
+  assert( VFSEngineType( "pwrite" ) == VERNAMFS_ENGINE_PWRITE );
+  assert( VFSEngineType( "direct" ) == VERNAMFS_ENGINE_DIRECT );
+  assert( VFSEngineType( "aio" ) == -1 );
+  assert( strcmp( VFSEngineName( VERNAMFS_ENGINE_DIRECT ), "direct" ) == 0 );
+  uint64_t page = sysconf( _SC_PAGE_SIZE );
+  VFSEngine* bad;
+  bad = VFSEngineOpen( VERNAMFS_ENGINE_MMAP, path, PADSIZE, page + 1, 4 );
+  assert( !bad );
+  bad = VFSEngineOpen( VERNAMFS_ENGINE_MMAP, path, PADSIZE, page / 2, 4 );
+  assert( !bad );
+  bad = VFSEngineOpen( VERNAMFS_ENGINE_MMAP, path, PADSIZE, 
+					   2 * (uint64_t)VERNAMFS_MAXWINDOWSIZE, 4 );
+  assert( !bad );
+  bad = VFSEngineOpen( VERNAMFS_ENGINE_MMAP, path, PADSIZE, page, 0 );
+  assert( !bad );
+  bad = VFSEngineOpen( 7, path, PADSIZE, page, 4 );
+  assert( !bad );
+
+  int type;
+  for( type = VERNAMFS_ENGINE_MMAP; type <= VERNAMFS_ENGINE_DIRECT; type++ ) {
+
+	// Not all filesystems, e.g. tmpfs, take O_DIRECT
+	VFSEngine* probe = VFSEngineOpen( type, path, PADSIZE, 0, 1 );
+	if( !probe ) {
+	  assert( type == VERNAMFS_ENGINE_DIRECT );
+	  printf( "%s: not supported on %s, skipped\n", 
+			  VFSEngineName( type ), path );
+	  continue;
+	}
+	VFSEngineClose( probe );
+
+	alone( type );
+	run( type, 1, VERNAMFS_DURABILITY_LAZY );
+	run( type, SHARDS, VERNAMFS_DURABILITY_LAZY );
+	run( type, 1, VERNAMFS_DURABILITY_FILE );
+	run( type, SHARDS, VERNAMFS_DURABILITY_FILE );
+  }
+
+  unlink( path );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
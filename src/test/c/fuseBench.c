@@ -0,0 +1,524 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+/**
+ * @author Stuart Maclean
+ *
+ * End-to-end throughput/latency harness for a mounted VernamFS.
+ *
+ * Makes a temporary keyed pad ('vernamfs generate -z -n ... -o'),
+ * mounts it, drives workloads through the mount point, unmounts and
+ * then runs 'vernamfs recover -z' to check every file round-trips.
+ * Reports files/s, MB/s and p50/p99/p999 latencies for open, write
+ * and release (close) per workload.
+ *
+ * Workloads (-w, repeatable, default all):
+ *
+ * tiny - many small files
+ *
+ * huge - a few very large files
+ *
+ * mixed - file sizes log-uniform from 1 byte to 4MB
+ *
+ * concurrent - -j writers, each with its own open file.  Any EBUSY
+ * open (a mount serializing writers) is counted and retried.
+ *
+ * -n and -s override a workload's file count and size.  With -b DIR
+ * the same workloads go to an ordinary directory instead, with no
+ * pad, mount or recover, for comparing against a native filesystem.
+ *
+ * $ ./fuseBench -V ./vernamfs
+ * $ ./fuseBench -V ./vernamfs -w concurrent -j 8
+ * $ ./fuseBench -b /tmp/native -w tiny
+ */
+
+typedef struct {
+  double* v;
+  size_t n, capacity;
+} Samples;
+
+typedef struct {
+  Samples open, write, release;
+  uint64_t files, bytes, busy, failed;
+} Stats;
+
+typedef struct {
+  const char* name;
+  char prefix;
+  int files;
+  uint64_t size;		// fixed size, or max size if mixed
+  int mixed;
+  int writers;
+} Workload;
+
+// What was written, so recover's output can be checked
+typedef struct {
+  char name[32];
+  uint64_t seed;
+  uint64_t size;
+} FileRecord;
+
+typedef struct {
+  Workload* w;
+  const char* dir;
+  int first, last;		// file indices, [first,last)
+  Stats stats;
+} Writer;
+
+static Workload workloads[] = {
+  { .name = "tiny", .prefix = 't', .files = 10000, .size = 64 },
+  { .name = "huge", .prefix = 'h', .files = 4, .size = 128 << 20 },
+  { .name = "mixed", .prefix = 'm', .files = 2000, .size = 4 << 20,
+	.mixed = 1 },
+  { .name = "concurrent", .prefix = 'c', .files = 1000, .size = 4096,
+	.writers = 4 },
+  { .name = NULL }
+};
+
+static size_t chunkSize = 128 * 1024;
+
+static FileRecord* records;
+static int recordCount;
+
+static double now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t splitmix64( uint64_t x ) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Content of any file is a pure function of its seed and offset
+static void fill( uint8_t* buf, size_t len, uint64_t seed, uint64_t offset ) {
+  size_t i;
+  uint64_t word = 0;
+  for( i = 0; i < len; i++ ) {
+	uint64_t p = offset + i;
+	if( i == 0 || (p & 7) == 0 )
+	  word = splitmix64( seed ^ (p >> 3) );
+	buf[i] = word >> (8 * (p & 7));
+  }
+}
+
+static uint64_t fileSize( Workload* w, int i ) {
+  if( !w->mixed )
+	return w->size;
+  uint64_t r = splitmix64( ((uint64_t)w->prefix << 32) + i );
+  int bits = 0;
+  while( ((uint64_t)2 << bits) <= w->size )
+	bits++;
+  bits = r % (bits + 1);
+  uint64_t s = ((uint64_t)1 << bits) + (r >> 32) % ((uint64_t)1 << bits);
+  return s > w->size ? w->size : s;
+}
+
+static void samplesAdd( Samples* s, double x ) {
+  if( s->n == s->capacity ) {
+	s->capacity = s->capacity ? 2 * s->capacity : 1024;
+	s->v = realloc( s->v, s->capacity * sizeof( double ) );
+  }
+  s->v[s->n++] = x;
+}
+
+static void samplesMerge( Samples* to, Samples* from ) {
+  size_t i;
+  for( i = 0; i < from->n; i++ )
+	samplesAdd( to, from->v[i] );
+  free( from->v );
+}
+
+static int compareDoubles( const void* a, const void* b ) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile( Samples* s, double p ) {
+  if( s->n == 0 )
+	return 0;
+  size_t i = (size_t)(p * s->n);
+  return s->v[i < s->n ? i : s->n - 1];
+}
+
+static void recordFile( const char* name, uint64_t seed, uint64_t size ) {
+  static int capacity = 0;
+  if( recordCount == capacity ) {
+	capacity = capacity ? 2 * capacity : 1024;
+	records = realloc( records, capacity * sizeof( FileRecord ) );
+  }
+  FileRecord* r = records + recordCount++;
+  snprintf( r->name, sizeof( r->name ), "%s", name );
+  r->seed = seed;
+  r->size = size;
+}
+
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* writer( void* arg ) {
+  Writer* thiz = (Writer*)arg;
+  Workload* w = thiz->w;
+  uint8_t* buf = malloc( chunkSize );
+  int i;
+  for( i = thiz->first; i < thiz->last; i++ ) {
+	char name[32];
+	snprintf( name, sizeof( name ), "%c%07d", w->prefix, i );
+	char path[1024];
+	snprintf( path, sizeof( path ), "%s/%s", thiz->dir, name );
+	uint64_t seed = splitmix64( ((uint64_t)w->prefix << 40) ^ i );
+	uint64_t size = fileSize( w, i );
+
+	int fd;
+	double t0;
+	for( ;; ) {
+	  t0 = now();
+	  fd = open( path, O_WRONLY | O_CREAT, 0644 );
+	  if( fd >= 0 || errno != EBUSY )
+		break;
+	  thiz->stats.busy++;
+	  usleep( 100 );
+	}
+	if( fd < 0 ) {
+	  fprintf( stderr, "open %s: %s\n", path, strerror( errno ) );
+	  thiz->stats.failed++;
+	  continue;
+	}
+	samplesAdd( &thiz->stats.open, now() - t0 );
+
+	uint64_t written = 0;
+	while( written < size ) {
+	  size_t n = size - written < chunkSize ? size - written : chunkSize;
+	  fill( buf, n, seed, written );
+	  t0 = now();
+	  ssize_t nout = write( fd, buf, n );
+	  samplesAdd( &thiz->stats.write, now() - t0 );
+	  if( nout <= 0 ) {
+		fprintf( stderr, "write %s: %s\n", path, 
+				 nout < 0 ? strerror( errno ) : "short" );
+		thiz->stats.failed++;
+		break;
+	  }
+	  written += nout;
+	}
+
+	t0 = now();
+	close( fd );
+	samplesAdd( &thiz->stats.release, now() - t0 );
+
+	thiz->stats.files++;
+	thiz->stats.bytes += written;
+	pthread_mutex_lock( &recordLock );
+	recordFile( name, seed, written );
+	pthread_mutex_unlock( &recordLock );
+  }
+  free( buf );
+  return NULL;
+}
+
+static void reportLatency( const char* op, Samples* s ) {
+  qsort( s->v, s->n, sizeof( double ), compareDoubles );
+  printf( "  %-8s %10zu ops  p50 %10.1f  p99 %10.1f  p999 %10.1f us\n",
+		  op, s->n, percentile( s, 0.5 ) * 1e6, 
+		  percentile( s, 0.99 ) * 1e6, percentile( s, 0.999 ) * 1e6 );
+}
+
+static void runWorkload( Workload* w, const char* dir ) {
+  int writers = w->writers > 0 ? w->writers : 1;
+  Writer* ws = calloc( writers, sizeof( Writer ) );
+  pthread_t* tids = calloc( writers, sizeof( pthread_t ) );
+
+  double t0 = now();
+  int i;
+  for( i = 0; i < writers; i++ ) {
+	ws[i].w = w;
+	ws[i].dir = dir;
+	ws[i].first = (int)((int64_t)w->files * i / writers);
+	ws[i].last = (int)((int64_t)w->files * (i+1) / writers);
+	pthread_create( tids + i, NULL, writer, ws + i );
+  }
+  Stats total;
+  memset( &total, 0, sizeof( total ) );
+  for( i = 0; i < writers; i++ ) {
+	pthread_join( tids[i], NULL );
+	samplesMerge( &total.open, &ws[i].stats.open );
+	samplesMerge( &total.write, &ws[i].stats.write );
+	samplesMerge( &total.release, &ws[i].stats.release );
+	total.files += ws[i].stats.files;
+	total.bytes += ws[i].stats.bytes;
+	total.busy += ws[i].stats.busy;
+	total.failed += ws[i].stats.failed;
+  }
+  double elapsed = now() - t0;
+
+  printf( "%s: %"PRIu64" files, %"PRIu64" bytes, %d writer(s), %.3f s\n",
+		  w->name, total.files, total.bytes, writers, elapsed );
+  printf( "  %.1f files/s, %.2f MB/s, %"PRIu64" busy, %"PRIu64" failed\n",
+		  total.files / elapsed, total.bytes / elapsed / 1e6,
+		  total.busy, total.failed );
+  reportLatency( "open", &total.open );
+  reportLatency( "write", &total.write );
+  reportLatency( "release", &total.release );
+
+  free( total.open.v );
+  free( total.write.v );
+  free( total.release.v );
+  free( ws );
+  free( tids );
+}
+
+// Every recorded file, found in dir with exactly the content written?
+static int verify( const char* dir ) {
+  uint8_t* expected = malloc( chunkSize );
+  uint8_t* actual = malloc( chunkSize );
+  int bad = 0;
+  int i;
+  for( i = 0; i < recordCount; i++ ) {
+	FileRecord* r = records + i;
+	char path[1024];
+	snprintf( path, sizeof( path ), "%s/%s", dir, r->name );
+	int fd = open( path, O_RDONLY );
+	if( fd < 0 ) {
+	  fprintf( stderr, "verify %s: missing\n", path );
+	  bad++;
+	  continue;
+	}
+	uint64_t offset = 0;
+	int ok = 1;
+	while( ok && offset < r->size ) {
+	  size_t n = r->size - offset < chunkSize ? r->size - offset : chunkSize;
+	  fill( expected, n, r->seed, offset );
+	  ok = read( fd, actual, n ) == n && memcmp( expected, actual, n ) == 0;
+	  offset += n;
+	}
+	if( ok && read( fd, actual, 1 ) != 0 )
+	  ok = 0;
+	close( fd );
+	if( !ok ) {
+	  fprintf( stderr, "verify %s: content differs\n", path );
+	  bad++;
+	}
+  }
+  free( expected );
+  free( actual );
+  printf( "verify: %d of %d files round-tripped\n", recordCount - bad, 
+		  recordCount );
+  return bad;
+}
+
+static int run( const char* fmt, ... ) {
+  char cmd[4096];
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( cmd, sizeof( cmd ), fmt, ap );
+  va_end( ap );
+  fprintf( stderr, "+ %s\n", cmd );
+  int sc = system( cmd );
+  if( sc )
+	fprintf( stderr, "Failed (%d): %s\n", sc, cmd );
+  return sc;
+}
+
+// Mounted once mnt is on a different device from its parent
+static int waitMounted( const char* mnt, const char* parent ) {
+  int i;
+  for( i = 0; i < 100; i++ ) {
+	struct stat s1, s2;
+	if( stat( mnt, &s1 ) == 0 && stat( parent, &s2 ) == 0 &&
+		s1.st_dev != s2.st_dev )
+	  return 0;
+	usleep( 50000 );
+  }
+  return -1;
+}
+
+static uint64_t parseSize( const char* s ) {
+  char* end;
+  uint64_t n = strtoull( s, &end, 10 );
+  switch( *end ) {
+  case 'G': case 'g':
+	n <<= 10;
+  case 'M': case 'm':
+	n <<= 10;
+  case 'K': case 'k':
+	n <<= 10;
+  }
+  return n;
+}
+
+static void usage( const char* prog ) {
+  fprintf( stderr, "Usage: %s [-V vernamfs] [-w workload]* [-n files] "
+		   "[-s size] [-j writers] [-c chunk] [-p padSize] [-k] [-b dir]\n",
+		   prog );
+}
+
+int main( int argc, char* argv[] ) {
+
+  char* vernamfs = "./vernamfs";
+  char* baseDir = NULL;
+  char* selected[8];
+  int selectedCount = 0;
+  int files = 0;
+  uint64_t size = 0;
+  int writers = 0;
+  uint64_t padSize = 0;
+  int keep = 0;
+
+  int c;
+  while( (c = getopt( argc, argv, "V:w:n:s:j:c:p:kb:") ) != -1 ) {
+	switch( c ) {
+	case 'V':
+	  vernamfs = optarg;
+	  break;
+	case 'w':
+	  if( selectedCount < 8 )
+		selected[selectedCount++] = optarg;
+	  break;
+	case 'n':
+	  files = atoi( optarg );
+	  break;
+	case 's':
+	  size = parseSize( optarg );
+	  break;
+	case 'j':
+	  writers = atoi( optarg );
+	  break;
+	case 'c':
+	  chunkSize = parseSize( optarg );
+	  break;
+	case 'p':
+	  padSize = parseSize( optarg );
+	  break;
+	case 'k':
+	  keep = 1;
+	  break;
+	case 'b':
+	  baseDir = optarg;
+	  break;
+	default:
+	  usage( argv[0] );
+	  return -1;
+	}
+  }
+  if( chunkSize == 0 ) {
+	usage( argv[0] );
+	return -1;
+  }
+
+  // Apply overrides, and size the pad (and its file table) to fit
+  uint64_t dataNeeded = 0;
+  int filesNeeded = 0;
+  Workload* w;
+  for( w = workloads; w->name; w++ ) {
+	int i;
+	for( i = 0; i < selectedCount; i++ )
+	  if( strcmp( selected[i], w->name ) == 0 )
+		break;
+	if( selectedCount && i == selectedCount ) {
+	  w->files = 0;
+	  continue;
+	}
+	if( files )
+	  w->files = files;
+	if( size )
+	  w->size = size;
+	if( writers && w->writers )
+	  w->writers = writers;
+	for( i = 0; i < w->files; i++ )
+	  dataNeeded += fileSize( w, i );
+	filesNeeded += w->files;
+  }
+  if( padSize == 0 )
+	padSize = dataNeeded + dataNeeded / 8 + ((uint64_t)64 << 20);
+
+  char tmp[] = "/tmp/fuseBenchXXXXXX";
+  char mnt[64], pad[64], out[64];
+  const char* target = baseDir;
+  if( !baseDir ) {
+	if( !mkdtemp( tmp ) ) {
+	  perror( "mkdtemp" );
+	  return -1;
+	}
+	snprintf( mnt, sizeof( mnt ), "%s/mnt", tmp );
+	snprintf( pad, sizeof( pad ), "%s/pad", tmp );
+	snprintf( out, sizeof( out ), "%s/out", tmp );
+	mkdir( mnt, 0755 );
+	if( run( "%s generate -z -n %d -s %"PRIu64" -o %s", 
+			 vernamfs, filesNeeded + 1, padSize, pad ) )
+	  return -1;
+	if( run( "%s mount %s %s > %s/mount.log 2>&1", 
+			 vernamfs, pad, mnt, tmp ) ||
+		waitMounted( mnt, tmp ) ) {
+	  fprintf( stderr, "Mount failed, see %s/mount.log\n", tmp );
+	  return -1;
+	}
+	target = mnt;
+  } else {
+	mkdir( baseDir, 0755 );
+  }
+
+  for( w = workloads; w->name; w++ )
+	if( w->files )
+	  runWorkload( w, target );
+
+  int bad;
+  if( !baseDir ) {
+	if( run( "fusermount -u %s", mnt ) )
+	  return -1;
+	if( run( "%s recover -z %s %s > /dev/null", vernamfs, pad, out ) )
+	  return -1;
+	bad = verify( out );
+	if( !keep && !bad )
+	  run( "rm -rf %s", tmp );
+  } else {
+	bad = verify( baseDir );
+  }
+  return bad ? 1 : 0;
+}
+
+// eof
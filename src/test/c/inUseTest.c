@@ -39,16 +39,18 @@
 /**
  * @author Stuart Maclean
  *
- * Test correct serialized access to a VernamFS.
+ * Test concurrent access to a VernamFS.
  *
  * 1: Start a VernamFS: vernamfs mount otpFile mnt
  *
  * 2: Run first instance of this program.
  *
  * 3: In new terminal, run second instance of this program, within 60
- * seconds of starting the first.  Should see:
- * 
- * open: Device or resource busy
+ * seconds of starting the first.  Both opens should succeed, and once
+ * both have exited, two entries named /bar appear in 'rls | vls'.
+ *
+ * Mounted with the '-s' fuse option, writers are still independent,
+ * just served one fuse request at a time.
  */
 int main( int argc, char* argv[] ) {
 
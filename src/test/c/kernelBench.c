@@ -0,0 +1,568 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "vernamfs/aes128.h"
+#include "vernamfs/aesctr.h"
+#include "vernamfs/chacha20.h"
+#include "vernamfs/keystream.h"
+#include "vernamfs/remote.h"
+#include "vernamfs/vault.h"
+#include "vernamfs/vernamfs.h"
+#include "vernamfs/xor.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Micro-benchmarks for the core kernels: the VFS write path, per-file
+ * table overhead, vault-side table decoding (vls/vcat/recover), the
+ * keystreams behind generate, XOR kernels and remote result I/O.
+ *
+ * Results go out as JSON, one result per line, with ns/op, MB/s and,
+ * where the cpu has a usable cycle counter (the x86 TSC), cycles/byte.
+ * Given a previous run's JSON (-c), prints instead a comparison,
+ * flagging anything more than -r percent slower, and exits 1 if so.
+ *
+ * $ ./kernelBench -o bench.json
+ * $ ./kernelBench -f vfsWrite -t 0.5
+ * $ ./kernelBench -c bench.json
+ *
+ * 'make bench' runs it, 'make bench BASELINE=old.json' compares.
+ */
+
+typedef struct {
+  char name[64];
+  uint64_t iterations;
+  uint64_t bytesPerOp;
+  double nsPerOp;
+  double cyclesPerOp;	// < 0 if unknown
+} BenchResult;
+
+typedef void (*BenchFn)( void* ctx );
+
+#define MAXRESULTS 128
+
+static BenchResult results[MAXRESULTS];
+static int resultCount = 0;
+
+static double minSeconds = 0.2;
+static const char* filter = NULL;
+
+static double now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles( void ) {
+#ifdef HAVE_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/*
+  Run fn until at least minSeconds has passed, doubling the batch
+  each time.  The best of three such runs is kept.
+*/
+static void bench( const char* name, BenchFn fn, void* ctx, 
+				   uint64_t bytesPerOp ) {
+
+  if( filter && !strstr( name, filter ) )
+	return;
+  if( resultCount == MAXRESULTS )
+	return;
+
+  BenchResult* r = results + resultCount++;
+  snprintf( r->name, sizeof( r->name ), "%s", name );
+  r->bytesPerOp = bytesPerOp;
+  r->nsPerOp = -1;
+  r->cyclesPerOp = -1;
+
+  // Warm up: caches, page faults, lazy kernel selection
+  fn( ctx );
+
+  int run;
+  for( run = 0; run < 3; run++ ) {
+	uint64_t n = 1;
+	double secs;
+	uint64_t cyc;
+	for( ;; ) {
+	  double t0 = now();
+	  uint64_t c0 = cycles();
+	  uint64_t i;
+	  for( i = 0; i < n; i++ )
+		fn( ctx );
+	  cyc = cycles() - c0;
+	  secs = now() - t0;
+	  if( secs >= minSeconds / 3 || n >= (1ULL << 40) )
+		break;
+	  n *= 2;
+	}
+	double ns = secs * 1e9 / n;
+	if( r->nsPerOp < 0 || ns < r->nsPerOp ) {
+	  r->nsPerOp = ns;
+	  r->iterations = n;
+#ifdef HAVE_CYCLES
+	  r->cyclesPerOp = (double)cyc / n;
+#endif
+	}
+  }
+  fprintf( stderr, "%-32s %12.1f ns/op\n", r->name, r->nsPerOp );
+}
+
+/********************** VFS write path ***********************************/
+
+typedef struct {
+  VFS vfs;
+  VFSHeader pristine;
+  uint8_t* pad;
+  uint8_t* buf;
+  size_t size;
+} WriteCtx;
+
+#define PADSIZE ((uint64_t)80 << 20)
+
+static void writeCtxInit( WriteCtx* thiz, int maxFiles ) {
+  thiz->pad = calloc( 1, PADSIZE );
+  thiz->buf = calloc( 1, 16 << 20 );
+  if( !thiz->pad || !thiz->buf ) {
+	fprintf( stderr, "kernelBench: out of memory\n" );
+	exit( 1 );
+  }
+  VFSInit( &thiz->vfs, PADSIZE, maxFiles, VERNAMFS_NAMELENGTHDEFAULT, 0 );
+  thiz->vfs.backing = thiz->pad;
+  thiz->pristine = thiz->vfs.header;
+}
+
+static void writeCtxFree( WriteCtx* thiz ) {
+  free( thiz->pad );
+  free( thiz->buf );
+}
+
+// Start again at an empty VFS, as if freshly initialised
+static void writeCtxReset( WriteCtx* thiz ) {
+  VFSRelease( &thiz->vfs );
+  thiz->vfs.header = thiz->pristine;
+  VFSAddEntry( &thiz->vfs, "/bench" );
+}
+
+static void benchWrite( void* ctx ) {
+  WriteCtx* thiz = (WriteCtx*)ctx;
+  VFSHeader* h = &thiz->vfs.header;
+  if( h->dataPtr + thiz->size > h->length )
+	writeCtxReset( thiz );
+  VFSWrite( &thiz->vfs, thiz->buf, thiz->size );
+}
+
+static void benchFile( void* ctx ) {
+  WriteCtx* thiz = (WriteCtx*)ctx;
+  VFSHeader* h = &thiz->vfs.header;
+  if( h->tablePtr + h->tableEntrySize >= h->dataOffset ||
+	  h->dataPtr + h->padding > h->length ) {
+	thiz->vfs.header = thiz->pristine;
+  }
+  VFSAddEntry( &thiz->vfs, "/bench/file.dat" );
+  VFSWrite( &thiz->vfs, thiz->buf, 100 );
+  VFSRelease( &thiz->vfs );
+}
+
+static void benchVFS( void ) {
+  WriteCtx ctx;
+  writeCtxInit( &ctx, 1024 );
+  VFSAddEntry( &ctx.vfs, "/bench" );
+
+  size_t sizes[] = { 1, 16, 256, 4096, 65536, 1 << 20, 16 << 20, 0 };
+  int i;
+  for( i = 0; sizes[i]; i++ ) {
+	char name[64];
+	snprintf( name, sizeof( name ), "vfsWrite/%zu", sizes[i] );
+	ctx.size = sizes[i];
+	bench( name, benchWrite, &ctx, sizes[i] );
+  }
+  VFSRelease( &ctx.vfs );
+  writeCtxFree( &ctx );
+
+  writeCtxInit( &ctx, 8192 );
+  bench( "vfsFile/addWriteRelease", benchFile, &ctx, 0 );
+  writeCtxFree( &ctx );
+}
+
+/********************** Vault-side table decode **************************/
+
+#define TABLEENTRIES 1024
+#define TABLEOFFSET 4096
+
+typedef struct {
+  VFSVault* vault;
+  uint8_t* remote;
+  uint8_t* actual;
+  uint32_t tableEntrySize;
+  uint64_t sum;
+} DecodeCtx;
+
+// As vls and recover do: each remote entry against the vault pad
+static void benchDecode( void* ctx ) {
+  DecodeCtx* thiz = (DecodeCtx*)ctx;
+  int i;
+  for( i = 0; i < TABLEENTRIES; i++ ) {
+	uint64_t off = (uint64_t)i * thiz->tableEntrySize;
+	VFSVaultXor( thiz->vault, TABLEOFFSET + off, thiz->actual,
+				 thiz->remote + off, thiz->tableEntrySize );
+	VFSTableEntryFixed* tef = (VFSTableEntryFixed*)thiz->actual;
+	thiz->sum += tef->offset + tef->length;
+  }
+}
+
+static void benchDecodeVault( const char* name, VFSVault* vault ) {
+  DecodeCtx ctx;
+  ctx.vault = vault;
+  ctx.tableEntrySize = vault->tableEntrySize;
+  ctx.remote = calloc( TABLEENTRIES, ctx.tableEntrySize );
+  ctx.actual = malloc( ctx.tableEntrySize );
+  ctx.sum = 0;
+  bench( name, benchDecode, &ctx, 
+		 (uint64_t)TABLEENTRIES * ctx.tableEntrySize );
+  free( ctx.remote );
+  free( ctx.actual );
+}
+
+static void benchVault( void ) {
+  uint8_t key[32] = { 0 };
+  VFSVault vault;
+
+  // A real vault copy, in the page cache
+  char path[] = "/tmp/kernelBenchVaultXXXXXX";
+  int fd = mkstemp( path );
+  if( fd >= 0 ) {
+	WriteCtx w;
+	writeCtxInit( &w, TABLEENTRIES );
+	VFSStore( &w.vfs );
+	int ok = write( fd, w.pad, 1 << 20 ) == (1 << 20);
+	close( fd );
+	writeCtxFree( &w );
+	if( ok && VFSVaultOpenFile( &vault, path ) == 0 ) {
+	  benchDecodeVault( "tableDecode/file", &vault );
+	  VFSVaultClose( &vault );
+	}
+	unlink( path );
+  }
+
+  if( VFSVaultOpenKey( &vault, VERNAMFS_PADTYPE_AES128CTR, key,
+					   VERNAMFS_NAMELENGTHDEFAULT ) == 0 ) {
+	benchDecodeVault( "tableDecode/aes128", &vault );
+	VFSVaultClose( &vault );
+  }
+  if( VFSVaultOpenKey( &vault, VERNAMFS_PADTYPE_CHACHA20, key,
+					   VERNAMFS_NAMELENGTHDEFAULT ) == 0 ) {
+	benchDecodeVault( "tableDecode/chacha20", &vault );
+	VFSVaultClose( &vault );
+  }
+}
+
+/********************** Keystreams and XOR *******************************/
+
+#define STREAMBYTES (1 << 20)
+
+typedef struct {
+  AES128CTR aes;
+  ChaCha20 chacha;
+  uint8_t* buf;
+  uint8_t* buf2;
+  size_t len;
+} CipherCtx;
+
+static void benchTinyAES( void* ctx ) {
+  CipherCtx* thiz = (CipherCtx*)ctx;
+  AES128_ECB_encrypt( thiz->buf, thiz->aes.key, thiz->buf2 );
+}
+
+static void benchAESBlocks( void* ctx ) {
+  CipherCtx* thiz = (CipherCtx*)ctx;
+  AES128CTRBlocks( &thiz->aes, 0, thiz->buf, thiz->len / AES128CTR_BLOCKSIZE );
+}
+
+static void benchChaChaBlocks( void* ctx ) {
+  CipherCtx* thiz = (CipherCtx*)ctx;
+  ChaCha20Blocks( &thiz->chacha, 0, thiz->buf, 
+				  thiz->len / CHACHA20_BLOCKSIZE );
+}
+
+static void benchXor( void* ctx ) {
+  CipherCtx* thiz = (CipherCtx*)ctx;
+  VFSXor( thiz->buf, thiz->buf2, thiz->len );
+}
+
+static void benchCiphers( void ) {
+  uint8_t key[32] = { 0 };
+  CipherCtx ctx;
+  AES128CTRInit( &ctx.aes, key );
+  ChaCha20Init( &ctx.chacha, key );
+  ctx.buf = calloc( 1, STREAMBYTES );
+  ctx.buf2 = calloc( 1, STREAMBYTES );
+
+  bench( "aes128/tinyAESBlock", benchTinyAES, &ctx, AES128CTR_BLOCKSIZE );
+
+  char name[64];
+  const char* aesBackends[] = { "soft", "ttable", "aesni", "armv8", NULL };
+  const char** b;
+  for( b = aesBackends; *b; b++ ) {
+	if( AES128CTRSelect( &ctx.aes, *b ) )
+	  continue;
+	// tiny-AES is slow enough that a smaller run will do
+	ctx.len = strcmp( *b, "soft" ) ? STREAMBYTES : STREAMBYTES / 16;
+	snprintf( name, sizeof( name ), "keystream/aes128/%s", *b );
+	bench( name, benchAESBlocks, &ctx, ctx.len );
+  }
+
+  const char* chachaBackends[] = { "scalar", "sse2", "avx2", "neon", NULL };
+  ctx.len = STREAMBYTES;
+  for( b = chachaBackends; *b; b++ ) {
+	if( ChaCha20Select( &ctx.chacha, *b ) )
+	  continue;
+	snprintf( name, sizeof( name ), "keystream/chacha20/%s", *b );
+	bench( name, benchChaChaBlocks, &ctx, ctx.len );
+  }
+
+  const char* xorKernels[] = 
+	{ "scalar", "sse2", "avx2", "avx512", "neon", NULL };
+  const char* best = VFSXorKernelName();
+  ctx.len = 65536;
+  for( b = xorKernels; *b; b++ ) {
+	if( VFSXorSelect( *b ) )
+	  continue;
+	snprintf( name, sizeof( name ), "xor/%s/64K", *b );
+	bench( name, benchXor, &ctx, ctx.len );
+  }
+  VFSXorSelect( best );
+
+  free( ctx.buf );
+  free( ctx.buf2 );
+}
+
+/********************** Remote results ***********************************/
+
+typedef struct {
+  int fd;
+  VFSRemoteResult rr;
+} RemoteCtx;
+
+static void benchRemoteWrite( void* ctx ) {
+  RemoteCtx* thiz = (RemoteCtx*)ctx;
+  lseek( thiz->fd, 0, SEEK_SET );
+  VFSRemoteResultWrite( &thiz->rr, thiz->fd );
+}
+
+static void benchRemoteRead( void* ctx ) {
+  RemoteCtx* thiz = (RemoteCtx*)ctx;
+  lseek( thiz->fd, 0, SEEK_SET );
+  VFSRemoteResult* r = VFSRemoteResultRead( thiz->fd );
+  if( r ) {
+	VFSRemoteResultFree( r );
+	free( r );
+  }
+}
+
+static void benchRemote( void ) {
+  char path[] = "/tmp/kernelBenchRemoteXXXXXX";
+  RemoteCtx ctx;
+  ctx.fd = mkstemp( path );
+  if( ctx.fd < 0 )
+	return;
+  unlink( path );
+
+  size_t sizes[] = { 4096, 1 << 20, 0 };
+  int i;
+  for( i = 0; sizes[i]; i++ ) {
+	ctx.rr.offset = 0x1000;
+	ctx.rr.length = sizes[i];
+	ctx.rr.data = calloc( 1, sizes[i] );
+	ctx.rr.dataOnHeap = 1;
+	char name[64];
+	snprintf( name, sizeof( name ), "remoteResultWrite/%zu", sizes[i] );
+	bench( name, benchRemoteWrite, &ctx, sizes[i] );
+	benchRemoteWrite( &ctx );
+	snprintf( name, sizeof( name ), "remoteResultRead/%zu", sizes[i] );
+	bench( name, benchRemoteRead, &ctx, sizes[i] );
+	VFSRemoteResultFree( &ctx.rr );
+  }
+  close( ctx.fd );
+}
+
+/********************** Reporting ****************************************/
+
+static void reportJSON( FILE* fp ) {
+  fprintf( fp, "{\n" );
+#if defined(__x86_64__)
+  fprintf( fp, "  \"arch\": \"x86_64\",\n" );
+#elif defined(__aarch64__)
+  fprintf( fp, "  \"arch\": \"aarch64\",\n" );
+#elif defined(__arm__)
+  fprintf( fp, "  \"arch\": \"arm\",\n" );
+#else
+  fprintf( fp, "  \"arch\": \"unknown\",\n" );
+#endif
+  fprintf( fp, "  \"xor\": \"%s\",\n", VFSXorKernelName() );
+  fprintf( fp, "  \"results\": [\n" );
+  int i;
+  for( i = 0; i < resultCount; i++ ) {
+	BenchResult* r = results + i;
+	fprintf( fp, "    { \"name\": \"%s\", \"iterations\": %"PRIu64
+			 ", \"ns_per_op\": %.3f", r->name, r->iterations, r->nsPerOp );
+	if( r->bytesPerOp ) {
+	  fprintf( fp, ", \"mb_per_s\": %.3f", 
+			   r->bytesPerOp / (r->nsPerOp / 1e9) / 1e6 );
+	  if( r->cyclesPerOp >= 0 )
+		fprintf( fp, ", \"cycles_per_byte\": %.4f", 
+				 r->cyclesPerOp / r->bytesPerOp );
+	  else
+		fprintf( fp, ", \"cycles_per_byte\": null" );
+	} else {
+	  fprintf( fp, ", \"mb_per_s\": null, \"cycles_per_byte\": null" );
+	}
+	fprintf( fp, " }%s\n", i + 1 < resultCount ? "," : "" );
+  }
+  fprintf( fp, "  ]\n}\n" );
+}
+
+/*
+  Reads back our own JSON, one result per line, so a simple scan for
+  name and ns_per_op suffices.  @return 0 if every common result is
+  within threshold percent of its baseline.
+*/
+static int compare( const char* baselineFile, double threshold ) {
+  FILE* fp = fopen( baselineFile, "r" );
+  if( !fp ) {
+	fprintf( stderr, "Cannot open baseline: %s (%d)\n", baselineFile, errno );
+	return -1;
+  }
+  printf( "%-32s %14s %14s %8s\n", "name", "base ns/op", "ns/op", "change" );
+  int regressions = 0;
+  char line[512];
+  while( fgets( line, sizeof( line ), fp ) ) {
+	char* np = strstr( line, "\"name\": \"" );
+	char* tp = strstr( line, "\"ns_per_op\": " );
+	if( !np || !tp )
+	  continue;
+	np += strlen( "\"name\": \"" );
+	char* end = strchr( np, '"' );
+	if( !end )
+	  continue;
+	*end = 0;
+	double base = atof( tp + strlen( "\"ns_per_op\": " ) );
+	int i;
+	for( i = 0; i < resultCount; i++ ) {
+	  if( strcmp( results[i].name, np ) )
+		continue;
+	  double change = base > 0 ? 
+		100.0 * (results[i].nsPerOp - base) / base : 0;
+	  int regressed = change > threshold;
+	  regressions += regressed;
+	  printf( "%-32s %14.1f %14.1f %+7.1f%%%s\n", np, base, 
+			  results[i].nsPerOp, change, regressed ? "  REGRESSION" : "" );
+	}
+  }
+  fclose( fp );
+  return regressions ? 1 : 0;
+}
+
+int main( int argc, char* argv[] ) {
+
+  char* output = NULL;
+  char* baseline = NULL;
+  double threshold = 10;
+
+  int c;
+  while( (c = getopt( argc, argv, "c:f:o:r:t:") ) != -1 ) {
+	switch( c ) {
+	case 'c':
+	  baseline = optarg;
+	  break;
+	case 'f':
+	  filter = optarg;
+	  break;
+	case 'o':
+	  output = optarg;
+	  break;
+	case 'r':
+	  threshold = atof( optarg );
+	  break;
+	case 't':
+	  minSeconds = atof( optarg );
+	  break;
+	default:
+	  fprintf( stderr, "Usage: %s [-f filter] [-t secs] [-o out.json] "
+			   "[-c baseline.json [-r percent]]\n", argv[0] );
+	  return -1;
+	}
+  }
+
+  benchVFS();
+  benchVault();
+  benchCiphers();
+  benchRemote();
+
+  // Compare first, so that the baseline may also be the output
+  int rc = 0;
+  if( baseline )
+	rc = compare( baseline, threshold );
+
+  if( output ) {
+	FILE* fp = fopen( output, "w" );
+	if( !fp ) {
+	  fprintf( stderr, "Cannot open output: %s\n", output );
+	  return -1;
+	}
+	reportJSON( fp );
+	fclose( fp );
+  } else if( !baseline ) {
+	reportJSON( stdout );
+  }
+  return rc;
+}
+
+// eof
@@ -0,0 +1,199 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * VFSLog record logs on an all-zeros pad, so that table and records
+ * read back in the clear.  Many records must share one table entry
+ * per segment, with no padding between records, the stored header
+ * must always cover records written, and VFSLogSplit must give the
+ * records back.  Records must reach the pad only in chunks ending on
+ * combine size boundaries, or at commit.
+ */
+
+#define PADSIZE (1 << 20)
+#define MAXFILES 8
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  uint8_t* pad = calloc( 1, PADSIZE );
+  VFS vfs;
+  sc = VFSInit( &vfs, PADSIZE, MAXFILES, 30, 16 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFSHeader* h = &vfs.header;
+  VFSHeader* stored = (VFSHeader*)pad;
+  uint64_t dataOffset = h->dataOffset;
+
+  VFSLog* log;
+  sc = VFSLogOpen( &vfs, "/telemetry", 1000, &log );
+  assert( sc == 0 );
+
+  // 10-byte records: 14 bytes framed, so a segment is 72 records
+  char record[16];
+  int i;
+  for( i = 0; i < 100; i++ ) {
+	sprintf( record, "rec%06d\n", i );
+	sc = VFSLogAppend( log, record, 10 );
+	assert( sc == 0 );
+
+	// Stored dataPtr never behind the records written
+	assert( stored->dataPtr >= log->start + log->length - log->buffered );
+  }
+
+  // One segment committed on size, the second still open
+  VFSTableEntryFixed* tef = (VFSTableEntryFixed*)(pad + h->tableOffset);
+  assert( stored->tablePtr == h->tableOffset + h->tableEntrySize );
+  assert( tef->offset == dataOffset );
+  assert( tef->length == (72 * 14 | VERNAMFS_LENGTH_RECORDS) );
+  assert( strcmp( (char*)(tef + 1), "/telemetry" ) == 0 );
+  assert( log->start == dataOffset + 72 * 14 );
+  assert( log->length == 28 * 14 );
+
+  // Records back to back, length-prefixed
+  uint32_t length;
+  memcpy( &length, pad + dataOffset + 14, sizeof( length ) );
+  assert( length == 10 );
+  assert( memcmp( pad + dataOffset + 18, "rec000001", 9 ) == 0 );
+
+  // Commit drops the stored dataPtr back to the segment's aligned end
+  VFSLogCommit( log );
+  assert( stored->tablePtr == h->tableOffset + 2 * h->tableEntrySize );
+  tef = (VFSTableEntryFixed*)(pad + h->tableOffset + h->tableEntrySize);
+  assert( tef->offset == dataOffset + 72 * 14 );
+  assert( tef->length == (28 * 14 | VERNAMFS_LENGTH_RECORDS) );
+  uint64_t end = dataOffset + 100 * 14;
+  assert( stored->dataPtr == (end + 15) / 16 * 16 );
+
+  // Nothing to commit, no entry
+  VFSLogCommit( log );
+  assert( stored->tablePtr == h->tableOffset + 2 * h->tableEntrySize );
+
+  // Split out both segments, to a pipe
+  int fds[2];
+  sc = pipe( fds );
+  assert( sc == 0 );
+  sc = VFSLogSplit( pad + dataOffset, 72 * 14, fds[1] );
+  assert( sc == 72 );
+  sc = VFSLogSplit( pad + dataOffset + 72 * 14, 28 * 14, fds[1] );
+  assert( sc == 28 );
+  close( fds[1] );
+  static char text[2000];
+  size_t have = 0;
+  ssize_t nin;
+  while( (nin = read( fds[0], text + have, sizeof( text ) - have )) > 0 )
+	have += nin;
+  close( fds[0] );
+  assert( have == 100 * 11 );
+  for( i = 0; i < 100; i++ ) {
+	sprintf( record, "rec%06d\n\n", i );
+	assert( memcmp( text + i * 11, record, 11 ) == 0 );
+  }
+
+  // Broken framing
+  sc = VFSLogSplit( pad + dataOffset, 72 * 14 - 1, -1 );
+  assert( sc == -1 );
+
+  // Table full: no new segment can start
+  for( i = 2; i < MAXFILES; i++ ) {
+	sc = VFSLogAppend( log, "x", 1 );
+	assert( sc == 0 );
+	VFSLogCommit( log );
+  }
+  sc = VFSLogAppend( log, "x", 1 );
+  assert( sc == -ENOSPC );
+  VFSLogClose( log );
+  sc = VFSLogOpen( &vfs, "/more", 1000, &log );
+  assert( sc == -ENOSPC );
+  assert( stored->tablePtr == h->tableOffset + MAXFILES * h->tableEntrySize );
+
+  // Write-combining, in 4K chunks, on a fresh pad
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, MAXFILES, 30, 16 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  sc = VFSSetCombineSize( &vfs, 1000 );
+  assert( sc == -1 );
+  sc = VFSSetCombineSize( &vfs, 2048 );
+  assert( sc == -1 );
+  sc = VFSSetCombineSize( &vfs, 4096 );
+  assert( sc == 0 );
+  assert( VFSCombineSize( &vfs ) == 4096 );
+  sc = VFSLogOpen( &vfs, "/combined", 100000, &log );
+  assert( sc == 0 );
+  uint64_t flushed = 0;
+  for( i = 0; i < 1000; i++ ) {
+	sprintf( record, "rec%06d\n", i );
+	sc = VFSLogAppend( log, record, 10 );
+	assert( sc == 0 );
+	uint64_t end = log->start + log->length;
+	assert( log->buffered < 4096 );
+	assert( (end - log->buffered) % 4096 == 0 );
+	if( end - log->buffered > flushed ) {
+	  flushed = end - log->buffered;
+	  assert( stored->dataPtr >= flushed );
+	}
+
+	// Nothing beyond the last chunk yet on the pad
+	assert( pad[end - log->buffered] == 0 );
+  }
+  assert( flushed == (dataOffset + 1000 * 14) / 4096 * 4096 );
+  VFSLogClose( log );
+  tef = (VFSTableEntryFixed*)(pad + h->tableOffset);
+  assert( tef->length == (1000 * 14 | VERNAMFS_LENGTH_RECORDS) );
+  memcpy( &length, pad + dataOffset + 999 * 14, sizeof( length ) );
+  assert( length == 10 );
+  assert( memcmp( pad + dataOffset + 999 * 14 + 4, "rec000999", 9 ) == 0 );
+
+  free( pad );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
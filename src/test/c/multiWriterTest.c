@@ -0,0 +1,319 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Concurrent VFSFile writers on an all-zeros pad, so that table and
+ * data areas read back in the clear.  Every file must land intact,
+ * in its own extent, with no two extents or table entries overlapping
+ * (i.e. no pad byte written twice), and a full table or pad must
+ * surface as ENOSPC.  Then again on a sharded VFS, each writer pinned
+ * to one shard, and with releases pipelined to a worker, which must
+ * write files out in release order.
+ */
+
+#define WRITERS 8
+#define FILESPERWRITER 50
+#define PADSIZE (16 << 20)
+#define SHARDS 4
+
+static VFS vfs;
+
+// Where each writer w writes: targets[w % targetCount]
+static VFS* targets = &vfs;
+static int targetCount = 1;
+
+static uint8_t content( int writer, int file, uint64_t offset ) {
+  return (uint8_t)(writer * 31 + file * 7 + offset);
+}
+
+static void* writer( void* arg ) {
+  int sc;
+  int w = (int)(intptr_t)arg;
+  uint8_t buf[3000];
+  int i;
+  for( i = 0; i < FILESPERWRITER; i++ ) {
+	char name[32];
+	sprintf( name, "/w%d.%d", w, i );
+	VFSFile* f;
+	sc = VFSFileOpen( targets + w % targetCount, name, &f );
+	assert( sc == 0 );
+
+	// Sizes from 0 up to ~20K, written in uneven chunks
+	uint64_t size = (w * 977 + i * 409) % 20000;
+	uint64_t off = 0;
+	while( off < size ) {
+	  size_t n = size - off < sizeof( buf ) ? size - off : 
+		1 + (off % sizeof( buf ));
+	  size_t j;
+	  for( j = 0; j < n; j++ )
+		buf[j] = content( w, i, off + j );
+	  sc = VFSFileWrite( f, buf, n, off );
+	  assert( sc == n );
+	  off += n;
+	}
+	sc = VFSFileRelease( f );
+	assert( sc == 0 );
+  }
+  return NULL;
+}
+
+static int compareOffsets( const void* a, const void* b ) {
+  const VFSTableEntryFixed* x = a;
+  const VFSTableEntryFixed* y = b;
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static void runWriters( void ) {
+  pthread_t tids[WRITERS];
+  int i;
+  for( i = 0; i < WRITERS; i++ )
+	pthread_create( tids + i, NULL, writer, (void*)(intptr_t)i );
+  for( i = 0; i < WRITERS; i++ )
+	pthread_join( tids[i], NULL );
+}
+
+/*
+  Every file, in every table of the VFS stored on pad, intact and
+  within its own table's data area, and no two extents overlapping.
+*/
+static void checkFiles( void* pad ) {
+  int sc;
+  VFS stored;
+  VFSLoad( &stored, pad );
+  int files = WRITERS * FILESPERWRITER;
+  VFSTableEntryFixed* entries = calloc( files, sizeof( VFSTableEntryFixed ) );
+  int count = 0;
+  int k;
+  for( k = 0; k < VFSShardCount( &stored ); k++ ) {
+	VFS shard;
+	VFSShard( &stored, k, &shard );
+	VFSHeader* h = &shard.header;
+	int i;
+	for( i = 0; h->tableOffset + i * h->tableEntrySize < h->tablePtr; i++ ) {
+	  uint8_t* te = (uint8_t*)pad + h->tableOffset + i * h->tableEntrySize;
+	  VFSTableEntryFixed* e = entries + count++;
+	  memcpy( e, te, sizeof( VFSTableEntryFixed ) );
+	  int w, n;
+	  sc = sscanf( (char*)te + sizeof( VFSTableEntryFixed ), "/w%d.%d", 
+				   &w, &n );
+	  assert( sc == 2 );
+	  uint64_t size = (w * 977 + n * 409) % 20000;
+	  assert( e->length == size );
+	  assert( e->offset % h->padding == 0 );
+	  assert( e->offset >= h->dataOffset );
+	  assert( e->offset + e->length <= h->dataPtr );
+	  assert( h->dataPtr <= h->length );
+	  uint64_t j;
+	  for( j = 0; j < size; j++ )
+		assert( ((uint8_t*)pad)[e->offset + j] == content( w, n, j ) );
+	}
+  }
+  assert( count == files );
+
+  qsort( entries, files, sizeof( VFSTableEntryFixed ), compareOffsets );
+  int i;
+  for( i = 1; i < files; i++ )
+	assert( entries[i-1].offset + entries[i-1].length <= entries[i].offset );
+  free( entries );
+}
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  void* pad = calloc( 1, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, WRITERS * FILESPERWRITER, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  assert( vfs.header.magic == VERNAMFS_MAGIC );
+  VFSHeader h0 = vfs.header;
+
+  runWriters();
+
+  // The stored header matches, all slots used, all claims published
+  VFSHeader* h = (VFSHeader*)pad;
+  int files = WRITERS * FILESPERWRITER;
+  assert( h->tablePtr == h0.tableOffset + files * h0.tableEntrySize );
+  assert( vfs.tableReserved == vfs.tableClaim );
+  assert( vfs.tablePublished == h->tablePtr );
+  assert( vfs.dataReserved == vfs.dataClaim && vfs.dataClaim == h->dataPtr );
+  checkFiles( pad );
+
+  // Table full
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/full", &f );
+  assert( sc == -ENOSPC );
+
+  // Pad full: a fresh VFS, one file may not outgrow the data area
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, 4, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  sc = VFSFileOpen( &vfs, "/big", &f );
+  assert( sc == 0 );
+  uint64_t space = vfs.header.length - vfs.header.dataOffset;
+  static uint8_t chunk[1 << 20];
+  uint64_t off;
+  for( off = 0; off + sizeof( chunk ) <= space; off += sizeof( chunk ) ) {
+	sc = VFSFileWrite( f, chunk, sizeof( chunk ), off );
+	assert( sc == sizeof( chunk ) );
+  }
+  sc = VFSFileWrite( f, chunk, sizeof( chunk ), off );
+  assert( sc == -ENOSPC );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  assert( vfs.header.dataPtr <= vfs.header.length );
+
+  // Packed: 16-byte alignment, each file using just what it needs
+  sc = VFSInit( &vfs, PADSIZE, 4, 30, 3 );
+  assert( sc == -1 );
+  sc = VFSInit( &vfs, PADSIZE, 4, 30, 1 << 30 );
+  assert( sc == -1 );
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, WRITERS * FILESPERWRITER, 30, 16 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  assert( vfs.header.padding == 16 );
+  assert( vfs.header.dataOffset % 4096 == 0 );
+  runWriters();
+  checkFiles( pad );
+  uint64_t used = 0;
+  int w, n;
+  for( w = 0; w < WRITERS; w++ )
+	for( n = 0; n < FILESPERWRITER; n++ )
+	  used += ((w * 977 + n * 409) % 20000 + 15) / 16 * 16;
+  assert( h->dataPtr - h->dataOffset == used );
+
+  // Sharded, each writer on its own shard's view
+  memset( pad, 0, PADSIZE );
+  sc = VFSInitSharded( &vfs, PADSIZE, WRITERS * FILESPERWRITER, 30, 0,
+					   SHARDS );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  assert( VFSShardCount( &vfs ) == SHARDS );
+  VFS views[SHARDS];
+  int i;
+  for( i = 0; i < SHARDS; i++ )
+	VFSShard( &vfs, i, views + i );
+  targets = views;
+  targetCount = SHARDS;
+  runWriters();
+  checkFiles( pad );
+
+  // Each shard full on its own
+  for( i = 0; i < SHARDS; i++ ) {
+	sc = VFSFileOpen( views + i, "/full", &f );
+	assert( sc == -ENOSPC );
+  }
+
+  // Pipelined, a queue shallower than the writers, so releases wait
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, WRITERS * FILESPERWRITER, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  targets = &vfs;
+  targetCount = 1;
+  VFSSetPipeline( &vfs, WRITERS / 2 );
+  assert( vfs.pipeline == NULL );
+  sc = VFSStartPipeline( &vfs );
+  assert( sc == 0 );
+  assert( vfs.pipeline != NULL );
+  runWriters();
+  VFSStopPipeline( &vfs );
+  assert( vfs.pipeline == NULL );
+  assert( h->tablePtr == h0.tableOffset + files * h0.tableEntrySize );
+  assert( vfs.tablePublished == h->tablePtr );
+  assert( vfs.dataClaim == h->dataPtr );
+  checkFiles( pad );
+
+  // One releaser: table entries in release order
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, 8, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFSSetPipeline( &vfs, 2 );
+  sc = VFSStartPipeline( &vfs );
+  assert( sc == 0 );
+  VFSFile* open[8];
+  for( i = 0; i < 8; i++ ) {
+	char name[16];
+	sprintf( name, "/o%d", i );
+	sc = VFSFileOpen( &vfs, name, open + i );
+	assert( sc == 0 );
+	sc = VFSFileWrite( open[i], name, 3, 0 );
+	assert( sc == 3 );
+  }
+  for( i = 7; i >= 0; i-- ) {
+	sc = VFSFileRelease( open[i] );
+	assert( sc == 0 );
+  }
+  VFSStopPipeline( &vfs );
+  assert( h->tablePtr == h->tableOffset + 8 * h->tableEntrySize );
+  for( i = 0; i < 8; i++ ) {
+	uint8_t* te = (uint8_t*)pad + h->tableOffset + i * h->tableEntrySize;
+	char name[16];
+	sprintf( name, "/o%d", 7 - i );
+	assert( strcmp( (char*)te + sizeof( VFSTableEntryFixed ), name ) == 0 );
+	VFSTableEntryFixed* e = (VFSTableEntryFixed*)te;
+	assert( memcmp( (uint8_t*)pad + e->offset, name, 3 ) == 0 );
+  }
+
+  free( pad );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
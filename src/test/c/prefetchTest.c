@@ -0,0 +1,173 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * VFSSetPrefetch on an all-zeros, file-backed (so mmap'ed, as when
+ * mounted) pad.  The pad read in must run a window ahead of both
+ * table and data writes, never past either area, and large writes,
+ * xor'ed a window at a time, must still land intact.  Also run with
+ * concurrent writers, who share the readahead.
+ */
+
+#define PADSIZE (16 << 20)
+#define WINDOW (1 << 18)
+#define WRITERS 4
+#define FILESPERWRITER 8
+#define FILESIZE 100000
+
+static VFS vfs;
+
+static void* writer( void* arg ) {
+  int sc;
+  int w = (int)(intptr_t)arg;
+  uint8_t buf[FILESIZE];
+  int i;
+  for( i = 0; i < FILESPERWRITER; i++ ) {
+	char name[32];
+	sprintf( name, "/w%d.%d", w, i );
+	memset( buf, w * FILESPERWRITER + i + 1, sizeof( buf ) );
+	VFSFile* f;
+	sc = VFSFileOpen( &vfs, name, &f );
+	assert( sc == 0 );
+	sc = VFSFileWrite( f, buf, sizeof( buf ), 0 );
+	assert( sc == sizeof( buf ) );
+	sc = VFSFileRelease( f );
+	assert( sc == 0 );
+  }
+  return NULL;
+}
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  char path[] = "/tmp/prefetchTestXXXXXX";
+  int fd = mkstemp( path );
+  assert( fd >= 0 );
+  unlink( path );
+  sc = ftruncate( fd, PADSIZE );
+  assert( sc == 0 );
+  uint8_t* pad = mmap( NULL, PADSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, 
+					   fd, 0 );
+  assert( pad != MAP_FAILED );
+
+  sc = VFSInit( &vfs, PADSIZE, WRITERS * FILESPERWRITER + 1, 30, 0 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFSHeader* h = &vfs.header;
+  uint64_t tableEnd = h->tableOffset + 
+	(uint64_t)h->maxFiles * h->tableEntrySize;
+
+  // Off by default
+  assert( vfs.prefetchBytes == 0 );
+  assert( vfs.tablePrefetched == 0 && vfs.dataPrefetched == 0 );
+
+  // On, from the current pointers, the table area a bound
+  VFSSetPrefetch( &vfs, WINDOW );
+  assert( vfs.tablePrefetched == tableEnd );
+  assert( vfs.dataPrefetched == h->dataOffset + WINDOW );
+
+  // A large file, xor'ed a window at a time
+  static uint8_t big[3 * WINDOW + 1000];
+  size_t i;
+  for( i = 0; i < sizeof( big ); i++ )
+	big[i] = (uint8_t)(i / 7 + 1);
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/big", &f );
+  assert( sc == 0 );
+  sc = VFSFileWrite( f, big, sizeof( big ), 0 );
+  assert( sc == sizeof( big ) );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  VFSTableEntryFixed* tef = (VFSTableEntryFixed*)(pad + h->tableOffset);
+  assert( tef->length == sizeof( big ) );
+  assert( memcmp( pad + tef->offset, big, sizeof( big ) ) == 0 );
+  uint64_t end = tef->offset + sizeof( big );
+  assert( vfs.dataPrefetched >= end + WINDOW / 2 );
+  assert( vfs.dataPrefetched <= end + WINDOW );
+
+  // Concurrent writers, the readahead ever ahead, never past the pad
+  pthread_t tids[WRITERS];
+  int w;
+  for( w = 0; w < WRITERS; w++ )
+	pthread_create( tids + w, NULL, writer, (void*)(intptr_t)w );
+  for( w = 0; w < WRITERS; w++ )
+	pthread_join( tids[w], NULL );
+  VFSHeader* stored = (VFSHeader*)pad;
+  assert( stored->tablePtr == tableEnd );
+  assert( vfs.dataPrefetched >= stored->dataPtr );
+  assert( vfs.dataPrefetched <= h->length );
+  int n;
+  for( n = 1; n <= WRITERS * FILESPERWRITER; n++ ) {
+	tef = (VFSTableEntryFixed*)(pad + h->tableOffset + n * h->tableEntrySize);
+	int fw, fi;
+	sc = sscanf( (char*)(tef + 1), "/w%d.%d", &fw, &fi );
+	assert( sc == 2 );
+	assert( tef->length == FILESIZE );
+	uint8_t expected = fw * FILESPERWRITER + fi + 1;
+	for( i = 0; i < FILESIZE; i++ )
+	  assert( pad[tef->offset + i] == expected );
+  }
+
+  // Near the end of the pad, the data area is the bound
+  VFS tail;
+  sc = VFSInit( &tail, PADSIZE, 4, 30, 0 );
+  assert( sc == 0 );
+  tail.header.dataPtr = PADSIZE - WINDOW / 4;
+  tail.backing = pad;
+  VFSSetPrefetch( &tail, WINDOW );
+  assert( tail.dataPrefetched == PADSIZE );
+
+  munmap( pad, PADSIZE );
+  close( fd );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
@@ -0,0 +1,276 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Rotating VFSFiles, by size and by time, on an all-zeros pad, so that
+ * table and data read back in the clear.  One file as written must
+ * become several table entries, name, name.0001, etc, whose contents
+ * together are the file's.  Past part VERNAMFS_MAXPART, the last part
+ * must just grow, its suffix never outgrowing the name's room.
+ */
+
+#define PADSIZE (4 << 20)
+#define MAXFILES 8
+
+static uint8_t* pad;
+static VFS vfs;
+
+static void fresh( int chained ) {
+  int sc;
+  memset( pad, 0, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, MAXFILES, 30, 0 );
+  assert( sc == 0 );
+  VFSSetChained( &vfs, chained );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+}
+
+static VFSTableEntryFixed* entry( int i ) {
+  return (VFSTableEntryFixed*)(pad + vfs.header.tableOffset + 
+							   i * vfs.header.tableEntrySize);
+}
+
+static int entries( void ) {
+  VFSHeader* stored = (VFSHeader*)pad;
+  return (stored->tablePtr - stored->tableOffset) / 
+	vfs.header.tableEntrySize;
+}
+
+// Content, contiguous or chained, of entry i, into buf
+static uint64_t content( int i, uint8_t* buf ) {
+  VFSTableEntryFixed* tef = entry( i );
+  uint64_t length = tef->length & VERNAMFS_LENGTH_MASK;
+  if( !(tef->length & VERNAMFS_LENGTH_CHAINED) ) {
+	memcpy( buf, pad + tef->offset, length );
+	return length;
+  }
+  uint64_t have = 0;
+  uint64_t extent = tef->offset;
+  while( extent ) {
+	VFSExtentHeader* eh = (VFSExtentHeader*)(pad + extent);
+	memcpy( buf + have, eh + 1, eh->length );
+	have += eh->length;
+	extent = eh->next;
+  }
+  assert( have == length );
+  return length;
+}
+
+static void bySize( int chained ) {
+  int sc;
+  fresh( chained );
+  VFSSetRotation( &vfs, 10000, 0 );
+
+  static uint8_t data[50000], back[50000];
+  uint64_t i;
+  for( i = 0; i < sizeof( data ); i++ )
+	data[i] = (uint8_t)(i * 7 + i / 251);
+
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/stream", &f );
+  assert( sc == 0 );
+  for( i = 0; i < sizeof( data ); i += 2500 ) {
+	sc = VFSFileWrite( f, data + i, 2500, i );
+	assert( sc == 2500 );
+  }
+
+  // Parts already done are in the table, mid-flight
+  assert( entries() == 4 );
+
+  // Content of an ended part cannot be rewritten
+  sc = VFSFileWrite( f, data, 10, 100 );
+  assert( sc == -EINVAL );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+
+  assert( entries() == 5 );
+  uint64_t have = 0;
+  for( i = 0; i < 5; i++ ) {
+	char name[32];
+	if( i )
+	  sprintf( name, "/stream.%04d", (int)i );
+	else
+	  strcpy( name, "/stream" );
+	assert( strcmp( (char*)(entry( i ) + 1), name ) == 0 );
+	assert( content( i, back + have ) == 10000 );
+	have += 10000;
+  }
+  assert( memcmp( data, back, sizeof( data ) ) == 0 );
+
+  // Table full: no rotation, the last part just grows
+  fresh( chained );
+  VFSSetRotation( &vfs, 10000, 0 );
+  sc = VFSFileOpen( &vfs, "/s", &f );
+  assert( sc == 0 );
+  for( i = 0; i < sizeof( data ); i += 2500 ) {
+	sc = VFSFileWrite( f, data + i, 2500, i );
+	assert( sc == 2500 );
+  }
+  VFSFile* g;
+  sc = VFSFileOpen( &vfs, "/t", &g );
+  assert( sc == 0 );
+  for( i = 0; i < sizeof( data ); i += 2500 ) {
+	sc = VFSFileWrite( g, data + i, 2500, i );
+	assert( sc == 2500 );
+  }
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  sc = VFSFileRelease( g );
+  assert( sc == 0 );
+  assert( entries() == MAXFILES );
+  uint64_t total = 0;
+  for( i = 0; i < MAXFILES; i++ )
+	total += content( i, back );
+  assert( total == 2 * sizeof( data ) );
+}
+
+static void byTime( void ) {
+  int sc;
+  fresh( 0 );
+  VFSSetRotation( &vfs, 0, 1 );
+
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, "/slow", &f );
+  assert( sc == 0 );
+  sc = VFSFileWrite( f, "abc", 3, 0 );
+  assert( sc == 3 );
+  sc = VFSFileWrite( f, "def", 3, 3 );
+  assert( sc == 3 );
+  assert( entries() == 0 );
+  sleep( 2 );
+  sc = VFSFileWrite( f, "ghi", 3, 6 );
+  assert( sc == 3 );
+  assert( entries() == 1 );
+  assert( (entry( 0 )->length & VERNAMFS_LENGTH_MASK) == 6 );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  assert( entries() == 2 );
+  uint8_t back[16];
+  assert( content( 1, back ) == 3 && memcmp( back, "ghi", 3 ) == 0 );
+
+  // Ended just before release, so no empty last part
+  fresh( 0 );
+  VFSSetRotation( &vfs, 0, 1 );
+  sc = VFSFileOpen( &vfs, "/slow", &f );
+  assert( sc == 0 );
+  sc = VFSFileWrite( f, "abc", 3, 0 );
+  assert( sc == 3 );
+  sleep( 2 );
+  sc = VFSFileWrite( f, "", 0, 3 );
+  assert( sc == 0 );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+  assert( entries() == 1 );
+  assert( vfs.tableReserved == vfs.tableClaim );
+
+  // Rotating names need room for the suffix: 47 chars fit, less 5
+  char name[64];
+  memset( name, 'x', sizeof( name ) );
+  name[0] = '/';
+  name[43] = 0;
+  sc = VFSFileOpen( &vfs, name, &f );
+  assert( sc == -ENAMETOOLONG );
+  name[42] = 0;
+  sc = VFSFileOpen( &vfs, name, &f );
+  assert( sc == 0 );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+}
+
+static void lastPart( void ) {
+
+  int sc;
+  // Room for every part, and more, 8-byte aligned so all fit the pad
+  memset( pad, 0, PADSIZE );
+  int maxFiles = VERNAMFS_MAXPART + 3;
+  sc = VFSInit( &vfs, PADSIZE, maxFiles, 30, 8 );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFSSetRotation( &vfs, 1, 0 );
+
+  // The longest name a rotating file may have
+  char name[64];
+  memset( name, 'x', sizeof( name ) );
+  name[0] = '/';
+  name[42] = 0;
+  VFSFile* f;
+  sc = VFSFileOpen( &vfs, name, &f );
+  assert( sc == 0 );
+  int i;
+  for( i = 0; i < VERNAMFS_MAXPART + 5; i++ ) {
+	sc = VFSFileWrite( f, "z", 1, i );
+	assert( sc == 1 );
+  }
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+
+  assert( entries() == VERNAMFS_MAXPART + 1 );
+  char last[VERNAMFS_MAXTABLEENTRYSIZE];
+  snprintf( last, sizeof( last ), "%s.%04d", name, VERNAMFS_MAXPART );
+  VFSTableEntryFixed* tef = entry( VERNAMFS_MAXPART );
+  assert( strcmp( (char*)(tef + 1), last ) == 0 );
+  assert( tef->length == 5 );
+
+  // Nothing spilled into the next entry
+  uint8_t* next = (uint8_t*)entry( VERNAMFS_MAXPART + 1 );
+  for( i = 0; i < vfs.header.tableEntrySize; i++ )
+	assert( next[i] == 0 );
+}
+
+int main( int argc, char* argv[] ) {
+  pad = malloc( PADSIZE );
+  bySize( 0 );
+  bySize( 1 );
+  byTime();
+  lastPart();
+  free( pad );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
@@ -0,0 +1,180 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Cursor slots (VERNAMFS_FLAGS_SLOTS).  Commits must alternate between
+ * the two slots, VFSLoad must take the newest valid one, so that a
+ * torn commit falls back to the one before and a torn header pointer
+ * does no harm, and each shard must commit to its own pair.  Pads
+ * without the flag keep their pointers in the header alone.
+ */
+
+#define PADSIZE (1 << 20)
+#define SHARDS 3
+
+static VFSCursorSlot* slot( uint8_t* pad, int unit, int which ) {
+  return (VFSCursorSlot*)(pad + VERNAMFS_SLOTSOFFSET) + 2 * unit + which;
+}
+
+static void writeFile( VFS* vfs, const char* name ) {
+  int sc;
+  VFSFile* f;
+  sc = VFSFileOpen( vfs, name, &f );
+  assert( sc == 0 );
+  sc = VFSFileWrite( f, name, strlen( name ), 0 );
+  assert( sc == strlen( name ) );
+  sc = VFSFileRelease( f );
+  assert( sc == 0 );
+}
+
+int main( int argc, char* argv[] ) {
+
+  int sc;
+  // Whatever the first page held, init's store clears the slots
+  uint8_t* pad = malloc( PADSIZE );
+  memset( pad, 0xa5, PADSIZE );
+  VFS vfs;
+  sc = VFSInit( &vfs, PADSIZE, 16, 30, 0 );
+  assert( sc == 0 );
+  assert( vfs.header.flags & VERNAMFS_FLAGS_SLOTS );
+  assert( VFSHeaderExtent( &vfs ) == 
+		  VERNAMFS_SLOTSOFFSET + 2 * sizeof( VFSCursorSlot ) );
+  assert( VFSHeaderExtent( &vfs ) <= vfs.header.tableOffset );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  assert( slot( pad, 0, 1 )->sequence == 1 );
+  assert( slot( pad, 0, 0 )->sequence == 0 );
+  VFSLoad( &vfs, pad );
+  assert( vfs.slotSequence == 1 );
+  VFSHeader* h = &vfs.header;
+  uint64_t tableOffset = h->tableOffset;
+
+  // Commits alternate
+  writeFile( &vfs, "/a" );
+  assert( slot( pad, 0, 0 )->sequence == 2 );
+  assert( slot( pad, 0, 0 )->tablePtr == tableOffset + h->tableEntrySize );
+  assert( slot( pad, 0, 1 )->sequence == 1 );
+  writeFile( &vfs, "/b" );
+  assert( slot( pad, 0, 1 )->sequence == 3 );
+  uint64_t dataPtrA = slot( pad, 0, 0 )->dataPtr;
+
+  // A torn header pointer: the slot is believed
+  VFSHeader* stored = (VFSHeader*)pad;
+  stored->tablePtr = 0xdeadbeef;
+  VFS loaded;
+  VFSLoad( &loaded, pad );
+  assert( loaded.header.tablePtr == tableOffset + 2 * h->tableEntrySize );
+  assert( loaded.header.dataPtr == h->dataPtr );
+  assert( loaded.slotSequence == 3 );
+
+  // A torn commit: the one before it
+  slot( pad, 0, 1 )->dataPtr ^= 0x1000;
+  VFSLoad( &loaded, pad );
+  assert( loaded.slotSequence == 2 );
+  assert( loaded.header.tablePtr == tableOffset + h->tableEntrySize );
+  assert( loaded.header.dataPtr == dataPtrA );
+
+  // Carrying on from there overwrites the torn slot
+  writeFile( &loaded, "/c" );
+  assert( slot( pad, 0, 1 )->sequence == 3 );
+  VFSLoad( &vfs, pad );
+  assert( vfs.slotSequence == 3 );
+  assert( vfs.header.tablePtr == tableOffset + 2 * h->tableEntrySize );
+
+  // Neither valid: the header's own pointers
+  memset( slot( pad, 0, 0 ), 0, 2 * sizeof( VFSCursorSlot ) );
+  stored->tablePtr = tableOffset;
+  VFSLoad( &loaded, pad );
+  assert( loaded.slotSequence == 0 );
+  assert( loaded.header.tablePtr == tableOffset );
+
+  // Sharded: each shard its own pair
+  memset( pad, 0xa5, PADSIZE );
+  sc = VFSInitSharded( &vfs, PADSIZE, 6, 30, 0, SHARDS );
+  assert( sc == 0 );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  VFS views[SHARDS];
+  int i;
+  for( i = 0; i < SHARDS; i++ ) {
+	VFSShard( &vfs, i, views + i );
+	assert( views[i].slotSequence == 1 );
+  }
+  writeFile( views + 1, "/s1" );
+  writeFile( views + 1, "/s1b" );
+  writeFile( views + 2, "/s2" );
+  assert( slot( pad, 2, 1 )->sequence == 3 );
+  assert( slot( pad, 3, 0 )->sequence == 2 );
+  assert( slot( pad, 1, 1 )->sequence == 1 );
+  VFSShardHeader* sh = (VFSShardHeader*)(pad + VERNAMFS_SHARDSOFFSET);
+  sh[1].tablePtr = 0;
+  slot( pad, 3, 0 )->checksum ^= 1;
+  VFSLoad( &loaded, pad );
+  assert( loaded.shards[0].tablePtr == loaded.shards[0].tableOffset );
+  assert( loaded.shards[1].tablePtr == 
+		  loaded.shards[1].tableOffset + 2 * h->tableEntrySize );
+  assert( loaded.shards[2].tablePtr == loaded.shards[2].tableOffset );
+
+  // No flag: pointers in the header alone, slots untouched
+  memset( pad, 0xa5, PADSIZE );
+  sc = VFSInit( &vfs, PADSIZE, 16, 30, 0 );
+  assert( sc == 0 );
+  vfs.header.flags &= ~VERNAMFS_FLAGS_SLOTS;
+  assert( VFSHeaderExtent( &vfs ) == sizeof( VFSHeader ) );
+  vfs.backing = pad;
+  VFSStore( &vfs );
+  VFSLoad( &vfs, pad );
+  writeFile( &vfs, "/old" );
+  assert( stored->tablePtr == tableOffset + h->tableEntrySize );
+  assert( pad[VERNAMFS_SLOTSOFFSET] == 0xa5 );
+  VFSLoad( &loaded, pad );
+  assert( loaded.slotSequence == 0 );
+  assert( loaded.header.tablePtr == tableOffset + h->tableEntrySize );
+
+  free( pad );
+  printf( "OK\n" );
+  return 0;
+}
+
+// eof
@@ -0,0 +1,471 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "vernamfs/vernamfs.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Vault-side scaling benchmark.  For each combination of pad size
+ * (-p), table entry count (-n) and file size (-s), each a comma
+ * separated list, builds a synthetic remote pad with that many files
+ * written, then times the vault-side pipeline:
+ *
+ * rls > rls.out, vls rls.out, rcat (last file) > rcat.out, vcat
+ * rcat.out, recover
+ *
+ * recording wall time, max RSS, minor/major page faults and bytes
+ * read from disk for each, as run by the vernamfs binary (-V).  vcat
+ * and recover output are checked against what was written.
+ *
+ * The vault is keyed (-z) unless -v, when a vault copy file is
+ * generated too.  Combinations that cannot fit (each file takes at
+ * least one page of pad) are skipped.  Pads live under -d, so point
+ * that at a disk big enough; -D drops the page cache before each
+ * step (needs root).  -o appends one JSON object per step, for
+ * plotting across runs.
+ *
+ * $ ./vaultBench -V ./vernamfs -p 1G,16G -n 10,1000,100000
+ * $ ./vaultBench -V ./vernamfs -d /big -p 256G -n 10000000 -s 4K -D
+ */
+
+typedef struct {
+  const char* step;
+  double wall;
+  long maxRSSKB;
+  long minorFaults, majorFaults;
+  uint64_t readBytes;
+  int status;
+} StepResult;
+
+static char* vernamfs = "./vernamfs";
+static int dropCaches = 0;
+static int vaultFile = 0;
+static FILE* json = NULL;
+
+static double now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t parseSize( const char* s, char** end ) {
+  uint64_t n = strtoull( s, end, 10 );
+  switch( **end ) {
+  case 'T': case 't':
+	n <<= 10;
+  case 'G': case 'g':
+	n <<= 10;
+  case 'M': case 'm':
+	n <<= 10;
+  case 'K': case 'k':
+	n <<= 10;
+	(*end)++;
+  }
+  return n;
+}
+
+// "1G,16G,256G" -> array, 0-terminated
+static uint64_t* parseList( const char* s ) {
+  int count = 1;
+  const char* p;
+  for( p = s; *p; p++ )
+	count += *p == ',';
+  uint64_t* result = calloc( count + 1, sizeof( uint64_t ) );
+  int i = 0;
+  char* end = (char*)s;
+  while( *end ) {
+	uint64_t v = parseSize( end, &end );
+	if( v )
+	  result[i++] = v;
+	if( *end && *end != ',' )
+	  break;
+	if( *end )
+	  end++;
+  }
+  return result;
+}
+
+// Content of file i, a cheap function of file index and offset
+static void fill( uint8_t* buf, size_t len, uint64_t i, uint64_t offset ) {
+  size_t j;
+  for( j = 0; j < len; j++ ) {
+	uint64_t p = offset + j;
+	buf[j] = (uint8_t)(i * 131 + p * 7 + (p >> 12));
+  }
+}
+
+static int checkFile( const char* path, uint64_t i, uint64_t length ) {
+  int fd = open( path, O_RDONLY );
+  if( fd < 0 )
+	return -1;
+  size_t bufSize = 1 << 20;
+  uint8_t* expected = malloc( bufSize );
+  uint8_t* actual = malloc( bufSize );
+  uint64_t offset = 0;
+  int sc = 0;
+  while( sc == 0 && offset < length ) {
+	size_t n = length - offset < bufSize ? length - offset : bufSize;
+	fill( expected, n, i, offset );
+	if( read( fd, actual, n ) != n || memcmp( expected, actual, n ) )
+	  sc = -1;
+	offset += n;
+  }
+  if( sc == 0 && read( fd, actual, 1 ) != 0 )
+	sc = -1;
+  close( fd );
+  free( expected );
+  free( actual );
+  return sc;
+}
+
+static void dropPageCache( void ) {
+  sync();
+  int fd = open( "/proc/sys/vm/drop_caches", O_WRONLY );
+  if( fd < 0 || write( fd, "3\n", 2 ) != 2 )
+	fprintf( stderr, "Cannot drop page cache (not root?)\n" );
+  if( fd >= 0 )
+	close( fd );
+}
+
+/*
+  Run vernamfs with the given args, stdout to outFile (if non-NULL),
+  and gather its resource usage.
+*/
+static StepResult timeStep( const char* step, const char* outFile, 
+							char* const args[] ) {
+  StepResult r;
+  memset( &r, 0, sizeof( r ) );
+  r.step = step;
+  if( dropCaches )
+	dropPageCache();
+
+  double t0 = now();
+  pid_t pid = fork();
+  if( pid == 0 ) {
+	if( outFile ) {
+	  int fd = open( outFile, O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+	  if( fd < 0 )
+		_exit( 126 );
+	  dup2( fd, 1 );
+	  close( fd );
+	}
+	execv( vernamfs, args );
+	_exit( 127 );
+  }
+  struct rusage ru;
+  int status = -1;
+  if( pid < 0 || wait4( pid, &status, 0, &ru ) != pid ) {
+	r.status = -1;
+	return r;
+  }
+  r.wall = now() - t0;
+  r.status = status;
+  r.maxRSSKB = ru.ru_maxrss;
+  r.minorFaults = ru.ru_minflt;
+  r.majorFaults = ru.ru_majflt;
+  r.readBytes = (uint64_t)ru.ru_inblock * 512;
+  return r;
+}
+
+static void report( StepResult* r, uint64_t padSize, uint64_t entries,
+					uint64_t fileSize, int ok ) {
+  printf( "  %-10s %10.3f s %10ld KB %10ld minflt %8ld majflt %12.1f MB%s\n",
+		  r->step, r->wall, r->maxRSSKB, r->minorFaults, r->majorFaults,
+		  r->readBytes / 1e6, ok ? "" : "  FAILED" );
+  if( json ) {
+	fprintf( json, "{ \"pad\": %"PRIu64", \"entries\": %"PRIu64
+			 ", \"file_size\": %"PRIu64", \"vault\": \"%s\", \"step\": \"%s\""
+			 ", \"wall_s\": %.6f, \"maxrss_kb\": %ld, \"minflt\": %ld"
+			 ", \"majflt\": %ld, \"read_bytes\": %"PRIu64", \"ok\": %s }\n",
+			 padSize, entries, fileSize, vaultFile ? "file" : "key", 
+			 r->step, r->wall, r->maxRSSKB, r->minorFaults, r->majorFaults,
+			 r->readBytes, ok ? "true" : "false" );
+	fflush( json );
+  }
+}
+
+/*
+  Write entries files of fileSize each, straight through the VFS api
+  onto the mapped remote pad, as a mount would.  @return offset of the
+  last file's data, or 0 on failure.
+*/
+static uint64_t populate( const char* remote, uint64_t padSize, 
+						  uint64_t entries, uint64_t fileSize ) {
+  int fd = open( remote, O_RDWR );
+  if( fd < 0 )
+	return 0;
+  void* addr = mmap( NULL, padSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( addr == MAP_FAILED )
+	return 0;
+  VFS vfs;
+  VFSLoad( &vfs, addr );
+
+  size_t bufSize = 1 << 20;
+  uint8_t* buf = malloc( bufSize );
+  uint64_t lastOffset = 0;
+  uint64_t i;
+  for( i = 0; i < entries; i++ ) {
+	char name[32];
+	snprintf( name, sizeof( name ), "/f%010"PRIu64, i );
+	if( VFSAddEntry( &vfs, name ) ) {
+	  lastOffset = 0;
+	  break;
+	}
+	lastOffset = vfs.header.dataPtr;
+	uint64_t written = 0;
+	while( written < fileSize ) {
+	  size_t n = fileSize - written < bufSize ? fileSize - written : bufSize;
+	  fill( buf, n, i, written );
+	  size_t nout = VFSWrite( &vfs, buf, n );
+	  if( nout != n )
+		break;
+	  written += n;
+	}
+	VFSRelease( &vfs );
+	if( written < fileSize ) {
+	  lastOffset = 0;
+	  break;
+	}
+  }
+  VFSStore( &vfs );
+  free( buf );
+  munmap( addr, padSize );
+  return lastOffset;
+}
+
+static int runConfig( const char* baseDir, uint64_t padSize, 
+					  uint64_t entries, uint64_t fileSize, int keep ) {
+
+  // Each file's data starts on a page, and the table precedes the data
+  uint64_t page = 4096;
+  uint64_t perFile = (fileSize + page - 1) / page * page;
+  uint64_t table = entries * 64 + 2 * page;
+  if( perFile == 0 )
+	perFile = page;
+  if( table + entries * perFile > padSize ) {
+	printf( "pad %"PRIu64" entries %"PRIu64" size %"PRIu64": "
+			"does not fit, skipped\n", padSize, entries, fileSize );
+	return 0;
+  }
+  printf( "pad %"PRIu64" entries %"PRIu64" size %"PRIu64" vault %s\n",
+		  padSize, entries, fileSize, vaultFile ? "file" : "key" );
+
+  char dir[1024], remote[1100], vault[1100], rls[1100], rcat[1100];
+  char vls[1100], vcat[1100], out[1100], cmd[2200];
+  snprintf( dir, sizeof( dir ), "%s/vaultBench.%d", baseDir, (int)getpid() );
+  snprintf( remote, sizeof( remote ), "%s/remote", dir );
+  snprintf( vault, sizeof( vault ), "%s/vault", dir );
+  snprintf( rls, sizeof( rls ), "%s/rls.out", dir );
+  snprintf( vls, sizeof( vls ), "%s/vls.out", dir );
+  snprintf( rcat, sizeof( rcat ), "%s/rcat.out", dir );
+  snprintf( vcat, sizeof( vcat ), "%s/vcat.out", dir );
+  snprintf( out, sizeof( out ), "%s/out", dir );
+  if( mkdir( dir, 0755 ) ) {
+	fprintf( stderr, "Cannot mkdir: %s (%d)\n", dir, errno );
+	return -1;
+  }
+
+  char entriesS[32], padS[32];
+  snprintf( entriesS, sizeof( entriesS ), "%"PRIu64, entries );
+  snprintf( padS, sizeof( padS ), "%"PRIu64, padSize );
+  int failed = 0;
+  StepResult r;
+
+  char* genR[] = { "vernamfs", "generate", "-z", "-n", entriesS, "-s", padS,
+				   "-o", remote, NULL };
+  r = timeStep( "generate", NULL, genR );
+  report( &r, padSize, entries, fileSize, r.status == 0 );
+  failed |= r.status;
+  if( vaultFile && !failed ) {
+	char* genV[] = { "vernamfs", "generate", "-z", "-s", padS,
+					 "-o", vault, NULL };
+	r = timeStep( "generateV", NULL, genV );
+	report( &r, padSize, entries, fileSize, r.status == 0 );
+	failed |= r.status;
+  }
+
+  uint64_t lastOffset = 0;
+  if( !failed ) {
+	double t0 = now();
+	lastOffset = populate( remote, padSize, entries, fileSize );
+	failed |= lastOffset == 0;
+	printf( "  %-10s %10.3f s\n", "populate", now() - t0 );
+  }
+
+  if( !failed ) {
+	char* a[] = { "vernamfs", "rls", remote, NULL };
+	r = timeStep( "rls", rls, a );
+	report( &r, padSize, entries, fileSize, r.status == 0 );
+	failed |= r.status;
+  }
+  if( !failed ) {
+	char* a1[] = { "vernamfs", "vls", vault, rls, NULL };
+	char* a2[] = { "vernamfs", "vls", "-z", rls, NULL };
+	r = timeStep( "vls", vls, vaultFile ? a1 : a2 );
+	report( &r, padSize, entries, fileSize, r.status == 0 );
+	failed |= r.status;
+  }
+  if( !failed ) {
+	char offS[32], lenS[32];
+	snprintf( offS, sizeof( offS ), "0x%"PRIx64, lastOffset );
+	snprintf( lenS, sizeof( lenS ), "0x%"PRIx64, fileSize );
+	char* a[] = { "vernamfs", "rcat", remote, offS, lenS, NULL };
+	r = timeStep( "rcat", rcat, a );
+	report( &r, padSize, entries, fileSize, r.status == 0 );
+	failed |= r.status;
+  }
+  if( !failed ) {
+	char* a1[] = { "vernamfs", "vcat", vault, rcat, NULL };
+	char* a2[] = { "vernamfs", "vcat", "-z", rcat, NULL };
+	r = timeStep( "vcat", vcat, vaultFile ? a1 : a2 );
+	int ok = r.status == 0 && checkFile( vcat, entries - 1, fileSize ) == 0;
+	report( &r, padSize, entries, fileSize, ok );
+	failed |= !ok;
+  }
+  if( !failed ) {
+	char* a1[] = { "vernamfs", "recover", remote, vault, out, NULL };
+	char* a2[] = { "vernamfs", "recover", "-z", remote, out, NULL };
+	r = timeStep( "recover", "/dev/null", vaultFile ? a1 : a2 );
+	char first[1200], last[1200];
+	snprintf( first, sizeof( first ), "%s/f%010d", out, 0 );
+	snprintf( last, sizeof( last ), "%s/f%010"PRIu64, out, entries - 1 );
+	int ok = r.status == 0 && checkFile( first, 0, fileSize ) == 0 &&
+	  checkFile( last, entries - 1, fileSize ) == 0;
+	report( &r, padSize, entries, fileSize, ok );
+	failed |= !ok;
+  }
+
+  if( !keep ) {
+	snprintf( cmd, sizeof( cmd ), "rm -rf %s", dir );
+	if( system( cmd ) )
+	  fprintf( stderr, "Cannot remove %s\n", dir );
+  }
+  return failed ? -1 : 0;
+}
+
+int main( int argc, char* argv[] ) {
+
+  char* baseDir = "/tmp";
+  uint64_t* padSizes = NULL;
+  uint64_t* entryCounts = NULL;
+  uint64_t* fileSizes = NULL;
+  char* output = NULL;
+  int keep = 0;
+
+  int c;
+  while( (c = getopt( argc, argv, "V:d:p:n:s:o:vDk") ) != -1 ) {
+	switch( c ) {
+	case 'V':
+	  vernamfs = optarg;
+	  break;
+	case 'd':
+	  baseDir = optarg;
+	  break;
+	case 'p':
+	  padSizes = parseList( optarg );
+	  break;
+	case 'n':
+	  entryCounts = parseList( optarg );
+	  break;
+	case 's':
+	  fileSizes = parseList( optarg );
+	  break;
+	case 'o':
+	  output = optarg;
+	  break;
+	case 'v':
+	  vaultFile = 1;
+	  break;
+	case 'D':
+	  dropCaches = 1;
+	  break;
+	case 'k':
+	  keep = 1;
+	  break;
+	default:
+	  fprintf( stderr, "Usage: %s [-V vernamfs] [-d dir] [-p padSizes] "
+			   "[-n entryCounts] [-s fileSizes] [-o out.json] [-v] [-D] [-k]\n",
+			   argv[0] );
+	  return -1;
+	}
+  }
+  if( !padSizes )
+	padSizes = parseList( "1G" );
+  if( !entryCounts )
+	entryCounts = parseList( "10,1000,100000" );
+
+  if( output ) {
+	json = fopen( output, "a" );
+	if( !json ) {
+	  fprintf( stderr, "Cannot open output: %s\n", output );
+	  return -1;
+	}
+  }
+
+  int failures = 0;
+  uint64_t *p, *n, *s;
+  for( p = padSizes; *p; p++ ) {
+	for( n = entryCounts; *n; n++ ) {
+	  if( fileSizes ) {
+		for( s = fileSizes; *s; s++ )
+		  failures += runConfig( baseDir, *p, *n, *s, keep ) != 0;
+	  } else {
+		// Half the pad's data area, shared evenly
+		uint64_t size = (*p - *n * 64) / 2 / *n;
+		size = size > 4096 ? size / 4096 * 4096 - 1 : size;
+		failures += runConfig( baseDir, *p, *n, size, keep ) != 0;
+	  }
+	}
+  }
+  if( json )
+	fclose( json );
+  return failures ? 1 : 0;
+}
+
+// eof
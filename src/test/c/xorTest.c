@@ -0,0 +1,107 @@
+/**
+ * Copyright © 2016, University of Washington
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of the University of Washington nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UNIVERSITY OF
+ * WASHINGTON BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vernamfs/xor.h"
+
+/**
+ * @author Stuart Maclean
+ *
+ * Check every XOR kernel this cpu supports against a plain byte loop,
+ * over a range of lengths and source/destination misalignments.
+ */
+
+#define MAXLEN 1100
+
+static void testKernel( const char* name ) {
+
+  if( VFSXorSelect( name ) ) {
+	printf( "%s: not supported, skipped\n", name );
+	return;
+  }
+  printf( "%s\n", name );
+
+  uint8_t a[MAXLEN+64], b[MAXLEN+64], d[MAXLEN+64], expected[MAXLEN+64];
+  int i;
+  for( i = 0; i < sizeof( a ); i++ ) {
+	a[i] = rand();
+	b[i] = rand();
+  }
+
+  int len, offA, offB;
+  for( len = 0; len <= MAXLEN; len += (len < 300 ? 1 : 97) ) {
+	for( offA = 0; offA < 64; offA += 7 ) {
+	  for( offB = 0; offB < 64; offB += 13 ) {
+
+		// Combine: d = a ^ b
+		for( i = 0; i < len; i++ )
+		  expected[i] = a[offA+i] ^ b[offB+i];
+		memset( d, 0x5a, sizeof( d ) );
+		VFSXorCombine( d + offB, a + offA, b + offB, len );
+		assert( memcmp( d + offB, expected, len ) == 0 );
+		// Nothing either side touched
+		for( i = 0; i < offB; i++ )
+		  assert( d[i] == 0x5a );
+		for( i = offB + len; i < sizeof( d ); i++ )
+		  assert( d[i] == 0x5a );
+
+		// In place: d ^= b
+		memcpy( d + offA, a + offA, len );
+		VFSXor( d + offA, b + offB, len );
+		assert( memcmp( d + offA, expected, len ) == 0 );
+	  }
+	}
+  }
+}
+
+int main( int argc, char* argv[] ) {
+
+  testKernel( "scalar" );
+
+  testKernel( "sse2" );
+
+  testKernel( "avx2" );
+
+  testKernel( "avx512" );
+
+  testKernel( "neon" );
+
+  return 0;
+}
+
+// eof